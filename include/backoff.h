@@ -0,0 +1,26 @@
+#ifndef __INC_BACKOFF_H
+#define __INC_BACKOFF_H
+
+#include <stdint.h>
+
+/**
+ * backoff_window - upper bound of an exponential backoff with full jitter:
+ *  the caller waits a uniformly random time in [0, window]
+ *
+ * @attempt: number of consecutive failed attempts so far
+ * @base: window after the first failure [ms]
+ * @cap: largest window [ms]
+ *
+ * Return: backoff window for the next attempt [ms]
+*/
+inline uint32_t backoff_window(uint8_t attempt, uint32_t base, uint32_t cap)
+{
+	uint32_t window = base;
+
+	while (attempt-- && window < cap)
+		window <<= 1;
+
+	return (window < cap ? window : cap);
+}
+
+#endif		/* ifndef __INC_BACKOFF_H */
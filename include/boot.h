@@ -0,0 +1,94 @@
+#ifndef __INC_BOOT_H
+#define __INC_BOOT_H
+
+#include <stdint.h>
+
+/* boots kept in the history, the current one included */
+#define BOOT_HISTORY            4
+
+/**
+ * enum boot_phase_e - profiled phases of a boot, in the order they run;
+ *  each lasts from the end of the previous one
+ *
+ * @BOOT_PHASE_CORE: app start to setup(), less the constructors below
+ * @BOOT_PHASE_CTOR_PORTAL: web server, DNS server and WiFi manager
+ *  constructors
+ * @BOOT_PHASE_CTOR_MQTT: MQTT client constructor
+ * @BOOT_PHASE_SERIAL: serial port
+ * @BOOT_PHASE_BUS: SPI and I2C buses
+ * @BOOT_PHASE_RFID: RFID reader
+ * @BOOT_PHASE_DISPLAY: LCD
+ * @BOOT_PHASE_RTC: real-time clock
+ * @BOOT_PHASE_ALARM: alarm LED and buzzer
+ * @BOOT_PHASE_CONFIG: saved configuration
+ * @BOOT_PHASE_WIFI: WiFi and config portal setup
+ * @BOOT_PHASE_MQTT: MQTT client setup and flash-backed modules
+ * @BOOT_PHASE_TIMESYNC: scan clock
+ * @BOOT_PHASE_TASKS: tasks started
+ * @BOOT_PHASE_POWER: power mode, the end of setup()
+ * @BOOT_PHASE_WIFI_UP: WiFi started at the end of setup() to the first
+ *  IP address
+ * @BOOT_PHASE_MQTT_UP: first IP address to the first MQTT connection,
+ *  the end of the boot
+ * @BOOT_PHASE_COUNT: number of phases
+*/
+typedef enum boot_phase_e
+{
+	BOOT_PHASE_CORE = 0,
+	BOOT_PHASE_CTOR_PORTAL = 1,
+	BOOT_PHASE_CTOR_MQTT = 2,
+	BOOT_PHASE_SERIAL = 3,
+	BOOT_PHASE_BUS = 4,
+	BOOT_PHASE_RFID = 5,
+	BOOT_PHASE_DISPLAY = 6,
+	BOOT_PHASE_RTC = 7,
+	BOOT_PHASE_ALARM = 8,
+	BOOT_PHASE_CONFIG = 9,
+	BOOT_PHASE_WIFI = 10,
+	BOOT_PHASE_MQTT = 11,
+	BOOT_PHASE_TIMESYNC = 12,
+	BOOT_PHASE_TASKS = 13,
+	BOOT_PHASE_POWER = 14,
+	BOOT_PHASE_WIFI_UP = 15,
+	BOOT_PHASE_MQTT_UP = 16,
+	BOOT_PHASE_COUNT = 17
+} boot_phase_t;
+
+/**
+ * struct boot_record_s - profile of one boot
+ *
+ * @boot: number of the boot since power-on, 1 for the first
+ * @reset: cause of the reset that started it, one of HAL_RESET_*
+ * @reserved: zero
+ * @reached_us: app start to the end of the last phase it completed [us]
+ * @phase_us: time spent in each phase, 0 until it completes [us]
+*/
+typedef struct boot_record_s
+{
+	uint32_t boot;
+	uint8_t reset;
+	uint8_t reserved[3];
+	uint32_t reached_us;
+	uint32_t phase_us[BOOT_PHASE_COUNT];
+} boot_record_t;
+
+/* Boot profiler functions */
+void boot_mark(uint8_t);
+const boot_record_t *boot_record(uint8_t);
+const char *boot_phase_name(uint8_t);
+const char *boot_reset_name(uint8_t);
+
+/**
+ * struct boot_mark_s - ends a phase from a static object's constructor,
+ *  to time static constructors: define one ending BOOT_PHASE_CORE before
+ *  them and one ending their phase after them, in the same file, where
+ *  they are constructed in order
+ *
+ * @phase: phase to end, one of enum boot_phase_e
+*/
+typedef struct boot_mark_s
+{
+	boot_mark_s(uint8_t phase) { boot_mark(phase); }
+} boot_mark_t;
+
+#endif		/* ifndef __INC_BOOT_H */
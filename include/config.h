@@ -0,0 +1,20 @@
+#ifndef __INC_CONFIG_H
+#define __INC_CONFIG_H
+
+#include <stdint.h>
+
+/*
+ * schema version of the saved configuration: bump it when fields are
+ * appended to the record, never reorder or remove them
+*/
+#define CONFIG_VERSION          1
+
+/* key of the saved configuration in the settings storage (NVS) */
+#define CONFIG_KEY              "broker-config"
+
+/* Saved configuration functions */
+void initialize_config(void);
+bool config_available(void);
+bool config_save(void);
+
+#endif		/* ifndef __INC_CONFIG_H */
@@ -0,0 +1,10 @@
+#ifndef __INC_CRC16_H
+#define __INC_CRC16_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* CRC16-CCITT used to validate the flash-backed modules' records */
+uint16_t crc16(const void *, size_t);
+
+#endif		/* ifndef __INC_CRC16_H */
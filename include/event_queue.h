@@ -0,0 +1,112 @@
+#ifndef __INC_EVENT_QUEUE_H
+#define __INC_EVENT_QUEUE_H
+
+#include <stdint.h>
+#include <atomic>
+#include "scan.h"
+
+/* number of events a queue holds, a power of two */
+#define EVENT_QUEUE_SIZE        16
+
+/**
+ * enum event_type_e - typed events passed between the firmware's tasks
+ *
+ * @EVENT_SCAN: a card was read, @scan holds the scan (RFID -> network)
+ * @EVENT_SCANNED: a card was read, @scan holds the scan and @code the
+ *  verdict cache's verdict, 0 if the backend decides (RFID -> UI)
+ * @EVENT_VERDICT: sentry platform's verdict on a scan, @code is one of
+ *  enum alerts_e (MQTT -> UI)
+ * @EVENT_ALARM: alarm triggered (@code 1) or silenced (@code 0) (MQTT -> UI)
+ * @EVENT_SHIFT: shift started (@code 1) or over (@code 0) (MQTT -> UI)
+ * @EVENT_OVERDUE: an expected scan is overdue (MQTT -> UI)
+ * @EVENT_WIFI: WiFi connected (@code 1) or lost (@code 0) (WiFi -> UI)
+*/
+typedef enum event_type_e
+{
+	EVENT_SCAN = 1,
+	EVENT_SCANNED = 2,
+	EVENT_VERDICT = 3,
+	EVENT_ALARM = 4,
+	EVENT_SHIFT = 5,
+	EVENT_OVERDUE = 6,
+	EVENT_WIFI = 7
+} event_type_t;
+
+/**
+ * struct event_s - event passed between tasks
+ *
+ * @type: one of enum event_type_e
+ * @code: event-specific value
+ * @scan: scan, for EVENT_SCAN and EVENT_SCANNED
+ * @detected_at: micros() when the scan's card was detected, for tracing
+*/
+typedef struct event_s
+{
+	uint8_t type;
+	uint8_t code;
+	scan_record_t scan;
+	uint32_t detected_at;
+} event_t;
+
+/**
+ * struct event_queue_s - bounded lock-free single-producer/single-consumer
+ *  event queue, each queue must only be pushed from one task and popped
+ *  from one task
+ *
+ * @events: ring of queued events
+ * @head: count of events pushed, written by the producer only
+ * @tail: count of events popped, written by the consumer only
+ * @dropped: count of events dropped because the queue was full
+*/
+typedef struct event_queue_s
+{
+	event_t events[EVENT_QUEUE_SIZE];
+	std::atomic<uint32_t> head;
+	std::atomic<uint32_t> tail;
+	uint32_t dropped;
+} event_queue_t;
+
+/**
+ * event_queue_push - queues an event, producer side
+ *
+ * @queue: queue to push to
+ * @event: event to queue, copied
+ *
+ * Return: true if queued, false if the queue was full
+*/
+inline bool event_queue_push(event_queue_t *queue, const event_t *event)
+{
+	uint32_t head = queue->head.load(std::memory_order_relaxed);
+
+	if (head - queue->tail.load(std::memory_order_acquire) >= EVENT_QUEUE_SIZE)
+	{
+		queue->dropped++;
+		return false;
+	}
+
+	queue->events[head & (EVENT_QUEUE_SIZE - 1)] = *event;
+	queue->head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+/**
+ * event_queue_pop - dequeues the oldest event, consumer side
+ *
+ * @queue: queue to pop from
+ * @event: where to copy the event
+ *
+ * Return: true if an event was dequeued, false if the queue was empty
+*/
+inline bool event_queue_pop(event_queue_t *queue, event_t *event)
+{
+	uint32_t tail = queue->tail.load(std::memory_order_relaxed);
+
+	if (tail == queue->head.load(std::memory_order_acquire))
+		return false;
+
+	*event = queue->events[tail & (EVENT_QUEUE_SIZE - 1)];
+	queue->tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+#endif		/* ifndef __INC_EVENT_QUEUE_H */
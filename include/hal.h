@@ -0,0 +1,188 @@
+#ifndef __INC_HAL_H
+#define __INC_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "storage.h"
+
+/*
+ * Thin hardware abstraction layer: the firmware logic only talks to the
+ * devices through these functions. src/hal/esp32 implements them on top
+ * of the device libraries, src/hal/native implements them with fakes so
+ * the logic builds and runs on Linux ([env:native]).
+*/
+
+/* Buses */
+void hal_bus_init(void);
+
+/*
+ * I2C bus manager: a transaction holds the bus from hal_bus_acquire() to
+ * hal_bus_release(), waiting transactions go in device priority order.
+ * The hal_rtc_* functions take the bus themselves, LCD transfers must be
+ * bracketed by the caller. Transactions must not nest.
+*/
+#define HAL_BUS_RTC             0	/* highest priority */
+#define HAL_BUS_LCD             1
+#define HAL_BUS_DEVICES         2
+
+/**
+ * struct hal_bus_stats_s - I2C bus usage since startup
+ *
+ * @transactions: transactions run
+ * @waits: transactions that queued behind another
+ * @max_queue: most transactions queued at once
+ * @busy_us: time the bus was held [us]
+ * @recoveries: times a stuck bus was recovered
+*/
+typedef struct hal_bus_stats_s
+{
+	uint32_t transactions;
+	uint32_t waits;
+	uint8_t max_queue;
+	uint64_t busy_us;
+	uint32_t recoveries;
+} hal_bus_stats_t;
+
+void hal_bus_acquire(uint8_t);
+void hal_bus_release(void);
+void hal_bus_stats(hal_bus_stats_t *);
+
+/* Cycle counter of the calling core, for fine-grained timing */
+uint32_t hal_cycle_count(void);
+uint32_t hal_cycles_per_us(void);
+
+/* Monotonic time since startup, never wraps, runs through light sleep [us] */
+uint64_t hal_clock_us(void);
+
+/*
+ * Cause of the last reset, and memory kept across resets but not power
+ * cycles (RTC memory on the ESP32), left as it was: check before use
+*/
+#define HAL_RESET_UNKNOWN       0
+#define HAL_RESET_POWER_ON      1
+#define HAL_RESET_EXTERNAL      2
+#define HAL_RESET_SOFTWARE      3
+#define HAL_RESET_PANIC         4
+#define HAL_RESET_WATCHDOG      5
+#define HAL_RESET_BROWNOUT      6
+#define HAL_RESET_DEEP_SLEEP    7
+#define HAL_RESET_COUNT         8
+
+#define HAL_RETAINED_SIZE       512
+
+uint8_t hal_reset_reason(void);
+void *hal_retained_memory(void);
+
+/*
+ * LCD: HD44780 behind a PCF8574 I2C backpack; transfers are queued until
+ * hal_lcd_commit(), which sends them in a single I2C write
+*/
+void hal_lcd_init(void);
+void hal_lcd_create_char(uint8_t, const uint8_t *);
+void hal_lcd_set_cursor(uint8_t, uint8_t);
+void hal_lcd_write(uint8_t);
+void hal_lcd_commit(void);
+#ifdef LCD_BENCHMARK
+void hal_lcd_benchmark(void);
+#endif
+
+/* RFID reader: MFRC522 on SPI */
+void hal_rfid_init(void);
+bool hal_rfid_card_present(void);
+bool hal_rfid_read_uid(uint8_t *, uint8_t *);
+void hal_rfid_halt(void);
+bool hal_rfid_irq_attach(void (*)(void));
+void hal_rfid_irq_arm(void);
+void hal_rfid_irq_clear(void);
+bool hal_rfid_irq_answered(void);
+void hal_rfid_counters(uint32_t *, uint32_t *);
+
+/* Real-time clock: DS3231 on I2C, times are epoch seconds */
+void hal_rtc_init(void);
+bool hal_rtc_lost_power(void);
+uint32_t hal_rtc_now(void);
+void hal_rtc_adjust(uint32_t);
+bool hal_rtc_sqw_attach(void (*)(void));
+
+/**
+ * struct hal_mqtt_callbacks_s - MQTT client event handlers
+ *
+ * @on_connect: connected to the broker, with the session-present flag
+ * @on_disconnect: disconnected from the broker, with the reason code
+ * @on_subscribe: subscription acknowledged, with packet ID and granted QoS
+ * @on_unsubscribe: unsubscription acknowledged, with packet ID
+ * @on_message: (fragment of a) message received: topic, payload,
+ *  fragment length, fragment offset and total payload length
+ * @on_publish: publish acknowledged, with packet ID
+*/
+typedef struct hal_mqtt_callbacks_s
+{
+	void (*on_connect)(bool);
+	void (*on_disconnect)(int);
+	void (*on_subscribe)(uint16_t, uint8_t);
+	void (*on_unsubscribe)(uint16_t);
+	void (*on_message)(const char *, const char *, size_t, size_t, size_t);
+	void (*on_publish)(uint16_t);
+} hal_mqtt_callbacks_t;
+
+/* MQTT client */
+void hal_mqtt_init(const hal_mqtt_callbacks_t *);
+void hal_mqtt_set_client_id(const char *);
+void hal_mqtt_set_keep_alive(uint16_t);
+void hal_mqtt_set_clean_session(bool);
+void hal_mqtt_set_will(const char *, uint8_t, bool, const char *);
+void hal_mqtt_set_credentials(const char *, const char *);
+void hal_mqtt_set_server_host(const char *, uint16_t);
+void hal_mqtt_set_server_ip(uint32_t, uint16_t);
+void hal_mqtt_connect(void);
+bool hal_mqtt_connected(void);
+uint16_t hal_mqtt_publish(const char *, uint8_t, bool, const char *, size_t);
+uint16_t hal_mqtt_subscribe(const char *, uint8_t);
+
+/*
+ * UDP for the SNTP client: one socket, the handler runs when a datagram
+ * arrives, which is kept with its arrival time until received. Addresses
+ * are IPv4 as stored in an IPAddress.
+*/
+bool hal_udp_begin(uint16_t, void (*)(void));
+bool hal_udp_send(uint32_t, uint16_t, const uint8_t *, size_t);
+size_t hal_udp_receive(uint8_t *, size_t, uint64_t *);
+
+/*
+ * DNS, never blocking: a lookup runs in the background and is polled by
+ * calling again with the same host until it is resolved or failed. One
+ * lookup at a time, from a single task.
+*/
+#define HAL_DNS_RESOLVED        0
+#define HAL_DNS_PENDING         1
+#define HAL_DNS_FAILED          2
+
+uint8_t hal_dns_lookup(const char *, uint32_t *);
+
+/* Tasks, pinned to a core and woken periodically or by a notification */
+void hal_task_start(uint8_t, const char *, void (*)(void), uint32_t,
+	uint8_t, uint8_t, uint32_t);
+void hal_task_notify(uint8_t);
+void hal_task_notify_from_isr(uint8_t);
+void hal_task_set_period(uint8_t, uint32_t);
+void hal_task_stats(uint8_t, uint32_t *, uint32_t *);
+void hal_loop_idle(void);
+
+/*
+ * Power: light sleep while every task is idle, woken by the reader IRQ
+ * (only when cards are detected through it), the WiFi config button or a
+ * timer; WiFi in modem sleep. Configuring reports what the chip does.
+*/
+#define HAL_POWER_FULL_SPEED    0	/* no power management */
+#define HAL_POWER_SCALING       1	/* CPU frequency scaling only */
+#define HAL_POWER_LIGHT_SLEEP   2	/* scaling and light sleep */
+
+uint8_t hal_power_configure(bool, bool);
+
+/* Persistent storage for the flash-backed modules */
+bool hal_storage_open(storage_t *, const char *, uint32_t);
+
+/* Persistent storage for small settings, NVS on the ESP32 */
+bool hal_settings_open(storage_t *, const char *, uint32_t);
+
+#endif		/* ifndef __INC_HAL_H */
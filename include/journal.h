@@ -0,0 +1,23 @@
+#ifndef __INC_JOURNAL_H
+#define __INC_JOURNAL_H
+
+#include <stdint.h>
+#include "storage.h"
+#include "scan.h"
+
+/* number of scan records kept in the offline journal */
+#define JOURNAL_CAPACITY        512
+
+/* path of the journal's backing file on LittleFS */
+#define JOURNAL_PATH            "/scan-journal.bin"
+
+/* Offline scan journal functions */
+uint32_t journal_storage_size(void);
+bool journal_begin(storage_t *);
+bool journal_append(const scan_record_t *);
+bool journal_peek(uint32_t, scan_record_t *);
+void journal_consume(uint32_t);
+uint32_t journal_pending(void);
+uint32_t journal_dropped(void);
+
+#endif		/* ifndef __INC_JOURNAL_H */
@@ -3,6 +3,22 @@
 
 #include <Arduino.h>
 
+/* LCD dimensions */
+#define LCD_COLUMNS             16
+#define LCD_ROWS                2
+
+/*
+ * largest run of unchanged cells that a flush rewrites instead of
+ * moving the cursor past it
+ */
+#define LCD_FLUSH_MAX_GAP       1
+
+/* scrolling messages: regions scrolling at once, longest message */
+#define LCD_SCROLL_REGIONS      LCD_ROWS
+#define LCD_SCROLL_MAX_LEN      64
+/* blank cells the message scrolls in from */
+#define LCD_SCROLL_LEAD         3
+
 /**
  * enum display_status_e - For displaying connection status
  *
@@ -24,6 +40,9 @@ void display_AP_mode(void);
 void display_valid_scan(void);
 void display_invalid_scan(uint8_t);
 void display_scan_time_elapsed(void);
+void display_scroll_run(void);
+void display_scroll_stop(void);
+uint32_t display_transfer_count(void);
 void initialize_display(void);
 
 #endif		/* ifndef __INC_DISPLAY_LCD_H */
@@ -12,6 +12,11 @@
 #define MFRC_RST_PIN 4
 /* MFRC reader SPI chip-select pin */
 #define MFRC_SS_PIN 5
+/* MFRC reader IRQ pin, driven low when a card answers a REQA */
+#define MFRC_IRQ_PIN 27
+
+/* DS3231 INT/SQW pin, its 1 Hz square wave falls as each second starts */
+#define RTC_SQW_PIN 25
 
 /* For starting Up WiFi config mode of WifiManager */
 #define WIFI_CONFIG_PIN 0
@@ -2,6 +2,7 @@
 #define __INC_MQTT_HEADER_H
 
 #include <Arduino.h>
+#include "payload.h"
 
 #define MQTT_HOST_DOMAIN_MAX_LEN        30
 #define MQTT_HOST_IP_MAX_LEN            15
@@ -12,7 +13,52 @@
 #define MQTT_CLIENT_ID_PREFIX           "Checkpoint-"
 #define MQTT_CLIENT_ID_PREFIX_LEN       11
 
-#define MQTT_RECONNECT_ATTEMPT_PERIOD   2.0f
+#define MQTT_PAYLOAD_FORMAT_MAX_LEN     7
+
+/*
+ * reconnection backoff: after n consecutive failures the next attempt
+ * waits a random time in [0, min(MQTT_BACKOFF_CAP, MQTT_BACKOFF_BASE * 2^n)]
+ * so a fleet disconnected together does not reconnect in lock-step [ms]
+*/
+#define MQTT_BACKOFF_BASE               1000
+#define MQTT_BACKOFF_CAP                60000
+
+/**
+ * enum mqtt_state_e - MQTT connection states
+ *
+ * @MQTT_STATE_IDLE: no connection wanted, WiFi is down
+ * @MQTT_STATE_CONNECTING: connection attempt in progress
+ * @MQTT_STATE_CONNECTED: connected to the broker
+ * @MQTT_STATE_BACKOFF: waiting out the backoff before the next attempt
+*/
+typedef enum mqtt_state_e
+{
+	MQTT_STATE_IDLE = 0,
+	MQTT_STATE_CONNECTING = 1,
+	MQTT_STATE_CONNECTED = 2,
+	MQTT_STATE_BACKOFF = 3
+} mqtt_state_t;
+
+/* slots in the inbound topic dispatch table, a power of two */
+#define MQTT_TOPIC_TABLE_SIZE           16
+/* largest inbound payload that is reassembled and dispatched */
+#define MQTT_RX_PAYLOAD_MAX_LEN         256
+
+/* number of journalled scans published per replay batch */
+#define JOURNAL_REPLAY_BATCH            16
+/* time to wait for a replay batch's acknowledgements before resending [ms] */
+#define JOURNAL_REPLAY_TIMEOUT          10000
+/*
+ * acknowledgements held until the network task matches them against the
+ * replay batch, a power of two; one dropped when full resends its batch
+*/
+#define JOURNAL_REPLAY_ACKS             (2 * JOURNAL_REPLAY_BATCH)
+
+/*
+ * time a live scan waits for its verdict: verdicts arriving when no scan
+ * waits are another checkpoint's, or replayed from a resumed session [ms]
+*/
+#define MQTT_VERDICT_TIMEOUT            10000
 
 /* broker's domain name/IP Address */
 extern char broker_host[];
@@ -29,6 +75,8 @@ extern IPAddress broker_ip;
 extern bool domain;
 /* created MQTT client's ID */
 extern char mqtt_client_id[];
+/* encoding of published scan messages, chosen at configuration time */
+extern payload_format_t payload_format;
 
 
 void mqtt_setup_once(void);
@@ -36,6 +84,8 @@ void mqtt_setup_repeated(void);
 void mqtt_stop_reconnect(void);
 void connect_to_mqtt(void);
 bool mqtt_isConnected(void);
-void mqtt_send_scanned_card(void);
+uint16_t mqtt_send_scanned_card(const scan_record_t *);
+void mqtt_replay_journal(void);
+void mqtt_publish_diagnostics(void);
 
 #endif		/* ifndef __INC_MQTT_HEADER_H */
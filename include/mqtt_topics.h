@@ -0,0 +1,140 @@
+#ifndef __INC_MQTT_TOPICS_H
+#define __INC_MQTT_TOPICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * checkpoint side of the sentry platform's MQTT protocol: the topics, the
+ * QoS each is used at and how inbound payloads are parsed; shared by the
+ * firmware (mqtt.cpp) and the host tools that stand in for checkpoints
+*/
+
+/* subscribe topics */
+
+/* topic to receive the shift started/over message */
+#define SHIFT_ON_OFF "sentry-platform/backend-server/shift-status"
+/* topic to receive when a scan is overdue */
+#define CHKS_OVERDUE "sentry-platform/circuit-handler/overdue-scan"
+/* topic to receive alerts from the circuit handler */
+#define RESPONSE "sentry-platform/checkpoints/A/response"
+/* topic to receive alarm signal */
+#define ALARM "sentry-platform/backend-server/alarm"
+/* topic to receive updates of the registered/stolen card table */
+#define CARD_UPDATES "sentry-platform/backend-server/card-updates"
+
+/* publish topics */
+
+/* topic to publish scanned sentry's information */
+#define SENTRY_SCAN_INFO "sentry-platform/checkpoints/sentry-scan-info"
+/* topic to publish connection status */
+#define CONNECTED "sentry-platform/checkpoints/connected"
+/* topic to publish a scan outside the shift */
+#define OUTSIDE_SHIFT_SCAN "sentry-platform/checkpoints/outside-shift-scan"
+/* topic to request the card table updates missing from the verdict cache */
+#define CARD_SYNC "sentry-platform/checkpoints/card-sync"
+/* topic to publish the scan latency histograms */
+#define DIAGNOSTICS "sentry-platform/checkpoints/diagnostics"
+/* topic to publish the profiles of the last boots */
+#define BOOT_REPORT "sentry-platform/checkpoints/boot-report"
+
+/*
+ * QoS of the scan messages: the backend drops redelivered scans by their
+ * sequence number, so at least once is enough; 2 restores exactly once
+*/
+#ifndef MQTT_SCAN_QOS
+#define MQTT_SCAN_QOS                   1
+#endif
+
+/**
+ * struct topic_qos_s - QoS level a topic is published or subscribed at
+ *
+ * @topic: topic
+ * @qos: 0 at most once, 1 at least once, 2 exactly once
+ * @subscribe: true for inbound topics, subscribed to on every connection
+*/
+typedef struct topic_qos_s
+{
+	const char *topic;
+	uint8_t qos;
+	bool subscribe;
+} topic_qos_t;
+
+/*
+ * QoS policy: exactly once costs a four-packet handshake, at least once
+ * two, so QoS 2 is kept for messages a duplicate would be mistaken for
+ * another: verdicts do not say which scan they answer. Scans carry the
+ * device's sequence number for the backend to drop duplicates, the
+ * other inbound messages are states or versioned updates. Overdue
+ * notices are at most once: the broker does not queue QoS 0 for an
+ * offline session, so a resumed one does not raise stale overdue alarms.
+*/
+static const topic_qos_t topic_qos[] = {
+	{SENTRY_SCAN_INFO, MQTT_SCAN_QOS, false},
+	{OUTSIDE_SHIFT_SCAN, MQTT_SCAN_QOS, false},
+	{CONNECTED, 1, false},
+	{CARD_SYNC, 1, false},
+	{DIAGNOSTICS, 0, false},
+	{BOOT_REPORT, 1, false},
+	{SHIFT_ON_OFF, 1, true},
+	{RESPONSE, 2, true},
+	{ALARM, 1, true},
+	{CHKS_OVERDUE, 0, true},
+	{CARD_UPDATES, 1, true},
+};
+
+#define TOPIC_QOS_COUNT (sizeof(topic_qos) / sizeof(topic_qos[0]))
+
+/**
+ * mqtt_qos_of - looks up the QoS level of a topic in the policy
+ *
+ * @topic: topic to publish on
+ *
+ * Return: QoS level, 2 for a topic missing from the policy
+*/
+inline uint8_t mqtt_qos_of(const char *topic)
+{
+	for (size_t i = 0; i < TOPIC_QOS_COUNT; i++)
+		if (!strcmp(topic_qos[i].topic, topic))
+			return (topic_qos[i].qos);
+
+	return (2);
+}
+
+/**
+ * mqtt_parse_on_off - parses an "ON"/"OFF" payload
+ *
+ * @payload: payload bytes, not null-terminated
+ * @len: length of the payload
+ *
+ * Return: true for "ON", false for anything else
+*/
+inline bool mqtt_parse_on_off(const char *payload, size_t len)
+{
+	return (len == 2 && payload[0] == 'O' && payload[1] == 'N');
+}
+
+/**
+ * mqtt_parse_code - parses a decimal payload the way atoi() would
+ *
+ * @payload: payload bytes, not null-terminated
+ * @len: length of the payload
+ *
+ * Return: parsed number, 0 if the payload does not start with a number
+*/
+inline uint32_t mqtt_parse_code(const char *payload, size_t len)
+{
+	uint32_t code = 0;
+	size_t i = 0;
+
+	while (i < len && (payload[i] == ' ' || payload[i] == '\t'))
+		i++;
+
+	for (; i < len && payload[i] >= '0' && payload[i] <= '9'; i++)
+		code = code * 10 + (payload[i] - '0');
+
+	return (code);
+}
+
+#endif		/* ifndef __INC_MQTT_TOPICS_H */
@@ -3,9 +3,42 @@
 
 #include <Arduino.h>
 
+/*
+ * longest wait for a direct connection to the cached access point before
+ * falling back to a full scan [ms]
+*/
+#define WIFI_FAST_CONNECT_TIMEOUT       3000
+
+/*
+ * 1 to reuse the cached DHCP lease as a static configuration on fast
+ * connections, skipping DHCP: only for networks whose DHCP server
+ * reserves the address for the checkpoint, as the lease's expiry is not
+ * checked and a reassigned address would conflict
+*/
+#ifndef WIFI_REUSE_LEASE
+#define WIFI_REUSE_LEASE                0
+#endif
+
+/*
+ * a static IP can be set instead with build flags, e.g.
+ * -DWIFI_STATIC_IP=\"192.168.1.50\" -DWIFI_STATIC_GATEWAY=\"192.168.1.1\"
+ * (WIFI_STATIC_SUBNET defaults to 255.255.255.0, WIFI_STATIC_DNS to the
+ * gateway)
+*/
+#ifdef WIFI_STATIC_IP
+#ifndef WIFI_STATIC_SUBNET
+#define WIFI_STATIC_SUBNET              "255.255.255.0"
+#endif
+#ifndef WIFI_STATIC_DNS
+#define WIFI_STATIC_DNS                 WIFI_STATIC_GATEWAY
+#endif
+#endif
+
 /* WiFi connection functions */
 void initialize_wifi(void);
+void wifi_start(void);
 bool wifi_isConnected(void);
 void check_wifi_config_requested(void);
+void check_wifi_fallback(void);
 
 #endif		/* ifndef __INC_MY_WIFI_H */
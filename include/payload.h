@@ -0,0 +1,67 @@
+#ifndef __INC_PAYLOAD_H
+#define __INC_PAYLOAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "scan.h"
+#include "hal.h"
+
+/*
+ * buffer sizes large enough for the longest payload of each kind
+ * (10-byte UID, 10-digit IDs/times, fully escaped 20-byte client ID)
+*/
+#define PAYLOAD_SCAN_MAX_LEN            128
+#define PAYLOAD_CONNECTED_MAX_LEN       160
+#define PAYLOAD_CARD_SYNC_MAX_LEN       64
+#define PAYLOAD_DIAGNOSTICS_MAX_LEN     3328	/* counts up to 7 digits */
+#define PAYLOAD_BOOT_REPORT_MAX_LEN     1792
+
+/*
+ * compact binary scan message, version 2, all integers little-endian:
+ *
+ *   offset  size  field
+ *   0       1     version (PAYLOAD_BINARY_VERSION), never '{' so the
+ *                 backend can tell it apart from the JSON message
+ *   1       1     flags (PAYLOAD_FLAG_*)
+ *   2       4     checkpoint ID
+ *   6       4     scan time (epoch)
+ *   10      2     milliseconds past the scan time
+ *   12      4     scan sequence number
+ *   16      1     UID length in bytes
+ *   17      n     UID bytes
+ *
+ * version 1 lacks the milliseconds and sequence number, its UID length
+ * is at offset 10
+*/
+#define PAYLOAD_BINARY_VERSION          2
+#define PAYLOAD_BINARY_HEADER_LEN       17
+#define PAYLOAD_BINARY_V1_HEADER_LEN    11
+#define PAYLOAD_SCAN_BINARY_MAX_LEN     (PAYLOAD_BINARY_HEADER_LEN + RFID_UID_MAX_LEN)
+
+/* binary scan message flags */
+#define PAYLOAD_FLAG_OUTSIDE_SHIFT      0x01
+
+/**
+ * enum payload_format_e - encoding used for published scan messages
+ *
+ * @PAYLOAD_FORMAT_JSON: JSON text, the default
+ * @PAYLOAD_FORMAT_BINARY: compact versioned binary encoding
+*/
+typedef enum payload_format_e
+{
+	PAYLOAD_FORMAT_JSON = 0,
+	PAYLOAD_FORMAT_BINARY = 1
+} payload_format_t;
+
+/* Fixed-buffer MQTT payload encoders, no heap allocation */
+size_t payload_format_uid(char *, size_t, const uint8_t *, uint8_t);
+size_t payload_encode_scan_json(char *, size_t, uint32_t, const scan_record_t *);
+size_t payload_encode_connected_json(char *, size_t, const char *, bool);
+size_t payload_encode_card_sync_json(char *, size_t, uint32_t, uint32_t);
+size_t payload_encode_diagnostics_json(char *, size_t, uint32_t, uint32_t,
+	const hal_bus_stats_t *);
+size_t payload_encode_boot_report_json(char *, size_t, uint32_t);
+size_t payload_encode_scan_binary(uint8_t *, size_t, uint32_t, const scan_record_t *);
+bool payload_decode_scan_binary(const uint8_t *, size_t, uint32_t *, scan_record_t *);
+
+#endif		/* ifndef __INC_PAYLOAD_H */
@@ -0,0 +1,45 @@
+#ifndef __INC_POWER_H
+#define __INC_POWER_H
+
+#include <stdint.h>
+
+/*
+ * power modes
+ *   POWER_MODE_NORMAL: full speed, the reader and LCD at their usual rates
+ *   POWER_MODE_LOW: light sleep whenever every task is idle, WiFi in
+ *     modem sleep, the reader and LCD serviced less often
+*/
+#define POWER_MODE_NORMAL       0
+#define POWER_MODE_LOW          1
+#ifndef POWER_MODE_DEFAULT
+#define POWER_MODE_DEFAULT      POWER_MODE_NORMAL
+#endif
+
+#define POWER_MODE_MAX_LEN      7
+
+/*
+ * low-power rates [ms]: longer periods sleep more, but detect cards,
+ * refresh the LCD and replay the offline journal later
+ *   REQA: REQA period in IRQ mode
+ *   RFID: RFID task period in polling mode
+ *   UI, NET: UI and network task periods, both are woken by their events
+*/
+#define LOW_POWER_REQA_PERIOD   250
+#define LOW_POWER_RFID_PERIOD   100
+#define LOW_POWER_UI_PERIOD     200
+#define LOW_POWER_NET_PERIOD    1000
+
+/* period between two power statistics reports [ms] */
+#define POWER_STATS_PERIOD      60000
+
+/* power mode in use, one of POWER_MODE_NORMAL or POWER_MODE_LOW */
+extern uint8_t power_mode;
+
+/* Power management functions */
+void initialize_power(void);
+void power_apply(void);
+void power_set_mode(uint8_t);
+void power_record_wake(uint32_t);
+void power_log_stats(void);
+
+#endif		/* ifndef __INC_POWER_H */
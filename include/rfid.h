@@ -2,12 +2,91 @@
 #define __INC_RFID_READER_H
 
 #include <Arduino.h>
+#include "scan.h"
 
-/* string variable to store stringified RFID UID */
-extern String card_id;
+/* length of a stringified RFID UID: "xx " per byte, with a null byte */
+#define RFID_UID_STR_MAX_LEN    (RFID_UID_MAX_LEN * 3)
+
+/*
+ * card detection modes
+ *   RFID_DETECT_POLL: asks the reader for a card on every RFID task run,
+ *     200 commands/s, each holding the SPI bus until the reader's 25 ms
+ *     receive timeout while no card answers
+ *   RFID_DETECT_IRQ: a timer re-arms a REQA on the reader, which pulls
+ *     MFRC_IRQ_PIN low when a card answers and wakes the RFID task; 40
+ *     commands/s (a REQA and a flag read every RFID_REQA_PERIOD) of a few
+ *     register accesses each, needs the reader's IRQ pin wired to
+ *     MFRC_IRQ_PIN (build with -DRFID_DETECT_MODE=1)
+*/
+#define RFID_DETECT_POLL        0
+#define RFID_DETECT_IRQ         1
+#ifndef RFID_DETECT_MODE
+#define RFID_DETECT_MODE        RFID_DETECT_POLL
+#endif
+
+/*
+ * IRQ mode falls back to polling after this many consecutive REQAs a
+ * card answered without the IRQ line moving: the line is not wired
+*/
+#define RFID_IRQ_MISSED_MAX     3
+
+/* period between two REQAs in IRQ mode [ms] */
+#define RFID_REQA_PERIOD        50
+/*
+ * repeat taps: a card read again within RFID_REPEAT_WINDOW ms of its last
+ * read is dropped, so a card held on the reader is one scan; the window
+ * restarts on every read, 0 disables suppression
+*/
+#ifndef RFID_REPEAT_WINDOW
+#define RFID_REPEAT_WINDOW      5000
+#endif
+/* number of recently read cards remembered for suppression */
+#define RFID_RECENT_CARDS       8
+
+/* period between two detection statistics reports [ms] */
+#define RFID_STATS_PERIOD       60000
+
+/**
+ * struct rfid_stats_s - card detection statistics over a report period
+ *
+ * @elapsed: length of the period [ms]
+ * @commands: commands issued to the reader (polls, REQA re-arms, reads)
+ * @bus_us: time spent talking to the reader over SPI [us]
+ * @detections: cards read
+ * @suppressed: repeat taps dropped
+ * @latency_total: sum of the detection latencies, from the REQA the card
+ *  answered to its UID being read [us]
+ * @latency_max: longest detection latency [us]
+*/
+typedef struct rfid_stats_s
+{
+	uint32_t elapsed;
+	uint32_t commands;
+	uint32_t bus_us;
+	uint32_t detections;
+	uint32_t suppressed;
+	uint32_t latency_total;
+	uint32_t latency_max;
+} rfid_stats_t;
+
+/* card detection mode in use, falls back to polling without an IRQ line */
+extern uint8_t rfid_detect_mode;
+
+/* fixed buffer storing the stringified RFID UID */
+extern char card_id[];
+
+/* raw bytes and length of the last scanned RFID UID */
+extern byte card_uid[];
+extern byte card_uid_size;
+/* micros() when the last scanned card was detected */
+extern uint32_t card_detected_at;
 
 /* RFID reader functions */
 void initialize_rfid(void);
+void rfid_set_reqa_period(uint32_t);
 bool rfid_read_new_card(void);
+void rfid_get_stats(rfid_stats_t *);
+void rfid_log_stats(void);
+uint32_t rfid_suppressed_taps(void);
 
 #endif		/* ifndef __INC_RFID_READER_H */
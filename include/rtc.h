@@ -2,26 +2,52 @@
 #define __INC_RTC_DS3231_H
 
 #include <Arduino.h>
+#include "hal.h"
 
+/* period between two checks of the software clock against the chip [ms] */
+#define RTC_CHECK_PERIOD        600000
 /*
- *	library to interact with the DS3231 real-time clock, includes Wire.h
+ * longest wait for a square wave edge [ms]: past it the line is taken
+ * as silent and the clock runs off chip reads until edges come again
 */
-#include <RTClib.h>
+#define RTC_SQW_TIMEOUT         2500
 
-/* active RTC instance */
-extern RTC_DS3231 my_RTC;
+/* reads per method timed by rtc_benchmark(), with -D RTC_BENCHMARK */
+#define RTC_BENCHMARK_READS     64
+
+/**
+ * struct rtc_stats_s - software clock state since startup
+ *
+ * @running: whether the clock follows the square wave
+ * @edges: square wave edges seen
+ * @checks: checks against the chip
+ * @mismatches: checks that found the clock a second or more off
+*/
+typedef struct rtc_stats_s
+{
+	bool running;
+	uint32_t edges;
+	uint32_t checks;
+	uint32_t mismatches;
+} rtc_stats_t;
 
 /* Functions to interact with the RTC */
 void initialize_RTC(void);
+uint64_t rtc_now_us(void);
+void rtc_check(void);
+void rtc_adjust(uint64_t);
+void rtc_get_stats(rtc_stats_t *);
+void rtc_benchmark(void);
 
 /**
- * get_time_now - retrieves the current time from theRTC
+ * get_time_now - retrieves the current time off the software clock,
+ *  without touching the I2C bus
  *
- * Return: current date/time
+ * Return: current epoch time
 */
-inline DateTime get_time_now(void)
+inline uint32_t get_time_now(void)
 {
-	return (my_RTC.now());
+	return ((uint32_t)(rtc_now_us() / 1000000));
 }
 
 #endif		/* ifndef __INC_RTC_DS3231_H */
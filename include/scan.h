@@ -0,0 +1,31 @@
+#ifndef __INC_SCAN_H
+#define __INC_SCAN_H
+
+#include <stdint.h>
+
+/* maximum RFID UID length in bytes */
+#define RFID_UID_MAX_LEN        10
+
+/**
+ * struct scan_record_s - a single sentry scan, as published/journalled
+ *
+ * @scan_time: epoch time of the scan
+ * @seq: the device's sequence number, increases with every scan across
+ *  reboots, so scans within the same millisecond keep their order and
+ *  the backend can drop redelivered ones; 0 if none could be reserved
+ * @scan_ms: milliseconds past @scan_time
+ * @uid: scanned RFID UID bytes
+ * @uid_size: length of the RFID UID in bytes (4, 7 or 10)
+ * @outside_shift: non-zero if the scan happened with no ongoing shift
+*/
+typedef struct scan_record_s
+{
+	uint32_t scan_time;
+	uint32_t seq;
+	uint16_t scan_ms;
+	uint8_t uid[RFID_UID_MAX_LEN];
+	uint8_t uid_size;
+	uint8_t outside_shift;
+} scan_record_t;
+
+#endif		/* ifndef __INC_SCAN_H */
@@ -0,0 +1,22 @@
+#ifndef __INC_SCAN_SEQ_H
+#define __INC_SCAN_SEQ_H
+
+#include <stdint.h>
+#include "storage.h"
+
+/*
+ * scan sequence numbers are reserved on flash this many at a time, so
+ * the flash is written once per reservation and once per boot; a reboot
+ * skips what was left of the reservation
+*/
+#define SCAN_SEQ_RESERVE        1024
+
+/* path of the sequence numbers' backing file on LittleFS */
+#define SCAN_SEQ_PATH           "/scan-seq.bin"
+
+/* Scan sequence number functions */
+uint32_t scan_seq_storage_size(void);
+bool scan_seq_begin(storage_t *);
+uint32_t scan_seq_next(void);
+
+#endif		/* ifndef __INC_SCAN_SEQ_H */
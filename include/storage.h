@@ -0,0 +1,30 @@
+#ifndef __INC_STORAGE_H
+#define __INC_STORAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * struct storage_s - pluggable byte-addressable persistent storage, lets
+ *  flash-backed modules run on any backend (LittleFS file, NVS, plain file)
+ *
+ * @read: reads @len bytes at @offset into @data, returns true on success
+ * @write: writes @len bytes from @data at @offset, returns true on success
+ * @size: usable size of the storage in bytes
+ * @ctx: backend-specific context passed back to @read and @write
+*/
+typedef struct storage_s
+{
+	bool (*read)(void *ctx, uint32_t offset, void *data, size_t len);
+	bool (*write)(void *ctx, uint32_t offset, const void *data, size_t len);
+	uint32_t size;
+	void *ctx;
+} storage_t;
+
+/* LittleFS file-backed storage */
+bool storage_littlefs_open(storage_t *, const char *, uint32_t);
+
+/* NVS blob-backed storage */
+bool storage_nvs_open(storage_t *, const char *, uint32_t);
+
+#endif		/* ifndef __INC_STORAGE_H */
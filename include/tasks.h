@@ -0,0 +1,55 @@
+#ifndef __INC_TASKS_H
+#define __INC_TASKS_H
+
+#include <stdint.h>
+#include "event_queue.h"
+
+/*
+ * task layout: RFID acquisition and UI on the application core, network
+ * on the protocol core next to the WiFi stack
+ *   core: CPU the task is pinned to
+ *   priority: FreeRTOS priority, higher runs first
+ *   period: longest sleep between two runs, a notification wakes it early [ms]
+ *   stack: stack size [bytes]
+*/
+#define RFID_TASK_CORE          1
+#define RFID_TASK_PRIORITY      3
+#define RFID_TASK_PERIOD        5
+#define RFID_TASK_IRQ_PERIOD    1000	/* IRQ mode: the reader wakes it */
+#define RFID_TASK_STACK         4096
+
+#define UI_TASK_CORE            1
+#define UI_TASK_PRIORITY        1
+#define UI_TASK_PERIOD          20
+#define UI_TASK_STACK           8192	/* runs the WiFi config portal */
+
+#define NET_TASK_CORE           0
+#define NET_TASK_PRIORITY       2
+#define NET_TASK_PERIOD         10
+#define NET_TASK_STACK          6144
+
+/**
+ * enum task_id_e - the firmware's tasks
+ *
+ * @TASK_RFID: detects cards on the reader and timestamps scans
+ * @TASK_UI: owns the LCD, alarm and WiFi config button
+ * @TASK_NET: publishes scans and replays the offline journal
+*/
+typedef enum task_id_e
+{
+	TASK_RFID = 0,
+	TASK_UI = 1,
+	TASK_NET = 2,
+	TASK_COUNT = 3
+} task_id_t;
+
+/* queue from the MQTT client callbacks to the UI task */
+extern event_queue_t mqtt_ui_queue;
+/* queue from the WiFi event handler to the UI task */
+extern event_queue_t wifi_ui_queue;
+
+/* Task functions */
+void post_event(event_queue_t *, uint8_t, uint8_t, uint8_t);
+void initialize_tasks(void);
+
+#endif		/* ifndef __INC_TASKS_H */
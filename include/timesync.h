@@ -0,0 +1,68 @@
+#ifndef __INC_TIMESYNC_H
+#define __INC_TIMESYNC_H
+
+#include <stdint.h>
+#include "scan.h"
+
+/*
+ * SNTP server the checkpoint's clock follows, an IP address or a domain
+ * name; empty for the MQTT broker's host, which is site-local and
+ * reachable wherever the checkpoint works
+*/
+#ifndef TIMESYNC_SERVER
+#define TIMESYNC_SERVER         ""
+#endif
+#define TIMESYNC_SERVER_PORT    123
+#define TIMESYNC_LOCAL_PORT     4123
+
+/*
+ * sync cadence [ms]
+ *   PERIOD: between two syncs once synced
+ *   RETRY: between two attempts until synced, or after a failed attempt
+ *   TIMEOUT: longest wait for the server's response
+*/
+#define TIMESYNC_PERIOD         900000
+#define TIMESYNC_RETRY          30000
+#define TIMESYNC_TIMEOUT        2000
+
+/* responses that took longer than this round trip are discarded [ms] */
+#define TIMESYNC_MAX_DELAY      500
+/* larger offsets are steps (boot, RTC off), kept out of the drift estimate [ms] */
+#define TIMESYNC_STEP_THRESHOLD 1000
+/* the RTC is set once it is off by this much [ms] */
+#define TIMESYNC_RTC_TOLERANCE  500
+/* longest drift correction believed, crystals are within tens of ppm [ppb] */
+#define TIMESYNC_MAX_DRIFT      500000
+/* shortest time between two syncs that updates the drift estimate [ms] */
+#define TIMESYNC_DRIFT_MIN_SPAN 60000
+
+/**
+ * struct timesync_stats_s - time sync state since startup
+ *
+ * @synced: whether a server response was ever accepted
+ * @syncs: server responses accepted
+ * @failures: attempts that timed out or were discarded
+ * @rtc_adjusts: times the RTC was set
+ * @offset_us: server time minus the clock's at the last sync [us]
+ * @delay_us: round trip of the last accepted response [us]
+ * @drift_ppb: correction applied to the local timer's rate [ppb]
+*/
+typedef struct timesync_stats_s
+{
+	bool synced;
+	uint32_t syncs;
+	uint32_t failures;
+	uint32_t rtc_adjusts;
+	int64_t offset_us;
+	uint32_t delay_us;
+	int32_t drift_ppb;
+} timesync_stats_t;
+
+/* Time sync functions */
+void initialize_timesync(void);
+void timesync_run(void);
+uint64_t timesync_now_us(void);
+void timesync_stamp(scan_record_t *);
+void timesync_get_stats(timesync_stats_t *);
+
+#endif		/* ifndef __INC_TIMESYNC_H */
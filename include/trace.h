@@ -0,0 +1,77 @@
+#ifndef __INC_TRACE_H
+#define __INC_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * latency histogram buckets: bucket 0 counts latencies under 2 us,
+ * bucket i (0 < i < TRACE_BUCKETS - 1) counts latencies in
+ * [2^i, 2^(i + 1)) us and the last bucket counts everything longer
+*/
+#define TRACE_BUCKETS           24
+
+/* period between two diagnostics publications [ms] */
+#define TRACE_PUBLISH_PERIOD    300000
+
+/**
+ * enum trace_stage_e - traced stages of a scan, from tap to verdict,
+ *  and of the MQTT connection
+ *
+ * @TRACE_DETECT: REQA sent (poll or IRQ re-arm) to card detected
+ * @TRACE_READ_UID: card selected and its UID read
+ * @TRACE_FORMAT_UID: UID formatted for the logs/LCD
+ * @TRACE_TIMESTAMP: scan time read from the RTC
+ * @TRACE_PUBLISH: card detected to scan handed to the MQTT client
+ * @TRACE_ACK: scan published to its acknowledgement by the broker
+ * @TRACE_VERDICT: scan published to the backend's response
+ * @TRACE_TAP_TO_VERDICT: card detected to the backend's response
+ * @TRACE_MQTT_READY: connection attempt to subscriptions in place,
+ *  reconnection or not
+ * @TRACE_BOOT_TO_PUBLISH: boot to the first message handed to the MQTT
+ *  client, once per boot
+ * @TRACE_WIFI_CONNECT: WiFi connection started (boot or dropout) to IP
+ *  address obtained
+ * @TRACE_STAGE_COUNT: number of stages
+*/
+typedef enum trace_stage_e
+{
+	TRACE_DETECT = 0,
+	TRACE_READ_UID = 1,
+	TRACE_FORMAT_UID = 2,
+	TRACE_TIMESTAMP = 3,
+	TRACE_PUBLISH = 4,
+	TRACE_ACK = 5,
+	TRACE_VERDICT = 6,
+	TRACE_TAP_TO_VERDICT = 7,
+	TRACE_MQTT_READY = 8,
+	TRACE_BOOT_TO_PUBLISH = 9,
+	TRACE_WIFI_CONNECT = 10,
+	TRACE_STAGE_COUNT = 11
+} trace_stage_t;
+
+/**
+ * struct trace_histogram_s - latency histogram of a stage since startup
+ *
+ * @count: number of latencies recorded
+ * @max: longest latency recorded [us]
+ * @buckets: latency counts, see TRACE_BUCKETS
+*/
+typedef struct trace_histogram_s
+{
+	uint32_t count;
+	uint32_t max;
+	uint32_t buckets[TRACE_BUCKETS];
+} trace_histogram_t;
+
+/* Scan latency tracer functions */
+uint32_t trace_cycles(void);
+void trace_cycles_since(uint8_t, uint32_t);
+void trace_record(uint8_t, uint32_t);
+void trace_published(uint32_t, uint16_t);
+void trace_acked(uint16_t);
+void trace_verdict(void);
+const trace_histogram_t *trace_histogram(uint8_t);
+const char *trace_stage_name(uint8_t);
+
+#endif		/* ifndef __INC_TRACE_H */
@@ -0,0 +1,45 @@
+#ifndef __INC_UI_H
+#define __INC_UI_H
+
+#include <stdint.h>
+
+/*
+ * screen timing [ms]
+ *   DWELL: least time a screen stays up before a lower priority one
+ *          replaces it
+ *   TIMEOUT: time a screen stays up before the UI falls back to the
+ *            alarm or home screen
+*/
+#define UI_CONNECTING_TIMEOUT   3000
+#define UI_VERIFYING_DWELL      1000
+#define UI_VERIFYING_TIMEOUT    10000
+#define UI_VERDICT_DWELL        3000
+#define UI_VERDICT_TIMEOUT      12000
+
+/**
+ * enum ui_screen_e - screens of the LCD, lowest priority first
+ *
+ * @UI_HOME: connection status and "Scan Card", while no alarm is on
+ * @UI_CONNECTING: WiFi lost, reconnecting
+ * @UI_VERIFYING: scan sent, awaiting the verdict
+ * @UI_VALID: valid scan verdict
+ * @UI_INVALID: invalid scan verdict, its code is the reason
+ * @UI_ALARM: alarm raised by the platform, while it is on
+ * @UI_SCREEN_COUNT: number of screens
+*/
+typedef enum ui_screen_e
+{
+	UI_HOME = 0,
+	UI_CONNECTING = 1,
+	UI_VERIFYING = 2,
+	UI_VALID = 3,
+	UI_INVALID = 4,
+	UI_ALARM = 5,
+	UI_SCREEN_COUNT = 6
+} ui_screen_t;
+
+/* UI state machine functions, run by the UI task */
+void ui_show(uint8_t, uint8_t);
+void ui_run(void);
+
+#endif		/* ifndef __INC_UI_H */
@@ -0,0 +1,81 @@
+#ifndef __INC_VERDICT_CACHE_H
+#define __INC_VERDICT_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "storage.h"
+#include "scan.h"
+
+/* number of cards the verdict cache holds */
+#define VERDICT_CACHE_CAPACITY          1024
+/* bits in the cache's Bloom filter (a power of two) and hashes per card */
+#define VERDICT_CACHE_BLOOM_BITS        8192
+#define VERDICT_CACHE_BLOOM_HASHES      3
+
+/* path of the cache's backing file on LittleFS */
+#define VERDICT_CACHE_PATH              "/verdict-cache.bin"
+/*
+ * time updates gather in RAM before the cache is saved, a snapshot's
+ * messages and bursts of deltas are written once [ms]
+*/
+#define VERDICT_CACHE_PERSIST_DELAY     5000
+
+/*
+ * card update message, sent by the backend on the card-updates topic,
+ * whitespace-separated ASCII tokens:
+ *
+ *   <base version> <new version> [reset] [more] <op> <op> ...
+ *
+ *   base version: cache version the update applies to, ignored with reset
+ *   new version: cache version once applied, non-zero
+ *   reset: the cache is emptied before applying the update
+ *   more: a multi-message snapshot continues in the next update, no
+ *         verdict is given until the snapshot is complete
+ *   op: +<uid hex> registered card, !<uid hex> stolen card,
+ *       -<uid hex> card removed
+ *
+ * e.g. "41 42 +04a12bff !deadbeef -0badcafe"
+ *
+ * A message is at most MQTT_RX_PAYLOAD_MAX_LEN (256) bytes, about 25 ops:
+ * larger updates are split, a snapshot with "more". A longer one is
+ * dropped on arrival and the checkpoint requests a card sync instead.
+*/
+
+/**
+ * enum card_status_e - what the cache knows of a card
+ *
+ * @CARD_REGISTERED: card is registered to a sentry
+ * @CARD_STOLEN: card has been reported stolen
+*/
+typedef enum card_status_e
+{
+	CARD_REGISTERED = 1,
+	CARD_STOLEN = 2
+} card_status_t;
+
+/**
+ * enum verdict_update_e - outcome of applying a card update message
+ *
+ * @VERDICT_UPDATE_APPLIED: the cache moved to the update's version
+ * @VERDICT_UPDATE_STALE: the update is already in the cache, ignored
+ * @VERDICT_UPDATE_GAP: updates were missed, the cache needs a resync
+ * @VERDICT_UPDATE_INVALID: malformed update, ignored
+*/
+typedef enum verdict_update_e
+{
+	VERDICT_UPDATE_APPLIED = 0,
+	VERDICT_UPDATE_STALE = 1,
+	VERDICT_UPDATE_GAP = 2,
+	VERDICT_UPDATE_INVALID = 3
+} verdict_update_t;
+
+/* On-device card verdict cache functions */
+uint32_t verdict_cache_storage_size(void);
+bool verdict_cache_begin(storage_t *);
+uint8_t verdict_cache_lookup(const uint8_t *, uint8_t);
+verdict_update_t verdict_cache_update(const char *, size_t);
+void verdict_cache_persist(uint32_t);
+uint32_t verdict_cache_version(void);
+uint32_t verdict_cache_count(void);
+
+#endif		/* ifndef __INC_VERDICT_CACHE_H */
@@ -0,0 +1,194 @@
+#include <Arduino.h>
+#include "boot.h"
+#include "crc16.h"
+#include "hal.h"
+
+/*
+ * Boot profiler: each phase of the boot is ended by boot_mark(), which
+ * adds the time since the previous mark to it. The profiles of the last
+ * BOOT_HISTORY boots are kept in memory that survives resets, and are
+ * updated at every mark, so a boot cut short by the watchdog still shows
+ * how far it got. The first mark may run from a static constructor,
+ * before setup(): everything here is zero-initialised, no constructors.
+*/
+
+/**
+ * struct boot_history_s - ring of the last boots' profiles, in retained
+ *  memory
+ *
+ * @magic: BOOT_HISTORY_MAGIC, anything else is a power-on's garbage
+ * @crc: CRC16 over the rest of the history
+ * @head: slot of the current boot
+ * @count: boots held
+ * @records: boot profiles
+*/
+typedef struct boot_history_s
+{
+	uint32_t magic;
+	uint16_t crc;
+	uint8_t head;
+	uint8_t count;
+	boot_record_t records[BOOT_HISTORY];
+} boot_history_t;
+
+/* changes with the layout, so a firmware update starts a new history */
+#define BOOT_HISTORY_MAGIC      (0xB0070000 | sizeof(boot_history_t))
+
+static_assert(sizeof(boot_history_t) <= HAL_RETAINED_SIZE,
+	"boot history does not fit the retained memory");
+
+static const char *const phase_names[BOOT_PHASE_COUNT] = {
+	"core",
+	"ctor-portal",
+	"ctor-mqtt",
+	"serial",
+	"bus",
+	"rfid",
+	"display",
+	"rtc",
+	"alarm",
+	"config",
+	"wifi",
+	"mqtt",
+	"timesync",
+	"tasks",
+	"power",
+	"wifi-up",
+	"mqtt-up"
+};
+
+static const char *const reset_names[HAL_RESET_COUNT] = {
+	"unknown",
+	"power-on",
+	"external",
+	"software",
+	"panic",
+	"watchdog",
+	"brownout",
+	"deep-sleep"
+};
+
+/* history in retained memory, NULL until the first mark */
+static boot_history_t *history = NULL;
+/* current boot's profile */
+static boot_record_t *current = NULL;
+/* time of the last mark [us] */
+static uint32_t last_mark_micros = 0;
+/* phases ended, by bit */
+static uint32_t marked = 0;
+
+/**
+ * history_crc - computes the checksum of the history
+ *
+ * Return: CRC16 over the history past its checksum
+*/
+static uint16_t history_crc()
+{
+	return (crc16(&history->head,
+		sizeof(*history) - offsetof(boot_history_t, head)));
+}
+
+/**
+ * boot_begin - picks up the history left by the previous boots, or
+ *  starts one, and adds the current boot to it
+ *
+ * Return: Nothing
+*/
+static void boot_begin()
+{
+	uint32_t boot = 1;
+
+	history = (boot_history_t *)hal_retained_memory();
+
+	if (history->magic != BOOT_HISTORY_MAGIC || history->crc != history_crc() ||
+			history->head >= BOOT_HISTORY || history->count > BOOT_HISTORY)
+	{
+		memset(history, 0, sizeof(*history));
+		history->magic = BOOT_HISTORY_MAGIC;
+		history->head = BOOT_HISTORY - 1;
+	}
+	else if (history->count)
+		boot = history->records[history->head].boot + 1;
+
+	history->head = (history->head + 1) % BOOT_HISTORY;
+	if (history->count < BOOT_HISTORY)
+		history->count++;
+
+	current = &history->records[history->head];
+	memset(current, 0, sizeof(*current));
+	current->boot = boot;
+	history->crc = history_crc();
+}
+
+/**
+ * boot_mark - ends a phase of the boot; phases end once, but for
+ *  BOOT_PHASE_CORE, which adds up the time around the timed constructors
+ *
+ * @phase: one of enum boot_phase_e
+ *
+ * Return: Nothing
+*/
+void boot_mark(uint8_t phase)
+{
+	uint32_t now = micros();
+
+	if (phase >= BOOT_PHASE_COUNT || (marked & (1UL << BOOT_PHASE_MQTT_UP)))
+		return;
+
+	if (!current)
+		boot_begin();
+
+	if (phase != BOOT_PHASE_CORE && (marked & (1UL << phase)))
+		return;
+
+	/* esp-idf reads the reset cause in a constructor of its own */
+	if (current->reset == HAL_RESET_UNKNOWN)
+		current->reset = hal_reset_reason();
+
+	current->phase_us[phase] += now - last_mark_micros;
+	current->reached_us = now;
+	last_mark_micros = now;
+	marked |= 1UL << phase;
+
+	history->crc = history_crc();
+}
+
+/**
+ * boot_record - retrieves the profile of a boot in the history
+ *
+ * @age: 0 for the current boot, 1 for the previous one, and so on
+ *
+ * Return: the boot's profile, NULL if the history does not go that far
+*/
+const boot_record_t *boot_record(uint8_t age)
+{
+	if (!history || age >= history->count)
+		return (NULL);
+
+	return (&history->records[
+		(history->head + BOOT_HISTORY - age) % BOOT_HISTORY]);
+}
+
+/**
+ * boot_phase_name - retrieves the name a phase is published under
+ *
+ * @phase: one of enum boot_phase_e
+ *
+ * Return: the phase's name, NULL for an unknown phase
+*/
+const char *boot_phase_name(uint8_t phase)
+{
+	return (phase < BOOT_PHASE_COUNT ? phase_names[phase] : NULL);
+}
+
+/**
+ * boot_reset_name - retrieves the name a reset cause is published under
+ *
+ * @reset: one of HAL_RESET_*
+ *
+ * Return: the cause's name, "unknown" for an unknown cause
+*/
+const char *boot_reset_name(uint8_t reset)
+{
+	return (reset_names[reset < HAL_RESET_COUNT ? reset : HAL_RESET_UNKNOWN]);
+}
@@ -0,0 +1,213 @@
+#include <Arduino.h>
+#include "main.h"
+#include "config.h"
+#include "mqtt.h"
+#include "power.h"
+#include "storage.h"
+#include "crc16.h"
+#include "hal.h"
+
+/*
+ * Settings entered in the config portal (broker, credentials, checkpoint
+ * ID, scan format, power mode), kept across power cycles so a checkpoint
+ * rejoins the broker on boot instead of waiting to be reconfigured.
+ *
+ * The record is a header (schema version, body length, CRC16 over the
+ * body) followed by the body. Later schemas only append fields: an older
+ * record still loads, the fields it lacks at their defaults, while one
+ * written by a newer firmware is ignored.
+*/
+
+/**
+ * struct config_header_s - on-storage header of the saved configuration
+ *
+ * @version: CONFIG_VERSION of the firmware that wrote it
+ * @length: length of the body that follows
+ * @crc: CRC16 over the @length bytes of the body
+ * @reserved: zero
+*/
+typedef struct config_header_s
+{
+	uint16_t version;
+	uint16_t length;
+	uint16_t crc;
+	uint16_t reserved;
+} config_header_t;
+
+/**
+ * struct config_body_s - saved configuration, schema version 1
+ *
+ * @broker_host: broker's domain name, if @domain
+ * @broker_username: broker's username
+ * @broker_password: broker's password
+ * @checkpoint_id: checkpoint ID, as entered, the client ID's suffix
+ * @broker_ip: broker's IPv4 address as stored in an IPAddress, unless @domain
+ * @domain: 1 if the broker is given by domain name
+ * @payload_format: one of enum payload_format_e
+ * @power_mode: POWER_MODE_NORMAL or POWER_MODE_LOW
+ * @reserved: zero
+*/
+typedef struct config_body_s
+{
+	char broker_host[MQTT_HOST_DOMAIN_MAX_LEN];
+	char broker_username[MQTT_BROKER_USER_MAX_LEN];
+	char broker_password[MQTT_BROKER_PASS_MAX_LEN];
+	char checkpoint_id[MQTT_CLIENT_ID_MAX_LEN - MQTT_CLIENT_ID_PREFIX_LEN];
+	uint32_t broker_ip;
+	uint8_t domain;
+	uint8_t payload_format;
+	uint8_t power_mode;
+	uint8_t reserved;
+} config_body_t;
+
+#define CONFIG_STORAGE_SIZE     (sizeof(config_header_t) + sizeof(config_body_t))
+
+/* settings storage, size 0 until initialize_config opens it */
+static storage_t config_storage;
+
+/* whether a valid configuration was loaded or saved */
+static bool config_valid = false;
+
+/**
+ * copy_str - copies a string into a fixed-size field, always terminated
+ *
+ * @dest: destination field
+ * @size: size of the field
+ * @src: string to copy
+ *
+ * Return: Nothing
+*/
+static void copy_str(char *dest, size_t size, const char *src)
+{
+	strncpy(dest, src, size - 1);
+	dest[size - 1] = '\0';
+}
+
+/**
+ * load - reads the saved configuration into the settings in use
+ *
+ * Return: true if a valid configuration was found, false otherwise
+*/
+static bool load()
+{
+	config_header_t header;
+	config_body_t body;
+
+	if (!config_storage.read(config_storage.ctx, 0, &header, sizeof(header)))
+		return false;
+
+	/* erased storage: never configured */
+	if (header.version == 0xFFFF)
+		return false;
+
+	if (header.version > CONFIG_VERSION || header.length > sizeof(body))
+	{
+		Serial.printf("Saved configuration v%u is newer, ignored\n",
+			(unsigned int)header.version);
+		return false;
+	}
+
+	/* fields an older schema lacks keep their zero defaults */
+	memset(&body, 0, sizeof(body));
+	if (!config_storage.read(config_storage.ctx, sizeof(header), &body,
+			header.length) || crc16(&body, header.length) != header.crc)
+	{
+		Serial.println("Saved configuration corrupted, ignored");
+		return false;
+	}
+
+	copy_str(broker_host, MQTT_HOST_DOMAIN_MAX_LEN, body.broker_host);
+	copy_str(broker_username, MQTT_BROKER_USER_MAX_LEN, body.broker_username);
+	copy_str(broker_password, MQTT_BROKER_PASS_MAX_LEN, body.broker_password);
+	copy_str(&mqtt_client_id[MQTT_CLIENT_ID_PREFIX_LEN],
+		MQTT_CLIENT_ID_MAX_LEN - MQTT_CLIENT_ID_PREFIX_LEN, body.checkpoint_id);
+	CHECKPOINT_ID = atoi(&mqtt_client_id[MQTT_CLIENT_ID_PREFIX_LEN]);
+	broker_ip = IPAddress(body.broker_ip);
+	domain = body.domain;
+	payload_format = body.payload_format == PAYLOAD_FORMAT_BINARY ?
+		PAYLOAD_FORMAT_BINARY : PAYLOAD_FORMAT_JSON;
+	/* applied by initialize_power(), once the tasks exist */
+	power_mode = body.power_mode == POWER_MODE_LOW ?
+		POWER_MODE_LOW : POWER_MODE_NORMAL;
+
+	return true;
+}
+
+/**
+ * initialize_config - opens the settings storage and loads the saved
+ *  configuration, if any, into the settings in use
+ *
+ * Return: Nothing
+*/
+void initialize_config()
+{
+	if (!hal_settings_open(&config_storage, CONFIG_KEY, CONFIG_STORAGE_SIZE))
+	{
+		config_storage.size = 0;
+		Serial.println("Configuration storage unavailable");
+		return;
+	}
+
+	config_valid = load();
+
+	if (config_valid)
+	{
+		Serial.print("Configuration loaded, checkpoint ");
+		Serial.println(CHECKPOINT_ID);
+	}
+	else
+		Serial.println("No saved configuration");
+}
+
+/**
+ * config_available - checks if the checkpoint is configured, from the
+ *  saved configuration or the config portal since boot
+ *
+ * Return: true if configured, false otherwise
+*/
+bool config_available()
+{
+	return (config_valid);
+}
+
+/**
+ * config_save - saves the settings in use, called once the config
+ *  portal has set them
+ *
+ * Return: true on success, false otherwise
+*/
+bool config_save()
+{
+	config_header_t header;
+	config_body_t body;
+
+	memset(&body, 0, sizeof(body));
+	copy_str(body.broker_host, sizeof(body.broker_host), broker_host);
+	copy_str(body.broker_username, sizeof(body.broker_username), broker_username);
+	copy_str(body.broker_password, sizeof(body.broker_password), broker_password);
+	copy_str(body.checkpoint_id, sizeof(body.checkpoint_id),
+		&mqtt_client_id[MQTT_CLIENT_ID_PREFIX_LEN]);
+	body.broker_ip = (uint32_t)broker_ip;
+	body.domain = domain;
+	body.payload_format = payload_format;
+	body.power_mode = power_mode;
+
+	header.version = CONFIG_VERSION;
+	header.length = sizeof(body);
+	header.crc = crc16(&body, sizeof(body));
+	header.reserved = 0;
+
+	config_valid = true;
+
+	/* the body first: a header without its body fails the CRC */
+	if (!config_storage.size ||
+			!config_storage.write(config_storage.ctx, sizeof(header),
+				&body, sizeof(body)) ||
+			!config_storage.write(config_storage.ctx, 0, &header, sizeof(header)))
+	{
+		Serial.println("Configuration not saved");
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,24 @@
+#include "crc16.h"
+
+/**
+ * crc16 - computes the CRC16-CCITT of a buffer
+ *
+ * @data: buffer to checksum
+ * @len: length of the buffer in bytes
+ *
+ * Return: CRC16 of the buffer
+*/
+uint16_t crc16(const void *data, size_t len)
+{
+	const uint8_t *bytes = (const uint8_t *)data;
+	uint16_t crc = 0xFFFF;
+
+	while (len--)
+	{
+		crc ^= (uint16_t)(*bytes++) << 8;
+		for (uint8_t i = 0; i < 8; i++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return (crc);
+}
@@ -0,0 +1,81 @@
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <esp_attr.h>
+#include "hal.h"
+
+
+/**
+ * hal_cycle_count - reads the calling core's CPU cycle counter
+ *
+ * Return: cycle count, wraps around every few seconds
+*/
+uint32_t hal_cycle_count()
+{
+	return (ESP.getCycleCount());
+}
+
+/**
+ * hal_cycles_per_us - retrieves the CPU cycles per microsecond
+ *
+ * Return: CPU frequency [MHz]
+*/
+uint32_t hal_cycles_per_us()
+{
+	return (ESP.getCpuFreqMHz());
+}
+
+/**
+ * hal_clock_us - reads the time since startup, off the ESP timer, safe
+ *  in interrupt handlers
+ *
+ * Return: time since startup [us]
+*/
+uint64_t IRAM_ATTR hal_clock_us()
+{
+	return (esp_timer_get_time());
+}
+
+/* kept across resets: the bootloader leaves it uninitialised */
+static RTC_NOINIT_ATTR uint32_t retained[HAL_RETAINED_SIZE / 4];
+
+/**
+ * hal_reset_reason - retrieves the cause of the last reset
+ *
+ * Return: one of HAL_RESET_*
+*/
+uint8_t hal_reset_reason()
+{
+	switch (esp_reset_reason())
+	{
+		case ESP_RST_POWERON:
+			return (HAL_RESET_POWER_ON);
+		case ESP_RST_EXT:
+			return (HAL_RESET_EXTERNAL);
+		case ESP_RST_SW:
+			return (HAL_RESET_SOFTWARE);
+		case ESP_RST_PANIC:
+			return (HAL_RESET_PANIC);
+		case ESP_RST_INT_WDT:
+		case ESP_RST_TASK_WDT:
+		case ESP_RST_WDT:
+			return (HAL_RESET_WATCHDOG);
+		case ESP_RST_BROWNOUT:
+			return (HAL_RESET_BROWNOUT);
+		case ESP_RST_DEEPSLEEP:
+			return (HAL_RESET_DEEP_SLEEP);
+		default:
+			return (HAL_RESET_UNKNOWN);
+	}
+}
+
+/**
+ * hal_retained_memory - retrieves the memory kept across resets, in RTC
+ *  slow memory; garbage after a power cycle
+ *
+ * Return: HAL_RETAINED_SIZE bytes, word-aligned
+*/
+void *hal_retained_memory()
+{
+	return (retained);
+}
@@ -0,0 +1,185 @@
+#include <Arduino.h>
+#include <Wire.h>
+#include <SPI.h>
+#include <esp_timer.h>
+#include "hal.h"
+
+/*
+ * I2C bus manager: Wire is only driven by the holder of the bus, so the
+ * multi-byte sequences of the LCD and RTC libraries never interleave
+ * between tasks (or the Ticker task). A released bus is handed straight
+ * to the highest priority waiter, each device waiting on its own
+ * semaphore, and runs at that device's clock.
+*/
+
+/* bus clock per device [Hz]: the DS3231 does fast mode, the PCF8574 does not */
+static const uint32_t bus_clock_of[HAL_BUS_DEVICES] = {
+	400000,		/* HAL_BUS_RTC */
+	100000,		/* HAL_BUS_LCD */
+};
+
+/* longest a transaction waits on a device that stopped answering [ms] */
+#define BUS_TIMEOUT             50
+/* tasks that may wait on the same device at once */
+#define BUS_MAX_WAITERS         4
+/* half a period of the recovery clock, 100 kHz [us] */
+#define BUS_RECOVERY_HALF_CLOCK 5
+
+static portMUX_TYPE bus_mux = portMUX_INITIALIZER_UNLOCKED;
+/* whether a transaction holds the bus, and how many wait per device */
+static bool bus_held = false;
+static uint8_t bus_waiting[HAL_BUS_DEVICES];
+/* given to hand the bus over to a waiter of that device */
+static SemaphoreHandle_t bus_grant[HAL_BUS_DEVICES];
+
+/* owned by the holder of the bus */
+static uint32_t bus_clock = 0;
+static int64_t bus_held_at = 0;
+static hal_bus_stats_t stats;
+
+/**
+ * hal_bus_init - initialises the SPI bus (RFID reader) and the I2C bus
+ *  (LCD and RTC)
+ *
+ * Return: Nothing
+*/
+void hal_bus_init()
+{
+	SPI.begin();
+	Wire.begin();
+	Wire.setTimeOut(BUS_TIMEOUT);
+
+	for (uint8_t device = 0; device < HAL_BUS_DEVICES; device++)
+		bus_grant[device] = xSemaphoreCreateCounting(BUS_MAX_WAITERS, 0);
+}
+
+/**
+ * bus_recover - frees the bus from a device holding SDA low, having lost
+ *  track of a transfer: clocks it out of the byte, then sends a STOP
+ *
+ * Return: Nothing
+*/
+static void bus_recover()
+{
+	Wire.end();
+
+	pinMode(SDA, INPUT_PULLUP);
+	pinMode(SCL, OUTPUT_OPEN_DRAIN);
+	digitalWrite(SCL, HIGH);
+
+	for (uint8_t i = 0; i < 9 && digitalRead(SDA) == LOW; i++)
+	{
+		digitalWrite(SCL, LOW);
+		delayMicroseconds(BUS_RECOVERY_HALF_CLOCK);
+		digitalWrite(SCL, HIGH);
+		delayMicroseconds(BUS_RECOVERY_HALF_CLOCK);
+	}
+
+	/* STOP: SDA rises while SCL is high */
+	pinMode(SDA, OUTPUT_OPEN_DRAIN);
+	digitalWrite(SCL, LOW);
+	digitalWrite(SDA, LOW);
+	delayMicroseconds(BUS_RECOVERY_HALF_CLOCK);
+	digitalWrite(SCL, HIGH);
+	delayMicroseconds(BUS_RECOVERY_HALF_CLOCK);
+	digitalWrite(SDA, HIGH);
+	delayMicroseconds(BUS_RECOVERY_HALF_CLOCK);
+
+	Wire.begin();
+	Wire.setTimeOut(BUS_TIMEOUT);
+	bus_clock = 0;
+	stats.recoveries++;
+}
+
+/**
+ * hal_bus_acquire - starts an I2C transaction, waiting for the bus if
+ *  another one holds it
+ *
+ * @device: HAL_BUS_RTC or HAL_BUS_LCD, sets the priority and bus clock
+ *
+ * Return: Nothing
+ *
+ * Note: not from an interrupt handler
+*/
+void hal_bus_acquire(uint8_t device)
+{
+	bool wait;
+
+	portENTER_CRITICAL(&bus_mux);
+	wait = bus_held;
+	if (wait)
+	{
+		uint8_t queued = 0;
+
+		bus_waiting[device]++;
+		for (uint8_t d = 0; d < HAL_BUS_DEVICES; d++)
+			queued += bus_waiting[d];
+		if (queued > stats.max_queue)
+			stats.max_queue = queued;
+		stats.waits++;
+	}
+	else
+		bus_held = true;
+	portEXIT_CRITICAL(&bus_mux);
+
+	/* the releasing transaction hands the bus over, still held */
+	if (wait)
+		xSemaphoreTake(bus_grant[device], portMAX_DELAY);
+
+	/* an idle bus has both lines high */
+	if (digitalRead(SDA) == LOW || digitalRead(SCL) == LOW)
+		bus_recover();
+
+	if (bus_clock != bus_clock_of[device])
+	{
+		bus_clock = bus_clock_of[device];
+		Wire.setClock(bus_clock);
+	}
+
+	bus_held_at = esp_timer_get_time();
+	stats.transactions++;
+}
+
+/**
+ * hal_bus_release - ends an I2C transaction, handing the bus over to the
+ *  highest priority waiter if any
+ *
+ * Return: Nothing
+*/
+void hal_bus_release()
+{
+	int8_t next = -1;
+
+	stats.busy_us += esp_timer_get_time() - bus_held_at;
+
+	portENTER_CRITICAL(&bus_mux);
+	for (uint8_t device = 0; device < HAL_BUS_DEVICES; device++)
+	{
+		if (bus_waiting[device])
+		{
+			bus_waiting[device]--;
+			next = device;
+			break;
+		}
+	}
+	if (next < 0)
+		bus_held = false;
+	portEXIT_CRITICAL(&bus_mux);
+
+	if (next >= 0)
+		xSemaphoreGive(bus_grant[next]);
+}
+
+/**
+ * hal_bus_stats - gets the I2C bus usage since startup
+ *
+ * @copy: where to store the usage
+ *
+ * Return: Nothing
+*/
+void hal_bus_stats(hal_bus_stats_t *copy)
+{
+	portENTER_CRITICAL(&bus_mux);
+	*copy = stats;
+	portEXIT_CRITICAL(&bus_mux);
+}
@@ -0,0 +1,249 @@
+#include <Arduino.h>
+#include <Wire.h>
+#include <esp_timer.h>
+#include "hal.h"
+#include "lcd.h"
+
+/*
+ * HD44780 driver over the PCF8574 backpack, in 4-bit mode. The expander's
+ * outputs drive the LCD's pins, so a nibble is two expander bytes, with
+ * the enable line high then low, and the LCD latches it on the falling
+ * edge. Commands and characters are queued as expander bytes and sent as
+ * a single multi-byte I2C write on hal_lcd_commit() (or once Wire's
+ * buffer is full), where LiquidCrystal_I2C sends three single-byte writes
+ * per nibble. Every expander byte takes 90 us at 100 kHz, more than any
+ * command but clear needs, so no delays are needed in between.
+*/
+
+/* I2C address of the LCD's PCF8574 backpack */
+#define LCD_I2C_ADDRESS         0x27
+
+/* PCF8574 outputs: P0 RS, P1 RW, P2 EN, P3 backlight, P4-P7 D4-D7 */
+#define LCD_PIN_RS              0x01
+#define LCD_PIN_EN              0x04
+#define LCD_PIN_BACKLIGHT       0x08
+
+/* HD44780 commands */
+#define LCD_CLEAR               0x01
+#define LCD_ENTRY_MODE          0x06	/* cursor moves right, no shift */
+#define LCD_DISPLAY_ON          0x0C	/* cursor and blink off */
+#define LCD_FUNCTION_SET        0x28	/* 4-bit, 2 lines, 5x8 dots */
+#define LCD_SET_CGRAM           0x40
+#define LCD_SET_DDRAM           0x80
+#define LCD_ROW_OFFSET          0x40	/* DDRAM address of the second row */
+
+/* expander bytes per I2C write, Wire's buffer */
+#define LCD_BATCH_MAX           128
+
+/* full-screen refreshes timed by hal_lcd_benchmark(), with -D LCD_BENCHMARK */
+#define LCD_BENCHMARK_REFRESHES 8
+
+/* expander bytes queued for the next write */
+static uint8_t batch[LCD_BATCH_MAX];
+static size_t batch_len = 0;
+/* expander outputs after the last queued byte, 0xFF if unknown */
+static uint8_t lcd_pins = 0xFF;
+
+/**
+ * batch_send - sends the queued expander bytes in a single I2C write
+ *
+ * Return: Nothing
+*/
+static void batch_send()
+{
+	if (!batch_len)
+		return;
+
+	Wire.beginTransmission(LCD_I2C_ADDRESS);
+	Wire.write(batch, batch_len);
+	Wire.endTransmission();
+	batch_len = 0;
+}
+
+/**
+ * batch_nibble - queues a nibble, strobed into the LCD
+ *
+ * @nibble: 4 bits to send
+ * @rs: LCD_PIN_RS for character data, 0 for a command
+ *
+ * Return: Nothing
+*/
+static void batch_nibble(uint8_t nibble, uint8_t rs)
+{
+	uint8_t pins = (nibble << 4) | rs | LCD_PIN_BACKLIGHT;
+
+	if (batch_len + 3 > LCD_BATCH_MAX)
+		batch_send();
+
+	/* RS settles before the enable line rises */
+	if ((lcd_pins & LCD_PIN_RS) != rs)
+		batch[batch_len++] = pins;
+
+	batch[batch_len++] = pins | LCD_PIN_EN;
+	batch[batch_len++] = pins;
+	lcd_pins = pins;
+}
+
+/**
+ * batch_byte - queues a command or character, high nibble first
+ *
+ * @value: byte to send
+ * @rs: LCD_PIN_RS for character data, 0 for a command
+ *
+ * Return: Nothing
+*/
+static void batch_byte(uint8_t value, uint8_t rs)
+{
+	batch_nibble(value >> 4, rs);
+	batch_nibble(value & 0x0F, rs);
+}
+
+/**
+ * hal_lcd_init - initialises the LCD and turns its backlight on
+ *
+ * Return: Nothing
+ *
+ * Note: clears the LCD, hal_bus_init() should be called prior to this
+*/
+void hal_lcd_init()
+{
+	batch_len = 0;
+	lcd_pins = 0xFF;
+
+	/* power-on wait, then back to 8-bit from wherever it was, then 4-bit */
+	delay(50);
+	batch_nibble(0x03, 0);
+	batch_send();
+	delay(5);
+	batch_nibble(0x03, 0);
+	batch_send();
+	delayMicroseconds(150);
+	batch_nibble(0x03, 0);
+	batch_nibble(0x02, 0);
+
+	batch_byte(LCD_FUNCTION_SET, 0);
+	batch_byte(LCD_DISPLAY_ON, 0);
+	batch_byte(LCD_CLEAR, 0);
+	batch_send();
+	delay(2);
+
+	batch_byte(LCD_ENTRY_MODE, 0);
+	batch_send();
+}
+
+/**
+ * hal_lcd_create_char - stores a custom character in the LCD's memory
+ *
+ * @location: custom character slot, 0 to 7
+ * @bitmap: 8 rows of 5-bit pixel data
+ *
+ * Return: Nothing
+ *
+ * Note: leaves the LCD's cursor position undefined
+*/
+void hal_lcd_create_char(uint8_t location, const uint8_t *bitmap)
+{
+	batch_byte(LCD_SET_CGRAM | ((location & 0x07) << 3), 0);
+	for (uint8_t i = 0; i < 8; i++)
+		batch_byte(bitmap[i], LCD_PIN_RS);
+}
+
+/**
+ * hal_lcd_set_cursor - moves the LCD's cursor
+ *
+ * @col: column
+ * @row: row
+ *
+ * Return: Nothing
+*/
+void hal_lcd_set_cursor(uint8_t col, uint8_t row)
+{
+	batch_byte(LCD_SET_DDRAM | (col + (row ? LCD_ROW_OFFSET : 0)), 0);
+}
+
+/**
+ * hal_lcd_write - writes a character at the LCD's cursor, which then
+ *  moves one column right
+ *
+ * @c: character or custom character slot
+ *
+ * Return: Nothing
+*/
+void hal_lcd_write(uint8_t c)
+{
+	batch_byte(c, LCD_PIN_RS);
+}
+
+/**
+ * hal_lcd_commit - sends the queued commands and characters to the LCD
+ *
+ * Return: Nothing
+ *
+ * Note: the caller holds the bus from the first queued transfer to this
+*/
+void hal_lcd_commit()
+{
+	batch_send();
+}
+
+#ifdef LCD_BENCHMARK
+#include <LiquidCrystal_I2C.h>
+
+/**
+ * hal_lcd_benchmark - logs what a full-screen refresh costs through
+ *  LiquidCrystal_I2C and through the batched driver
+ *
+ * Return: Nothing
+ *
+ * Note: clears the LCD, hal_bus_init() should be called prior to this
+*/
+void hal_lcd_benchmark()
+{
+	static LiquidCrystal_I2C library(LCD_I2C_ADDRESS, LCD_COLUMNS, LCD_ROWS);
+	uint32_t library_us, batched_us;
+	int64_t start;
+
+	hal_bus_acquire(HAL_BUS_LCD);
+
+	library.init();
+	library.backlight();
+
+	start = esp_timer_get_time();
+	for (uint8_t i = 0; i < LCD_BENCHMARK_REFRESHES; i++)
+	{
+		for (uint8_t row = 0; row < LCD_ROWS; row++)
+		{
+			library.setCursor(0, row);
+			for (uint8_t col = 0; col < LCD_COLUMNS; col++)
+				library.write('0' + (i + col) % 10);
+		}
+	}
+	library_us = (esp_timer_get_time() - start) / LCD_BENCHMARK_REFRESHES;
+
+	hal_lcd_init();
+
+	/* a row per commit, as display updates go */
+	start = esp_timer_get_time();
+	for (uint8_t i = 0; i < LCD_BENCHMARK_REFRESHES; i++)
+	{
+		for (uint8_t row = 0; row < LCD_ROWS; row++)
+		{
+			hal_lcd_set_cursor(0, row);
+			for (uint8_t col = 0; col < LCD_COLUMNS; col++)
+				hal_lcd_write('0' + (i + col) % 10);
+			hal_lcd_commit();
+		}
+	}
+	batched_us = (esp_timer_get_time() - start) / LCD_BENCHMARK_REFRESHES;
+
+	hal_lcd_init();
+
+	hal_bus_release();
+
+	Serial.print("LCD full-screen refresh: LiquidCrystal_I2C ");
+	Serial.print(library_us);
+	Serial.print(" us, batched ");
+	Serial.print(batched_us);
+	Serial.println(" us");
+}
+#endif
@@ -0,0 +1,223 @@
+#include <Arduino.h>
+#include "hal.h"
+#include "boot.h"
+
+/*
+ *	MQTT library helps with setting up the MQTT client
+ *	and asynchronous connection handling
+ */
+#include <AsyncMqttClient.h>
+
+
+/* asynchronous MQTT Client instance, its constructor timed */
+static boot_mark_t mqtt_ctor_start(BOOT_PHASE_CORE);
+static AsyncMqttClient mqtt_client;
+static boot_mark_t mqtt_ctor_end(BOOT_PHASE_CTOR_MQTT);
+
+/* firmware's MQTT event handlers */
+static hal_mqtt_callbacks_t callbacks;
+
+/**
+ * on_connect - forwards the client's connect event
+ *
+ * @session_present: whether the broker kept a session for the client
+ *
+ * Return: Nothing
+*/
+static void on_connect(bool session_present)
+{
+	callbacks.on_connect(session_present);
+}
+
+/**
+ * on_disconnect - forwards the client's disconnect event
+ *
+ * @reason: reason for the disconnection
+ *
+ * Return: Nothing
+*/
+static void on_disconnect(AsyncMqttClientDisconnectReason reason)
+{
+	callbacks.on_disconnect((int)reason);
+}
+
+/**
+ * on_message - forwards the client's message event
+ *
+ * @topic: MQTT topic on which message was posted
+ * @payload: message contents, or a fragment of them
+ * @properties: MQTT message properties (unused)
+ * @len: length of this payload fragment
+ * @index: offset of this fragment in the whole payload
+ * @total: total length of the payload
+ *
+ * Return: Nothing
+*/
+static void on_message(char *topic, char *payload,
+		AsyncMqttClientMessageProperties properties,
+		size_t len, size_t index, size_t total)
+{
+	callbacks.on_message(topic, payload, len, index, total);
+}
+
+/**
+ * hal_mqtt_init - registers the firmware's MQTT event handlers
+ *
+ * @handlers: event handlers, all must be set
+ *
+ * Return: Nothing
+*/
+void hal_mqtt_init(const hal_mqtt_callbacks_t *handlers)
+{
+	callbacks = *handlers;
+
+	mqtt_client.onConnect(on_connect);
+	mqtt_client.onDisconnect(on_disconnect);
+	mqtt_client.onSubscribe(callbacks.on_subscribe);
+	mqtt_client.onUnsubscribe(callbacks.on_unsubscribe);
+	mqtt_client.onMessage(on_message);
+	mqtt_client.onPublish(callbacks.on_publish);
+}
+
+/**
+ * hal_mqtt_set_client_id - sets the client ID used when connecting
+ *
+ * @client_id: client ID, must stay valid while the client is in use
+ *
+ * Return: Nothing
+*/
+void hal_mqtt_set_client_id(const char *client_id)
+{
+	mqtt_client.setClientId(client_id);
+}
+
+/**
+ * hal_mqtt_set_keep_alive - sets the keep-alive (heartbeat) interval
+ *
+ * @seconds: keep-alive interval [s]
+ *
+ * Return: Nothing
+*/
+void hal_mqtt_set_keep_alive(uint16_t seconds)
+{
+	mqtt_client.setKeepAlive(seconds);
+}
+
+/**
+ * hal_mqtt_set_clean_session - chooses between a fresh session on every
+ *  connection and one the broker keeps while the client is away
+ *
+ * @clean: true for a fresh session, false to keep it
+ *
+ * Return: Nothing
+*/
+void hal_mqtt_set_clean_session(bool clean)
+{
+	mqtt_client.setCleanSession(clean);
+}
+
+/**
+ * hal_mqtt_set_will - sets the last will and testament message
+ *
+ * @topic: LWT topic
+ * @qos: LWT QoS
+ * @retain: LWT retain flag
+ * @payload: LWT payload, must stay valid while the client is in use
+ *
+ * Return: Nothing
+*/
+void hal_mqtt_set_will(
+		const char *topic, uint8_t qos, bool retain, const char *payload)
+{
+	mqtt_client.setWill(topic, qos, retain, payload);
+}
+
+/**
+ * hal_mqtt_set_credentials - sets the broker credentials
+ *
+ * @username: broker username, must stay valid while the client is in use
+ * @password: broker password, must stay valid while the client is in use
+ *
+ * Return: Nothing
+*/
+void hal_mqtt_set_credentials(const char *username, const char *password)
+{
+	mqtt_client.setCredentials(username, password);
+}
+
+/**
+ * hal_mqtt_set_server_host - sets the broker by domain name
+ *
+ * @host: broker domain name, must stay valid while the client is in use
+ * @port: broker port
+ *
+ * Return: Nothing
+*/
+void hal_mqtt_set_server_host(const char *host, uint16_t port)
+{
+	mqtt_client.setServer(host, port);
+}
+
+/**
+ * hal_mqtt_set_server_ip - sets the broker by IP address
+ *
+ * @ip: broker IPv4 address, as stored in an IPAddress
+ * @port: broker port
+ *
+ * Return: Nothing
+*/
+void hal_mqtt_set_server_ip(uint32_t ip, uint16_t port)
+{
+	mqtt_client.setServer(IPAddress(ip), port);
+}
+
+/**
+ * hal_mqtt_connect - starts connecting to the broker, completion is
+ *  reported through on_connect/on_disconnect
+ *
+ * Return: Nothing
+*/
+void hal_mqtt_connect()
+{
+	mqtt_client.connect();
+}
+
+/**
+ * hal_mqtt_connected - checks if the client is connected to the broker
+ *
+ * Return: true if connected, false otherwise
+*/
+bool hal_mqtt_connected()
+{
+	return (mqtt_client.connected());
+}
+
+/**
+ * hal_mqtt_publish - queues a message for publishing
+ *
+ * @topic: topic to publish on
+ * @qos: QoS of the publish
+ * @retain: retain flag
+ * @payload: message contents
+ * @len: length of the message contents
+ *
+ * Return: packet ID (1 for QoS 0), 0 if the message could not be queued
+*/
+uint16_t hal_mqtt_publish(const char *topic, uint8_t qos, bool retain,
+		const char *payload, size_t len)
+{
+	return (mqtt_client.publish(topic, qos, retain, payload, len));
+}
+
+/**
+ * hal_mqtt_subscribe - subscribes to a topic
+ *
+ * @topic: topic to subscribe to
+ * @qos: maximum QoS requested
+ *
+ * Return: packet ID, 0 if the request could not be queued
+*/
+uint16_t hal_mqtt_subscribe(const char *topic, uint8_t qos)
+{
+	return (mqtt_client.subscribe(topic, qos));
+}
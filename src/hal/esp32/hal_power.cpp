@@ -0,0 +1,84 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include "main.h"
+#include "hal.h"
+
+
+/* CPU frequency while idle in the low-power mode [MHz], the least WiFi runs at */
+#define POWER_MIN_CPU_FREQ      80
+
+/**
+ * configure_wake_pin - has a pin wake the chip from light sleep while low,
+ *  or restores its falling-edge interrupt
+ *
+ * @pin: GPIO, its interrupt handler must mask it until serviced as waking
+ *  turns it into a level interrupt
+ * @wake: true to wake on it, false to stop
+ *
+ * Return: Nothing
+*/
+static void configure_wake_pin(uint8_t pin, bool wake)
+{
+	if (wake)
+		gpio_wakeup_enable((gpio_num_t)pin, GPIO_INTR_LOW_LEVEL);
+	else
+	{
+		gpio_wakeup_disable((gpio_num_t)pin);
+		gpio_set_intr_type((gpio_num_t)pin, GPIO_INTR_NEGEDGE);
+	}
+}
+
+/**
+ * hal_power_configure - switches automatic light sleep and WiFi modem
+ *  sleep on or off
+ *
+ * @low_power: true for light sleep whenever every task is idle and the
+ *  deepest modem sleep that keeps the association, false for full speed
+ * @reader_wake: true if cards are detected through the reader's IRQ line,
+ *  which then wakes the chip; false leaves the line out, it may float or
+ *  be stuck low when not wired or not signalling
+ *
+ * Return: HAL_POWER_LIGHT_SLEEP, HAL_POWER_SCALING if the framework was
+ *  built without tickless idle, HAL_POWER_FULL_SPEED if it is off or the
+ *  framework was built without power management
+*/
+uint8_t hal_power_configure(bool low_power, bool reader_wake)
+{
+	/* full speed, as set up at boot: the first call runs before any scaling */
+	static uint32_t max_freq = ESP.getCpuFreqMHz();
+	esp_pm_config_esp32_t config;
+	esp_err_t err;
+
+	/* the WiFi stays associated, waking for the AP's beacons only */
+	WiFi.setSleep(low_power ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
+
+	/* without an ISR on it, the reader's line must neither wake nor interrupt */
+	if (reader_wake)
+		configure_wake_pin(MFRC_IRQ_PIN, low_power);
+	else
+		gpio_wakeup_disable((gpio_num_t)MFRC_IRQ_PIN);
+	configure_wake_pin(WIFI_CONFIG_PIN, low_power);
+	if (low_power)
+		esp_sleep_enable_gpio_wakeup();
+
+	/* timers (Tickers, task periods) wake it through tickless idle */
+	config.max_freq_mhz = max_freq;
+	config.min_freq_mhz = low_power ? POWER_MIN_CPU_FREQ : config.max_freq_mhz;
+	config.light_sleep_enable = low_power;
+
+	err = esp_pm_configure(&config);
+	if (!low_power)
+		return (HAL_POWER_FULL_SPEED);
+	if (err == ESP_OK)
+		return (HAL_POWER_LIGHT_SLEEP);
+
+	/* no tickless idle: frequency scaling only, if there is power management */
+	config.light_sleep_enable = false;
+	if (esp_pm_configure(&config) == ESP_OK)
+		return (HAL_POWER_SCALING);
+
+	return (HAL_POWER_FULL_SPEED);
+}
@@ -0,0 +1,200 @@
+#include <Arduino.h>
+#include <driver/gpio.h>
+#include <hal/gpio_ll.h>
+#include "main.h"
+#include "hal.h"
+#include "scan.h"
+
+/*
+*	library to interact with RFID card reader, includes SPI.h
+*/
+#include <MFRC522.h>
+
+
+/*
+ * MFRC522 interrupt set-up
+ *   ComIEnReg: IRqInv (IRQ line active low) | RxIEn (card answered)
+ *   DivIEnReg: IRQPushPull (IRQ line driven both ways)
+ *   BitFramingReg: StartSend | 7 bits in the last byte, for a short frame
+*/
+#define MFRC_COM_IRQ_ENABLE     0xA0
+#define MFRC_DIV_IRQ_ENABLE     0x80
+#define MFRC_COM_IRQ_CLEAR      0x7F
+#define MFRC_COM_IRQ_RX         0x20	/* ComIrqReg: RxIRq, a card answered */
+#define MFRC_FIFO_FLUSH         0x80
+#define MFRC_REQA_FRAMING       0x87
+
+/* active MFRC instance */
+static MFRC522 reader(MFRC_SS_PIN, MFRC_RST_PIN);
+
+/* commands issued to the reader and time spent on them, see hal_rfid_counters */
+static uint32_t reader_commands = 0;
+static uint32_t reader_bus_us = 0;
+
+/* handler run when a card answers, see hal_rfid_irq_attach */
+static void (*irq_handler)(void) = NULL;
+
+/**
+ * hal_rfid_init - sets up the RFID MFRC module on the SPI bus
+ *
+ * Return: Nothing
+ *
+ * Note: SPI.begin() should be called prior to this
+*/
+void hal_rfid_init()
+{
+	reader.PCD_Init();
+}
+
+/**
+ * hal_rfid_card_present - checks if a 'new' card is in the reader's field
+ *
+ * Return: true if a card answered, false otherwise
+*/
+bool hal_rfid_card_present()
+{
+	uint32_t start = micros();
+	bool present = reader.PICC_IsNewCardPresent();
+
+	reader_commands++;
+	reader_bus_us += micros() - start;
+
+	return (present);
+}
+
+/**
+ * hal_rfid_read_uid - selects the card in the field and reads its UID
+ *
+ * @uid: buffer of RFID_UID_MAX_LEN bytes for the UID
+ * @uid_size: where to store the UID's length in bytes
+ *
+ * Return: true if the UID was read, false otherwise
+*/
+bool hal_rfid_read_uid(uint8_t *uid, uint8_t *uid_size)
+{
+	uint32_t start = micros();
+	bool read = reader.PICC_ReadCardSerial();
+
+	reader_commands++;
+	reader_bus_us += micros() - start;
+
+	if (!read)
+		return false;
+
+	*uid_size = min(reader.uid.size, (byte)RFID_UID_MAX_LEN);
+	memcpy(uid, reader.uid.uidByte, *uid_size);
+
+	return true;
+}
+
+/**
+ * hal_rfid_halt - puts the read card to sleep until it leaves the field
+ *
+ * Return: Nothing
+*/
+void hal_rfid_halt()
+{
+	reader.PICC_HaltA();
+	reader.PCD_StopCrypto1();
+}
+
+/**
+ * irq_isr - interrupt handler of the IRQ line: masks it until the next
+ *  hal_rfid_irq_clear(), as the low-power mode turns it into a level
+ *  interrupt to wake from light sleep, then runs the attached handler
+ *
+ * Return: Nothing
+*/
+static void IRAM_ATTR irq_isr()
+{
+	gpio_ll_intr_disable(&GPIO, (gpio_num_t)MFRC_IRQ_PIN);
+	irq_handler();
+}
+
+/**
+ * hal_rfid_irq_attach - has the reader signal answered REQAs on its IRQ line
+ *
+ * @handler: interrupt handler, run when a card answers
+ *
+ * Return: true if the IRQ line is set up, false if MFRC_IRQ_PIN cannot
+ *  interrupt
+*/
+bool hal_rfid_irq_attach(void (*handler)(void))
+{
+	if (digitalPinToInterrupt(MFRC_IRQ_PIN) < 0)
+		return false;
+
+	pinMode(MFRC_IRQ_PIN, INPUT_PULLUP);
+
+	reader.PCD_WriteRegister(MFRC522::ComIEnReg, MFRC_COM_IRQ_ENABLE);
+	reader.PCD_WriteRegister(MFRC522::DivIEnReg, MFRC_DIV_IRQ_ENABLE);
+	hal_rfid_irq_clear();
+
+	irq_handler = handler;
+	attachInterrupt(digitalPinToInterrupt(MFRC_IRQ_PIN), irq_isr, FALLING);
+
+	return true;
+}
+
+/**
+ * hal_rfid_irq_arm - sends a REQA, a card answering it pulls the IRQ line
+ *
+ * Return: Nothing
+*/
+void hal_rfid_irq_arm()
+{
+	uint32_t start = micros();
+
+	reader.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+	reader.PCD_WriteRegister(MFRC522::ComIrqReg, MFRC_COM_IRQ_CLEAR);
+	reader.PCD_WriteRegister(MFRC522::FIFOLevelReg, MFRC_FIFO_FLUSH);
+	reader.PCD_WriteRegister(MFRC522::FIFODataReg, MFRC522::PICC_CMD_REQA);
+	reader.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Transceive);
+	reader.PCD_WriteRegister(MFRC522::BitFramingReg, MFRC_REQA_FRAMING);
+
+	reader_commands++;
+	reader_bus_us += micros() - start;
+}
+
+/**
+ * hal_rfid_irq_clear - releases the IRQ line and unmasks its interrupt
+ *
+ * Return: Nothing
+*/
+void hal_rfid_irq_clear()
+{
+	reader.PCD_WriteRegister(MFRC522::ComIrqReg, MFRC_COM_IRQ_CLEAR);
+	gpio_intr_enable((gpio_num_t)MFRC_IRQ_PIN);
+}
+
+/**
+ * hal_rfid_irq_answered - checks the reader's interrupt flags for an
+ *  answer to the last REQA, whether or not the IRQ line signalled it
+ *
+ * Return: true if a card answered, false otherwise
+*/
+bool hal_rfid_irq_answered()
+{
+	uint32_t start = micros();
+	bool answered = reader.PCD_ReadRegister(MFRC522::ComIrqReg) &
+		MFRC_COM_IRQ_RX;
+
+	reader_commands++;
+	reader_bus_us += micros() - start;
+
+	return (answered);
+}
+
+/**
+ * hal_rfid_counters - gets the reader's cumulative usage counters
+ *
+ * @commands: where to store the number of commands issued to the reader
+ * @bus_us: where to store the time spent on them over SPI [us]
+ *
+ * Return: Nothing
+*/
+void hal_rfid_counters(uint32_t *commands, uint32_t *bus_us)
+{
+	*commands = reader_commands;
+	*bus_us = reader_bus_us;
+}
@@ -0,0 +1,97 @@
+#include <Arduino.h>
+#include "main.h"
+#include "hal.h"
+
+/*
+ *	library to interact with the DS3231 real-time clock, includes Wire.h
+*/
+#include <RTClib.h>
+
+
+/* active RTC instance */
+static RTC_DS3231 my_RTC;
+
+/**
+ * hal_rtc_init - sets up the RTC on the I2C bus
+ *
+ * Return: Nothing
+ *
+ * Note: hal_bus_init() should be called prior to this
+*/
+void hal_rtc_init()
+{
+	hal_bus_acquire(HAL_BUS_RTC);
+	my_RTC.begin();
+	hal_bus_release();
+}
+
+/**
+ * hal_rtc_lost_power - checks if the RTC stopped while unpowered
+ *
+ * Return: true if the RTC's time is invalid, false otherwise
+*/
+bool hal_rtc_lost_power()
+{
+	bool lost;
+
+	hal_bus_acquire(HAL_BUS_RTC);
+	lost = my_RTC.lostPower();
+	hal_bus_release();
+
+	return (lost);
+}
+
+/**
+ * hal_rtc_now - reads the current time from the RTC
+ *
+ * Return: current epoch time
+*/
+uint32_t hal_rtc_now()
+{
+	uint32_t epoch;
+
+	hal_bus_acquire(HAL_BUS_RTC);
+	epoch = my_RTC.now().unixtime();
+	hal_bus_release();
+
+	return (epoch);
+}
+
+/**
+ * hal_rtc_adjust - sets the RTC's time
+ *
+ * @epoch: epoch time to set
+ *
+ * Return: Nothing
+*/
+void hal_rtc_adjust(uint32_t epoch)
+{
+	hal_bus_acquire(HAL_BUS_RTC);
+	my_RTC.adjust(DateTime(epoch));
+	hal_bus_release();
+}
+
+/**
+ * hal_rtc_sqw_attach - has the RTC output its 1 Hz square wave and runs a
+ *  handler as each second starts
+ *
+ * @handler: interrupt handler, run on the square wave's falling edge
+ *
+ * Return: true if the square wave is set up, false if RTC_SQW_PIN cannot
+ *  interrupt
+*/
+bool hal_rtc_sqw_attach(void (*handler)(void))
+{
+	if (digitalPinToInterrupt(RTC_SQW_PIN) < 0)
+		return false;
+
+	/* INT/SQW is open-drain */
+	pinMode(RTC_SQW_PIN, INPUT_PULLUP);
+	hal_bus_acquire(HAL_BUS_RTC);
+	my_RTC.writeSqwPinMode(DS3231_SquareWave1Hz);
+	hal_bus_release();
+
+	attachInterrupt(digitalPinToInterrupt(RTC_SQW_PIN), handler, FALLING);
+
+	return true;
+}
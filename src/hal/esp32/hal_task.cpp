@@ -0,0 +1,142 @@
+#include <Arduino.h>
+#include "hal.h"
+#include "tasks.h"
+
+
+/* FreeRTOS handles of the firmware's tasks, indexed by enum task_id_e */
+static TaskHandle_t task_handles[TASK_COUNT];
+
+/**
+ * struct task_params_s - what a task runs and how often
+ *
+ * @step: one run of the task's work
+ * @period: longest sleep between two runs [ticks]
+ * @runs: runs since startup
+ * @busy_us: time spent running since startup [us]
+*/
+typedef struct task_params_s
+{
+	void (*step)(void);
+	volatile TickType_t period;
+	volatile uint32_t runs;
+	volatile uint32_t busy_us;
+} task_params_t;
+
+static task_params_t task_params[TASK_COUNT];
+
+/**
+ * task_main - FreeRTOS task body: runs the task's step, then sleeps until
+ *  notified or its period elapses
+ *
+ * @arg: the task's task_params_t
+ *
+ * Return: Nothing, never returns
+*/
+static void task_main(void *arg)
+{
+	task_params_t *params = (task_params_t *)arg;
+	uint32_t start;
+
+	for (;;)
+	{
+		start = micros();
+		params->step();
+		params->busy_us += micros() - start;
+		params->runs++;
+		ulTaskNotifyTake(pdTRUE, params->period);
+	}
+}
+
+/**
+ * hal_task_start - creates a task pinned to a core
+ *
+ * @id: one of enum task_id_e
+ * @name: task name, for debugging
+ * @step: one run of the task's work
+ * @period: longest time between two runs [ms]
+ * @core: core to pin the task to
+ * @priority: FreeRTOS priority
+ * @stack: stack size [bytes]
+ *
+ * Return: Nothing
+*/
+void hal_task_start(uint8_t id, const char *name, void (*step)(void),
+		uint32_t period, uint8_t core, uint8_t priority, uint32_t stack)
+{
+	task_params[id].step = step;
+	task_params[id].period = pdMS_TO_TICKS(period) ? pdMS_TO_TICKS(period) : 1;
+
+	xTaskCreatePinnedToCore(task_main, name, stack, &task_params[id],
+		priority, &task_handles[id], core);
+}
+
+/**
+ * hal_task_notify - wakes a task before its period elapses
+ *
+ * @id: one of enum task_id_e
+ *
+ * Return: Nothing
+*/
+void hal_task_notify(uint8_t id)
+{
+	if (task_handles[id])
+		xTaskNotifyGive(task_handles[id]);
+}
+
+/**
+ * hal_task_notify_from_isr - wakes a task from an interrupt handler
+ *
+ * @id: one of enum task_id_e
+ *
+ * Return: Nothing
+*/
+void IRAM_ATTR hal_task_notify_from_isr(uint8_t id)
+{
+	BaseType_t woken = pdFALSE;
+
+	if (task_handles[id])
+		vTaskNotifyGiveFromISR(task_handles[id], &woken);
+
+	if (woken)
+		portYIELD_FROM_ISR();
+}
+
+/**
+ * hal_task_set_period - changes the longest sleep between two runs of a
+ *  task, from its next sleep on
+ *
+ * @id: one of enum task_id_e
+ * @period: longest time between two runs [ms]
+ *
+ * Return: Nothing
+*/
+void hal_task_set_period(uint8_t id, uint32_t period)
+{
+	task_params[id].period = pdMS_TO_TICKS(period) ? pdMS_TO_TICKS(period) : 1;
+}
+
+/**
+ * hal_task_stats - retrieves how often a task ran and for how long
+ *
+ * @id: one of enum task_id_e
+ * @runs: where to store the number of runs since startup
+ * @busy_us: where to store the time spent running since startup [us]
+ *
+ * Return: Nothing
+*/
+void hal_task_stats(uint8_t id, uint32_t *runs, uint32_t *busy_us)
+{
+	*runs = task_params[id].runs;
+	*busy_us = task_params[id].busy_us;
+}
+
+/**
+ * hal_loop_idle - retires the Arduino loop task, the firmware's own
+ *  tasks do all the work
+ *
+ * Return: Nothing
+*/
+void hal_loop_idle()
+{
+	vTaskDelete(NULL);
+}
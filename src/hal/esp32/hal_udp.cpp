@@ -0,0 +1,160 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <AsyncUDP.h>
+#include <esp_timer.h>
+#include <lwip/dns.h>
+#include <atomic>
+#include "hal.h"
+
+
+/* largest datagram kept, longer ones are dropped */
+#define UDP_PACKET_MAX_LEN      64
+
+/* UDP socket, received datagrams are handled in the async_udp task */
+static AsyncUDP udp;
+
+/* firmware's handler, run when a datagram arrives */
+static void (*receive_handler)(void) = NULL;
+
+/* last received datagram and its arrival time, kept until received */
+static uint8_t rx_packet[UDP_PACKET_MAX_LEN];
+static size_t rx_len = 0;
+static uint64_t rx_at = 0;
+/* set once rx_packet holds a datagram, cleared once it is received */
+static std::atomic<bool> rx_full(false);
+
+/*
+ * DNS lookup: HAL_DNS_PENDING while it runs, its outcome until collected,
+ * DNS_IDLE otherwise; dns_ip is the address it resolved to
+*/
+#define DNS_IDLE                0xFF
+static std::atomic<uint8_t> dns_state(DNS_IDLE);
+static uint32_t dns_ip = 0;
+
+/**
+ * on_packet - stores an arriving datagram with its arrival time, unless
+ *  the last one was not received yet
+ *
+ * @packet: arrived datagram
+ *
+ * Return: Nothing
+*/
+static void on_packet(AsyncUDPPacket &packet)
+{
+	uint64_t now = esp_timer_get_time();
+
+	if (rx_full.load(std::memory_order_acquire) ||
+			packet.length() > UDP_PACKET_MAX_LEN)
+		return;
+
+	memcpy(rx_packet, packet.data(), packet.length());
+	rx_len = packet.length();
+	rx_at = now;
+	rx_full.store(true, std::memory_order_release);
+
+	if (receive_handler)
+		receive_handler();
+}
+
+/**
+ * hal_udp_begin - opens the UDP socket
+ *
+ * @port: local port to listen on
+ * @handler: run when a datagram arrives, from another task
+ *
+ * Return: true on success, false otherwise
+*/
+bool hal_udp_begin(uint16_t port, void (*handler)(void))
+{
+	receive_handler = handler;
+
+	if (!udp.listen(port))
+		return false;
+
+	udp.onPacket(on_packet);
+	return true;
+}
+
+/**
+ * hal_udp_send - sends a datagram
+ *
+ * @ip: IPv4 address to send to
+ * @port: port to send to
+ * @data: datagram
+ * @len: length of the datagram
+ *
+ * Return: true if sent, false otherwise
+*/
+bool hal_udp_send(uint32_t ip, uint16_t port, const uint8_t *data,
+		size_t len)
+{
+	return (udp.writeTo(data, len, IPAddress(ip), port) == len);
+}
+
+/**
+ * on_dns_found - stores the outcome of a lookup, run in the lwIP task
+ *
+ * @name: host looked up
+ * @addr: its address, NULL if it could not be resolved
+ * @arg: unused
+ *
+ * Return: Nothing
+*/
+static void on_dns_found(const char *name, const ip_addr_t *addr, void *arg)
+{
+	if (addr)
+		dns_ip = ip4_addr_get_u32(ip_2_ip4(addr));
+
+	dns_state.store(addr ? HAL_DNS_RESOLVED : HAL_DNS_FAILED,
+		std::memory_order_release);
+}
+
+/**
+ * hal_dns_lookup - resolves a host without blocking: starts a lookup, or
+ *  polls the one in progress
+ *
+ * @host: IP address or domain name
+ * @ip: where to store its IPv4 address, once resolved
+ *
+ * Return: HAL_DNS_RESOLVED, HAL_DNS_PENDING or HAL_DNS_FAILED
+*/
+uint8_t hal_dns_lookup(const char *host, uint32_t *ip)
+{
+	IPAddress literal;
+	ip_addr_t addr;
+	uint8_t state;
+	err_t err;
+
+	if (literal.fromString(host))
+	{
+		*ip = (uint32_t)literal;
+		return (HAL_DNS_RESOLVED);
+	}
+
+	state = dns_state.load(std::memory_order_acquire);
+	if (state == HAL_DNS_PENDING)
+		return (HAL_DNS_PENDING);
+
+	/* the lookup started by an earlier call completed */
+	if (state != DNS_IDLE)
+	{
+		dns_state.store(DNS_IDLE, std::memory_order_relaxed);
+		if (state == HAL_DNS_RESOLVED)
+			*ip = dns_ip;
+		return (state);
+	}
+
+	dns_state.store(HAL_DNS_PENDING, std::memory_order_release);
+
+	/* answered from lwIP's cache, or started in the background */
+	err = dns_gethostbyname(host, &addr, on_dns_found, NULL);
+	if (err == ERR_INPROGRESS)
+		return (HAL_DNS_PENDING);
+
+	dns_state.store(DNS_IDLE, std::memory_order_relaxed);
+	if (err != ERR_OK)
+		return (HAL_DNS_FAILED);
+
+	*ip = ip4_addr_get_u32(ip_2_ip4(&addr));
+	return (HAL_DNS_RESOLVED);
+}
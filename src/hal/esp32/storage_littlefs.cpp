@@ -0,0 +1,141 @@
+#include <Arduino.h>
+#include "storage.h"
+#include "hal.h"
+
+/*
+ *	flash filesystem, wear-levels the writes to the underlying flash
+ *	partition
+ */
+#include <LittleFS.h>
+
+
+/* chunk size used when pre-allocating a new storage file */
+#define STORAGE_FILL_CHUNK      64
+
+/* number of storage files that can be open at once */
+#define STORAGE_MAX_FILES       4
+
+/* open storage files, indexed by the storage's context */
+static File storage_files[STORAGE_MAX_FILES];
+static uint8_t storage_files_used = 0;
+
+/* LittleFS only needs to be mounted once */
+static bool littlefs_mounted = false;
+
+/**
+ * littlefs_read - reads bytes from a LittleFS-backed storage
+ *
+ * @ctx: pointer to the storage's open file
+ * @offset: offset into the file to read from
+ * @data: buffer to read into
+ * @len: number of bytes to read
+ *
+ * Return: true if all bytes were read, false otherwise
+*/
+static bool littlefs_read(void *ctx, uint32_t offset, void *data, size_t len)
+{
+	File *file = (File *)ctx;
+
+	if (!file->seek(offset))
+		return false;
+
+	return (file->read((uint8_t *)data, len) == len);
+}
+
+/**
+ * littlefs_write - writes bytes to a LittleFS-backed storage
+ *
+ * @ctx: pointer to the storage's open file
+ * @offset: offset into the file to write to
+ * @data: bytes to write
+ * @len: number of bytes to write
+ *
+ * Return: true if all bytes were written and flushed, false otherwise
+*/
+static bool littlefs_write(
+		void *ctx, uint32_t offset, const void *data, size_t len)
+{
+	File *file = (File *)ctx;
+
+	if (!file->seek(offset))
+		return false;
+
+	if (file->write((const uint8_t *)data, len) != len)
+		return false;
+
+	file->flush();
+	return true;
+}
+
+/**
+ * storage_littlefs_open - opens (creating and pre-allocating if needed)
+ *  a fixed-size file on LittleFS as a storage backend
+ *
+ * @storage: storage to set up
+ * @path: path of the backing file
+ * @size: size of the storage in bytes
+ *
+ * Return: true on success, false if the filesystem or file is unusable
+*/
+bool storage_littlefs_open(storage_t *storage, const char *path, uint32_t size)
+{
+	if (storage_files_used >= STORAGE_MAX_FILES)
+		return false;
+
+	/* format the partition on first use */
+	if (!littlefs_mounted && !LittleFS.begin(true))
+	{
+		Serial.println("LittleFS mount failed");
+		return false;
+	}
+	littlefs_mounted = true;
+
+	File *file = &storage_files[storage_files_used];
+
+	*file = LittleFS.open(path, "r+");
+
+	/* new or truncated file: fill with erased-flash bytes */
+	if (!*file || file->size() < size)
+	{
+		uint8_t erased[STORAGE_FILL_CHUNK];
+
+		if (*file)
+			file->close();
+
+		memset(erased, 0xFF, sizeof(erased));
+		*file = LittleFS.open(path, "w");
+		if (!*file)
+			return false;
+
+		for (uint32_t i = 0; i < size; i += sizeof(erased))
+			file->write(erased, min((uint32_t)sizeof(erased), size - i));
+
+		file->close();
+		*file = LittleFS.open(path, "r+");
+		if (!*file)
+			return false;
+	}
+
+	storage->read = littlefs_read;
+	storage->write = littlefs_write;
+	storage->size = size;
+	storage->ctx = file;
+	storage_files_used++;
+
+	return true;
+}
+
+/**
+ * hal_storage_open - opens a fixed-size persistent storage, backed by a
+ *  LittleFS file on the ESP32
+ *
+ * @storage: storage to set up
+ * @path: path of the backing file
+ * @size: size of the storage in bytes
+ *
+ * Return: true on success, false otherwise
+*/
+bool hal_storage_open(storage_t *storage, const char *path, uint32_t size)
+{
+	return (storage_littlefs_open(storage, path, size));
+}
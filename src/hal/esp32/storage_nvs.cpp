@@ -0,0 +1,159 @@
+#include <Arduino.h>
+#include "storage.h"
+#include "hal.h"
+
+/*
+ *	key-value store in the NVS flash partition, for small settings that
+ *	are rarely written
+ */
+#include <Preferences.h>
+
+
+/* NVS namespace of the firmware's settings */
+#define STORAGE_NVS_NAMESPACE   "sentry"
+
+/* largest blob an NVS-backed storage holds */
+#define STORAGE_NVS_MAX_SIZE    256
+
+/* number of NVS-backed storages that can be open at once */
+#define STORAGE_NVS_MAX_KEYS    2
+
+/**
+ * struct nvs_blob_s - an NVS-backed storage, one blob under a key
+ *
+ * @key: blob's key, at most 15 characters
+ * @data: copy of the blob, NVS blobs are written whole
+ * @size: size of the blob
+*/
+typedef struct nvs_blob_s
+{
+	const char *key;
+	uint8_t data[STORAGE_NVS_MAX_SIZE];
+	uint32_t size;
+} nvs_blob_t;
+
+static Preferences preferences;
+
+/* open NVS-backed storages, indexed by the storage's context */
+static nvs_blob_t nvs_blobs[STORAGE_NVS_MAX_KEYS];
+static uint8_t nvs_blobs_used = 0;
+
+/* the namespace only needs to be opened once */
+static bool nvs_opened = false;
+
+/**
+ * nvs_read - reads bytes from an NVS-backed storage
+ *
+ * @ctx: pointer to the storage's blob
+ * @offset: offset into the blob to read from
+ * @data: buffer to read into
+ * @len: number of bytes to read
+ *
+ * Return: true if all bytes were read, false otherwise
+*/
+static bool nvs_read(void *ctx, uint32_t offset, void *data, size_t len)
+{
+	nvs_blob_t *blob = (nvs_blob_t *)ctx;
+
+	if (offset + len > blob->size)
+		return false;
+
+	memcpy(data, blob->data + offset, len);
+	return true;
+}
+
+/**
+ * nvs_write - writes bytes to an NVS-backed storage, rewriting its blob
+ *
+ * @ctx: pointer to the storage's blob
+ * @offset: offset into the blob to write to
+ * @data: bytes to write
+ * @len: number of bytes to write
+ *
+ * Return: true if the blob was committed, false otherwise
+*/
+static bool nvs_write(
+		void *ctx, uint32_t offset, const void *data, size_t len)
+{
+	nvs_blob_t *blob = (nvs_blob_t *)ctx;
+
+	if (offset + len > blob->size)
+		return false;
+
+	memcpy(blob->data + offset, data, len);
+	return (preferences.putBytes(blob->key, blob->data, blob->size) ==
+		blob->size);
+}
+
+/**
+ * storage_nvs_open - opens (creating if needed) a fixed-size blob in NVS
+ *  as a storage backend
+ *
+ * @storage: storage to set up
+ * @key: key of the blob, at most 15 characters, kept by reference
+ * @size: size of the storage in bytes, at most STORAGE_NVS_MAX_SIZE
+ *
+ * Return: true on success, false if NVS or the blob is unusable
+*/
+bool storage_nvs_open(storage_t *storage, const char *key, uint32_t size)
+{
+	if (nvs_blobs_used >= STORAGE_NVS_MAX_KEYS || size > STORAGE_NVS_MAX_SIZE)
+		return false;
+
+	if (!nvs_opened && !preferences.begin(STORAGE_NVS_NAMESPACE, false))
+	{
+		Serial.println("NVS open failed");
+		return false;
+	}
+	nvs_opened = true;
+
+	nvs_blob_t *blob = &nvs_blobs[nvs_blobs_used];
+	size_t stored = preferences.getBytesLength(key);
+
+	blob->key = key;
+	blob->size = size;
+
+	/*
+	 * keep what a blob of another size holds, its owner's header tells
+	 * which part is valid: cut a longer one, pad a shorter or new one with
+	 * erased-flash bytes
+	*/
+	memset(blob->data, 0xFF, size);
+	if (stored)
+	{
+		uint8_t old[STORAGE_NVS_MAX_SIZE];
+		size_t keep = min(stored, (size_t)size);
+
+		if (stored > sizeof(old) ||
+				preferences.getBytes(key, old, stored) != stored)
+			keep = 0;
+		memcpy(blob->data, old, keep);
+	}
+
+	if (stored != size &&
+			preferences.putBytes(key, blob->data, size) != size)
+		return false;
+
+	storage->read = nvs_read;
+	storage->write = nvs_write;
+	storage->size = size;
+	storage->ctx = blob;
+	nvs_blobs_used++;
+
+	return true;
+}
+
+/**
+ * hal_settings_open - opens a fixed-size persistent storage for small
+ *  settings, backed by an NVS blob on the ESP32
+ *
+ * @storage: storage to set up
+ * @key: key of the settings
+ * @size: size of the storage in bytes
+ *
+ * Return: true on success, false otherwise
+*/
+bool hal_settings_open(storage_t *storage, const char *key, uint32_t size)
+{
+	return (storage_nvs_open(storage, key, size));
+}
@@ -0,0 +1,152 @@
+#include <stdarg.h>
+#include <Arduino.h>
+#include <Ticker.h>
+#include "native.h"
+
+
+/* Serial port stand-in */
+NativeSerial Serial;
+
+/* simulated time since startup [us] */
+static uint64_t native_micros = 0;
+
+/* every constructed Ticker, so the harness can fire them */
+static Ticker *tickers = NULL;
+
+/**
+ * NativeSerial::printf - formatted print to stdout
+ *
+ * @format: printf format string
+ *
+ * Return: number of characters printed
+*/
+int NativeSerial::printf(const char *format, ...)
+{
+	va_list args;
+	int n;
+
+	va_start(args, format);
+	n = vprintf(format, args);
+	va_end(args);
+
+	return (n);
+}
+
+/**
+ * native_advance_us - advances the simulated clock
+ *
+ * @us: time to advance by [us]
+ *
+ * Return: Nothing
+*/
+void native_advance_us(uint32_t us)
+{
+	native_micros += us;
+}
+
+unsigned long millis()
+{
+	return (unsigned long)(native_micros / 1000);
+}
+
+unsigned long micros()
+{
+	return (unsigned long)native_micros;
+}
+
+/* the firmware's blocking delays simply skip simulated time */
+void delay(unsigned long ms)
+{
+	native_advance_us(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	native_advance_us(us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+}
+
+int digitalRead(uint8_t pin)
+{
+	return (HIGH);
+}
+
+void tone(uint8_t pin, unsigned int frequency)
+{
+}
+
+void noTone(uint8_t pin)
+{
+}
+
+long random(long max_value)
+{
+	return (max_value > 0 ? rand() % max_value : 0);
+}
+
+long random(long min_value, long max_value)
+{
+	return (min_value + random(max_value - min_value));
+}
+
+Ticker::Ticker() : callback(0), period(0), due(0), repeat(false)
+{
+	next = tickers;
+	tickers = this;
+}
+
+Ticker::~Ticker()
+{
+	for (Ticker **t = &tickers; *t; t = &(*t)->next)
+	{
+		if (*t == this)
+		{
+			*t = next;
+			break;
+		}
+	}
+}
+
+void Ticker::arm(uint32_t ms, callback_t cb, bool repeating)
+{
+	callback = cb;
+	period = ms ? ms : 1;
+	due = millis() + period;
+	repeat = repeating;
+}
+
+void Ticker::run(unsigned long now)
+{
+	if (!callback || (long)(now - due) < 0)
+		return;
+
+	callback_t cb = callback;
+
+	if (repeat)
+		due += period;
+	else
+		callback = 0;
+
+	cb();
+}
+
+/**
+ * native_ticker_run - fires every Ticker that is due at the current
+ *  simulated time
+ *
+ * Return: Nothing
+*/
+void native_ticker_run()
+{
+	unsigned long now = millis();
+
+	for (Ticker *t = tickers; t; t = t->next)
+		t->run(now);
+}
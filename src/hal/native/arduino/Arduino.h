@@ -0,0 +1,155 @@
+#ifndef __INC_NATIVE_ARDUINO_H
+#define __INC_NATIVE_ARDUINO_H
+
+/*
+ * Minimal stand-in for the Arduino core used by the firmware logic when
+ * it is built for Linux ([env:native]). Time is simulated: millis() only
+ * moves when the native harness or delay() advances it.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <string>
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+
+#define HIGH                    0x1
+#define LOW                     0x0
+#define INPUT                   0x01
+#define OUTPUT                  0x03
+#define INPUT_PULLUP            0x05
+#define FALLING                 0x02
+#define RISING                  0x01
+#define HEX                     16
+#define DEC                     10
+
+#define IRAM_ATTR
+#define F(string_literal)       (string_literal)
+
+/* Simulated time */
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long);
+void delayMicroseconds(unsigned int);
+
+/* GPIO, logged only */
+void pinMode(uint8_t, uint8_t);
+void digitalWrite(uint8_t, uint8_t);
+int digitalRead(uint8_t);
+void tone(uint8_t, unsigned int);
+void noTone(uint8_t);
+
+long random(long);
+long random(long, long);
+
+/**
+ * class String - heap string with the subset of the Arduino String API
+ *  used by the firmware
+*/
+class String
+{
+public:
+	String() {}
+	String(const char *s) : str(s ? s : "") {}
+	String(const std::string &s) : str(s) {}
+
+	const char *c_str() const { return str.c_str(); }
+	unsigned int length() const { return str.length(); }
+
+	String substring(unsigned int from) const
+	{
+		return (from < str.length() ? String(str.substr(from)) : String());
+	}
+	String substring(unsigned int from, unsigned int to) const
+	{
+		return (from < str.length() ? String(str.substr(from, to - from)) : String());
+	}
+
+	bool operator==(const char *s) const { return str == s; }
+	bool operator==(const String &s) const { return str == s.str; }
+
+	String operator+(const String &s) const { return String(str + s.str); }
+	String operator+(const char *s) const { return String(str + s); }
+	friend String operator+(const char *a, const String &b)
+	{
+		return String(std::string(a) + b.str);
+	}
+
+private:
+	std::string str;
+};
+
+/**
+ * class IPAddress - IPv4 address stored the way the ESP32 core stores it,
+ *  first octet in the lowest byte
+*/
+class IPAddress
+{
+public:
+	IPAddress() : addr(0) {}
+	IPAddress(uint32_t a) : addr(a) {}
+	IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+		: addr(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) {}
+
+	bool fromString(const char *s)
+	{
+		unsigned int a, b, c, d;
+
+		if (sscanf(s, "%u.%u.%u.%u", &a, &b, &c, &d) != 4 ||
+				a > 255 || b > 255 || c > 255 || d > 255)
+			return false;
+		*this = IPAddress(a, b, c, d);
+		return true;
+	}
+
+	String toString() const
+	{
+		char buf[16];
+
+		snprintf(buf, sizeof(buf), "%u.%u.%u.%u", addr & 0xFF,
+			(addr >> 8) & 0xFF, (addr >> 16) & 0xFF, addr >> 24);
+		return String(buf);
+	}
+
+	operator uint32_t() const { return addr; }
+
+private:
+	uint32_t addr;
+};
+
+/**
+ * class NativeSerial - Serial port stand-in writing to stdout
+*/
+class NativeSerial
+{
+public:
+	void begin(unsigned long) {}
+
+	void print(const char *s) { fputs(s, stdout); }
+	void print(const String &s) { fputs(s.c_str(), stdout); }
+	void print(char c) { fputc(c, stdout); }
+	void print(int v) { printf("%d", v); }
+	void print(unsigned int v) { printf("%u", v); }
+	void print(long v) { printf("%ld", v); }
+	void print(unsigned long v) { printf("%lu", v); }
+	void print(double v) { printf("%.2f", v); }
+	void print(const IPAddress &ip) { print(ip.toString()); }
+
+	void println() { fputc('\n', stdout); }
+	template <typename T> void println(const T &v) { print(v); println(); }
+
+	int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+	size_t write(const uint8_t *data, size_t len) { return fwrite(data, 1, len, stdout); }
+};
+
+extern NativeSerial Serial;
+
+#endif		/* ifndef __INC_NATIVE_ARDUINO_H */
@@ -0,0 +1,42 @@
+#ifndef __INC_NATIVE_TICKER_H
+#define __INC_NATIVE_TICKER_H
+
+#include <stdint.h>
+
+/**
+ * class Ticker - stand-in for the ESP32 Ticker, fired from the native
+ *  harness as simulated time advances (see native_ticker_run)
+*/
+class Ticker
+{
+public:
+	typedef void (*callback_t)(void);
+
+	Ticker();
+	~Ticker();
+
+	void attach(float seconds, callback_t callback) { arm(seconds * 1000, callback, true); }
+	void attach_ms(uint32_t ms, callback_t callback) { arm(ms, callback, true); }
+	void once(float seconds, callback_t callback) { arm(seconds * 1000, callback, false); }
+	void once_ms(uint32_t ms, callback_t callback) { arm(ms, callback, false); }
+	void detach() { callback = 0; }
+	bool active() const { return callback != 0; }
+
+	/* fires the callback if due, called by the native harness */
+	void run(unsigned long now);
+
+	friend void native_ticker_run(void);
+
+private:
+	void arm(uint32_t ms, callback_t cb, bool repeat);
+
+	callback_t callback;
+	uint32_t period;
+	unsigned long due;
+	bool repeat;
+	Ticker *next;
+};
+
+void native_ticker_run(void);
+
+#endif		/* ifndef __INC_NATIVE_TICKER_H */
@@ -0,0 +1,1026 @@
+#include <Arduino.h>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include "hal.h"
+#include "lcd.h"
+#include "scan.h"
+#include "tasks.h"
+#include "native.h"
+
+/*
+ * Fakes behind the hardware abstraction layer for [env:native]:
+ * in-memory LCD, virtual card taps, simulated RTC, SNTP server stand-in,
+ * loopback MQTT broker and file-backed storage.
+*/
+
+
+/* Buses: one thread, so a transaction never waits */
+
+static bool bus_held = false;
+static uint64_t bus_held_at = 0;
+static hal_bus_stats_t bus_stats;
+
+void hal_bus_init()
+{
+}
+
+void hal_bus_acquire(uint8_t device)
+{
+	(void)device;
+
+	/* would deadlock on the board */
+	if (bus_held)
+		fprintf(stderr, "[bus] nested I2C transaction\n");
+
+	bus_held = true;
+	bus_held_at = micros();
+	bus_stats.transactions++;
+}
+
+void hal_bus_release()
+{
+	bus_stats.busy_us += micros() - bus_held_at;
+	bus_held = false;
+}
+
+void hal_bus_stats(hal_bus_stats_t *copy)
+{
+	*copy = bus_stats;
+}
+
+/* one simulated cycle per microsecond */
+uint32_t hal_cycle_count()
+{
+	return (micros());
+}
+
+uint32_t hal_cycles_per_us()
+{
+	return (1);
+}
+
+uint64_t hal_clock_us()
+{
+	return (micros());
+}
+
+/* every run is a power-on: the retained memory starts zeroed */
+static uint32_t retained[HAL_RETAINED_SIZE / 4];
+
+uint8_t hal_reset_reason()
+{
+	return (HAL_RESET_POWER_ON);
+}
+
+void *hal_retained_memory()
+{
+	return (retained);
+}
+
+
+/* Tasks, run in turn by the native harness */
+
+/**
+ * struct native_task_s - a firmware task in the simulation
+ *
+ * @step: one run of the task's work
+ * @period: longest time between two runs [ms]
+ * @last_run: millis() at the last run
+ * @notified: set by hal_task_notify, runs the task on the next tick
+ * @runs: runs since startup
+*/
+typedef struct native_task_s
+{
+	void (*step)(void);
+	uint32_t period;
+	unsigned long last_run;
+	bool notified;
+	uint32_t runs;
+} native_task_t;
+
+static native_task_t native_tasks[TASK_COUNT];
+
+void hal_task_start(uint8_t id, const char *name, void (*step)(void),
+		uint32_t period, uint8_t core, uint8_t priority, uint32_t stack)
+{
+	native_tasks[id].step = step;
+	native_tasks[id].period = period;
+	native_tasks[id].last_run = millis();
+	native_tasks[id].notified = true;
+}
+
+void hal_task_notify(uint8_t id)
+{
+	native_tasks[id].notified = true;
+}
+
+void hal_task_notify_from_isr(uint8_t id)
+{
+	hal_task_notify(id);
+}
+
+void hal_task_set_period(uint8_t id, uint32_t period)
+{
+	native_tasks[id].period = period;
+}
+
+/* steps take no simulated time, only the runs are counted */
+void hal_task_stats(uint8_t id, uint32_t *runs, uint32_t *busy_us)
+{
+	*runs = native_tasks[id].runs;
+	*busy_us = 0;
+}
+
+void hal_loop_idle()
+{
+}
+
+/**
+ * native_tasks_run - runs every task that was notified or whose period
+ *  elapsed, in task ID order
+ *
+ * Return: Nothing
+*/
+void native_tasks_run()
+{
+	for (int id = 0; id < TASK_COUNT; id++)
+	{
+		native_task_t *task = &native_tasks[id];
+
+		if (!task->step)
+			continue;
+		if (!task->notified && millis() - task->last_run < task->period)
+			continue;
+
+		task->notified = false;
+		task->last_run = millis();
+		task->runs++;
+		task->step();
+	}
+}
+
+
+/* Power, nothing to sleep: light sleep always "works" */
+
+uint8_t hal_power_configure(bool low_power, bool reader_wake)
+{
+	return (low_power ? HAL_POWER_LIGHT_SLEEP : HAL_POWER_FULL_SPEED);
+}
+
+
+/* In-memory LCD */
+
+static char lcd_cells[LCD_ROWS][LCD_COLUMNS];
+static uint8_t lcd_col = 0;
+static uint8_t lcd_row = 0;
+/*
+ * expander bytes written to the LCD's PCF8574 since startup, counted as
+ * the esp32 driver queues them, and the RS line after the last one
+*/
+static uint32_t lcd_i2c_bytes = 0;
+static uint8_t lcd_rs = 1;
+
+/**
+ * lcd_nibble_bytes - counts the expander bytes of a nibble: the enable
+ *  line high then low, after one setting RS if it changes
+ *
+ * @rs_line: RS line before the nibble, updated
+ * @rs: 1 for character data, 0 for a command
+ *
+ * Return: number of expander bytes
+*/
+static uint32_t lcd_nibble_bytes(uint8_t *rs_line, uint8_t rs)
+{
+	uint32_t bytes = *rs_line != rs ? 3 : 2;
+
+	*rs_line = rs;
+	return (bytes);
+}
+
+/**
+ * lcd_byte_bytes - counts the expander bytes of a command or character,
+ *  sent as two nibbles
+ *
+ * @rs_line: RS line before the byte, updated
+ * @rs: 1 for character data, 0 for a command
+ *
+ * Return: number of expander bytes
+*/
+static uint32_t lcd_byte_bytes(uint8_t *rs_line, uint8_t rs)
+{
+	uint32_t bytes = lcd_nibble_bytes(rs_line, rs);
+
+	return (bytes + lcd_nibble_bytes(rs_line, rs));
+}
+
+/* back to 8-bit mode three times, 4-bit, then four commands */
+void hal_lcd_init()
+{
+	memset(lcd_cells, ' ', sizeof(lcd_cells));
+	lcd_col = lcd_row = 0;
+
+	lcd_rs = 1;
+	for (uint8_t i = 0; i < 4; i++)
+		lcd_i2c_bytes += lcd_nibble_bytes(&lcd_rs, 0);
+	for (uint8_t i = 0; i < 4; i++)
+		lcd_i2c_bytes += lcd_byte_bytes(&lcd_rs, 0);
+}
+
+void hal_lcd_create_char(uint8_t location, const uint8_t *bitmap)
+{
+	lcd_i2c_bytes += lcd_byte_bytes(&lcd_rs, 0);
+	for (uint8_t i = 0; i < 8; i++)
+		lcd_i2c_bytes += lcd_byte_bytes(&lcd_rs, 1);
+}
+
+void hal_lcd_set_cursor(uint8_t col, uint8_t row)
+{
+	lcd_col = col;
+	lcd_row = row;
+	lcd_i2c_bytes += lcd_byte_bytes(&lcd_rs, 0);
+}
+
+void hal_lcd_write(uint8_t c)
+{
+	if (lcd_row < LCD_ROWS && lcd_col < LCD_COLUMNS)
+		lcd_cells[lcd_row][lcd_col] = c;
+	lcd_col++;
+	lcd_i2c_bytes += lcd_byte_bytes(&lcd_rs, 1);
+}
+
+/* the in-memory LCD shows transfers as they are queued */
+void hal_lcd_commit()
+{
+}
+
+#ifdef LCD_BENCHMARK
+void hal_lcd_benchmark()
+{
+	printf("LCD full-screen refresh: no bus to time in the native build\n");
+}
+#endif
+
+/**
+ * native_lcd_i2c_bytes - retrieves the expander bytes written to the LCD
+ *  since startup
+ *
+ * Return: number of bytes
+*/
+uint32_t native_lcd_i2c_bytes()
+{
+	return (lcd_i2c_bytes);
+}
+
+/**
+ * native_lcd_repaint_bytes - counts the expander bytes a full repaint of
+ *  the LCD would take now: a cursor command and every character, per row
+ *
+ * Return: number of bytes
+*/
+uint32_t native_lcd_repaint_bytes()
+{
+	uint8_t rs_line = lcd_rs;
+	uint32_t bytes = 0;
+
+	for (int row = 0; row < LCD_ROWS; row++)
+	{
+		bytes += lcd_byte_bytes(&rs_line, 0);
+		for (int col = 0; col < LCD_COLUMNS; col++)
+			bytes += lcd_byte_bytes(&rs_line, 1);
+	}
+
+	return (bytes);
+}
+
+/**
+ * native_lcd_dump - prints the LCD's contents, custom symbols as
+ *  '+' (success) and 'x' (failure)
+ *
+ * @out: stream to print to
+ *
+ * Return: Nothing
+*/
+void native_lcd_dump(FILE *out)
+{
+	for (int row = 0; row < LCD_ROWS; row++)
+	{
+		fputc('|', out);
+		for (int col = 0; col < LCD_COLUMNS; col++)
+		{
+			char c = lcd_cells[row][col];
+
+			if (c == DISPLAY_SUCCESS)
+				c = '+';
+			else if (c == DISPLAY_FAILURE)
+				c = 'x';
+			fputc(c, out);
+		}
+		fputs("|\n", out);
+	}
+}
+
+
+/* Virtual card taps */
+
+static std::deque<std::string> rfid_taps;
+/* IRQ mode: handler of the IRQ line, and whether a REQA is waiting for a card */
+static void (*rfid_irq_handler)(void) = NULL;
+static bool rfid_irq_armed = false;
+/* IRQ mode: a card answered the last REQA, and whether the line is wired */
+static bool rfid_irq_answered = false;
+static bool rfid_irq_wired = true;
+static uint32_t rfid_commands = 0;
+
+void hal_rfid_init()
+{
+}
+
+bool hal_rfid_card_present()
+{
+	rfid_commands++;
+	return (!rfid_taps.empty());
+}
+
+bool hal_rfid_read_uid(uint8_t *uid, uint8_t *uid_size)
+{
+	rfid_commands++;
+	if (rfid_taps.empty())
+		return false;
+
+	*uid_size = min(rfid_taps.front().size(), (size_t)RFID_UID_MAX_LEN);
+	memcpy(uid, rfid_taps.front().data(), *uid_size);
+	rfid_taps.pop_front();
+
+	return true;
+}
+
+void hal_rfid_halt()
+{
+}
+
+/* $SENTRY_RFID_NO_IRQ=1 leaves the simulated IRQ line unwired */
+bool hal_rfid_irq_attach(void (*handler)(void))
+{
+	const char *no_irq = getenv("SENTRY_RFID_NO_IRQ");
+
+	rfid_irq_wired = !(no_irq && atoi(no_irq));
+	rfid_irq_handler = handler;
+	return true;
+}
+
+void hal_rfid_irq_arm()
+{
+	rfid_commands++;
+	rfid_irq_armed = true;
+	rfid_irq_answered = false;
+
+	/* a card already in the field answers straight away */
+	if (!rfid_taps.empty())
+	{
+		rfid_irq_armed = false;
+		rfid_irq_answered = true;
+		if (rfid_irq_wired)
+			rfid_irq_handler();
+	}
+}
+
+void hal_rfid_irq_clear()
+{
+	rfid_irq_answered = false;
+}
+
+bool hal_rfid_irq_answered()
+{
+	rfid_commands++;
+	return (rfid_irq_answered);
+}
+
+/* no bus to time: the simulated clock only moves between ticks */
+void hal_rfid_counters(uint32_t *commands, uint32_t *bus_us)
+{
+	*commands = rfid_commands;
+	*bus_us = 0;
+}
+
+/**
+ * native_rfid_tap - presents a card to the virtual reader
+ *
+ * @uid: UID of the card
+ * @uid_size: length of the UID in bytes
+ *
+ * Return: Nothing
+*/
+void native_rfid_tap(const uint8_t *uid, uint8_t uid_size)
+{
+	rfid_taps.push_back(std::string((const char *)uid, uid_size));
+
+	if (rfid_irq_armed)
+	{
+		rfid_irq_armed = false;
+		rfid_irq_answered = true;
+		if (rfid_irq_wired)
+			rfid_irq_handler();
+	}
+}
+
+
+/* Simulated RTC, runs off the simulated clock */
+
+/*
+ * RTC time: rtc_epoch at micros() == rtc_set_at, counting whole seconds
+ * from there as the DS3231 restarts its second when set; 0 until set,
+ * i.e. "lost power"
+*/
+static uint32_t rtc_epoch = 0;
+static uint64_t rtc_set_at = 0;
+/* square wave handler, and the seconds since set at its last edge */
+static void (*rtc_sqw_handler)(void) = NULL;
+static uint32_t rtc_sqw_seconds = 0;
+/* time reads over the (simulated) I2C bus */
+static uint32_t rtc_reads = 0;
+
+void hal_rtc_init()
+{
+}
+
+bool hal_rtc_lost_power()
+{
+	return (rtc_epoch == 0);
+}
+
+uint32_t hal_rtc_now()
+{
+	rtc_reads++;
+	return (rtc_epoch + (uint32_t)((micros() - rtc_set_at) / 1000000));
+}
+
+void hal_rtc_adjust(uint32_t epoch)
+{
+	rtc_epoch = epoch;
+	rtc_set_at = micros();
+	rtc_sqw_seconds = 0;
+}
+
+/* $SENTRY_RTC_NO_SQW=1 leaves the simulated square wave unwired */
+bool hal_rtc_sqw_attach(void (*handler)(void))
+{
+	const char *no_sqw = getenv("SENTRY_RTC_NO_SQW");
+
+	if (!(no_sqw && atoi(no_sqw)))
+		rtc_sqw_handler = handler;
+	return true;
+}
+
+/**
+ * native_rtc_run - runs the square wave handler as each RTC second starts
+ *
+ * Return: Nothing
+*/
+void native_rtc_run()
+{
+	uint32_t seconds = (uint32_t)((micros() - rtc_set_at) / 1000000);
+
+	if (!rtc_sqw_handler || seconds == rtc_sqw_seconds)
+		return;
+
+	rtc_sqw_seconds = seconds;
+	rtc_sqw_handler();
+}
+
+/**
+ * native_rtc_reads - retrieves the RTC time reads since startup
+ *
+ * Return: number of reads
+*/
+uint32_t native_rtc_reads()
+{
+	return (rtc_reads);
+}
+
+
+/* SNTP server stand-in, answers whatever host the client asks */
+
+#define NATIVE_NTP_PORT         123
+#define NATIVE_NTP_PACKET_LEN   48
+/* simulated round trip of a request, split evenly both ways [us] */
+#define NATIVE_NTP_RTT          20000
+/* seconds from the NTP epoch (1900) to the Unix epoch (1970) */
+#define NATIVE_NTP_UNIX_OFFSET  2208988800ULL
+
+static bool ntp_up = false;
+/* server time: ntp_epoch0 at micros() == ntp_t0, off by ntp_drift_ppm */
+static uint64_t ntp_epoch0 = 0;
+static uint64_t ntp_t0 = 0;
+static int32_t ntp_drift_ppm = 0;
+
+static void (*udp_handler)(void) = NULL;
+/* request on its way to the server, and when it is answered [us] */
+static uint8_t ntp_request[NATIVE_NTP_PACKET_LEN];
+static bool ntp_request_pending = false;
+static uint64_t ntp_answer_at = 0;
+/* response waiting in the socket, and when it arrived [us] */
+static uint8_t udp_packet[NATIVE_NTP_PACKET_LEN];
+static size_t udp_packet_len = 0;
+static uint64_t udp_packet_at = 0;
+
+/**
+ * ntp_put_time - stores the server's time at a simulated instant as an
+ *  NTP timestamp
+ *
+ * @p: destination, 8 bytes
+ * @local_us: simulated instant, as micros() [us]
+ *
+ * Return: Nothing
+*/
+static void ntp_put_time(uint8_t *p, uint64_t local_us)
+{
+	int64_t elapsed = (int64_t)(local_us - ntp_t0);
+	uint64_t epoch_us = ntp_epoch0 + elapsed + elapsed * ntp_drift_ppm / 1000000;
+	uint64_t seconds = epoch_us / 1000000 + NATIVE_NTP_UNIX_OFFSET;
+	uint64_t fraction = ((epoch_us % 1000000) << 32) / 1000000;
+
+	for (int i = 0; i < 4; i++)
+	{
+		p[i] = (uint8_t)(seconds >> (24 - 8 * i));
+		p[4 + i] = (uint8_t)(fraction >> (24 - 8 * i));
+	}
+}
+
+bool hal_udp_begin(uint16_t port, void (*handler)(void))
+{
+	udp_handler = handler;
+	return true;
+}
+
+/* requests to a server that is down are lost, like UDP */
+bool hal_udp_send(uint32_t ip, uint16_t port, const uint8_t *data,
+		size_t len)
+{
+	if (!ntp_up || port != NATIVE_NTP_PORT || len != NATIVE_NTP_PACKET_LEN)
+		return true;
+
+	memcpy(ntp_request, data, len);
+	ntp_request_pending = true;
+	ntp_answer_at = micros() + NATIVE_NTP_RTT;
+	return true;
+}
+
+/* every host is the SNTP server stand-in, at 127.0.0.1 */
+uint8_t hal_dns_lookup(const char *host, uint32_t *ip)
+{
+	if (!*host)
+		return (HAL_DNS_FAILED);
+
+	*ip = 0x0100007F;
+	return (HAL_DNS_RESOLVED);
+}
+
+size_t hal_udp_receive(uint8_t *buf, size_t size, uint64_t *received_at)
+{
+	size_t len = udp_packet_len;
+
+	if (!len || len > size)
+		return (0);
+
+	memcpy(buf, udp_packet, len);
+	*received_at = udp_packet_at;
+	udp_packet_len = 0;
+	return (len);
+}
+
+/**
+ * native_ntp_set - starts or stops the SNTP server stand-in
+ *
+ * @up: whether it answers
+ * @offset_ms: its time minus the simulated RTC's, now [ms]
+ * @drift_ppm: how much faster than the simulated clock it runs [ppm]
+ *
+ * Return: Nothing
+*/
+void native_ntp_set(bool up, int32_t offset_ms, int32_t drift_ppm)
+{
+	ntp_up = up;
+	ntp_t0 = micros();
+	ntp_epoch0 = (uint64_t)hal_rtc_now() * 1000000 + (int64_t)offset_ms * 1000;
+	ntp_drift_ppm = drift_ppm;
+}
+
+/**
+ * native_ntp_run - answers the request in flight once its round trip is
+ *  over
+ *
+ * Return: Nothing
+*/
+void native_ntp_run()
+{
+	uint8_t *reply = udp_packet;
+
+	if (!ntp_request_pending || micros() < ntp_answer_at)
+		return;
+
+	ntp_request_pending = false;
+	if (!ntp_up)
+		return;
+
+	/* leap 0, version 4, mode server, stratum 1 */
+	memset(reply, 0, NATIVE_NTP_PACKET_LEN);
+	reply[0] = 0x24;
+	reply[1] = 1;
+	memcpy(&reply[24], &ntp_request[40], 8);
+	ntp_put_time(&reply[32], ntp_answer_at - NATIVE_NTP_RTT / 2);
+	ntp_put_time(&reply[40], ntp_answer_at - NATIVE_NTP_RTT / 2);
+	udp_packet_len = NATIVE_NTP_PACKET_LEN;
+	udp_packet_at = micros();
+
+	if (udp_handler)
+		udp_handler();
+}
+
+
+/* Loopback MQTT broker */
+
+/* simulated round trip between the client and the broker [us] */
+#define NATIVE_MQTT_RTT         40000
+
+/**
+ * struct mqtt_event_s - broker-to-client event, delivered by
+ *  native_mqtt_run once due so handlers never re-enter the firmware
+*/
+typedef struct mqtt_event_s
+{
+	enum { CONNACK, SUBACK, PUBACK, MESSAGE, REFUSED } type;
+	uint16_t packet_id;
+	uint8_t qos;
+	std::string topic;
+	std::string payload;
+	uint32_t due;
+} mqtt_event_t;
+
+static hal_mqtt_callbacks_t mqtt_callbacks;
+static bool mqtt_connected = false;
+static bool mqtt_broker_up = true;
+/* client asks for a clean session; whether the broker keeps one for it */
+static bool mqtt_clean_session = true;
+static bool mqtt_session = false;
+static uint16_t mqtt_packet_id = 0;
+static std::deque<mqtt_event_t> mqtt_events;
+static std::set<std::string> mqtt_subscriptions;
+/* messages for a kept session, delivered once the client is back */
+static std::deque<mqtt_event_t> mqtt_session_queue;
+static std::map<std::string, std::string> mqtt_retained;
+static const char *will_topic = NULL;
+static const char *will_payload = NULL;
+static bool will_retain = false;
+
+/**
+ * next_packet_id - allocates an MQTT packet ID, never 0
+ *
+ * Return: packet ID
+*/
+static uint16_t next_packet_id()
+{
+	if (++mqtt_packet_id == 0)
+		mqtt_packet_id = 1;
+	return (mqtt_packet_id);
+}
+
+/**
+ * post_event - queues a broker-to-client event
+ *
+ * @event: event
+ * @delay: time until it reaches the client [us]
+ *
+ * Return: Nothing
+*/
+static void post_event(mqtt_event_t event, uint32_t delay)
+{
+	event.due = micros() + delay;
+	mqtt_events.push_back(event);
+}
+
+/**
+ * broker_publish - routes a message through the loopback broker
+ *
+ * @topic: topic of the message
+ * @payload: message contents
+ * @retain: retain flag
+ *
+ * Return: Nothing
+*/
+static void broker_publish(
+		const std::string &topic, const std::string &payload, bool retain)
+{
+	if (retain)
+		mqtt_retained[topic] = payload;
+
+	if (mqtt_subscriptions.count(topic))
+	{
+		mqtt_event_t event = {mqtt_event_t::MESSAGE, 0, 0, topic, payload, 0};
+
+		if (mqtt_connected)
+			post_event(event, NATIVE_MQTT_RTT / 2);
+		else if (mqtt_session)
+			mqtt_session_queue.push_back(event);
+	}
+}
+
+void hal_mqtt_init(const hal_mqtt_callbacks_t *handlers)
+{
+	mqtt_callbacks = *handlers;
+}
+
+void hal_mqtt_set_client_id(const char *client_id)
+{
+}
+
+void hal_mqtt_set_keep_alive(uint16_t seconds)
+{
+}
+
+void hal_mqtt_set_clean_session(bool clean)
+{
+	mqtt_clean_session = clean;
+}
+
+void hal_mqtt_set_will(
+		const char *topic, uint8_t qos, bool retain, const char *payload)
+{
+	will_topic = topic;
+	will_payload = payload;
+	will_retain = retain;
+}
+
+void hal_mqtt_set_credentials(const char *username, const char *password)
+{
+}
+
+void hal_mqtt_set_server_host(const char *host, uint16_t port)
+{
+}
+
+void hal_mqtt_set_server_ip(uint32_t ip, uint16_t port)
+{
+}
+
+void hal_mqtt_connect()
+{
+	mqtt_event_t event = {mqtt_event_t::CONNACK, 0, 0, "", "", 0};
+
+	if (!mqtt_broker_up)
+		event.type = mqtt_event_t::REFUSED;
+
+	if (!mqtt_connected)
+		post_event(event, NATIVE_MQTT_RTT);
+}
+
+bool hal_mqtt_connected()
+{
+	return (mqtt_connected);
+}
+
+uint16_t hal_mqtt_publish(const char *topic, uint8_t qos, bool retain,
+		const char *payload, size_t len)
+{
+	if (!mqtt_connected)
+		return (0);
+
+	std::string data(payload, len);
+	uint16_t packet_id = qos ? next_packet_id() : 1;
+
+	printf("[mqtt] PUB %s q%u%s %s\n", topic, qos, retain ? " r" : "",
+		(len && payload[0] == '{') ? data.c_str() : "<binary>");
+
+	broker_publish(topic, data, retain);
+
+	if (qos)
+	{
+		mqtt_event_t event = {mqtt_event_t::PUBACK, packet_id, qos, "", "", 0};
+		post_event(event, NATIVE_MQTT_RTT);
+	}
+
+	return (packet_id);
+}
+
+uint16_t hal_mqtt_subscribe(const char *topic, uint8_t qos)
+{
+	if (!mqtt_connected)
+		return (0);
+
+	uint16_t packet_id = next_packet_id();
+	mqtt_event_t event = {mqtt_event_t::SUBACK, packet_id, qos, "", "", 0};
+
+	mqtt_subscriptions.insert(topic);
+	post_event(event, NATIVE_MQTT_RTT);
+
+	/* deliver the retained message, like a real broker */
+	if (mqtt_retained.count(topic))
+		broker_publish(topic, mqtt_retained[topic], false);
+
+	return (packet_id);
+}
+
+/**
+ * native_mqtt_run - delivers the loopback broker's pending events
+ *
+ * Return: Nothing
+*/
+void native_mqtt_run()
+{
+	while (!mqtt_events.empty() &&
+			(int32_t)(micros() - mqtt_events.front().due) >= 0)
+	{
+		mqtt_event_t event = mqtt_events.front();
+
+		mqtt_events.pop_front();
+
+		switch (event.type)
+		{
+			case mqtt_event_t::REFUSED:
+				printf("[mqtt] connection refused\n");
+				mqtt_callbacks.on_disconnect(0);
+				break;
+			case mqtt_event_t::CONNACK:
+			{
+				bool session_present = mqtt_session && !mqtt_clean_session;
+
+				/* a clean session drops the subscriptions with the rest */
+				if (!session_present)
+				{
+					mqtt_subscriptions.clear();
+					mqtt_session_queue.clear();
+				}
+				mqtt_session = !mqtt_clean_session;
+				mqtt_connected = true;
+				mqtt_callbacks.on_connect(session_present);
+
+				/* what the kept session queued while the client was away */
+				mqtt_events.insert(mqtt_events.end(),
+					mqtt_session_queue.begin(), mqtt_session_queue.end());
+				mqtt_session_queue.clear();
+				break;
+			}
+			case mqtt_event_t::SUBACK:
+				mqtt_callbacks.on_subscribe(event.packet_id, event.qos);
+				break;
+			case mqtt_event_t::PUBACK:
+				mqtt_callbacks.on_publish(event.packet_id);
+				break;
+			case mqtt_event_t::MESSAGE:
+				mqtt_callbacks.on_message(event.topic.c_str(),
+					event.payload.data(), event.payload.size(),
+					0, event.payload.size());
+				break;
+		}
+	}
+}
+
+/**
+ * native_mqtt_inject - publishes a message from another client of the
+ *  loopback broker, e.g. the backend server
+ *
+ * @topic: topic of the message
+ * @payload: message contents
+ *
+ * Return: Nothing
+*/
+void native_mqtt_inject(const char *topic, const char *payload)
+{
+	broker_publish(topic, payload, false);
+}
+
+/**
+ * native_mqtt_drop - drops the client's connection, the broker then
+ *  publishes the client's LWT
+ *
+ * Return: Nothing
+*/
+void native_mqtt_drop()
+{
+	if (!mqtt_connected)
+		return;
+
+	mqtt_connected = false;
+	mqtt_events.clear();
+
+	if (will_topic)
+		broker_publish(will_topic, will_payload, will_retain);
+
+	mqtt_callbacks.on_disconnect(0);
+}
+
+/**
+ * native_mqtt_set_broker - stops or restarts the loopback broker,
+ *  stopping it drops the client, refuses its connection attempts and
+ *  loses its session, as a broker without persistence does
+ *
+ * @up: true to start the broker, false to stop it
+ *
+ * Return: Nothing
+*/
+void native_mqtt_set_broker(bool up)
+{
+	mqtt_broker_up = up;
+
+	if (!up)
+	{
+		native_mqtt_drop();
+		mqtt_session = false;
+		mqtt_subscriptions.clear();
+		mqtt_session_queue.clear();
+	}
+}
+
+
+/* File-backed storage */
+
+/**
+ * file_read - reads bytes from a file-backed storage
+ *
+ * @ctx: storage's open FILE
+ * @offset: offset to read from
+ * @data: buffer to read into
+ * @len: number of bytes to read
+ *
+ * Return: true if all bytes were read, false otherwise
+*/
+static bool file_read(void *ctx, uint32_t offset, void *data, size_t len)
+{
+	FILE *file = (FILE *)ctx;
+
+	return (!fseek(file, offset, SEEK_SET) && fread(data, 1, len, file) == len);
+}
+
+/**
+ * file_write - writes bytes to a file-backed storage
+ *
+ * @ctx: storage's open FILE
+ * @offset: offset to write to
+ * @data: bytes to write
+ * @len: number of bytes to write
+ *
+ * Return: true if all bytes were written, false otherwise
+*/
+static bool file_write(void *ctx, uint32_t offset, const void *data, size_t len)
+{
+	FILE *file = (FILE *)ctx;
+
+	if (fseek(file, offset, SEEK_SET) || fwrite(data, 1, len, file) != len)
+		return false;
+
+	return (fflush(file) == 0);
+}
+
+/**
+ * hal_storage_open - opens a fixed-size storage backed by a plain file
+ *  in $SENTRY_FLASH_DIR (default: the working directory)
+ *
+ * @storage: storage to set up
+ * @path: path of the backing file, relative to the flash directory
+ * @size: size of the storage in bytes
+ *
+ * Return: true on success, false otherwise
+*/
+bool hal_storage_open(storage_t *storage, const char *path, uint32_t size)
+{
+	const char *dir = getenv("SENTRY_FLASH_DIR");
+	std::string file_path = std::string(dir ? dir : ".") + path;
+	FILE *file = fopen(file_path.c_str(), "r+b");
+
+	if (!file)
+	{
+		file = fopen(file_path.c_str(), "w+b");
+		if (!file)
+			return false;
+	}
+
+	/* extend new or short files with erased-flash bytes */
+	fseek(file, 0, SEEK_END);
+	for (long i = ftell(file); i < (long)size; i++)
+		fputc(0xFF, file);
+	fflush(file);
+
+	storage->read = file_read;
+	storage->write = file_write;
+	storage->size = size;
+	storage->ctx = file;
+
+	return true;
+}
+
+/**
+ * hal_settings_open - opens a fixed-size storage for small settings,
+ *  backed by a plain file named after the key in $SENTRY_FLASH_DIR
+ *
+ * @storage: storage to set up
+ * @key: key of the settings
+ * @size: size of the storage in bytes
+ *
+ * Return: true on success, false otherwise
+*/
+bool hal_settings_open(storage_t *storage, const char *key, uint32_t size)
+{
+	return (hal_storage_open(storage, ("/" + std::string(key) + ".bin").c_str(),
+		size));
+}
@@ -0,0 +1,277 @@
+#include <Arduino.h>
+#include <Ticker.h>
+#include "lcd.h"
+#include "journal.h"
+#include "rfid.h"
+#include "timesync.h"
+#include "rtc.h"
+#include "hal.h"
+#include "native.h"
+
+/*
+ * Native harness: runs the firmware's setup()/loop() on Linux against
+ * the fakes, driven by commands read from stdin, one per line:
+ *
+ *   tap <hex bytes>         present a card, e.g. "tap 04 a1 2b ff"
+ *   run <ms>                run the firmware for <ms> simulated ms
+ *   recv <topic> <payload>  publish a message from the backend
+ *   wifi up|down            connect/disconnect the simulated WiFi
+ *   broker up|down          start/stop the loopback MQTT broker
+ *   ntp up [ms] [ppm]|down  start the SNTP server stand-in, <ms> off the
+ *                           RTC and <ppm> fast, or stop it
+ *   time                    print the firmware's clock and sync state
+ *   lcd                     print the LCD's contents
+ *   stats                   print the firmware's counters
+ *   expect <counter> <max>  check that a counter stayed at most <max>
+ *                           since the last check of it, see expect()
+ *   # ...                   comment
+ *
+ * The harness exits with status 1 if any expect failed, so a scenario
+ * file doubles as a test: ./firmware < test/native/lcd_i2c_bytes.txt
+*/
+
+/* one loop() iteration per simulated tick [us] */
+#define NATIVE_TICK_US          1000
+
+/* LCD expander bytes at the last expect lcd-bytes */
+static uint32_t lcd_bytes_checked = 0;
+/* most LCD expander bytes in one tick since the last expect lcd-loop-bytes */
+static uint32_t lcd_loop_bytes_max = 0;
+/*
+ * full-repaint baseline since the last expect lcd-repaint-pct: the LCD
+ * expander bytes at that check, and the bytes repainting the whole LCD
+ * on every tick that wrote to it would have taken since
+*/
+static uint32_t lcd_repaint_checked = 0;
+static uint32_t lcd_repaint_bytes = 0;
+/* expects that failed */
+static unsigned int expect_failures = 0;
+
+void setup(void);
+void loop(void);
+
+/**
+ * run_for - runs the firmware for a stretch of simulated time
+ *
+ * @ms: simulated time to run for [ms]
+ *
+ * Return: Nothing
+*/
+static void run_for(unsigned long ms)
+{
+	unsigned long end = millis() + ms;
+
+	while ((long)(end - millis()) > 0)
+	{
+		uint32_t lcd_bytes = native_lcd_i2c_bytes();
+
+		native_wifi_run();
+		native_mqtt_run();
+		native_ntp_run();
+		native_rtc_run();
+		native_ticker_run();
+		native_tasks_run();
+		loop();
+		native_advance_us(NATIVE_TICK_US);
+
+		lcd_bytes = native_lcd_i2c_bytes() - lcd_bytes;
+		if (lcd_bytes > lcd_loop_bytes_max)
+			lcd_loop_bytes_max = lcd_bytes;
+		if (lcd_bytes)
+			lcd_repaint_bytes += native_lcd_repaint_bytes();
+	}
+}
+
+/**
+ * tap - parses hex bytes and presents them as a card
+ *
+ * @args: space-separated hex bytes
+ *
+ * Return: Nothing
+*/
+static void tap(char *args)
+{
+	uint8_t uid[RFID_UID_MAX_LEN];
+	uint8_t uid_size = 0;
+	char *end;
+
+	while (uid_size < RFID_UID_MAX_LEN)
+	{
+		unsigned long byte_value = strtoul(args, &end, 16);
+
+		if (end == args)
+			break;
+		uid[uid_size++] = byte_value;
+		args = end;
+	}
+
+	native_rfid_tap(uid, uid_size);
+}
+
+/**
+ * ntp - parses "up [offset ms] [drift ppm]" or "down" and starts or stops
+ *  the SNTP server stand-in
+ *
+ * @args: command arguments
+ *
+ * Return: Nothing
+*/
+static void ntp(char *args)
+{
+	char *state = strtok(args, " \t");
+	char *offset = strtok(NULL, " \t");
+	char *drift = strtok(NULL, " \t");
+
+	native_ntp_set(state && !strcmp(state, "up"),
+		offset ? strtol(offset, NULL, 10) : 0,
+		drift ? strtol(drift, NULL, 10) : 0);
+}
+
+/**
+ * print_time - prints the firmware's clock, its sync state and the RTC's
+ *  software clock
+ *
+ * Return: Nothing
+*/
+static void print_time()
+{
+	timesync_stats_t stats;
+	rtc_stats_t rtc;
+	uint64_t now = timesync_now_us();
+
+	timesync_get_stats(&stats);
+	rtc_get_stats(&rtc);
+	printf("[time] t=%lums clock=%llu.%03llu synced=%d syncs=%u failures=%u rtc-adjusts=%u offset-us=%lld delay-us=%u drift-ppb=%d\n",
+		millis(), (unsigned long long)(now / 1000000),
+		(unsigned long long)(now / 1000 % 1000), stats.synced,
+		stats.syncs, stats.failures, stats.rtc_adjusts,
+		(long long)stats.offset_us, stats.delay_us, stats.drift_ppb);
+	printf("[rtc] t=%lums running=%d edges=%u checks=%u mismatches=%u chip-reads=%u\n",
+		millis(), rtc.running, rtc.edges, rtc.checks, rtc.mismatches,
+		native_rtc_reads());
+}
+
+/**
+ * print_stats - prints the LCD, journal, RFID and I2C bus counters
+ *
+ * Return: Nothing
+*/
+static void print_stats()
+{
+	hal_bus_stats_t bus;
+
+	hal_bus_stats(&bus);
+	printf("[stats] t=%lums lcd-transfers=%u journal-pending=%u journal-dropped=%u rfid-suppressed=%u i2c-transactions=%u\n",
+		millis(), display_transfer_count(),
+		journal_pending(), journal_dropped(),
+		rfid_suppressed_taps(), bus.transactions);
+}
+
+/**
+ * expect - checks a counter against its bound and restarts it:
+ *  "lcd-bytes <max>": LCD expander bytes since the last check of it,
+ *  "lcd-loop-bytes <max>": most LCD expander bytes in one tick since then,
+ *  "lcd-repaint-pct <max>": LCD expander bytes since then, in percent of
+ *  the full-repaint baseline
+ *
+ * @args: command arguments
+ *
+ * Return: Nothing
+*/
+static void expect(char *args)
+{
+	char *counter = strtok(args, " \t");
+	char *max = strtok(NULL, " \t");
+	uint32_t value;
+
+	if (!counter || !max)
+	{
+		fprintf(stderr, "expect: <counter> <max>\n");
+		expect_failures++;
+		return;
+	}
+
+	if (!strcmp(counter, "lcd-bytes"))
+	{
+		value = native_lcd_i2c_bytes() - lcd_bytes_checked;
+		lcd_bytes_checked = native_lcd_i2c_bytes();
+	}
+	else if (!strcmp(counter, "lcd-loop-bytes"))
+	{
+		value = lcd_loop_bytes_max;
+		lcd_loop_bytes_max = 0;
+	}
+	else if (!strcmp(counter, "lcd-repaint-pct"))
+	{
+		value = native_lcd_i2c_bytes() - lcd_repaint_checked;
+		if (value)
+			value = (uint64_t)value * 100 / lcd_repaint_bytes;
+		lcd_repaint_checked = native_lcd_i2c_bytes();
+		lcd_repaint_bytes = 0;
+	}
+	else
+	{
+		fprintf(stderr, "expect: unknown counter %s\n", counter);
+		expect_failures++;
+		return;
+	}
+
+	if (value > strtoul(max, NULL, 10))
+		expect_failures++;
+
+	printf("[expect] t=%lums %s=%u max=%s %s\n", millis(), counter,
+		(unsigned int)value, max,
+		value > strtoul(max, NULL, 10) ? "FAIL" : "ok");
+}
+
+/**
+ * main - native entry point
+ *
+ * Return: 0 if every expect passed, 1 otherwise
+*/
+int main()
+{
+	char line[512];
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	setup();
+
+	while (fgets(line, sizeof(line), stdin))
+	{
+		char *cmd = strtok(line, " \t\r\n");
+		char *args = strtok(NULL, "\r\n");
+
+		if (!cmd || cmd[0] == '#')
+			continue;
+
+		if (!strcmp(cmd, "tap") && args)
+			tap(args);
+		else if (!strcmp(cmd, "run") && args)
+			run_for(strtoul(args, NULL, 10));
+		else if (!strcmp(cmd, "recv") && args)
+		{
+			char *topic = strtok(args, " \t");
+			char *payload = strtok(NULL, "");
+
+			native_mqtt_inject(topic, payload ? payload : "");
+		}
+		else if (!strcmp(cmd, "wifi") && args)
+			native_wifi_set(!strcmp(args, "up"));
+		else if (!strcmp(cmd, "broker") && args)
+			native_mqtt_set_broker(!strcmp(args, "up"));
+		else if (!strcmp(cmd, "ntp") && args)
+			ntp(args);
+		else if (!strcmp(cmd, "time"))
+			print_time();
+		else if (!strcmp(cmd, "lcd"))
+			native_lcd_dump(stdout);
+		else if (!strcmp(cmd, "stats"))
+			print_stats();
+		else if (!strcmp(cmd, "expect") && args)
+			expect(args);
+		else
+			fprintf(stderr, "unknown command: %s\n", cmd);
+	}
+
+	return (expect_failures ? 1 : 0);
+}
@@ -0,0 +1,44 @@
+#ifndef __INC_NATIVE_H
+#define __INC_NATIVE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Controls of the native fakes, used by the native harness (main.cpp)
+ * to drive the firmware logic on Linux
+*/
+
+/* simulated clock */
+void native_advance_us(uint32_t);
+
+/* firmware tasks */
+void native_tasks_run(void);
+
+/* virtual card taps */
+void native_rfid_tap(const uint8_t *, uint8_t);
+
+/* simulated RTC */
+void native_rtc_run(void);
+uint32_t native_rtc_reads(void);
+
+/* SNTP server stand-in */
+void native_ntp_set(bool, int32_t, int32_t);
+void native_ntp_run(void);
+
+/* loopback MQTT broker */
+void native_mqtt_run(void);
+void native_mqtt_inject(const char *, const char *);
+void native_mqtt_drop(void);
+void native_mqtt_set_broker(bool);
+
+/* simulated WiFi */
+void native_wifi_set(bool);
+void native_wifi_run(void);
+
+/* in-memory LCD */
+void native_lcd_dump(FILE *);
+uint32_t native_lcd_i2c_bytes(void);
+uint32_t native_lcd_repaint_bytes(void);
+
+#endif		/* ifndef __INC_NATIVE_H */
@@ -0,0 +1,124 @@
+#include <Arduino.h>
+#include "main.h"
+#include "mqtt.h"
+#include "my_wifi.h"
+#include "tasks.h"
+#include "config.h"
+#include "boot.h"
+#include "native.h"
+
+/*
+ * Simulated WiFi for [env:native], stands in for my_wifi.cpp: the
+ * checkpoint is "configured" from the environment instead of the
+ * captive portal and the connection is toggled by the native harness.
+*/
+
+
+/* simulated station connection state */
+static bool wifi_up = false;
+/* connection came up, "got IP" event not handled yet */
+static bool wifi_got_ip = false;
+
+/**
+ * initialize_wifi - configures the checkpoint from $SENTRY_CHECKPOINT_ID
+ *  (default 1), unless a saved configuration was loaded
+ *
+ * Return: Nothing
+*/
+void initialize_wifi()
+{
+	if (!config_available())
+	{
+		const char *id = getenv("SENTRY_CHECKPOINT_ID");
+
+		snprintf(&mqtt_client_id[MQTT_CLIENT_ID_PREFIX_LEN],
+			MQTT_CLIENT_ID_MAX_LEN - MQTT_CLIENT_ID_PREFIX_LEN, "%s",
+			id ? id : "1");
+		CHECKPOINT_ID = atoi(&mqtt_client_id[MQTT_CLIENT_ID_PREFIX_LEN]);
+
+		strncpy(broker_host, "loopback", MQTT_HOST_DOMAIN_MAX_LEN - 1);
+		domain = true;
+
+		config_save();
+	}
+}
+
+/**
+ * wifi_start - brings the simulated WiFi up
+ *
+ * Return: Nothing
+*/
+void wifi_start()
+{
+	native_wifi_set(true);
+}
+
+/**
+ * wifi_isConnected - checks if the simulated WiFi is connected
+ *
+ * Return: true if connected, false otherwise
+*/
+bool wifi_isConnected()
+{
+	return (wifi_up);
+}
+
+/**
+ * check_wifi_config_requested - no config portal in the simulation
+ *
+ * Return: Nothing
+*/
+void check_wifi_config_requested()
+{
+}
+
+/**
+ * check_wifi_fallback - no cached access point in the simulation
+ *
+ * Return: Nothing
+*/
+void check_wifi_fallback()
+{
+}
+
+/**
+ * native_wifi_set - brings the simulated WiFi up or down
+ *
+ * @up: true to connect, false to disconnect
+ *
+ * Return: Nothing
+*/
+void native_wifi_set(bool up)
+{
+	if (up == wifi_up)
+		return;
+
+	wifi_up = up;
+	wifi_got_ip = up;
+
+	if (!up)
+	{
+		Serial.println("WiFi connection lost. Reconnecting..");
+		post_event(&wifi_ui_queue, TASK_UI, EVENT_WIFI, 0);
+		mqtt_stop_reconnect();
+		native_mqtt_drop();
+	}
+}
+
+/**
+ * native_wifi_run - handles the simulated "got IP" event, like
+ *  wifi_event does on the device
+ *
+ * Return: Nothing
+*/
+void native_wifi_run()
+{
+	if (!wifi_got_ip)
+		return;
+
+	wifi_got_ip = false;
+	boot_mark(BOOT_PHASE_WIFI_UP);
+	post_event(&wifi_ui_queue, TASK_UI, EVENT_WIFI, 1);
+	mqtt_setup_repeated();
+	connect_to_mqtt();
+}
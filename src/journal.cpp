@@ -0,0 +1,262 @@
+#include <string.h>
+#include "journal.h"
+#include "crc16.h"
+
+/*
+ * The journal is a ring of JOURNAL_CAPACITY fixed-size slots followed by
+ * a small meta block. Every record carries a monotonically increasing
+ * sequence number and is always written to slot (seq % JOURNAL_CAPACITY),
+ * so writes rotate evenly over the whole ring and the head can be
+ * recovered after a reboot by finding the highest valid sequence number.
+ * The meta block only records the last sequence number that was
+ * delivered, and is rewritten once per replayed batch.
+*/
+
+/**
+ * struct journal_entry_s - on-flash layout of a journal slot
+ *
+ * @seq: sequence number of the record, 0 and 0xFFFFFFFF are never used
+ * @record: journalled scan
+ * @crc: CRC16 over @seq and @record
+*/
+typedef struct journal_entry_s
+{
+	uint32_t seq;
+	scan_record_t record;
+	uint16_t crc;
+} journal_entry_t;
+
+/**
+ * struct journal_meta_s - on-flash layout of the journal's meta block
+ *
+ * @acked_seq: sequence number of the last delivered record
+ * @crc: CRC16 over @acked_seq
+*/
+typedef struct journal_meta_s
+{
+	uint32_t acked_seq;
+	uint16_t crc;
+} journal_meta_t;
+
+#define JOURNAL_META_OFFSET     (JOURNAL_CAPACITY * sizeof(journal_entry_t))
+#define JOURNAL_STORAGE_SIZE    (JOURNAL_META_OFFSET + sizeof(journal_meta_t))
+
+/* backing storage, NULL until journal_begin succeeds */
+static storage_t *journal_storage = NULL;
+
+/* sequence number the next appended record gets */
+static uint32_t head_seq = 1;
+/* sequence number of the oldest undelivered record */
+static uint32_t tail_seq = 1;
+
+/* number of undelivered records overwritten because the ring was full */
+static uint32_t dropped_records = 0;
+
+/**
+ * entry_crc - computes the checksum of a journal entry
+ *
+ * @entry: journal entry
+ *
+ * Return: CRC16 over the entry's sequence number and record
+*/
+static uint16_t entry_crc(const journal_entry_t *entry)
+{
+	return (crc16(entry, offsetof(journal_entry_t, crc)));
+}
+
+/**
+ * read_entry - reads and validates the journal slot holding a sequence number
+ *
+ * @seq: sequence number to read
+ * @entry: where to store the read entry
+ *
+ * Return: true if the slot holds a valid entry for @seq, false otherwise
+*/
+static bool read_entry(uint32_t seq, journal_entry_t *entry)
+{
+	uint32_t offset = (seq % JOURNAL_CAPACITY) * sizeof(journal_entry_t);
+
+	if (!journal_storage->read(journal_storage->ctx, offset,
+			entry, sizeof(*entry)))
+		return false;
+
+	return (entry->seq == seq && entry->crc == entry_crc(entry));
+}
+
+/**
+ * write_meta - persists the sequence number of the last delivered record
+ *
+ * Return: Nothing
+*/
+static void write_meta()
+{
+	journal_meta_t meta;
+
+	memset(&meta, 0, sizeof(meta));
+	meta.acked_seq = tail_seq - 1;
+	meta.crc = crc16(&meta.acked_seq, sizeof(meta.acked_seq));
+
+	journal_storage->write(journal_storage->ctx, JOURNAL_META_OFFSET,
+		&meta, sizeof(meta));
+}
+
+/**
+ * journal_storage_size - retrieves the storage size the journal needs
+ *
+ * Return: size of the journal's storage in bytes
+*/
+uint32_t journal_storage_size()
+{
+	return (JOURNAL_STORAGE_SIZE);
+}
+
+/**
+ * journal_begin - attaches the journal to its storage and recovers the
+ *  undelivered records left from before the last reboot
+ *
+ * @storage: storage backend, at least JOURNAL_STORAGE_SIZE bytes
+ *
+ * Return: true on success, false if the storage is too small
+*/
+bool journal_begin(storage_t *storage)
+{
+	journal_entry_t entry;
+	journal_meta_t meta;
+	uint32_t max_seq = 0;
+	uint32_t acked_seq = 0;
+
+	if (storage->size < JOURNAL_STORAGE_SIZE)
+		return false;
+
+	journal_storage = storage;
+
+	/* locate the newest record in the ring */
+	for (uint32_t slot = 0; slot < JOURNAL_CAPACITY; slot++)
+	{
+		if (!storage->read(storage->ctx, slot * sizeof(entry),
+				&entry, sizeof(entry)))
+			continue;
+
+		if (entry.seq == 0 || entry.seq == 0xFFFFFFFF ||
+				entry.crc != entry_crc(&entry) ||
+				(entry.seq % JOURNAL_CAPACITY) != slot)
+			continue;
+
+		if (entry.seq > max_seq)
+			max_seq = entry.seq;
+	}
+
+	if (storage->read(storage->ctx, JOURNAL_META_OFFSET,
+			&meta, sizeof(meta)) &&
+			meta.crc == crc16(&meta.acked_seq, sizeof(meta.acked_seq)) &&
+			meta.acked_seq <= max_seq)
+		acked_seq = meta.acked_seq;
+
+	head_seq = max_seq + 1;
+	tail_seq = acked_seq + 1;
+
+	/* anything older than one full ring has been overwritten */
+	if (head_seq - tail_seq > JOURNAL_CAPACITY)
+		tail_seq = head_seq - JOURNAL_CAPACITY;
+
+	return true;
+}
+
+/**
+ * journal_append - appends a scan to the journal, overwriting the oldest
+ *  undelivered record if the journal is full
+ *
+ * @record: scan to journal
+ *
+ * Return: true if the scan was written, false otherwise
+*/
+bool journal_append(const scan_record_t *record)
+{
+	journal_entry_t entry;
+
+	if (!journal_storage)
+		return false;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.seq = head_seq;
+	entry.record = *record;
+	entry.crc = entry_crc(&entry);
+
+	if (!journal_storage->write(journal_storage->ctx,
+			(head_seq % JOURNAL_CAPACITY) * sizeof(entry),
+			&entry, sizeof(entry)))
+		return false;
+
+	head_seq++;
+
+	if (head_seq - tail_seq > JOURNAL_CAPACITY)
+	{
+		tail_seq++;
+		dropped_records++;
+	}
+
+	return true;
+}
+
+/**
+ * journal_peek - reads an undelivered record without removing it
+ *
+ * @n: position of the record, 0 being the oldest undelivered record
+ * @record: where to store the read record
+ *
+ * Return: true if the record was read, false if there is no such record or
+ *  its slot is corrupted (it should still be consumed to skip over it)
+*/
+bool journal_peek(uint32_t n, scan_record_t *record)
+{
+	journal_entry_t entry;
+
+	if (!journal_storage || n >= journal_pending())
+		return false;
+
+	if (!read_entry(tail_seq + n, &entry))
+		return false;
+
+	*record = entry.record;
+	return true;
+}
+
+/**
+ * journal_consume - removes delivered records from the journal
+ *
+ * @n: number of oldest records to remove
+ *
+ * Return: Nothing
+*/
+void journal_consume(uint32_t n)
+{
+	if (!journal_storage || n == 0)
+		return;
+
+	if (n > journal_pending())
+		n = journal_pending();
+
+	tail_seq += n;
+	write_meta();
+}
+
+/**
+ * journal_pending - retrieves the number of undelivered records
+ *
+ * Return: number of records awaiting delivery
+*/
+uint32_t journal_pending()
+{
+	return (head_seq - tail_seq);
+}
+
+/**
+ * journal_dropped - retrieves the number of undelivered records lost to
+ *  the journal being full since startup
+ *
+ * Return: number of dropped records
+*/
+uint32_t journal_dropped()
+{
+	return (dropped_records);
+}
@@ -1,13 +1,8 @@
 #include <Arduino.h>
-#include <Wire.h>
 #include "main.h"
 #include "lcd.h"
-
-/*
-	library to interact with the LCD Screen via I2C,
-	depends on Wire.h, included
-*/
-#include <LiquidCrystal_I2C.h>
+#include "hal.h"
+#include "tasks.h"
 
 /*
 	Library for performing fixed interval operations in a
@@ -16,8 +11,20 @@
 #include <Ticker.h>
 
 
-/* active I2C LCD instance */
-static LiquidCrystal_I2C lcd(0x27, 16, 2);
+/*
+ * shadow framebuffer: every display_* function draws into lcd_shadow,
+ * lcd_glass mirrors what is currently shown on the LCD, lcd_flush()
+ * only sends the cells that differ between the two
+ */
+static char lcd_shadow[LCD_ROWS][LCD_COLUMNS];
+static char lcd_glass[LCD_ROWS][LCD_COLUMNS];
+
+/* LCD's cursor position after the last transfer, -1 if unknown */
+static int lcd_cursor_col = -1;
+static int lcd_cursor_row = -1;
+
+/* number of command/data byte transfers sent to the LCD since startup */
+static volatile uint32_t lcd_transfers = 0;
 
 /* custom check-mark symbol to display */
 static const byte check[8] = {
@@ -43,72 +50,313 @@ static const byte x_mark[8] = {
 	0b00000
 };
 
-/* LCD scrolling ticker */
+/**
+ * struct scroll_region_s - a message scrolling round through a window
+ *  of a row
+ *
+ * @text: the message, LCD_SCROLL_LEAD blanks ahead of it and one behind
+ * @len: length of the padded message
+ * @col: first column of the window
+ * @row: row of the window
+ * @width: columns of the window
+ * @pos: offset of the message shown in the window's first column
+ * @period: time between two steps [ms]
+ * @due: millis() of the next step
+ * @active: whether it is scrolling
+*/
+typedef struct scroll_region_s
+{
+	char text[LCD_SCROLL_LEAD + LCD_SCROLL_MAX_LEN + 1];
+	uint8_t len;
+	uint8_t col;
+	uint8_t row;
+	uint8_t width;
+	uint8_t pos;
+	uint16_t period;
+	uint32_t due;
+	bool active;
+} scroll_region_t;
+
+/*
+ * scrolling regions, stepped by the UI task: the ticker only wakes it
+ * when the next step is due
+*/
+static scroll_region_t scroll_regions[LCD_SCROLL_REGIONS];
 static Ticker lcd_scroll_ticker;
 
-/* Flag to scroll message on the LCD screen */
-static volatile bool scroll_screen = false;
+/**
+ * lcd_put - draws a string into the shadow framebuffer, clipped to the row
+ *
+ * @col: column of the first character
+ * @row: display row: 0 or 1
+ * @text: string to draw
+ *
+ * Return: Nothing
+*/
+static void lcd_put(int col, int row, const char *text)
+{
+	if (row < 0 || row >= LCD_ROWS)
+		return;
+
+	for (; *text && col < LCD_COLUMNS; text++, col++)
+		if (col >= 0)
+			lcd_shadow[row][col] = *text;
+}
 
-/* Variables required for the scroll */
-static String scroll_message;
-static int scroll_pos;
-static int scroll_display_columns;
-static int scroll_row;
+/**
+ * lcd_put_char - draws a single character (or custom symbol) into the
+ *  shadow framebuffer
+ *
+ * @col: column of the character
+ * @row: display row: 0 or 1
+ * @c: character or custom symbol index to draw
+ *
+ * Return: Nothing
+*/
+static void lcd_put_char(int col, int row, char c)
+{
+	if (row < 0 || row >= LCD_ROWS || col < 0 || col >= LCD_COLUMNS)
+		return;
+
+	lcd_shadow[row][col] = c;
+}
 
 /**
- * scroll_callback - scrolls the setup scroll_message following the
- *  scroll_ticker only if scroll is activated
+ * lcd_flush - sends the shadow framebuffer cells that differ from the
+ *  LCD's contents, coalescing nearby changes into a single cursor move
+ *  followed by consecutive writes
  *
  * Return: Nothing
+ *
+ * Note: a cursor move costs one command transfer, so changed cells
+ *  separated by up to LCD_FLUSH_MAX_GAP unchanged cells are cheaper
+ *  to rewrite than to skip over. Each run is an I2C transaction, which
+ *  lets RTC transactions in between; the glass and cursor are only
+ *  touched while holding the bus, so flushes from different tasks at
+ *  worst rewrite the same cells
 */
-static void scroll_callback()
+static void lcd_flush()
 {
-	if (scroll_screen)
+	for (int row = 0; row < LCD_ROWS; row++)
 	{
-		if (scroll_pos < scroll_message.length() - 13)
+		int col = 0;
+
+		while (col < LCD_COLUMNS)
 		{
-			lcd.setCursor(0, scroll_row);
-			lcd.print(scroll_message.substring(
-				scroll_pos, scroll_pos + scroll_display_columns));
-			scroll_pos++;
-			return;
+			if (lcd_shadow[row][col] == lcd_glass[row][col])
+			{
+				col++;
+				continue;
+			}
+
+			hal_bus_acquire(HAL_BUS_LCD);
+
+			/* find the end of this run of changes */
+			int start = col;
+			int end = col;
+
+			for (int i = col + 1; i < LCD_COLUMNS; i++)
+			{
+				if (lcd_shadow[row][i] == lcd_glass[row][i])
+					continue;
+				if (i - end - 1 > LCD_FLUSH_MAX_GAP)
+					break;
+				end = i;
+			}
+
+			/* the LCD auto-increments its cursor after every write */
+			if (lcd_cursor_row != row || lcd_cursor_col != start)
+			{
+				hal_lcd_set_cursor(start, row);
+				lcd_transfers++;
+			}
+
+			for (int i = start; i <= end; i++)
+			{
+				hal_lcd_write((uint8_t)lcd_shadow[row][i]);
+				lcd_glass[row][i] = lcd_shadow[row][i];
+				lcd_transfers++;
+			}
+
+			lcd_cursor_row = row;
+			lcd_cursor_col = end + 1;
+			col = end + 1;
+
+			hal_lcd_commit();
+			hal_bus_release();
 		}
-		scroll_screen = false;
 	}
+}
+
+/**
+ * scroll_wake - wakes the UI task for the next scroll step, run by the
+ *  ticker
+ *
+ * Return: Nothing
+*/
+static void scroll_wake()
+{
+	hal_task_notify(TASK_UI);
+}
+
+/**
+ * scroll_arm - sets the ticker for the earliest step due, or stops it if
+ *  nothing scrolls
+ *
+ * Return: Nothing
+*/
+static void scroll_arm()
+{
+	uint32_t now = millis();
+	int32_t wait = INT32_MAX;
+
+	for (uint8_t i = 0; i < LCD_SCROLL_REGIONS; i++)
+	{
+		int32_t until = (int32_t)(scroll_regions[i].due - now);
+
+		if (scroll_regions[i].active && until < wait)
+			wait = until;
+	}
+
+	if (wait == INT32_MAX)
+		lcd_scroll_ticker.detach();
+	else
+		lcd_scroll_ticker.once_ms(wait > 0 ? wait : 1, scroll_wake);
+}
+
+/**
+ * scroll_render - draws a region's window into the shadow framebuffer
+ *
+ * @region: region to draw
+ *
+ * Return: Nothing
+*/
+static void scroll_render(const scroll_region_t *region)
+{
+	for (uint8_t i = 0; i < region->width; i++)
+	{
+		uint8_t at = region->pos + i;
+
+		lcd_put_char(region->col + i, region->row,
+			at < region->len ? region->text[at] : ' ');
+	}
+}
+
+/**
+ * display_scroll_stop - stops every scrolling region, leaving them as
+ *  drawn
+ *
+ * Return: Nothing
+*/
+void display_scroll_stop()
+{
+	for (uint8_t i = 0; i < LCD_SCROLL_REGIONS; i++)
+		scroll_regions[i].active = false;
 	lcd_scroll_ticker.detach();
 }
 
 /**
- * scroll_text - displays a scrolling message on the display,
- *  if the message's length exceeds 16 characters
+ * scroll_text - displays a message in a window of a row, scrolling it
+ *  round if it does not fit
  *
- * @row: display row on which to display message: 0 or 1
- * @message: message to display
- * @delay_time: time delay before scrolling to the next letter
- * @lcd_columns: number of display's columns = 16
+ * @col: first column of the window
+ * @row: display row of the window: 0 or 1
+ * @width: columns of the window
+ * @message: message to display, cut at LCD_SCROLL_MAX_LEN characters
+ * @period: time before scrolling to the next letter [ms]
  *
  * Return: Nothing
+ *
+ * Note: replaces a region scrolling over the same cells, unless it is
+ *  already scrolling this message
 */
-static void scroll_text(
-		int row, String message, int delay_time, int lcd_columns)
+static void scroll_text(uint8_t col, uint8_t row, uint8_t width,
+		const char *message, uint16_t period)
 {
-	/* Disable scrolling before editing message */
-	scroll_screen = false;
-
-	/* Adding some padding for the scroll message */
-	scroll_message = "   " + message + " ";
-	scroll_row = row;
-	scroll_display_columns = lcd_columns;
-	scroll_pos = 1;
-
-	lcd.setCursor(0, row);
-	lcd.print(scroll_message.substring(0, lcd_columns));
-	lcd_scroll_ticker.attach((float)delay_time/1000, scroll_callback);
+	scroll_region_t *region = NULL;
+	size_t len = strnlen(message, LCD_SCROLL_MAX_LEN);
+
+	for (uint8_t i = 0; i < LCD_SCROLL_REGIONS && !region; i++)
+	{
+		scroll_region_t *other = &scroll_regions[i];
+
+		if (!other->active || other->row != row ||
+				other->col >= col + width || col >= other->col + other->width)
+			continue;
+
+		if (other->col == col && other->width == width &&
+				other->len == LCD_SCROLL_LEAD + len + 1 &&
+				!memcmp(&other->text[LCD_SCROLL_LEAD], message, len))
+			return;
+
+		region = other;
+	}
+
+	for (uint8_t i = 0; i < LCD_SCROLL_REGIONS && !region; i++)
+		if (!scroll_regions[i].active)
+			region = &scroll_regions[i];
+
+	if (!region)
+		region = &scroll_regions[0];
+
+	memset(region->text, ' ', LCD_SCROLL_LEAD);
+	memcpy(&region->text[LCD_SCROLL_LEAD], message, len);
+	region->text[LCD_SCROLL_LEAD + len] = ' ';
+	region->len = LCD_SCROLL_LEAD + len + 1;
+	region->col = col;
+	region->row = row;
+	region->width = width;
+	region->pos = 0;
+	region->period = period;
+	region->due = millis() + period;
+	region->active = region->len > width;
+
+	scroll_render(region);
+	lcd_flush();
+	scroll_arm();
+}
+
+/**
+ * display_scroll_run - moves every scrolling region whose step is due one
+ *  letter on, run by the UI task
+ *
+ * Return: Nothing
+*/
+void display_scroll_run()
+{
+	uint32_t now = millis();
+	bool moved = false;
+
+	for (uint8_t i = 0; i < LCD_SCROLL_REGIONS; i++)
+	{
+		scroll_region_t *region = &scroll_regions[i];
+
+		if (!region->active || (int32_t)(now - region->due) < 0)
+			continue;
+
+		/* starts over once the message's end has reached the window's */
+		if (region->pos + region->width >= region->len)
+			region->pos = 0;
+		else
+			region->pos++;
+		scroll_render(region);
+		moved = true;
+
+		region->due += region->period;
+		if ((int32_t)(now - region->due) >= 0)
+			region->due = now + region->period;
+	}
+
+	if (!moved)
+		return;
+
+	lcd_flush();
+	scroll_arm();
 }
 
 
 /**
- * display_connected - displays WiFi and MQTT check marks when
+ * display_connected - draws WiFi and MQTT check marks when
  *  both are connected on display's top row
  *
  * @symbol_wifi: the symbol to show the WiFi connection
@@ -119,16 +367,11 @@ static void scroll_text(
 static void display_connected(
 		display_status_t symbol_wifi, display_status_t symbol_mqtt)
 {
-	lcd.setCursor(0, 0);
-	lcd.print("WiFi: ");
-	lcd.setCursor(6, 0);
-	lcd.write((uint8_t)symbol_wifi);
-	lcd.setCursor(7, 0);
-	lcd.print(" MQTT: ");
-	lcd.setCursor(14, 0);
-	lcd.write((uint8_t)symbol_mqtt);
-	lcd.setCursor(15, 0);
-	lcd.print(" ");
+	lcd_put(0, 0, "WiFi: ");
+	lcd_put_char(6, 0, (char)symbol_wifi);
+	lcd_put(7, 0, " MQTT: ");
+	lcd_put_char(14, 0, (char)symbol_mqtt);
+	lcd_put(15, 0, " ");
 }
 
 /**
@@ -139,14 +382,15 @@ static void display_connected(
  * @symbol_mqtt: the symbol to show the MQTT connection
  *
  * Return: Nothing
+ *
+ * Note: called on every loop, only changed cells reach the LCD
 */
 void display_default_text(
 	display_status_t symbol_wifi, display_status_t symbol_mqtt)
 {
 	display_connected(symbol_wifi, symbol_mqtt);
-
-	lcd.setCursor(0, 1);
-	lcd.print("   Scan Card    ");
+	lcd_put(0, 1, "   Scan Card    ");
+	lcd_flush();
 }
 
 /**
@@ -160,8 +404,7 @@ void display_scanning_verifying()
 {
 	display_connected(DISPLAY_SUCCESS, DISPLAY_SUCCESS);
 
-	String valid = "Scanning and verifying sentry ID..";
-	scroll_text(1, valid, 375, 16);
+	scroll_text(0, 1, LCD_COLUMNS, "Scanning and verifying sentry ID..", 375);
 }
 
 /**
@@ -173,11 +416,10 @@ void display_scanning_verifying()
 */
 void display_connecting_to_wifi()
 {
-	scroll_screen = false;
-	lcd.setCursor(0, 0);
-	lcd.print(" Connecting to  ");
-	lcd.setCursor(0, 1);
-	lcd.print("    WiFi....    ");
+	display_scroll_stop();
+	lcd_put(0, 0, " Connecting to  ");
+	lcd_put(0, 1, "    WiFi....    ");
+	lcd_flush();
 }
 
 /**
@@ -190,16 +432,14 @@ void display_connecting_to_wifi()
 */
 void display_mqtt_retry()
 {
-	scroll_screen = false;
-	lcd.setCursor(0, 0);
-	lcd.print("Enter valid MQTT");
-	lcd.setCursor(0, 1);
-	lcd.print(" Domain/IP Addr ");
+	display_scroll_stop();
+	lcd_put(0, 0, "Enter valid MQTT");
+	lcd_put(0, 1, " Domain/IP Addr ");
+	lcd_flush();
 	delay(3000);
-	lcd.setCursor(0, 0);
-	lcd.print("   Restarting   ");
-	lcd.setCursor(0, 1);
-	lcd.print("     Device     ");
+	lcd_put(0, 0, "   Restarting   ");
+	lcd_put(0, 1, "     Device     ");
+	lcd_flush();
 	delay(3000);
 }
 
@@ -213,11 +453,10 @@ void display_mqtt_retry()
 */
 void display_AP_mode()
 {
-	scroll_screen = false;
-	lcd.setCursor(0, 0);
-	lcd.print(" ! A.P. Mode !  ");
-	lcd.setCursor(0, 1);
-	lcd.print("Set WiFi & MQTT ");
+	display_scroll_stop();
+	lcd_put(0, 0, " ! A.P. Mode !  ");
+	lcd_put(0, 1, "Set WiFi & MQTT ");
+	lcd_flush();
 }
 
 /**
@@ -228,8 +467,10 @@ void display_AP_mode()
 */
 void display_valid_scan()
 {
-	String valid = "Valid scan! Continue to next checkpoint..";
-	scroll_text(1, valid, 375, 16);
+	display_connected(DISPLAY_SUCCESS, DISPLAY_SUCCESS);
+
+	scroll_text(0, 1, LCD_COLUMNS,
+		"Valid scan! Continue to next checkpoint..", 375);
 }
 
 /**
@@ -246,32 +487,26 @@ void display_valid_scan()
 */
 void display_invalid_scan(uint8_t reason)
 {
-	lcd.setCursor(0, 0);
-	lcd.print(" INVALID SCAN!  ");
-
-	String unexpected = "WRONG CHECKPOINT!";
-	String wrong_time = "WRONG TIME OF SCAN!";
+	lcd_put(0, 0, " INVALID SCAN!  ");
 
 	switch(reason)
 	{
 		case UNKNOWN_CARD:
-			lcd.setCursor(0, 1);
-			lcd.print("  UNKNOWN ID!   ");
+			lcd_put(0, 1, "  UNKNOWN ID!   ");
 			break;
 		case STOLEN_CARD:
-			lcd.setCursor(0, 1);
-			lcd.print("  STOLEN CARD!  ");
+			lcd_put(0, 1, "  STOLEN CARD!  ");
 			break;
 		case WRONG_CHECKPOINT:
-			scroll_text(1, unexpected, 250, 16);
+			scroll_text(0, 1, LCD_COLUMNS, "WRONG CHECKPOINT!", 250);
 			break;
 		case WRONG_TIME:
-			scroll_text(1, wrong_time, 250, 16);
+			scroll_text(0, 1, LCD_COLUMNS, "WRONG TIME OF SCAN!", 250);
 			break;
 		case NO_SHIFT_SCAN:
-			lcd.setCursor(0, 1);
-			lcd.print("NO ONGOING SHIFT");
+			lcd_put(0, 1, "NO ONGOING SHIFT");
 	}
+	lcd_flush();
 }
 
 /**
@@ -282,10 +517,20 @@ void display_invalid_scan(uint8_t reason)
 */
 void display_scan_time_elapsed()
 {
-	lcd.setCursor(0, 0);
-	lcd.print("SENTRY VERIFYING");
-	lcd.setCursor(0, 1);
-	lcd.print(" WINDOW PASSED! ");
+	lcd_put(0, 0, "SENTRY VERIFYING");
+	lcd_put(0, 1, " WINDOW PASSED! ");
+	lcd_flush();
+}
+
+/**
+ * display_transfer_count - retrieves the number of command/data bytes
+ *  sent to the LCD since startup, for measuring the bus load per loop
+ *
+ * Return: number of LCD byte transfers
+*/
+uint32_t display_transfer_count()
+{
+	return (lcd_transfers);
 }
 
 /**
@@ -293,14 +538,28 @@ void display_scan_time_elapsed()
  *
  * Return: Nothing
  *
- * Note: Wire.begin() should be called prior to this
+ * Note: hal_bus_init() should be called prior to this
 */
 void initialize_display()
 {
-	lcd.init();
-	lcd.backlight();
+#ifdef LCD_BENCHMARK
+	hal_lcd_benchmark();
+#endif
+
+	hal_bus_acquire(HAL_BUS_LCD);
+
+	hal_lcd_init();
 
 	/* saving the custom checkmark to the LCD's memory */
-	lcd.createChar((uint8_t)DISPLAY_SUCCESS, (byte *)check);
-	lcd.createChar((uint8_t)DISPLAY_FAILURE, (byte *)x_mark);
+	hal_lcd_create_char((uint8_t)DISPLAY_SUCCESS, check);
+	hal_lcd_create_char((uint8_t)DISPLAY_FAILURE, x_mark);
+
+	hal_lcd_commit();
+	hal_bus_release();
+
+	/* init() clears the LCD, so the glass starts out blank */
+	memset(lcd_shadow, ' ', sizeof(lcd_shadow));
+	memset(lcd_glass, ' ', sizeof(lcd_glass));
+	lcd_cursor_col = -1;
+	lcd_cursor_row = -1;
 }
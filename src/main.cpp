@@ -1,8 +1,9 @@
 #include <Arduino.h>
-#include <Wire.h>
-#include <SPI.h>
 #include "main.h"
 
+/* Hardware abstraction layer, owns the SPI and I2C buses */
+#include "hal.h"
+
 /* Functions for handling the WiFi connection */
 #include "my_wifi.h"
 
@@ -21,6 +22,21 @@
 /* Functions to interact with the alarm LED and buzzer */
 #include "alarm.h"
 
+/* SNTP-disciplined clock stamping the scans */
+#include "timesync.h"
+
+/* RFID acquisition, UI and network tasks */
+#include "tasks.h"
+
+/* Light sleep and the task rates of the low-power mode */
+#include "power.h"
+
+/* Broker settings saved from the config portal */
+#include "config.h"
+
+/* Time spent in each phase of the boot, kept across resets */
+#include "boot.h"
+
 /* checkpoint ID to send with a sentry scan */
 uint32_t CHECKPOINT_ID = 0;
 
@@ -38,73 +54,64 @@ volatile uint8_t alarm_reason;
  * Return: nothing
 */
 void setup() {
+	/* each phase of the boot is ended by its mark */
+	boot_mark(BOOT_PHASE_CORE);
+
 	Serial.begin(115200);
+	boot_mark(BOOT_PHASE_SERIAL);
 
 	/* initialise SPI, I2C, RFID, RTC and LCD comms */
 
-	SPI.begin();
+	hal_bus_init();	/* SPI for the RFID reader, I2C for the LCD and RTC */
+	boot_mark(BOOT_PHASE_BUS);
 	initialize_rfid();
-
-	Wire.begin();	/* For the LCD display and RTC_DS3231 */
+	boot_mark(BOOT_PHASE_RFID);
 	initialize_display();
+	boot_mark(BOOT_PHASE_DISPLAY);
 	initialize_RTC();
+	boot_mark(BOOT_PHASE_RTC);
 
 
 	/* setting up alarmLED and buzzer pins */
 	initialize_alarm();
+	boot_mark(BOOT_PHASE_ALARM);
+
+	/* settings saved from the config portal, before the first connection */
+	initialize_config();
+	boot_mark(BOOT_PHASE_CONFIG);
 
 	/* Setting Up wifi connection */
 	initialize_wifi();
+	boot_mark(BOOT_PHASE_WIFI);
 
 	/* some MQTT setup code, should run just once */
 	mqtt_setup_once();
+	boot_mark(BOOT_PHASE_MQTT);
+
+	/* scan clock, off the RTC until the first SNTP sync */
+	initialize_timesync();
+	boot_mark(BOOT_PHASE_TIMESYNC);
+
+	/* start the RFID, UI and network tasks */
+	initialize_tasks();
+	boot_mark(BOOT_PHASE_TASKS);
+
+	/* low-power mode, if selected, once the tasks run */
+	initialize_power();
+	boot_mark(BOOT_PHASE_POWER);
+
+	/* join the saved network last: "got IP" connects to MQTT */
+	wifi_start();
 }
 
 /**
  * loop - Repeatedly running code of the program
  *
  * Return: nothing
+ *
+ * Note: all the work happens in the tasks started by initialize_tasks()
 */
 void loop()
 {
-	/* if WiFi config mode button pressed */
-	check_wifi_config_requested();
-
-	if (alarm_on_off)
-	{
-		if (alarm_reason == OVERDUE_SCAN)
-			display_scan_time_elapsed();
-		else
-			display_invalid_scan(alarm_reason);
-		return;
-	}
-
-	/*
-		conditions with return statements:
-		running code below them is pointless hence early return, restart loop
-	*/
-
-	/* if both WiFi and MQTT connected, display check on both */
-	if (wifi_isConnected() && mqtt_isConnected())
-		display_default_text(DISPLAY_SUCCESS, DISPLAY_SUCCESS);
-
-	/* if only WiFi connected: display check on WiFi, X on MQTT */
-	else if (wifi_isConnected())
-	{
-		display_default_text(DISPLAY_SUCCESS, DISPLAY_FAILURE); return;
-	}
-
-	/* if neither connected: display X on both */
-	else
-	{
-		display_default_text(DISPLAY_FAILURE, DISPLAY_FAILURE); return;
-	}
-
-	/* Scanning any 'new' RFID card in the vicinity */
-	if (!rfid_read_new_card())
-		return;
-
-	display_scanning_verifying();
-
-	mqtt_send_scanned_card();
+	hal_loop_idle();
 }
@@ -1,22 +1,24 @@
 #include <Arduino.h>
+#include <atomic>
 #include "main.h"
 #include "mqtt.h"
+#include "mqtt_topics.h"
 #include "my_wifi.h"
-#include "lcd.h"
-#include "alarm.h"
-#include "rtc.h"
-#include "rfid.h"
-
-/*
- *	library to work with JSON data, used to send info to the backend server
- */
-#include <ArduinoJson.h>
-
-/*
- *	MQTT library helps with setting up the MQTT client
- *	and asynchronous connection handling
- */
-#include <AsyncMqttClient.h>
+#include "scan.h"
+#include "storage.h"
+#include "scan_seq.h"
+#include "journal.h"
+#include "verdict_cache.h"
+#include "trace.h"
+#include "boot.h"
+#include "backoff.h"
+#include "tasks.h"
+
+/* fixed-buffer encoders for the JSON messages sent to the backend server */
+#include "payload.h"
+
+/* asynchronous MQTT client, behind the hardware abstraction layer */
+#include "hal.h"
 
 /*
  *	Library for performing fixed interval operations in a
@@ -39,54 +41,101 @@ IPAddress broker_ip;
 /* flag indicating whether a domain name was given for the MQTT broker instead of an IP Address */
 bool domain = false;
 
-/* MQTT instantiations */
+/* encoding of published scan messages, chosen at configuration time */
+payload_format_t payload_format = PAYLOAD_FORMAT_JSON;
 
-/* asynchronous MQTT Client instance */
-static AsyncMqttClient mqtt_client;
+/* MQTT instantiations */
 
 /* created MQTT client's ID */
 char mqtt_client_id[MQTT_CLIENT_ID_MAX_LEN] = MQTT_CLIENT_ID_PREFIX;
 
-/* defining MQTT topics */
+/* MQTT client reconnection timer */
+static Ticker mqtt_reconnection_timer;
 
-/* subscribe topics */
+/* connection state, one of enum mqtt_state_e */
+static volatile uint8_t mqtt_state = MQTT_STATE_IDLE;
+/* consecutive failed connection attempts */
+static uint8_t mqtt_failed_attempts = 0;
+
+/* start of the current connection attempt [us] */
+static uint32_t attempt_started_micros = 0;
+/* subscriptions of the current connection awaiting acknowledgement */
+static volatile uint8_t subscribes_pending = 0;
+/*
+ * whether every subscription was acknowledged since boot: a session kept
+ * from before a reboot may predate this firmware's topics, so it is only
+ * trusted afterwards
+*/
+static bool subscribed_since_boot = false;
+/* whether the boot to first publish time was recorded */
+static bool published_since_boot = false;
 
-/* topic to receive the shift started/over message */
-#define SHIFT_ON_OFF "sentry-platform/backend-server/shift-status"
-/* topic to receive when a scan is overdue */
-#define CHKS_OVERDUE "sentry-platform/circuit-handler/overdue-scan"
-/* topic to receive alerts from the circuit handler */
-#define RESPONSE "sentry-platform/checkpoints/A/response"
-/* topic to receive alarm signal */
-#define ALARM "sentry-platform/backend-server/alarm"
+/* offline scan journal instantiations */
 
-/* publish topics */
+/* flash storage backing the offline scan journal */
+static storage_t journal_flash;
 
-/* topic to publish scanned sentry's information */
-#define SENTRY_SCAN_INFO "sentry-platform/checkpoints/sentry-scan-info"
-/* topic to publish connection status */
-#define CONNECTED "sentry-platform/checkpoints/connected"
-/* topic to publish a scan outside the shift */
-#define OUTSIDE_SHIFT_SCAN "sentry-platform/checkpoints/outside-shift-scan"
+/* flash storage backing the card verdict cache */
+static storage_t verdict_cache_flash;
 
-/* MQTT client reconnection timer */
-static Ticker mqtt_reconnection_timer;
+/* flash storage backing the scan sequence numbers */
+static storage_t scan_seq_flash;
 
-/* JSON instantiations */
+/* whether a live scan awaits its verdict, and since when */
+static volatile bool verdict_awaited = false;
+static volatile uint32_t verdict_awaited_millis = 0;
 
-/* JSON object to ferry connected info */
-static StaticJsonDocument<128> connected_to_mqtt;
+/*
+ * journal replay state, network task only: packet IDs of the batch
+ * awaiting acknowledgement, records of it published and acknowledged so
+ * far, and when it started [ms]
+*/
+static uint16_t replay_packet_ids[JOURNAL_REPLAY_BATCH];
+static uint8_t replay_sent = 0;
+static uint8_t replay_acked = 0;
+static unsigned long replay_started_millis = 0;
+/* set by the client's task on connection: start from a fresh batch */
+static std::atomic<bool> replay_restart(false);
+/*
+ * acknowledged packet IDs, pushed by the client's task and matched by the
+ * network task, which may not have recorded a batch's IDs when its first
+ * acknowledgements come
+*/
+static uint16_t replay_acks[JOURNAL_REPLAY_ACKS];
+static std::atomic<uint32_t> replay_acks_head(0);
+static std::atomic<uint32_t> replay_acks_tail(0);
+
+/* payload buffers, statically allocated so publishing never allocates */
+
+/* LWT payload, the client keeps a pointer to it so it must stay alive */
+static char will_payload[PAYLOAD_CONNECTED_MAX_LEN];
+/* connected status payload */
+static char connected_payload[PAYLOAD_CONNECTED_MAX_LEN];
+/* scan payload, JSON or binary depending on payload_format */
+static char scan_payload[PAYLOAD_SCAN_MAX_LEN];
+/* card table sync request payload */
+static char card_sync_payload[PAYLOAD_CARD_SYNC_MAX_LEN];
+/* diagnostics payload */
+static char diagnostics_payload[PAYLOAD_DIAGNOSTICS_MAX_LEN];
+/* boot report payload */
+static char boot_report_payload[PAYLOAD_BOOT_REPORT_MAX_LEN];
+
+/* time the diagnostics were last published [ms] */
+static unsigned long diagnostics_published_millis = 0;
 
 /* prototyping functions */
 
 /* WiFi and MQTT functions */
 
 static void on_mqtt_connect(bool);
-static void on_mqtt_disconnect(AsyncMqttClientDisconnectReason);
+static void on_mqtt_disconnect(int);
 static void on_mqtt_subscribe(uint16_t, uint8_t);
 static void on_mqtt_unsubscribe(uint16_t);
-static void on_mqtt_message(char *, char *, AsyncMqttClientMessageProperties, size_t, size_t, size_t);
+static void on_mqtt_message(const char *, const char *, size_t, size_t, size_t);
 static void on_mqtt_publish(uint16_t);
+static void build_topic_table(void);
+static void request_card_sync(void);
+static void attempt_connect(void);
 
 /**
  * mqtt_setup_once - MQTT client configs that should only be set once, at device startup
@@ -95,35 +144,64 @@ static void on_mqtt_publish(uint16_t);
 */
 void mqtt_setup_once()
 {
-	/* setting up Async MQTT client event-handling callback functions */
+	/* setting up the inbound topic dispatch table */
+	build_topic_table();
 
-	/* called handler when device connects to MQTT broker */
-	mqtt_client.onConnect(on_mqtt_connect);
-	/* handler for when device disconnects from MQTT broker */
-	mqtt_client.onDisconnect(on_mqtt_disconnect);
-	/* handler for when device subscribes to an MQTT topic */
-	mqtt_client.onSubscribe(on_mqtt_subscribe);
-	/* handler for when device unsubscribes from an MQTT topic */
-	mqtt_client.onUnsubscribe(on_mqtt_unsubscribe);
-	/* handler for when device receives a message published on any subscribed MQTT topic */
-	mqtt_client.onMessage(on_mqtt_message);
-	/* handler for when device publishes a message to an MQTT topic */
-	mqtt_client.onPublish(on_mqtt_publish);
+	/* setting up Async MQTT client event-handling callback functions */
+	static const hal_mqtt_callbacks_t callbacks = {
+		/* called handler when device connects to MQTT broker */
+		on_mqtt_connect,
+		/* handler for when device disconnects from MQTT broker */
+		on_mqtt_disconnect,
+		/* handler for when device subscribes to an MQTT topic */
+		on_mqtt_subscribe,
+		/* handler for when device unsubscribes from an MQTT topic */
+		on_mqtt_unsubscribe,
+		/* handler for when device receives a message published on any subscribed MQTT topic */
+		on_mqtt_message,
+		/* handler for when device publishes a message to an MQTT topic */
+		on_mqtt_publish
+	};
+
+	hal_mqtt_init(&callbacks);
 
 	/* setting a client ID, needed for final message retention */
-	mqtt_client.setClientId(mqtt_client_id);
+	hal_mqtt_set_client_id(mqtt_client_id);
 	/* setting up client keep-alive (heartbeat packet) timer */
-	mqtt_client.setKeepAlive(60);
+	hal_mqtt_set_keep_alive(60);
+	/* the broker keeps the session of the (stable) client ID, subscriptions included */
+	hal_mqtt_set_clean_session(false);
 
 	/* setting up LWT for the client in case of unprecedented disconnection */
-	connected_to_mqtt["id"] = mqtt_client_id; /* checkpoint */
-	connected_to_mqtt["connected"] = 0; /* connected to MQTT */
+	payload_encode_connected_json(will_payload, sizeof(will_payload),
+		mqtt_client_id, false);
+	hal_mqtt_set_will(CONNECTED, mqtt_qos_of(CONNECTED), true, will_payload);
+
+	/* setting up the offline scan journal, scans are only lost without it */
+	if (!hal_storage_open(&journal_flash, JOURNAL_PATH,
+			journal_storage_size()) || !journal_begin(&journal_flash))
+		Serial.println("Offline scan journal unavailable");
+	else
+	{
+		Serial.print("Journalled scans awaiting replay: ");
+		Serial.println(journal_pending());
+	}
 
-	/* serialising JSON object to JSON string */
-	String connection_info;
-	serializeJson(connected_to_mqtt, connection_info);
+	/* setting up the scan sequence numbers, they restart at 1 on every boot without it */
+	if (!hal_storage_open(&scan_seq_flash, SCAN_SEQ_PATH,
+			scan_seq_storage_size()) || !scan_seq_begin(&scan_seq_flash))
+		Serial.println("Scan sequence numbers not persisted");
 
-	mqtt_client.setWill(CONNECTED, 2, true, connection_info.c_str());
+	/* setting up the card verdict cache, verdicts then all come from the backend */
+	if (!hal_storage_open(&verdict_cache_flash, VERDICT_CACHE_PATH,
+			verdict_cache_storage_size()) ||
+			!verdict_cache_begin(&verdict_cache_flash))
+		Serial.println("Card verdict cache unavailable");
+	else
+	{
+		Serial.print("Cached cards: ");
+		Serial.println(verdict_cache_count());
+	}
 }
 
 /**
@@ -136,7 +214,11 @@ void mqtt_setup_repeated()
 	/* setting the MQTT client's credentials to connect to the server */
 
 	/* configuring the broker credentials into the client object to connect */
-	mqtt_client.setCredentials(broker_username, broker_password);
+	hal_mqtt_set_credentials(broker_username, broker_password);
+
+	/* the checkpoint ID may have changed, refresh the LWT in place */
+	payload_encode_connected_json(will_payload, sizeof(will_payload),
+		mqtt_client_id, false);
 
 	/*
 		set up with either domain name or IP Address,
@@ -145,35 +227,93 @@ void mqtt_setup_repeated()
 	if (domain)
 	{
 		Serial.println("using domain name");
-		mqtt_client.setServer(broker_host, 1883);
+		hal_mqtt_set_server_host(broker_host, 1883);
 	}
 	else if (!domain)
 	{
 		Serial.println("using IP address");
-		mqtt_client.setServer(broker_ip, 1883);
+		hal_mqtt_set_server_ip((uint32_t)broker_ip, 1883);
 	}
 }
 
 /**
- * connect_to_mqtt - connects the ESP MQTT client to the MQTT broker over WiFi
+ * attempt_connect - starts a connection attempt to the MQTT broker
  *
  * Return: Nothing
 */
-void connect_to_mqtt()
+static void attempt_connect()
 {
 	// display_connecting_to_mqtt();
 	Serial.println("Connecting to MQTT broker...");
-	mqtt_client.connect();
+	mqtt_state = MQTT_STATE_CONNECTING;
+	attempt_started_micros = micros();
+	hal_mqtt_connect();
+}
+
+/**
+ * connect_to_mqtt - connects the ESP MQTT client to the MQTT broker over
+ *  WiFi, retrying with backoff until mqtt_stop_reconnect()
+ *
+ * Return: Nothing
+*/
+void connect_to_mqtt()
+{
+	if (mqtt_state == MQTT_STATE_CONNECTING || mqtt_state == MQTT_STATE_CONNECTED)
+		return;
+
+	mqtt_reconnection_timer.detach();
+	mqtt_failed_attempts = 0;
+	attempt_connect();
 }
 
 /**
- * mqtt_stop_reconnect - stops the repetitive MQTT reconnection attempts
+ * mqtt_stop_reconnect - stops the MQTT reconnection attempts, called
+ *  when WiFi is lost
  *
  * Return: Nothing
 */
 void mqtt_stop_reconnect()
 {
 	mqtt_reconnection_timer.detach();
+	mqtt_state = MQTT_STATE_IDLE;
+}
+
+/**
+ * schedule_reconnect - schedules the next connection attempt after an
+ *  exponential backoff with full jitter
+ *
+ * Return: Nothing
+*/
+static void schedule_reconnect()
+{
+	uint32_t window = backoff_window(mqtt_failed_attempts,
+		MQTT_BACKOFF_BASE, MQTT_BACKOFF_CAP);
+	uint32_t delay_ms = random(window + 1);
+
+	if (mqtt_failed_attempts < 0xFF)
+		mqtt_failed_attempts++;
+
+	Serial.printf("Next MQTT attempt in %u ms\n", (unsigned int)delay_ms);
+
+	mqtt_state = MQTT_STATE_BACKOFF;
+	mqtt_reconnection_timer.once_ms(delay_ms, attempt_connect);
+}
+
+/**
+ * mqtt_ready - records the time from the connection attempt to the
+ *  subscriptions being in place
+ *
+ * @resumed: whether the broker kept the session
+ *
+ * Return: Nothing
+*/
+static void mqtt_ready(bool resumed)
+{
+	uint32_t elapsed = micros() - attempt_started_micros;
+
+	trace_record(TRACE_MQTT_READY, elapsed);
+	Serial.printf("MQTT ready in %u ms%s\n", (unsigned int)(elapsed / 1000),
+		resumed ? ", session resumed" : "");
 }
 
 /**
@@ -188,30 +328,75 @@ static void on_mqtt_connect(bool session_present)
 	Serial.println("Connected to MQTT!");
 	Serial.print("Session present: ");
 	Serial.println(session_present);
-	mqtt_stop_reconnect();
+	mqtt_reconnection_timer.detach();
+	mqtt_state = MQTT_STATE_CONNECTED;
+	mqtt_failed_attempts = 0;
 
-	/* publish to the web app that the device is MQTT (and WiFi) connected */
+	/* start replaying the offline journal from a fresh batch */
+	replay_restart.store(true);
 
-	connected_to_mqtt["id"] = mqtt_client_id; /* checkpoint */
+	/*
+	 * publish to the web app that the device is MQTT (and WiFi) connected,
+	 * even in a kept session: the broker published the LWT when it dropped
+	*/
 
-	connected_to_mqtt["connected"] = true; /* connected to MQTT */
+	payload_encode_connected_json(connected_payload,
+		sizeof(connected_payload), mqtt_client_id, true);
+	Serial.println(connected_payload);
 
-	/* serialising JSON object to JSON string */
+	hal_mqtt_publish(CONNECTED, mqtt_qos_of(CONNECTED), true, connected_payload,
+		strlen(connected_payload));
 
-	String connection_info;
-	serializeJson(connected_to_mqtt, connection_info);
-	Serial.println(connection_info.c_str());
+	/* the first message since boot: how long a power cycle keeps it offline */
+	if (!published_since_boot)
+	{
+		uint32_t boot_ms = millis();
+		size_t len;
+
+		published_since_boot = true;
+		trace_record(TRACE_BOOT_TO_PUBLISH,
+			boot_ms > UINT32_MAX / 1000 ? UINT32_MAX : boot_ms * 1000);
+		Serial.printf("Boot to first publish: %u ms\n", (unsigned int)boot_ms);
+
+		/* the boot is over, report where its time went, and the last ones' */
+		boot_mark(BOOT_PHASE_MQTT_UP);
+		len = payload_encode_boot_report_json(boot_report_payload,
+			sizeof(boot_report_payload), CHECKPOINT_ID);
+		if (len)
+		{
+			Serial.println(boot_report_payload);
+			hal_mqtt_publish(BOOT_REPORT, mqtt_qos_of(BOOT_REPORT), false,
+				boot_report_payload, len);
+		}
+	}
 
-	delayMicroseconds(3000000);
+	/* the broker kept the subscriptions, and queued what came in meanwhile */
+	if (session_present && subscribed_since_boot)
+		mqtt_ready(true);
+	else
+	{
+		/* subscribe to the relevant topics */
+		bool queued = true;
 
-	mqtt_client.publish(CONNECTED, 2, true, connection_info.c_str());
+		subscribed_since_boot = false;
+		subscribes_pending = 0;
+		for (size_t i = 0; i < TOPIC_QOS_COUNT; i++)
+		{
+			if (!topic_qos[i].subscribe)
+				continue;
+			if (hal_mqtt_subscribe(topic_qos[i].topic, topic_qos[i].qos))
+				subscribes_pending++;
+			else
+				queued = false;
+		}
 
-	/* subscribe to the relevant topics */
+		/* never ready, the next connection subscribes again */
+		if (!queued)
+			subscribes_pending = 0;
+	}
 
-	mqtt_client.subscribe(SHIFT_ON_OFF, 2);
-	mqtt_client.subscribe(RESPONSE, 2);
-	mqtt_client.subscribe(ALARM, 2);
-	mqtt_client.subscribe(CHKS_OVERDUE, 2);
+	/* catch up on the card updates missed while offline */
+	request_card_sync();
 }
 
 /**
@@ -221,13 +406,19 @@ static void on_mqtt_connect(bool session_present)
  *
  * Return: nothing
 */
-static void on_mqtt_disconnect(AsyncMqttClientDisconnectReason reason)
+static void on_mqtt_disconnect(int reason)
 {
 	Serial.println("Disconnected from MQTT.");
 	Serial.printf("Reason: %d\n", (int)reason);
 
-	if (wifi_isConnected())
-		mqtt_reconnection_timer.attach(MQTT_RECONNECT_ATTEMPT_PERIOD, connect_to_mqtt);
+	/* WiFi lost: reconnection resumes with it */
+	if (mqtt_state == MQTT_STATE_IDLE || !wifi_isConnected())
+	{
+		mqtt_state = MQTT_STATE_IDLE;
+		return;
+	}
+
+	schedule_reconnect();
 }
 
 /**
@@ -245,6 +436,12 @@ static void on_mqtt_subscribe(uint16_t packet_id, uint8_t qos)
 	Serial.println(packet_id);
 	Serial.print("  qos: ");
 	Serial.println(qos);
+
+	if (subscribes_pending && --subscribes_pending == 0)
+	{
+		subscribed_since_boot = true;
+		mqtt_ready(false);
+	}
 }
 
 /**
@@ -261,77 +458,283 @@ static void on_mqtt_unsubscribe(uint16_t packet_id)
 	Serial.println(packet_id);
 }
 
+/*
+ * inbound topic handlers, called with the fully reassembled payload from
+ * the MQTT client's task: anything touching the LCD or alarm is handed
+ * over to the UI task as an event
+*/
+
 /**
- * on_mqtt_message - event handler for post MQTT message reception actions
- *                   main controller for directing follow-up actions for messages received from subscriptions
+ * handle_shift_status - handles the shift started/over message
  *
- * @topic: MQTT topic on which message was posted
- * @payload: message contents
- * @properties: MQTT message properties (retain flag, QoS, etc)
- * @len: length of the MQTT payload string
- * @index: index of the incoming MQTT message
- * @total: total length of topic + payload
+ * @on: true if a shift has started, false if it is over
  *
  * Return: Nothing
 */
-static void on_mqtt_message(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total)
+static void handle_shift_status(bool on)
 {
-	Serial.println("Publish received.");
-	Serial.print("  topic: ");
-	Serial.println(topic);
+	/* also used to notify the checkpoints that the monitoring platform has disconnected from the broker */
+	/* reason could be that the server has gone down */
 
-	/* dumping the received bytearray payload into a string */
-	String message;
-	for (unsigned int i = 0; i < len; i++)
-		message += (char)payload[i];
+	shift_status = on; /* set shift to 'ongoing'/'over' */
+	post_event(&mqtt_ui_queue, TASK_UI, EVENT_SHIFT, on); /* deactivates the alarm when over */
+}
 
-	Serial.println(message);
+/**
+ * handle_alarm - handles the alarm triggered/silenced message
+ *
+ * @on: true if the alarm is triggered, false if it is silenced
+ *
+ * Return: Nothing
+*/
+static void handle_alarm(bool on)
+{
+	Serial.println(on ? "alarm triggered" : "alarm silenced");
+	post_event(&mqtt_ui_queue, TASK_UI, EVENT_ALARM, on);
+}
 
-	/* checking the topic on which the incoming message was published */
-	if (!strcmp(topic, SHIFT_ON_OFF))
+/**
+ * handle_overdue_scan - handles the overdue scan notification
+ *
+ * Return: Nothing
+*/
+static void handle_overdue_scan()
+{
+	post_event(&mqtt_ui_queue, TASK_UI, EVENT_OVERDUE, 0);
+}
+
+/**
+ * handle_response - handles the sentry platform's verdict on a scan
+ *
+ * @code: verdict, one of enum alerts_e
+ *
+ * Return: Nothing
+*/
+static void handle_response(uint32_t code)
+{
+	/* RESPONSE is shared by the fleet, and a resumed session replays it */
+	if (!verdict_awaited || millis() - verdict_awaited_millis >= MQTT_VERDICT_TIMEOUT)
 	{
-		if (message == "ON")
-			shift_status = true;
-		else
-		{
-			/* also used to notify the checkpoints that the monitoring platform has disconnected from the broker */
-			/* reason could be that the server has gone down */
+		Serial.printf("Verdict %u not awaited, ignored\n", (unsigned int)code);
+		return;
+	}
 
-			shift_status = false; /* set shift to 'over' */
-			silence_alarm(); /* deactivate the alarm */
-		}
+	verdict_awaited = false;
+	trace_verdict();
+	post_event(&mqtt_ui_queue, TASK_UI, EVENT_VERDICT, code);
+}
+
+/**
+ * request_card_sync - asks the backend for the card updates following the
+ *  verdict cache's version, or a full snapshot if the cache is empty
+ *
+ * Return: Nothing
+*/
+static void request_card_sync()
+{
+	size_t len = payload_encode_card_sync_json(card_sync_payload,
+		sizeof(card_sync_payload), CHECKPOINT_ID, verdict_cache_version());
+
+	if (len)
+		hal_mqtt_publish(CARD_SYNC, mqtt_qos_of(CARD_SYNC), false,
+			card_sync_payload, len);
+}
+
+/**
+ * handle_card_updates - applies a card table update to the verdict cache
+ *
+ * @payload: update message, see verdict_cache.h, not null-terminated
+ * @len: length of the payload
+ *
+ * Return: Nothing
+*/
+static void handle_card_updates(const char *payload, size_t len)
+{
+	switch (verdict_cache_update(payload, len))
+	{
+		case VERDICT_UPDATE_APPLIED:
+			Serial.printf("Card cache at version %u, %u cards\n",
+				(unsigned int)verdict_cache_version(),
+				(unsigned int)verdict_cache_count());
+			break;
+		case VERDICT_UPDATE_GAP:
+			request_card_sync();
+			break;
+		case VERDICT_UPDATE_INVALID:
+			Serial.println("Malformed card update ignored");
+			break;
+		case VERDICT_UPDATE_STALE:
+			break;
 	}
+}
+
+/**
+ * topic_hash - FNV-1a hash of a topic, evaluated at compile time for
+ *  the topic macros
+ *
+ * @topic: topic string
+ * @hash: hash of the characters before @topic
+ *
+ * Return: 32-bit hash of the topic
+*/
+static constexpr uint32_t topic_hash(const char *topic, uint32_t hash = 2166136261u)
+{
+	return (*topic ? topic_hash(topic + 1, (hash ^ (uint8_t)*topic) * 16777619u) : hash);
+}
+
+/**
+ * struct topic_route_s - routes an inbound topic to its typed handler,
+ *  exactly one of the handlers is set and decides how the payload is parsed
+ *
+ * @hash: compile-time hash of @topic
+ * @topic: subscribed topic
+ * @on_off: handler for "ON"/"OFF" payloads
+ * @code: handler for numeric payloads
+ * @notify: handler for topics whose payload is irrelevant
+ * @raw: handler parsing the payload itself
+*/
+typedef struct topic_route_s
+{
+	uint32_t hash;
+	const char *topic;
+	void (*on_off)(bool);
+	void (*code)(uint32_t);
+	void (*notify)(void);
+	void (*raw)(const char *, size_t);
+} topic_route_t;
+
+/* inbound topics and their handlers, a new topic only needs a new entry */
+static const topic_route_t topic_routes[] = {
+	{topic_hash(SHIFT_ON_OFF), SHIFT_ON_OFF, handle_shift_status, NULL, NULL, NULL},
+	{topic_hash(ALARM), ALARM, handle_alarm, NULL, NULL, NULL},
+	{topic_hash(CHKS_OVERDUE), CHKS_OVERDUE, NULL, NULL, handle_overdue_scan, NULL},
+	{topic_hash(RESPONSE), RESPONSE, NULL, handle_response, NULL, NULL},
+	{topic_hash(CARD_UPDATES), CARD_UPDATES, NULL, NULL, NULL, handle_card_updates},
+};
+
+#define TOPIC_ROUTES_COUNT (sizeof(topic_routes) / sizeof(topic_routes[0]))
+
+/* open-addressed hash table of topic_routes, indexed by topic hash */
+static const topic_route_t *topic_table[MQTT_TOPIC_TABLE_SIZE];
+
+static_assert((MQTT_TOPIC_TABLE_SIZE & (MQTT_TOPIC_TABLE_SIZE - 1)) == 0,
+	"MQTT_TOPIC_TABLE_SIZE must be a power of two");
+static_assert(TOPIC_ROUTES_COUNT < MQTT_TOPIC_TABLE_SIZE,
+	"MQTT_TOPIC_TABLE_SIZE too small for the inbound topics");
+
+/* reassembly buffer for inbound payloads delivered in fragments */
+static char rx_payload[MQTT_RX_PAYLOAD_MAX_LEN];
+
+/*
+ * cache version a card sync was requested from after dropping an oversized
+ * card update, not requested again from it should the backend resend it
+*/
+static bool card_update_dropped = false;
+static uint32_t card_update_dropped_version = 0;
 
-	else if (!strcmp(topic, ALARM))
+/**
+ * build_topic_table - fills the topic hash table from topic_routes
+ *
+ * Return: Nothing
+*/
+static void build_topic_table()
+{
+	memset(topic_table, 0, sizeof(topic_table));
+
+	for (size_t i = 0; i < TOPIC_ROUTES_COUNT; i++)
 	{
-		if (message == "ON")
-		{
-			Serial.println("alarm triggered");
-			trigger_alarm();
-		}
-		else
-		{
-			alarm_reason = 0;
-			Serial.println("alarm silenced");
-			silence_alarm();
-		}
+		uint32_t slot = topic_routes[i].hash & (MQTT_TOPIC_TABLE_SIZE - 1);
+
+		while (topic_table[slot])
+			slot = (slot + 1) & (MQTT_TOPIC_TABLE_SIZE - 1);
+		topic_table[slot] = &topic_routes[i];
 	}
+}
+
+/**
+ * find_topic_route - looks up the route of an inbound topic
+ *
+ * @topic: topic the message was published on
+ *
+ * Return: matching route, NULL if the topic is not handled
+*/
+static const topic_route_t *find_topic_route(const char *topic)
+{
+	uint32_t hash = topic_hash(topic);
+	uint32_t slot = hash & (MQTT_TOPIC_TABLE_SIZE - 1);
 
-	else if (!strcmp(topic, CHKS_OVERDUE))
+	for (; topic_table[slot]; slot = (slot + 1) & (MQTT_TOPIC_TABLE_SIZE - 1))
 	{
-		alarm_reason = 6;
+		/* a single strcmp guards against hash collisions */
+		if (topic_table[slot]->hash == hash &&
+				!strcmp(topic_table[slot]->topic, topic))
+			return (topic_table[slot]);
 	}
 
-	else if (!strcmp(topic, RESPONSE))
+	return (NULL);
+}
+
+/**
+ * on_mqtt_message - event handler for post MQTT message reception actions
+ *                   main controller for directing follow-up actions for messages received from subscriptions
+ *
+ * @topic: MQTT topic on which message was posted
+ * @payload: message contents, or a fragment of them
+ * @len: length of this payload fragment
+ * @index: offset of this fragment in the whole payload
+ * @total: total length of the payload
+ *
+ * Return: Nothing
+ *
+ * Note: large payloads arrive in several calls, they are reassembled into
+ *  rx_payload and only dispatched once complete
+*/
+static void on_mqtt_message(const char *topic, const char *payload, size_t len, size_t index, size_t total)
+{
+	/* payloads that cannot fit are dropped, fragment by fragment */
+	if (total > sizeof(rx_payload) || index + len > total)
 	{
-		uint8_t code = atoi(message.c_str());
+		if (index != 0)
+			return;
 
-		if (code == 1)
-		/* set flag to display success message on the LCD screen */
-			display_valid_scan();
-		else
-			alarm_reason = code;
+		Serial.printf("Dropped %u byte payload on %s\n", (unsigned int)total, topic);
+
+		/* a dropped card update is a missed one, catch up on it */
+		if (!strcmp(topic, CARD_UPDATES) && !(card_update_dropped &&
+				card_update_dropped_version == verdict_cache_version()))
+		{
+			card_update_dropped = true;
+			card_update_dropped_version = verdict_cache_version();
+			request_card_sync();
+		}
+		return;
 	}
+
+	memcpy(&rx_payload[index], payload, len);
+
+	/* wait for the remaining fragments */
+	if (index + len < total)
+		return;
+
+	Serial.println("Publish received.");
+	Serial.print("  topic: ");
+	Serial.println(topic);
+	Serial.printf("%.*s\n", (int)total, rx_payload);
+
+	/* checking the topic on which the incoming message was published */
+	const topic_route_t *route = find_topic_route(topic);
+
+	if (!route)
+		return;
+
+	if (route->on_off)
+		route->on_off(mqtt_parse_on_off(rx_payload, total));
+	else if (route->code)
+		route->code(mqtt_parse_code(rx_payload, total));
+	else if (route->notify)
+		route->notify();
+	else if (route->raw)
+		route->raw(rx_payload, total);
 }
 
 /**
@@ -346,6 +749,18 @@ static void on_mqtt_publish(uint16_t packet_id)
 	Serial.print("Publish acknowledged.");
 	Serial.print(" packet ID: ");
 	Serial.println(packet_id);
+
+	trace_acked(packet_id);
+
+	/* hand it to the network task, to count against the replay batch */
+	uint32_t head = replay_acks_head.load(std::memory_order_relaxed);
+
+	if (head - replay_acks_tail.load(std::memory_order_acquire) >=
+		JOURNAL_REPLAY_ACKS)
+		return;
+
+	replay_acks[head & (JOURNAL_REPLAY_ACKS - 1)] = packet_id;
+	replay_acks_head.store(head + 1, std::memory_order_release);
 }
 
 /**
@@ -355,44 +770,180 @@ static void on_mqtt_publish(uint16_t packet_id)
 */
 bool mqtt_isConnected()
 {
-	return mqtt_client.connected();
+	return hal_mqtt_connected();
 }
 
 /**
- * mqtt_send_scanned_card - sends a scanned card in the global card_id
- *  to the sentry platform for verifying
+ * publish_scan - publishes a scan record to the sentry platform
  *
- * Return: Nothing
+ * @record: scan to publish
+ *
+ * Return: packet ID of the publish, 0 if it could not be queued
 */
-void mqtt_send_scanned_card()
+static uint16_t publish_scan(const scan_record_t *record)
 {
-	/* JSON object to store the checkpoint ID, RFID UID and time of scan */
-	static StaticJsonDocument<128> sentry_scan_info;
+	size_t len;
 
-	/* extracting the current epoch time */
-	DateTime now = get_time_now();
+	/* encoding the checkpoint's ID, scanned RFID UID and time of scan (epoch) */
+	if (payload_format == PAYLOAD_FORMAT_BINARY)
+		len = payload_encode_scan_binary((uint8_t *)scan_payload,
+			sizeof(scan_payload), CHECKPOINT_ID, record);
+	else
+		len = payload_encode_scan_json(scan_payload,
+			sizeof(scan_payload), CHECKPOINT_ID, record);
 
-	/* saving the checkpoint's ID, scanned RFID UID and time of scan (epoch) into a JSON object */
+	if (!len)
+		return (0);
 
-	sentry_scan_info["checkpoint-id"] = CHECKPOINT_ID; /* checkpoint */
-	sentry_scan_info["sentry-id"] = card_id; /* RFID UID */
-	sentry_scan_info["scan-time"] = now.unixtime() + 20; /* epoch time of scan */
+	/* if scan not during shift - PROBLEM */
+	if (record->outside_shift)
+		return (hal_mqtt_publish(OUTSIDE_SHIFT_SCAN, mqtt_qos_of(OUTSIDE_SHIFT_SCAN),
+			false, scan_payload, len));
 
-	/* serialising JSON object to JSON string */
-	String sent_sentry_info;
-	serializeJson(sentry_scan_info, sent_sentry_info);
+	return (hal_mqtt_publish(SENTRY_SCAN_INFO, mqtt_qos_of(SENTRY_SCAN_INFO),
+		false, scan_payload, len));
+}
 
-	/*
-		publish - (required) convert JSON string to byte(char) array before publish
-		String.c_str() = const char*
-	*/
+/**
+ * mqtt_send_scanned_card - sends a scan to the sentry platform for
+ *  verifying, or journals it while offline
+ *
+ * @record: scan to send
+ *
+ * Return: packet ID of the publish, 0 if the scan was journalled instead
+*/
+uint16_t mqtt_send_scanned_card(const scan_record_t *record)
+{
+	uint16_t packet_id = 0;
 
-	/* if scan not during shift - PROBLEM */
-	if (!shift_status)
+	if (hal_mqtt_connected())
+		packet_id = publish_scan(record);
+
+	if (packet_id)
 	{
-		mqtt_client.publish(OUTSIDE_SHIFT_SCAN, 2, false, sent_sentry_info.c_str());
-		alarm_reason = NO_SHIFT_SCAN;
+		verdict_awaited_millis = millis();
+		verdict_awaited = true;
 	}
+	/* keep the scan for replay on reconnection */
 	else
-		mqtt_client.publish(SENTRY_SCAN_INFO, 2, false, sent_sentry_info.c_str());
+	{
+		if (journal_append(record))
+			Serial.println("Offline: scan journalled");
+		else
+			Serial.println("Offline: scan lost, journal unavailable");
+	}
+
+	return (packet_id);
+}
+
+/**
+ * mqtt_replay_journal - publishes scans journalled while offline in
+ *  batches, waiting for a batch to be acknowledged before the next one
+ *
+ * Return: Nothing
+ *
+ * Note: called on every loop after live scans are handled, so a large
+ *  backlog never delays a live scan by more than one batch
+*/
+void mqtt_replay_journal()
+{
+	scan_record_t record;
+	uint32_t tail = replay_acks_tail.load(std::memory_order_relaxed);
+	uint32_t head = replay_acks_head.load(std::memory_order_acquire);
+
+	/* reconnected: the batch in flight and its acknowledgements are void */
+	if (replay_restart.exchange(false))
+	{
+		replay_sent = replay_acked = 0;
+		tail = head;
+	}
+
+	/* count acknowledgements of the journal replay batch */
+	for (; tail != head; tail++)
+	{
+		uint16_t packet_id = replay_acks[tail & (JOURNAL_REPLAY_ACKS - 1)];
+
+		for (uint8_t i = 0; i < replay_sent; i++)
+		{
+			if (replay_packet_ids[i] == packet_id)
+			{
+				replay_packet_ids[i] = 0;
+				replay_acked++;
+				break;
+			}
+		}
+	}
+	replay_acks_tail.store(tail, std::memory_order_release);
+
+	if (!hal_mqtt_connected())
+		return;
+
+	/* current batch still in flight */
+	if (replay_sent > 0)
+	{
+		if (replay_acked < replay_sent)
+		{
+			/* lost acknowledgement, resend the batch */
+			if (millis() - replay_started_millis >= JOURNAL_REPLAY_TIMEOUT)
+				replay_sent = replay_acked = 0;
+			return;
+		}
+
+		journal_consume(replay_sent);
+		replay_sent = replay_acked = 0;
+	}
+
+	uint32_t batch = min(journal_pending(), (uint32_t)JOURNAL_REPLAY_BATCH);
+
+	if (batch == 0)
+		return;
+
+	replay_started_millis = millis();
+
+	for (uint32_t i = 0; i < batch; i++)
+	{
+		/* unreadable slot, consume it with the rest of the batch */
+		if (!journal_peek(i, &record))
+		{
+			replay_packet_ids[i] = 0;
+			replay_sent++;
+			replay_acked++;
+			continue;
+		}
+
+		uint16_t packet_id = publish_scan(&record);
+
+		/* client's outgoing buffer is full, continue with the next batch */
+		if (!packet_id)
+			break;
+
+		replay_packet_ids[i] = packet_id;
+		replay_sent++;
+	}
+}
+
+/**
+ * mqtt_publish_diagnostics - publishes the scan latency histograms and
+ *  I2C bus usage every TRACE_PUBLISH_PERIOD
+ *
+ * Return: Nothing
+*/
+void mqtt_publish_diagnostics()
+{
+	hal_bus_stats_t bus;
+	size_t len;
+
+	if (!hal_mqtt_connected() ||
+			millis() - diagnostics_published_millis < TRACE_PUBLISH_PERIOD)
+		return;
+
+	diagnostics_published_millis = millis();
+	hal_bus_stats(&bus);
+
+	len = payload_encode_diagnostics_json(diagnostics_payload,
+		sizeof(diagnostics_payload), CHECKPOINT_ID, millis() / 1000, &bus);
+
+	if (len)
+		hal_mqtt_publish(DIAGNOSTICS, mqtt_qos_of(DIAGNOSTICS), false,
+			diagnostics_payload, len);
 }
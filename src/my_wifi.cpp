@@ -1,12 +1,23 @@
 #include <Arduino.h>
 
 #include "main.h"
+#include "my_wifi.h"
 #include "mqtt.h"
 #include "lcd.h"
-#include "alarm.h"
+#include "tasks.h"
+#include "hal.h"
+#include "power.h"
+#include "config.h"
+#include "storage.h"
+#include "crc16.h"
+#include "trace.h"
+#include "boot.h"
 
 /* necessary WiFi library */
 #include <WiFi.h>
+#include <driver/gpio.h>
+#include <hal/gpio_ll.h>
+#include <Ticker.h>
 
 /*
  *  WiFi Manager to help with setting WiFi credentials at runtime
@@ -16,9 +27,12 @@
 
 /* object instantiation for WiFi Manager setup */
 
+/* times the constructors below, the startup until here is the core's */
+static boot_mark_t portal_ctors_start(BOOT_PHASE_CORE);
 static AsyncWebServer server(80);
 static DNSServer dns;
 static AsyncWiFiManager wifi_manager(&server, &dns);
+static boot_mark_t portal_ctors_end(BOOT_PHASE_CTOR_PORTAL);
 
 /* custom WiFi Manager parameters to capture MQTT broker info */
 
@@ -43,6 +57,12 @@ static AsyncWiFiManagerParameter mqtt_pass(
 /* Checkpoint ID form field */
 static AsyncWiFiManagerParameter checkpoint_id(
 	"checkpoint-id", "Checkpoint ID", NULL, (MQTT_CLIENT_ID_MAX_LEN - MQTT_CLIENT_ID_PREFIX_LEN));
+/* scan payload format form field: "json" (default) or "binary" */
+static AsyncWiFiManagerParameter scan_format(
+	"scan-format", "Scan format (json/binary)", "json", MQTT_PAYLOAD_FORMAT_MAX_LEN);
+/* power mode form field: "normal" (default) or "low" */
+static AsyncWiFiManagerParameter power_mode_param(
+	"power-mode", "Power mode (normal/low)", "normal", POWER_MODE_MAX_LEN);
 
 /* initialising variables to handle WiFi disconnection */
 
@@ -65,6 +85,292 @@ volatile bool configured = false;
 /* launch WiFi config interrupt flag */
 volatile bool config = false;
 
+/* config button interrupt masked until the button is released */
+static volatile bool config_button_masked = false;
+
+/* fast reconnection to the last access point */
+
+/* key of the cached access point and lease in the settings storage (NVS) */
+#define WIFI_CACHE_KEY          "wifi-cache"
+/* layout version of the cache, bump it when the record changes */
+#define WIFI_CACHE_VERSION      1
+
+/**
+ * struct wifi_cache_s - last access point the checkpoint got an IP
+ *  address from, connected to directly without scanning
+ *
+ * @version: WIFI_CACHE_VERSION, anything else is an invalid cache
+ * @crc: CRC16 over the rest of the record
+ * @ssid: network name
+ * @psk: network passphrase
+ * @bssid: access point's MAC address
+ * @channel: access point's channel
+ * @reserved: zero
+ * @ip: leased IPv4 address, as stored in an IPAddress
+ * @gateway: gateway's address
+ * @subnet: subnet mask
+ * @dns: DNS server's address
+*/
+typedef struct wifi_cache_s
+{
+	uint16_t version;
+	uint16_t crc;
+	char ssid[33];
+	char psk[65];
+	uint8_t bssid[6];
+	uint8_t channel;
+	uint8_t reserved;
+	uint32_t ip;
+	uint32_t gateway;
+	uint32_t subnet;
+	uint32_t dns;
+} wifi_cache_t;
+
+/* settings storage of the cache, size 0 if unavailable */
+static storage_t wifi_cache_storage;
+/* cache as last loaded or stored */
+static wifi_cache_t wifi_cache;
+static bool wifi_cache_valid = false;
+
+/*
+ * falls back to a full scan if the direct connection does not come up:
+ * the timer only flags it, the UI task does it, off the timer task
+*/
+static Ticker wifi_fallback_timer;
+static volatile bool wifi_fallback_pending = false;
+
+/* whether the driver is set to join the cached access point directly */
+static bool wifi_pinned = false;
+
+/* current connection: when it started [us], whether to the cached AP */
+static uint32_t wifi_connect_micros = 0;
+static bool wifi_connecting = false;
+static bool wifi_connecting_fast = false;
+/* association time of the current connection [ms] */
+static uint32_t wifi_associated_ms = 0;
+
+/**
+ * wifi_cache_crc - computes the checksum of a cache record
+ *
+ * @cache: cache record
+ *
+ * Return: CRC16 over the record past its header
+*/
+static uint16_t wifi_cache_crc(const wifi_cache_t *cache)
+{
+	return (crc16(cache->ssid, sizeof(*cache) - offsetof(wifi_cache_t, ssid)));
+}
+
+/**
+ * wifi_cache_load - opens the settings storage and reads the cache
+ *
+ * Return: Nothing
+*/
+static void wifi_cache_load()
+{
+	if (!hal_settings_open(&wifi_cache_storage, WIFI_CACHE_KEY,
+			sizeof(wifi_cache_t)))
+	{
+		wifi_cache_storage.size = 0;
+		return;
+	}
+
+	wifi_cache_valid = wifi_cache_storage.read(wifi_cache_storage.ctx, 0,
+			&wifi_cache, sizeof(wifi_cache)) &&
+		wifi_cache.version == WIFI_CACHE_VERSION &&
+		wifi_cache.crc == wifi_cache_crc(&wifi_cache);
+}
+
+/**
+ * wifi_cache_store - caches the access point and lease of the current
+ *  connection, if they changed
+ *
+ * Return: Nothing
+*/
+static void wifi_cache_store()
+{
+	wifi_cache_t cache;
+	uint8_t *bssid = WiFi.BSSID();
+
+	if (!bssid)
+		return;
+
+	/* zeroed padding, for the CRC and the comparison */
+	memset(&cache, 0, sizeof(cache));
+	cache.version = WIFI_CACHE_VERSION;
+	strncpy(cache.ssid, WiFi.SSID().c_str(), sizeof(cache.ssid) - 1);
+	strncpy(cache.psk, WiFi.psk().c_str(), sizeof(cache.psk) - 1);
+	memcpy(cache.bssid, bssid, sizeof(cache.bssid));
+	cache.channel = WiFi.channel();
+	cache.ip = (uint32_t)WiFi.localIP();
+	cache.gateway = (uint32_t)WiFi.gatewayIP();
+	cache.subnet = (uint32_t)WiFi.subnetMask();
+	cache.dns = (uint32_t)WiFi.dnsIP(0);
+	cache.crc = wifi_cache_crc(&cache);
+
+	/* NVS wears: only rewrite it when the network changes */
+	if (wifi_cache_valid && !memcmp(&cache, &wifi_cache, sizeof(cache)))
+		return;
+
+	wifi_cache = cache;
+	wifi_cache_valid = true;
+	if (wifi_cache_storage.size)
+		wifi_cache_storage.write(wifi_cache_storage.ctx, 0, &cache,
+			sizeof(cache));
+}
+
+/**
+ * wifi_cache_invalidate - forgets the cached access point, the next
+ *  connection scans
+ *
+ * Return: Nothing
+*/
+static void wifi_cache_invalidate()
+{
+	uint16_t version = 0;
+
+	if (!wifi_cache_valid)
+		return;
+
+	wifi_cache_valid = false;
+	if (wifi_cache_storage.size)
+		wifi_cache_storage.write(wifi_cache_storage.ctx, 0, &version,
+			sizeof(version));
+}
+
+/**
+ * wifi_apply_ip - sets the station's IP configuration: the static IP if
+ *  one is built in, else the cached lease if WIFI_REUSE_LEASE, else DHCP
+ *
+ * @lease: cache whose lease to reuse, NULL for DHCP
+ *
+ * Return: Nothing
+*/
+static void wifi_apply_ip(const wifi_cache_t *lease)
+{
+#ifdef WIFI_STATIC_IP
+	IPAddress ip, gateway, subnet, dns;
+
+	(void)lease;
+	ip.fromString(WIFI_STATIC_IP);
+	gateway.fromString(WIFI_STATIC_GATEWAY);
+	subnet.fromString(WIFI_STATIC_SUBNET);
+	dns.fromString(WIFI_STATIC_DNS);
+	WiFi.config(ip, gateway, subnet, dns);
+#else
+	if (WIFI_REUSE_LEASE && lease && lease->ip)
+		WiFi.config(IPAddress(lease->ip), IPAddress(lease->gateway),
+			IPAddress(lease->subnet), IPAddress(lease->dns));
+	/* all zeroes: back to DHCP */
+	else
+		WiFi.config(IPAddress(), IPAddress(), IPAddress());
+#endif
+}
+
+/**
+ * wifi_timing_start - starts timing a connection
+ *
+ * @fast: whether it is a direct connection to the cached access point
+ *
+ * Return: Nothing
+*/
+static void wifi_timing_start(bool fast)
+{
+	wifi_connect_micros = micros();
+	wifi_associated_ms = 0;
+	wifi_connecting = true;
+	wifi_connecting_fast = fast;
+}
+
+/**
+ * wifi_fallback_due - wifi_fallback_timer callback: has the UI task fall
+ *  back to a full scan, WIFI_FAST_CONNECT_TIMEOUT after a direct
+ *  connection started
+ *
+ * Return: Nothing
+*/
+static void wifi_fallback_due()
+{
+	wifi_fallback_pending = true;
+	hal_task_notify(TASK_UI);
+}
+
+/**
+ * wifi_fallback - gives up on the cached access point and scans, unless
+ *  the connection came up meanwhile
+ *
+ * Return: Nothing
+*/
+static void wifi_fallback()
+{
+	if (WiFi.isConnected())
+		return;
+
+	Serial.printf("No connection to the cached access point in %u ms, scanning\n",
+		(unsigned int)((micros() - wifi_connect_micros) / 1000));
+
+	wifi_cache_invalidate();
+	wifi_apply_ip(NULL);
+	wifi_pinned = false;
+	wifi_timing_start(false);
+
+	/* no BSSID or channel: scans all channels for the network */
+	WiFi.disconnect();
+	WiFi.begin(wifi_cache.ssid, wifi_cache.psk);
+}
+
+/**
+ * wifi_connect - joins the saved network, directly to the cached access
+ *  point when there is one (reusing its lease if WIFI_REUSE_LEASE), with
+ *  a full scan otherwise
+ *
+ * Return: Nothing
+*/
+static void wifi_connect()
+{
+	if (!wifi_cache_valid)
+	{
+		wifi_apply_ip(NULL);
+		wifi_timing_start(false);
+		WiFi.begin();
+		return;
+	}
+
+	wifi_apply_ip(&wifi_cache);
+	wifi_pinned = true;
+	wifi_timing_start(true);
+	WiFi.begin(wifi_cache.ssid, wifi_cache.psk, wifi_cache.channel,
+		wifi_cache.bssid);
+	wifi_fallback_timer.once_ms(WIFI_FAST_CONNECT_TIMEOUT, wifi_fallback_due);
+}
+
+/**
+ * wifi_connected - logs the phases of the connection that just got its
+ *  IP address and caches its access point
+ *
+ * Return: Nothing
+*/
+static void wifi_connected()
+{
+	uint32_t elapsed = micros() - wifi_connect_micros;
+
+	wifi_fallback_timer.detach();
+	wifi_fallback_pending = false;
+	wifi_cache_store();
+	boot_mark(BOOT_PHASE_WIFI_UP);
+
+	if (!wifi_connecting)
+		return;
+	wifi_connecting = false;
+
+	trace_record(TRACE_WIFI_CONNECT, elapsed);
+	Serial.printf("WiFi up in %u ms (%s): associated in %u ms, IP in %u ms\n",
+		(unsigned int)(elapsed / 1000),
+		wifi_connecting_fast ? "cached access point" : "scan",
+		(unsigned int)wifi_associated_ms,
+		(unsigned int)(elapsed / 1000 - wifi_associated_ms));
+}
+
 /**
  * set_broker_credentials - saves the received broker credentials into
  *  defined global variables
@@ -80,6 +386,12 @@ static void set_broker_credentials()
 	/* save checkpoint ID */
 	strncpy(&(mqtt_client_id[MQTT_CLIENT_ID_PREFIX_LEN]), checkpoint_id.getValue(), checkpoint_id.getValueLength());
 	CHECKPOINT_ID = atoi(&(mqtt_client_id[MQTT_CLIENT_ID_PREFIX_LEN]));
+	/* save scan payload format, anything but "binary" keeps JSON */
+	payload_format = strcasecmp(scan_format.getValue(), "binary") ?
+		PAYLOAD_FORMAT_JSON : PAYLOAD_FORMAT_BINARY;
+	/* save power mode, anything but "low" runs at full speed */
+	power_set_mode(strcasecmp(power_mode_param.getValue(), "low") ?
+		POWER_MODE_NORMAL : POWER_MODE_LOW);
 
 	/*
 		test for broker identity - domain name or IP address
@@ -119,6 +431,9 @@ static void set_broker_credentials()
 	Serial.println(broker_password);
 	Serial.println(broker_ip);
 
+	/* keep the settings for the next boot */
+	config_save();
+
 	/* some MQTT setup code, should be run with every WiFi connection */
 	mqtt_setup_repeated();
 
@@ -139,6 +454,15 @@ static void configure_wifi()
 {
 	wifi_manager.resetSettings();
 
+	/* the portal picks the network: no cached access point or lease */
+	wifi_fallback_timer.detach();
+	wifi_fallback_pending = false;
+	wifi_cache_invalidate();
+	wifi_apply_ip(NULL);
+	wifi_pinned = false;
+	/* waits on the user, not timed */
+	wifi_connecting = false;
+
 	domain = false;
 	configured = false;
 
@@ -210,6 +534,10 @@ void setup_wifi_manager()
 	wifi_manager.addParameter(&mqtt_pass);
 	/* add Checkpoint ID text field */
 	wifi_manager.addParameter(&checkpoint_id);
+	/* add scan payload format text field */
+	wifi_manager.addParameter(&scan_format);
+	/* add power mode text field */
+	wifi_manager.addParameter(&power_mode_param);
 }
 
 /**
@@ -227,12 +555,16 @@ static void wifi_event(WiFiEvent_t event)
 	{
 		case ARDUINO_EVENT_WIFI_STA_CONNECTED:
 			Serial.println("Connected to WiFi!");
-			silence_alarm();
+			/* silences the alarm */
+			post_event(&wifi_ui_queue, TASK_UI, EVENT_WIFI, 1);
 
 			/* reset the reconnection flag if set */
 			if (reconnecting)
 				reconnecting = false;
 
+			if (wifi_connecting)
+				wifi_associated_ms = (micros() - wifi_connect_micros) / 1000;
+
 			break;
 
 		case ARDUINO_EVENT_WIFI_STA_GOT_IP:
@@ -240,13 +572,15 @@ static void wifi_event(WiFiEvent_t event)
 			Serial.print("IP Address: ");
 			Serial.println(WiFi.localIP());
 
+			wifi_connected();
+
 			if (configured)
 				connect_to_mqtt();
 			break;
 
 		case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
 			Serial.println("WiFi connection lost. Reconnecting..");
-			display_connecting_to_wifi();
+			post_event(&wifi_ui_queue, TASK_UI, EVENT_WIFI, 0);
 
 			/* ensure not to attempt MQTT reconnection while WiFi disconnected */
 			mqtt_stop_reconnect();
@@ -259,6 +593,19 @@ static void wifi_event(WiFiEvent_t event)
 			{
 				reconnecting = true;
 				reconnect_millis = millis();
+
+				/*
+					a dropout, not a failed attempt: the driver reconnects with
+					the last configuration, to the cached access point if pinned
+					to it, scanning otherwise
+				*/
+				if (!wifi_connecting)
+				{
+					wifi_timing_start(wifi_pinned);
+					if (wifi_pinned)
+						wifi_fallback_timer.once_ms(WIFI_FAST_CONNECT_TIMEOUT,
+							wifi_fallback_due);
+				}
 			}
 
 			/*
@@ -285,13 +632,18 @@ static void wifi_event(WiFiEvent_t event)
 
 /**
  * launch_wifi_config - sets flag that indicates that device should go into
- *  on-demand WiFi config mode, triggered by ISR
+ *  on-demand WiFi config mode, triggered by ISR; masks the button until it
+ *  is released, as the low-power mode turns it into a level interrupt to
+ *  wake from light sleep
  *
  * Return: Nothing
 */
 void IRAM_ATTR launch_wifi_config()
 {
+	gpio_ll_intr_disable(&GPIO, (gpio_num_t)WIFI_CONFIG_PIN);
+	config_button_masked = true;
 	config = true;
+	hal_task_notify_from_isr(TASK_UI);
 }
 
 /**
@@ -309,6 +661,27 @@ void check_wifi_config_requested()
 		/* reset interrupt flag */
 		config = false;
 	}
+
+	if (config_button_masked && digitalRead(WIFI_CONFIG_PIN) == HIGH)
+	{
+		config_button_masked = false;
+		gpio_intr_enable((gpio_num_t)WIFI_CONFIG_PIN);
+	}
+}
+
+/**
+ * check_wifi_fallback - falls back to a full scan if the direct
+ *  connection to the cached access point timed out
+ *
+ * Return: Nothing
+*/
+void check_wifi_fallback()
+{
+	if (!wifi_fallback_pending)
+		return;
+
+	wifi_fallback_pending = false;
+	wifi_fallback();
 }
 
 /**
@@ -334,6 +707,29 @@ void initialize_wifi()
 
 	/* set up WiFi Manager configs, callbacks, parameters */
 	setup_wifi_manager();
+
+	/* last access point and lease, to rejoin without scanning */
+	wifi_cache_load();
+}
+
+/**
+ * wifi_start - rejoins the saved network if the checkpoint was configured
+ *  before the last power cycle, and connects to MQTT on "got IP" without
+ *  waiting for the config portal
+ *
+ * Return: Nothing
+ *
+ * Note: mqtt_setup_once() should be called prior to this: with a static
+ *  IP or a reused lease, "got IP" follows within milliseconds
+*/
+void wifi_start()
+{
+	if (!config_available())
+		return;
+
+	mqtt_setup_repeated();
+	configured = true;
+	wifi_connect();
 }
 
 /**
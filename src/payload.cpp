@@ -0,0 +1,503 @@
+#include <string.h>
+#include "payload.h"
+#include "trace.h"
+#include "boot.h"
+
+/* lower-case hex digits, matching the backend's stored sentry IDs */
+static const char hex_digits[] = "0123456789abcdef";
+
+/**
+ * struct payload_writer_s - bounded append-only writer into a caller's buffer
+ *
+ * @buf: destination buffer
+ * @size: size of the destination buffer
+ * @len: number of characters written so far
+ * @overflow: set once anything failed to fit
+*/
+typedef struct payload_writer_s
+{
+	char *buf;
+	size_t size;
+	size_t len;
+	bool overflow;
+} payload_writer_t;
+
+/**
+ * put_char - appends a character, keeping room for the terminating null byte
+ *
+ * @w: active writer
+ * @c: character to append
+ *
+ * Return: Nothing
+*/
+static void put_char(payload_writer_t *w, char c)
+{
+	if (w->len + 1 >= w->size)
+	{
+		w->overflow = true;
+		return;
+	}
+	w->buf[w->len++] = c;
+}
+
+/**
+ * put_str - appends a string verbatim
+ *
+ * @w: active writer
+ * @s: string to append
+ *
+ * Return: Nothing
+*/
+static void put_str(payload_writer_t *w, const char *s)
+{
+	while (*s)
+		put_char(w, *s++);
+}
+
+/**
+ * put_json_str - appends a quoted JSON string, escaping as needed
+ *
+ * @w: active writer
+ * @s: string to append
+ *
+ * Return: Nothing
+*/
+static void put_json_str(payload_writer_t *w, const char *s)
+{
+	put_char(w, '"');
+	for (; *s; s++)
+	{
+		unsigned char c = (unsigned char)*s;
+
+		if (c == '"' || c == '\\')
+		{
+			put_char(w, '\\');
+			put_char(w, c);
+		}
+		else if (c < 0x20)
+		{
+			put_str(w, "\\u00");
+			put_char(w, hex_digits[c >> 4]);
+			put_char(w, hex_digits[c & 0x0F]);
+		}
+		else
+			put_char(w, c);
+	}
+	put_char(w, '"');
+}
+
+/**
+ * put_uint - appends an unsigned decimal number
+ *
+ * @w: active writer
+ * @value: number to append
+ *
+ * Return: Nothing
+*/
+static void put_uint(payload_writer_t *w, uint32_t value)
+{
+	char digits[10];
+	uint8_t n = 0;
+
+	do {
+		digits[n++] = '0' + (value % 10);
+		value /= 10;
+	} while (value);
+
+	while (n)
+		put_char(w, digits[--n]);
+}
+
+/**
+ * put_uid - appends an RFID UID as space-separated lower-case hex bytes
+ *
+ * @w: active writer
+ * @uid: UID bytes
+ * @uid_size: length of the UID in bytes
+ *
+ * Return: Nothing
+*/
+static void put_uid(payload_writer_t *w, const uint8_t *uid, uint8_t uid_size)
+{
+	for (uint8_t i = 0; i < uid_size; i++)
+	{
+		if (i)
+			put_char(w, ' ');
+		put_char(w, hex_digits[uid[i] >> 4]);
+		put_char(w, hex_digits[uid[i] & 0x0F]);
+	}
+}
+
+/**
+ * finish - null-terminates the written payload
+ *
+ * @w: active writer
+ *
+ * Return: payload length, 0 if it did not fit in the buffer
+*/
+static size_t finish(payload_writer_t *w)
+{
+	if (w->size == 0)
+		return (0);
+
+	if (w->overflow)
+	{
+		w->buf[0] = '\0';
+		return (0);
+	}
+
+	w->buf[w->len] = '\0';
+	return (w->len);
+}
+
+/**
+ * payload_format_uid - formats an RFID UID as space-separated hex bytes,
+ *  e.g. "04 a1 2b ff"
+ *
+ * @buf: destination buffer
+ * @size: size of the destination buffer
+ * @uid: UID bytes
+ * @uid_size: length of the UID in bytes
+ *
+ * Return: length of the formatted UID, 0 if it did not fit
+*/
+size_t payload_format_uid(
+		char *buf, size_t size, const uint8_t *uid, uint8_t uid_size)
+{
+	payload_writer_t w = {buf, size, 0, false};
+
+	put_uid(&w, uid, uid_size);
+	return (finish(&w));
+}
+
+/**
+ * payload_encode_scan_json - encodes a scan as the sentry-scan-info JSON
+ *  message: {"checkpoint-id":N,"sentry-id":"xx xx ..","scan-time":T,
+ *  "scan-ms":MS,"seq":S}
+ *
+ * @buf: destination buffer, PAYLOAD_SCAN_MAX_LEN is always enough
+ * @size: size of the destination buffer
+ * @checkpoint_id: ID of this checkpoint
+ * @record: scan to encode
+ *
+ * Return: payload length, 0 if it did not fit
+*/
+size_t payload_encode_scan_json(char *buf, size_t size,
+		uint32_t checkpoint_id, const scan_record_t *record)
+{
+	payload_writer_t w = {buf, size, 0, false};
+
+	put_str(&w, "{\"checkpoint-id\":");
+	put_uint(&w, checkpoint_id);
+	put_str(&w, ",\"sentry-id\":\"");
+	put_uid(&w, record->uid, record->uid_size);
+	put_str(&w, "\",\"scan-time\":");
+	put_uint(&w, record->scan_time);
+	put_str(&w, ",\"scan-ms\":");
+	put_uint(&w, record->scan_ms);
+	put_str(&w, ",\"seq\":");
+	put_uint(&w, record->seq);
+	put_char(&w, '}');
+
+	return (finish(&w));
+}
+
+/**
+ * payload_encode_connected_json - encodes the checkpoint's connection
+ *  status message: {"id":"<client id>","connected":true|0}, as the web
+ *  app has always received it: true once connected, 0 in the LWT
+ *
+ * @buf: destination buffer, PAYLOAD_CONNECTED_MAX_LEN is always enough
+ * @size: size of the destination buffer
+ * @client_id: checkpoint's MQTT client ID
+ * @connected: connection status to report
+ *
+ * Return: payload length, 0 if it did not fit
+*/
+size_t payload_encode_connected_json(
+		char *buf, size_t size, const char *client_id, bool connected)
+{
+	payload_writer_t w = {buf, size, 0, false};
+
+	put_str(&w, "{\"id\":");
+	put_json_str(&w, client_id);
+	put_str(&w, ",\"connected\":");
+	put_str(&w, connected ? "true" : "0");
+	put_char(&w, '}');
+
+	return (finish(&w));
+}
+
+/**
+ * payload_encode_card_sync_json - encodes the card table sync request:
+ *  {"checkpoint-id":<id>,"cards-version":<version>}
+ *
+ * @buf: destination buffer, PAYLOAD_CARD_SYNC_MAX_LEN is always enough
+ * @size: size of the destination buffer
+ * @checkpoint_id: ID of this checkpoint
+ * @version: version of the card table the checkpoint holds, 0 if none
+ *
+ * Return: payload length, 0 if it did not fit
+*/
+size_t payload_encode_card_sync_json(char *buf, size_t size,
+		uint32_t checkpoint_id, uint32_t version)
+{
+	payload_writer_t w = {buf, size, 0, false};
+
+	put_str(&w, "{\"checkpoint-id\":");
+	put_uint(&w, checkpoint_id);
+	put_str(&w, ",\"cards-version\":");
+	put_uint(&w, version);
+	put_char(&w, '}');
+
+	return (finish(&w));
+}
+
+/**
+ * payload_encode_diagnostics_json - encodes the scan latency histograms
+ *  and I2C bus usage: {"checkpoint-id":<id>,"uptime":<s>,"stages":
+ *  {"<stage>":{"count":<n>,"max-us":<us>,"buckets":[<n>,...]},...},
+ *  "i2c":{"transactions":<n>,"waits":<n>,"max-queue":<n>,
+ *  "busy-permille":<n>,"recoveries":<n>}}, buckets as in trace.h without
+ *  the trailing empty ones
+ *
+ * @buf: destination buffer, PAYLOAD_DIAGNOSTICS_MAX_LEN is enough unless
+ *  a bucket holds 10 million latencies
+ * @size: size of the destination buffer
+ * @checkpoint_id: ID of this checkpoint
+ * @uptime: time since startup [s]
+ * @bus: I2C bus usage since startup
+ *
+ * Return: payload length, 0 if it did not fit
+*/
+size_t payload_encode_diagnostics_json(char *buf, size_t size,
+		uint32_t checkpoint_id, uint32_t uptime, const hal_bus_stats_t *bus)
+{
+	payload_writer_t w = {buf, size, 0, false};
+
+	put_str(&w, "{\"checkpoint-id\":");
+	put_uint(&w, checkpoint_id);
+	put_str(&w, ",\"uptime\":");
+	put_uint(&w, uptime);
+	put_str(&w, ",\"stages\":{");
+
+	for (uint8_t stage = 0; stage < TRACE_STAGE_COUNT; stage++)
+	{
+		const trace_histogram_t *histogram = trace_histogram(stage);
+		uint8_t used = TRACE_BUCKETS;
+
+		while (used && !histogram->buckets[used - 1])
+			used--;
+
+		if (stage)
+			put_char(&w, ',');
+		put_json_str(&w, trace_stage_name(stage));
+		put_str(&w, ":{\"count\":");
+		put_uint(&w, histogram->count);
+		put_str(&w, ",\"max-us\":");
+		put_uint(&w, histogram->max);
+		put_str(&w, ",\"buckets\":[");
+		for (uint8_t i = 0; i < used; i++)
+		{
+			if (i)
+				put_char(&w, ',');
+			put_uint(&w, histogram->buckets[i]);
+		}
+		put_str(&w, "]}");
+	}
+
+	/* [us/ms] = per mille */
+	put_str(&w, "},\"i2c\":{\"transactions\":");
+	put_uint(&w, bus->transactions);
+	put_str(&w, ",\"waits\":");
+	put_uint(&w, bus->waits);
+	put_str(&w, ",\"max-queue\":");
+	put_uint(&w, bus->max_queue);
+	put_str(&w, ",\"busy-permille\":");
+	put_uint(&w, uptime ? (uint32_t)(bus->busy_us / uptime / 1000) : 0);
+	put_str(&w, ",\"recoveries\":");
+	put_uint(&w, bus->recoveries);
+	put_str(&w, "}}");
+
+	return (finish(&w));
+}
+
+/**
+ * payload_encode_boot_report_json - encodes the profiles of the boots in
+ *  the history, newest first: {"checkpoint-id":<id>,"boots":[{"boot":<n>,
+ *  "reset":"<cause>","reached-ms":<ms>,"phases-us":{"<phase>":<us>,...}},
+ *  ...]}, phases as in boot.h
+ *
+ * @buf: destination buffer, PAYLOAD_BOOT_REPORT_MAX_LEN is always enough
+ * @size: size of the destination buffer
+ * @checkpoint_id: ID of this checkpoint
+ *
+ * Return: payload length, 0 if it did not fit
+*/
+size_t payload_encode_boot_report_json(char *buf, size_t size,
+		uint32_t checkpoint_id)
+{
+	payload_writer_t w = {buf, size, 0, false};
+	const boot_record_t *record;
+
+	put_str(&w, "{\"checkpoint-id\":");
+	put_uint(&w, checkpoint_id);
+	put_str(&w, ",\"boots\":[");
+
+	for (uint8_t age = 0; (record = boot_record(age)); age++)
+	{
+		if (age)
+			put_char(&w, ',');
+		put_str(&w, "{\"boot\":");
+		put_uint(&w, record->boot);
+		put_str(&w, ",\"reset\":");
+		put_json_str(&w, boot_reset_name(record->reset));
+		put_str(&w, ",\"reached-ms\":");
+		put_uint(&w, record->reached_us / 1000);
+		put_str(&w, ",\"phases-us\":{");
+		for (uint8_t phase = 0; phase < BOOT_PHASE_COUNT; phase++)
+		{
+			if (phase)
+				put_char(&w, ',');
+			put_json_str(&w, boot_phase_name(phase));
+			put_char(&w, ':');
+			put_uint(&w, record->phase_us[phase]);
+		}
+		put_str(&w, "}}");
+	}
+	put_str(&w, "]}");
+
+	return (finish(&w));
+}
+
+/**
+ * put_le32 - stores a 32-bit value little-endian
+ *
+ * @p: destination
+ * @value: value to store
+ *
+ * Return: Nothing
+*/
+static void put_le32(uint8_t *p, uint32_t value)
+{
+	p[0] = value & 0xFF;
+	p[1] = (value >> 8) & 0xFF;
+	p[2] = (value >> 16) & 0xFF;
+	p[3] = (value >> 24) & 0xFF;
+}
+
+/**
+ * put_le16 - stores a 16-bit value little-endian
+ *
+ * @p: destination
+ * @value: value to store
+ *
+ * Return: Nothing
+*/
+static void put_le16(uint8_t *p, uint16_t value)
+{
+	p[0] = value & 0xFF;
+	p[1] = value >> 8;
+}
+
+/**
+ * get_le32 - loads a little-endian 32-bit value
+ *
+ * @p: source
+ *
+ * Return: loaded value
+*/
+static uint32_t get_le32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+		((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+/**
+ * get_le16 - loads a little-endian 16-bit value
+ *
+ * @p: source
+ *
+ * Return: loaded value
+*/
+static uint16_t get_le16(const uint8_t *p)
+{
+	return ((uint16_t)(p[0] | (p[1] << 8)));
+}
+
+/**
+ * payload_encode_scan_binary - encodes a scan as the compact binary
+ *  sentry-scan-info message, see payload.h for the layout
+ *
+ * @buf: destination buffer, PAYLOAD_SCAN_BINARY_MAX_LEN is always enough
+ * @size: size of the destination buffer
+ * @checkpoint_id: ID of this checkpoint
+ * @record: scan to encode
+ *
+ * Return: payload length, 0 if it did not fit
+*/
+size_t payload_encode_scan_binary(uint8_t *buf, size_t size,
+		uint32_t checkpoint_id, const scan_record_t *record)
+{
+	uint8_t uid_size = record->uid_size;
+
+	if (uid_size > RFID_UID_MAX_LEN ||
+			size < (size_t)PAYLOAD_BINARY_HEADER_LEN + uid_size)
+		return (0);
+
+	buf[0] = PAYLOAD_BINARY_VERSION;
+	buf[1] = record->outside_shift ? PAYLOAD_FLAG_OUTSIDE_SHIFT : 0;
+	put_le32(&buf[2], checkpoint_id);
+	put_le32(&buf[6], record->scan_time);
+	put_le16(&buf[10], record->scan_ms);
+	put_le32(&buf[12], record->seq);
+	buf[16] = uid_size;
+	memcpy(&buf[PAYLOAD_BINARY_HEADER_LEN], record->uid, uid_size);
+
+	return (PAYLOAD_BINARY_HEADER_LEN + uid_size);
+}
+
+/**
+ * payload_decode_scan_binary - reference decoder for the binary
+ *  sentry-scan-info message
+ *
+ * @buf: received payload
+ * @len: length of the received payload
+ * @checkpoint_id: where to store the sending checkpoint's ID
+ * @record: where to store the decoded scan
+ *
+ * Return: true if the payload is a valid version 1 or 2 message, false
+ *  otherwise
+*/
+bool payload_decode_scan_binary(const uint8_t *buf, size_t len,
+		uint32_t *checkpoint_id, scan_record_t *record)
+{
+	/* version 1 has no milliseconds or sequence number */
+	size_t header_len = PAYLOAD_BINARY_HEADER_LEN;
+
+	if (len < PAYLOAD_BINARY_V1_HEADER_LEN)
+		return false;
+	if (buf[0] == 1)
+		header_len = PAYLOAD_BINARY_V1_HEADER_LEN;
+	else if (buf[0] != PAYLOAD_BINARY_VERSION || len < header_len)
+		return false;
+
+	uint8_t uid_size = buf[header_len - 1];
+
+	if (uid_size > RFID_UID_MAX_LEN || len != header_len + uid_size)
+		return false;
+
+	memset(record, 0, sizeof(*record));
+	*checkpoint_id = get_le32(&buf[2]);
+	record->outside_shift = (buf[1] & PAYLOAD_FLAG_OUTSIDE_SHIFT) ? 1 : 0;
+	record->scan_time = get_le32(&buf[6]);
+	if (buf[0] != 1)
+	{
+		record->scan_ms = get_le16(&buf[10]);
+		record->seq = get_le32(&buf[12]);
+	}
+	record->uid_size = uid_size;
+	memcpy(record->uid, &buf[header_len], uid_size);
+
+	return true;
+}
@@ -0,0 +1,157 @@
+#include <Arduino.h>
+#include "power.h"
+#include "tasks.h"
+#include "rfid.h"
+#include "hal.h"
+
+
+/* power mode in use, one of POWER_MODE_NORMAL or POWER_MODE_LOW */
+uint8_t power_mode = POWER_MODE_DEFAULT;
+
+/* what the chip does while idle, one of HAL_POWER_*, see hal_power_configure() */
+static uint8_t power_state = HAL_POWER_FULL_SPEED;
+
+/*
+ * wake-to-ready latencies, written by the RFID task: totals since startup
+ * and longest of the current report period
+*/
+static volatile uint32_t wakes = 0;
+static volatile uint32_t wake_total = 0;
+static volatile uint32_t wake_max = 0;
+
+/* statistics of the current report period, see power_log_stats() */
+static uint32_t stats_started_at = 0;
+static uint32_t stats_runs_base[TASK_COUNT];
+static uint32_t stats_busy_base[TASK_COUNT];
+static uint32_t stats_wakes_base = 0;
+static uint32_t stats_wake_total_base = 0;
+
+/**
+ * power_apply - applies the power mode to the chip, the reader and the
+ *  task periods, again whenever the reader's detection mode changes
+ *
+ * Return: Nothing
+*/
+void power_apply()
+{
+	bool low = power_mode == POWER_MODE_LOW;
+
+	power_state = hal_power_configure(low,
+		rfid_detect_mode == RFID_DETECT_IRQ);
+	if (low && power_state == HAL_POWER_SCALING)
+		Serial.println("No light sleep in this build, low-power mode scales the CPU only");
+	else if (low && power_state == HAL_POWER_FULL_SPEED)
+		Serial.println("No power management in this build, low-power mode only slows the tasks");
+
+	if (rfid_detect_mode == RFID_DETECT_IRQ)
+		rfid_set_reqa_period(low ? LOW_POWER_REQA_PERIOD : RFID_REQA_PERIOD);
+	else
+		hal_task_set_period(TASK_RFID,
+			low ? LOW_POWER_RFID_PERIOD : RFID_TASK_PERIOD);
+
+	hal_task_set_period(TASK_UI, low ? LOW_POWER_UI_PERIOD : UI_TASK_PERIOD);
+	hal_task_set_period(TASK_NET, low ? LOW_POWER_NET_PERIOD : NET_TASK_PERIOD);
+}
+
+/**
+ * initialize_power - applies the power mode and starts the power
+ *  statistics
+ *
+ * Return: Nothing
+ *
+ * Note: initialize_rfid() and initialize_tasks() should be called prior
+ *  to this
+*/
+void initialize_power()
+{
+	power_apply();
+
+	for (uint8_t id = 0; id < TASK_COUNT; id++)
+		hal_task_stats(id, &stats_runs_base[id], &stats_busy_base[id]);
+	stats_started_at = millis();
+}
+
+/**
+ * power_set_mode - switches to another power mode
+ *
+ * @mode: POWER_MODE_NORMAL or POWER_MODE_LOW
+ *
+ * Return: Nothing
+*/
+void power_set_mode(uint8_t mode)
+{
+	if (mode == power_mode)
+		return;
+
+	power_mode = mode;
+	power_apply();
+
+	Serial.println(mode == POWER_MODE_LOW ?
+		"Power mode: low" : "Power mode: normal");
+}
+
+/**
+ * power_record_wake - records how long a wake-up took to reach the task
+ *  it was for
+ *
+ * @us: time from the wake-up source firing to the task running [us]
+ *
+ * Return: Nothing
+*/
+void power_record_wake(uint32_t us)
+{
+	wake_total += us;
+	wakes++;
+	if (us > wake_max)
+		wake_max = us;
+}
+
+/**
+ * power_log_stats - logs the duty cycle and wake-to-ready latency and
+ *  starts a new report period once POWER_STATS_PERIOD has elapsed
+ *
+ * Return: Nothing
+*/
+void power_log_stats()
+{
+	uint32_t elapsed = millis() - stats_started_at;
+	uint32_t runs = 0, busy_us = 0, task_runs, task_busy_us;
+	uint32_t period_wakes, period_total;
+
+	if (elapsed < POWER_STATS_PERIOD)
+		return;
+
+	/* every task run ends a sleep, the time spent running is the duty cycle */
+	for (uint8_t id = 0; id < TASK_COUNT; id++)
+	{
+		hal_task_stats(id, &task_runs, &task_busy_us);
+		runs += task_runs - stats_runs_base[id];
+		busy_us += task_busy_us - stats_busy_base[id];
+		stats_runs_base[id] = task_runs;
+		stats_busy_base[id] = task_busy_us;
+	}
+
+	period_wakes = wakes - stats_wakes_base;
+	period_total = wake_total - stats_wake_total_base;
+
+	Serial.print(power_mode == POWER_MODE_NORMAL ? "Power (normal): " :
+		power_state == HAL_POWER_LIGHT_SLEEP ? "Power (low): " :
+		power_state == HAL_POWER_SCALING ? "Power (low, no light sleep): " :
+		"Power (low, full speed): ");
+	Serial.print(runs * 1000UL / elapsed);
+	Serial.print(" task runs/s, tasks busy ");
+	/* [us/ms] = per mille */
+	Serial.print(busy_us / elapsed / 10);
+	Serial.print(".");
+	Serial.print(busy_us / elapsed % 10);
+	Serial.print("%, wake-to-ready avg/max ");
+	Serial.print(period_wakes ? period_total / period_wakes : 0);
+	Serial.print("/");
+	Serial.print(wake_max);
+	Serial.println(" us");
+
+	stats_started_at += elapsed;
+	stats_wakes_base += period_wakes;
+	stats_wake_total_base += period_total;
+	wake_max = 0;
+}
@@ -1,82 +1,377 @@
 #include <Arduino.h>
 #include "main.h"
+#include "rfid.h"
+#include "payload.h"
+#include "tasks.h"
+#include "trace.h"
+#include "hal.h"
+#include "power.h"
+#include <Ticker.h>
 
-/*
-*	library to interact with RFID card reader, includes SPI.h
+
+/* card detection mode in use, one of RFID_DETECT_POLL or RFID_DETECT_IRQ */
+uint8_t rfid_detect_mode = RFID_DETECT_MODE;
+
+/* IRQ mode: set by the reader's IRQ line, a card answered the last REQA */
+static volatile bool rfid_irq_pending = false;
+/* IRQ mode: when the IRQ line was last pulled [us] */
+static volatile uint32_t rfid_irq_at = 0;
+/* IRQ mode: set by reqa_timer, the REQA is due to be re-armed */
+static volatile bool rfid_rearm_pending = true;
+/* IRQ mode: when the last REQA was sent [us] */
+static uint32_t rfid_armed_at = 0;
+/* IRQ mode: consecutive REQAs a card answered without the IRQ line moving */
+static uint8_t rfid_irq_missed = 0;
+static Ticker reqa_timer;
+
+/**
+ * struct recent_card_s - a recently read card
+ *
+ * @uid: RFID UID bytes
+ * @uid_size: length of the RFID UID in bytes, 0 for a free slot
+ * @seen_at: when the card was last read [ms]
 */
-#include <MFRC522.h>
+typedef struct recent_card_s
+{
+	uint8_t uid[RFID_UID_MAX_LEN];
+	uint8_t uid_size;
+	uint32_t seen_at;
+} recent_card_t;
+
+/* recently read cards, for repeat tap suppression */
+static recent_card_t recent_cards[RFID_RECENT_CARDS];
+/* repeat taps dropped since startup */
+static uint32_t suppressed_taps = 0;
 
+/* statistics of the current report period, see rfid_get_stats() */
+static uint32_t stats_started_at = 0;
+static uint32_t stats_commands_base = 0;
+static uint32_t stats_bus_us_base = 0;
+static uint32_t stats_detections = 0;
+static uint32_t stats_suppressed_base = 0;
+static uint32_t stats_latency_total = 0;
+static uint32_t stats_latency_max = 0;
 
-/* active MFRC instance */
-static MFRC522 reader(MFRC_SS_PIN, MFRC_RST_PIN);
-MFRC522::MIFARE_Key key;
+/* fixed buffer storing the stringified RFID UID */
+char card_id[RFID_UID_STR_MAX_LEN];
 
-/* string variable to store stringified RFID UID */
-String card_id;
+/* raw bytes and length of the last scanned RFID UID */
+byte card_uid[RFID_UID_MAX_LEN];
+byte card_uid_size = 0;
+/* micros() when the last scanned card was detected */
+uint32_t card_detected_at = 0;
+
+
+/**
+ * rfid_irq_handler - interrupt handler of the reader's IRQ line: a card
+ *  answered the last REQA, wakes the RFID task to read it
+ *
+ * Return: Nothing
+*/
+static void IRAM_ATTR rfid_irq_handler()
+{
+	rfid_irq_at = micros();
+	rfid_irq_pending = true;
+	hal_task_notify_from_isr(TASK_RFID);
+}
 
+/**
+ * rfid_reqa_due - reqa_timer callback: has the RFID task re-arm the REQA
+ *
+ * Return: Nothing
+*/
+static void rfid_reqa_due()
+{
+	rfid_rearm_pending = true;
+	hal_task_notify(TASK_RFID);
+}
 
 /**
- * initialize_rfid - sets up the RFID MFRC module on the SPI bus
+ * initialize_rfid - sets up the RFID MFRC module on the SPI bus and its
+ *  card detection: IRQ line and REQA timer, or polling
  *
  * Return: Nothing
  *
- * Note: SPI.begin() should be called prior to this
+ * Note: hal_bus_init() should be called prior to this
 */
 void initialize_rfid()
 {
-    reader.PCD_Init();
+	hal_rfid_init();
 
-	for (byte i = 0; i < 6; i++)
+	if (rfid_detect_mode == RFID_DETECT_IRQ)
 	{
-		key.keyByte[i] = 0xFF;
+		if (hal_rfid_irq_attach(rfid_irq_handler))
+			reqa_timer.attach_ms(RFID_REQA_PERIOD, rfid_reqa_due);
+		else
+		{
+			Serial.println("No RFID IRQ line, polling the reader");
+			rfid_detect_mode = RFID_DETECT_POLL;
+		}
 	}
+
+	stats_started_at = millis();
+}
+
+/**
+ * rfid_set_reqa_period - changes the period between two REQAs in IRQ mode,
+ *  longer saves power but detects cards later
+ *
+ * @period: period between two REQAs [ms]
+ *
+ * Return: Nothing
+*/
+void rfid_set_reqa_period(uint32_t period)
+{
+	if (rfid_detect_mode == RFID_DETECT_IRQ)
+		reqa_timer.attach_ms(period, rfid_reqa_due);
+}
+
+/**
+ * rfid_fall_back_to_polling - switches to polling the reader, the IRQ
+ *  line does not signal the cards that answer
+ *
+ * Return: Nothing
+*/
+static void rfid_fall_back_to_polling()
+{
+	Serial.println("RFID IRQ line not signalling cards, polling the reader");
+
+	reqa_timer.detach();
+	rfid_detect_mode = RFID_DETECT_POLL;
+	/* disarms the line's wake, polls at the power mode's period */
+	power_apply();
 }
 
 /**
- * dump_byte_array - dumps the scanned hex RFID UID into a string literal
+ * dump_byte_array - dumps the scanned hex RFID UID into card_id
  *
  * @buffer: buffer storing scanned RFID UID
  * @buffer_size: length of the RFID UID in bytes (4, 7 or 10)
  *
- * Return: string literal representation of the scanned RFID UID
+ * Return: Nothing
 */
 static void dump_byte_array(byte *buffer, byte buffer_size)
 {
-	/* reset stored RFID UID to an empty string for new scan */
-	card_id = "";
+	payload_format_uid(card_id, sizeof(card_id), buffer, buffer_size);
+}
+
+/**
+ * rfid_card_detected - checks if a 'new' card answered a REQA
+ *
+ * @sent_at: where to store when the REQA the card answered was sent [us]
+ *
+ * Return: true if a card is waiting to be read, false otherwise
+*/
+static bool rfid_card_detected(uint32_t *sent_at)
+{
+	if (rfid_detect_mode == RFID_DETECT_POLL)
+	{
+		*sent_at = micros();
+		return (hal_rfid_card_present());
+	}
 
-	for (byte i = 0; i < buffer_size; i++)
+	if (rfid_irq_pending)
 	{
-		if (i == 0)
-			card_id += (buffer[i] < 0x10 ? "0" : "");
-		else
-			card_id += (buffer[i] < 0x10 ? " 0" : " ");
+		*sent_at = rfid_armed_at;
+		return true;
+	}
+
+	if (rfid_rearm_pending)
+	{
+		rfid_rearm_pending = false;
+
+		/* a card answered the last REQA, but the IRQ line never moved */
+		if (!hal_rfid_irq_answered())
+			rfid_irq_missed = 0;
+		else if (++rfid_irq_missed >= RFID_IRQ_MISSED_MAX)
+		{
+			rfid_fall_back_to_polling();
+			return false;
+		}
+
+		rfid_armed_at = micros();
+		hal_rfid_irq_arm();
+	}
 
-		card_id += String(buffer[i], HEX);
+	return false;
+}
+
+/**
+ * rfid_repeat_tap - checks if a card was already read within the repeat
+ *  window, and remembers it as read now
+ *
+ * @uid: RFID UID bytes
+ * @uid_size: length of the RFID UID in bytes
+ *
+ * Return: true if the read is a repeat tap, false otherwise
+*/
+static bool rfid_repeat_tap(const uint8_t *uid, uint8_t uid_size)
+{
+	uint32_t now = millis();
+	recent_card_t *slot = &recent_cards[0];
+
+	if (RFID_REPEAT_WINDOW == 0)
+		return false;
+
+	for (uint8_t i = 0; i < RFID_RECENT_CARDS; i++)
+	{
+		recent_card_t *card = &recent_cards[i];
+
+		if (card->uid_size == uid_size && !memcmp(card->uid, uid, uid_size))
+		{
+			bool repeat = now - card->seen_at < RFID_REPEAT_WINDOW;
+
+			card->seen_at = now;
+			return (repeat);
+		}
+
+		/* otherwise replace a free slot, or the least recently read card */
+		if (slot->uid_size && (!card->uid_size ||
+				now - card->seen_at > now - slot->seen_at))
+			slot = card;
 	}
+
+	memcpy(slot->uid, uid, uid_size);
+	slot->uid_size = uid_size;
+	slot->seen_at = now;
+
+	return false;
 }
 
 /**
  * rfid_read_new_card - checks if a new card is available to be read and
- *  reads it if there is saving its UID to card_id
+ *  reads it if there is saving its UID to card_uid and card_id
  *
  * Return: true if a new card is available and has been successfully
  *  read, false otherwise
 */
 bool rfid_read_new_card()
 {
+	uint32_t sent_at, latency, start;
+	bool read;
+
 	/* checking if there is a 'new' RFID card in vicinity to scan */
-	if (!reader.PICC_IsNewCardPresent())
+	if (!rfid_card_detected(&sent_at))
+		return false;
+
+	card_detected_at = micros();
+
+	/* from the IRQ line waking the chip to the RFID task running */
+	if (rfid_detect_mode == RFID_DETECT_IRQ)
+		power_record_wake(card_detected_at - rfid_irq_at);
+
+	/* keeping the raw UID for the scan record */
+	start = trace_cycles();
+	read = hal_rfid_read_uid(card_uid, &card_uid_size);
+	if (read)
+		trace_cycles_since(TRACE_READ_UID, start);
+
+	if (rfid_detect_mode == RFID_DETECT_IRQ)
+	{
+		/* reading raised the IRQ line again, the next REQA re-arms it */
+		hal_rfid_irq_clear();
+		rfid_irq_pending = false;
+	}
+
+	if (!read)
 		return false;
 
-	if (!reader.PICC_ReadCardSerial())
+	/* a card held on the reader, the first read was the scan */
+	if (rfid_repeat_tap(card_uid, card_uid_size))
+	{
+		hal_rfid_halt();
+		suppressed_taps++;
 		return false;
+	}
 
 	/* dumping the scanned card's ID (hex number) into a string */
-	dump_byte_array(reader.uid.uidByte, reader.uid.size);
+	start = trace_cycles();
+	dump_byte_array(card_uid, card_uid_size);
+	trace_cycles_since(TRACE_FORMAT_UID, start);
+
+	hal_rfid_halt();
 
-	reader.PICC_HaltA();
-  	reader.PCD_StopCrypto1();
+	trace_record(TRACE_DETECT, card_detected_at - sent_at);
 
-    return true;
+	latency = micros() - sent_at;
+	stats_detections++;
+	stats_latency_total += latency;
+	if (latency > stats_latency_max)
+		stats_latency_max = latency;
+
+	return true;
+}
+
+/**
+ * rfid_get_stats - gets the card detection statistics since the start of
+ *  the current report period
+ *
+ * @stats: where to store the statistics
+ *
+ * Return: Nothing
+*/
+void rfid_get_stats(rfid_stats_t *stats)
+{
+	uint32_t commands, bus_us;
+
+	hal_rfid_counters(&commands, &bus_us);
+
+	stats->elapsed = millis() - stats_started_at;
+	stats->commands = commands - stats_commands_base;
+	stats->bus_us = bus_us - stats_bus_us_base;
+	stats->detections = stats_detections;
+	stats->suppressed = suppressed_taps - stats_suppressed_base;
+	stats->latency_total = stats_latency_total;
+	stats->latency_max = stats_latency_max;
+}
+
+/**
+ * rfid_log_stats - logs the card detection statistics and starts a new
+ *  report period once RFID_STATS_PERIOD has elapsed
+ *
+ * Return: Nothing
+*/
+void rfid_log_stats()
+{
+	rfid_stats_t stats;
+
+	if (millis() - stats_started_at < RFID_STATS_PERIOD)
+		return;
+
+	rfid_get_stats(&stats);
+
+	Serial.print(rfid_detect_mode == RFID_DETECT_IRQ ?
+		"RFID (irq): " : "RFID (poll): ");
+	Serial.print(stats.commands * 1000UL / stats.elapsed);
+	Serial.print(" commands/s, ");
+	Serial.print((uint32_t)((uint64_t)stats.bus_us * 1000 / stats.elapsed));
+	Serial.print(" us/s on SPI, ");
+	Serial.print(stats.detections);
+	Serial.print(" cards, ");
+	Serial.print(stats.suppressed);
+	Serial.print(" repeat taps dropped, latency avg/max ");
+	Serial.print(stats.detections ?
+		stats.latency_total / stats.detections : 0);
+	Serial.print("/");
+	Serial.print(stats.latency_max);
+	Serial.println(" us");
+
+	stats_started_at += stats.elapsed;
+	stats_commands_base += stats.commands;
+	stats_bus_us_base += stats.bus_us;
+	stats_detections = 0;
+	stats_suppressed_base += stats.suppressed;
+	stats_latency_total = 0;
+	stats_latency_max = 0;
+}
+
+/**
+ * rfid_suppressed_taps - retrieves the number of repeat taps dropped
+ *  since startup
+ *
+ * Return: number of dropped repeat taps
+*/
+uint32_t rfid_suppressed_taps()
+{
+	return (suppressed_taps);
 }
@@ -1,18 +1,168 @@
 #include <Arduino.h>
+#include <atomic>
 #include "rtc.h"
+#include "hal.h"
 
+/*
+ * Software epoch clock: the seconds advance on the DS3231's 1 Hz square
+ * wave interrupt and the time within a second is the local timer since
+ * the last edge, so reading the time never touches the I2C bus the LCD
+ * shares. The chip itself is read once the square wave runs, to learn
+ * which second the next edge starts, then every RTC_CHECK_PERIOD to catch
+ * any slip. Only the interrupt handler moves the clock, under a sequence
+ * lock; a second read off the chip is handed to it to apply at the next
+ * edge. Edges missed while the chip light-sleeps are bridged off the
+ * local timer, up to RTC_SQW_TIMEOUT; past that the second is read off
+ * the chip again.
+ *
+ * Until then, if RTC_SQW_PIN cannot interrupt, or while no edge comes
+ * for RTC_SQW_TIMEOUT (e.g. the wire is missing), the clock runs off the
+ * local timer from a chip read, with its second's phase unknown. The
+ * fallback has a sequence lock of its own, only the network task sets it.
+*/
+
+/* sequence lock guarding the clock, odd while it is updated */
+static std::atomic<uint32_t> clock_seq(0);
+/* epoch second the last edge started, 0 until known */
+static uint32_t clock_seconds = 0;
+/* local timer at the last edge, or at the attach until one came [us] */
+static uint64_t clock_edge_us = 0;
+/* sequence lock guarding the fallback, odd while it is updated */
+static std::atomic<uint32_t> fallback_seq(0);
+/* fallback: epoch time read off the chip, and when [us] */
+static uint64_t fallback_epoch_us = 0;
+static uint64_t fallback_us = 0;
+
+/* epoch second the next edge starts, as read off the chip, 0 if none */
+static std::atomic<uint32_t> resync_seconds(0);
+/* square wave edges seen */
+static volatile uint32_t sqw_edges = 0;
+static bool sqw_attached = false;
+/* whether the square wave went silent */
+static bool sqw_silent = false;
+
+/* millis() when the next check against the chip is due */
+static uint32_t next_check_at = 0;
+static uint32_t checks = 0;
+static uint32_t mismatches = 0;
 
-/* active RTC instance */
-RTC_DS3231 my_RTC;
 
 /**
- * initialize_RTC - initializes the RTC and sets the time if power was lost
+ * build_epoch - converts the firmware's compile time to epoch time
+ *
+ * Return: epoch time of __DATE__ ("Mmm dd yyyy") and __TIME__ ("hh:mm:ss")
+*/
+static uint32_t build_epoch()
+{
+	static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	const char *date = __DATE__;
+	const char *time = __TIME__;
+
+	int32_t year = atoi(date + 7);
+	int32_t month = 1;
+	int32_t day = atoi(date + 4);
+
+	while (month < 12 && strncmp(&months[(month - 1) * 3], date, 3))
+		month++;
+
+	/* days since epoch of a proleptic Gregorian date */
+	year -= month <= 2;
+	int32_t era = year / 400;
+	int32_t yoe = year - era * 400;
+	int32_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	int32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	int32_t days = era * 146097 + doe - 719468;
+
+	return ((uint32_t)days * 86400 + atoi(time) * 3600 +
+		atoi(time + 3) * 60 + atoi(time + 6));
+}
+
+/**
+ * rtc_sqw_handler - interrupt handler of the square wave: a second starts
+ *
+ * Return: Nothing
+*/
+static void IRAM_ATTR rtc_sqw_handler()
+{
+	uint64_t now = hal_clock_us();
+	uint64_t elapsed = now - clock_edge_us;
+	uint32_t resync = resync_seconds.exchange(0);
+
+	clock_seq.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	/* too long to bridge, and any resync is stale: unknown until checked */
+	if (elapsed >= (uint64_t)RTC_SQW_TIMEOUT * 1000)
+		clock_seconds = 0;
+	else if (resync)
+		clock_seconds = resync;
+	else if (clock_seconds)
+		clock_seconds += elapsed < 1500000 ? 1 : (elapsed + 500000) / 1000000;
+	clock_edge_us = now;
+
+	clock_seq.fetch_add(1, std::memory_order_release);
+	sqw_edges++;
+}
+
+/**
+ * read_clock - takes a consistent copy of the clock
+ *
+ * @seconds: where to store the second the last edge started, 0 if unknown
+ * @edge_us: where to store the local timer at the last edge [us]
+ * @epoch_us: where to store the fallback's epoch time [us]
+ * @at_us: where to store the local timer at the fallback's epoch time [us]
+ *
+ * Return: true if the clock follows the square wave, false if it runs
+ *  off the fallback
+*/
+static bool read_clock(uint32_t *seconds, uint64_t *edge_us,
+		uint64_t *epoch_us, uint64_t *at_us)
+{
+	uint32_t seq;
+
+	do {
+		seq = clock_seq.load(std::memory_order_acquire);
+		*seconds = clock_seconds;
+		*edge_us = clock_edge_us;
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((seq & 1) || clock_seq.load(std::memory_order_relaxed) != seq);
+
+	do {
+		seq = fallback_seq.load(std::memory_order_acquire);
+		*epoch_us = fallback_epoch_us;
+		*at_us = fallback_us;
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((seq & 1) || fallback_seq.load(std::memory_order_relaxed) != seq);
+
+	/* a chip read after the last edge means the square wave went silent */
+	return (*seconds && *edge_us >= *at_us);
+}
+
+/**
+ * set_fallback - restarts the fallback clock from a chip read
+ *
+ * @seconds: epoch time read off the chip
+ *
+ * Return: Nothing
+*/
+static void set_fallback(uint32_t seconds)
+{
+	fallback_seq.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	fallback_epoch_us = (uint64_t)seconds * 1000000;
+	fallback_us = hal_clock_us();
+	fallback_seq.fetch_add(1, std::memory_order_release);
+}
+
+/**
+ * initialize_RTC - initializes the RTC, sets the time if power was lost
+ *  and starts the software clock
  *
  * Return: Nothing
 */
 void initialize_RTC()
 {
-	my_RTC.begin();
+	hal_rtc_init();
 
 	/*
 		set time of the RTC
@@ -21,6 +171,178 @@ void initialize_RTC()
 		NB: set timezone of device to GMT+0 to set correct UTC epoch time
 				i.e. without timezone offset
 	*/
-	if (my_RTC.lostPower())
-		my_RTC.adjust(DateTime(F(__DATE__), F(__TIME__)));
+	if (hal_rtc_lost_power())
+		hal_rtc_adjust(build_epoch());
+
+	set_fallback(hal_rtc_now());
+
+	/* no handler runs yet: time the first edge's wait from here */
+	clock_edge_us = hal_clock_us();
+	sqw_attached = hal_rtc_sqw_attach(rtc_sqw_handler);
+	if (!sqw_attached)
+		Serial.println("No RTC square wave, the clock runs off the chip reads");
+
+	next_check_at = millis();
+
+#ifdef RTC_BENCHMARK
+	rtc_benchmark();
+#endif
+}
+
+/**
+ * rtc_now_us - reads the software clock, lock-free and off the I2C bus
+ *
+ * Return: current epoch time [us]
+*/
+uint64_t rtc_now_us()
+{
+	uint32_t seconds;
+	uint64_t edge_us, epoch_us, at_us;
+
+	if (!read_clock(&seconds, &edge_us, &epoch_us, &at_us))
+		return (epoch_us + (hal_clock_us() - at_us));
+
+	return ((uint64_t)seconds * 1000000 + (hal_clock_us() - edge_us));
+}
+
+/**
+ * rtc_check - checks the software clock against the chip when due, run
+ *  by the network task
+ *
+ * Return: Nothing
+ *
+ * Note: the chip is only read early in a second, so the second it gives
+ *  is the one the last edge started
+*/
+void rtc_check()
+{
+	uint32_t edges = sqw_edges, seconds, chip;
+	uint64_t edge_us, epoch_us, at_us;
+
+	read_clock(&seconds, &edge_us, &epoch_us, &at_us);
+
+	/* due, or edges run whose second is unknown and not yet read */
+	if ((int32_t)(millis() - next_check_at) < 0 &&
+		(seconds || !edges || resync_seconds.load()))
+		return;
+
+	if (!sqw_attached ||
+		hal_clock_us() - edge_us >= (uint64_t)RTC_SQW_TIMEOUT * 1000)
+	{
+		if (sqw_attached && !sqw_silent)
+		{
+			sqw_silent = true;
+			Serial.println("RTC square wave silent, the clock runs off the chip reads");
+		}
+
+		set_fallback(hal_rtc_now());
+		next_check_at = millis() + RTC_CHECK_PERIOD;
+		return;
+	}
+
+	if (sqw_silent)
+	{
+		sqw_silent = false;
+		Serial.println("RTC square wave back, the clock follows it again");
+	}
+
+	if (!edges || hal_clock_us() - edge_us >= 500000)
+		return;
+
+	chip = hal_rtc_now();
+
+	/* an edge during the read, try again */
+	if (sqw_edges != edges)
+		return;
+
+	next_check_at = millis() + RTC_CHECK_PERIOD;
+	checks++;
+
+	if (chip == seconds)
+		return;
+
+	if (seconds)
+	{
+		mismatches++;
+		Serial.print("RTC clock was off by ");
+		Serial.print((int32_t)(seconds - chip));
+		Serial.println(" s, resynced");
+	}
+
+	resync_seconds.store(chip + 1);
+}
+
+/**
+ * rtc_adjust - sets the chip, as the next second of a given clock starts
+ *  since the chip restarts its second when set
+ *
+ * @epoch_us: the time now [us]
+ *
+ * Return: Nothing
+ *
+ * Note: waits for up to a second
+*/
+void rtc_adjust(uint64_t epoch_us)
+{
+	uint32_t second = (uint32_t)(epoch_us / 1000000) + 1;
+
+	delay((1000000 - epoch_us % 1000000) / 1000);
+	hal_rtc_adjust(second);
+
+	if (sqw_attached && !sqw_silent)
+		resync_seconds.store(second + 1);
+	else
+		set_fallback(second);
+
+	/* make sure the next edge brought the new second */
+	next_check_at = millis() + 1000;
+}
+
+/**
+ * rtc_get_stats - gets the software clock state since startup
+ *
+ * @stats: where to store the state
+ *
+ * Return: Nothing
+*/
+void rtc_get_stats(rtc_stats_t *stats)
+{
+	uint32_t seconds;
+	uint64_t edge_us, epoch_us, at_us;
+
+	stats->running = read_clock(&seconds, &edge_us, &epoch_us, &at_us);
+	stats->edges = sqw_edges;
+	stats->checks = checks;
+	stats->mismatches = mismatches;
+}
+
+/**
+ * rtc_benchmark - logs what a time read costs, off the chip over I2C and
+ *  off the software clock
+ *
+ * Return: Nothing
+*/
+void rtc_benchmark()
+{
+	volatile uint64_t sink = 0;
+	uint64_t chip_ns, clock_ns;
+	uint32_t start;
+
+	start = hal_cycle_count();
+	for (uint8_t i = 0; i < RTC_BENCHMARK_READS; i++)
+		sink += hal_rtc_now();
+	chip_ns = (uint64_t)(hal_cycle_count() - start) * 1000 /
+		hal_cycles_per_us() / RTC_BENCHMARK_READS;
+
+	start = hal_cycle_count();
+	for (uint8_t i = 0; i < RTC_BENCHMARK_READS; i++)
+		sink += rtc_now_us();
+	clock_ns = (uint64_t)(hal_cycle_count() - start) * 1000 /
+		hal_cycles_per_us() / RTC_BENCHMARK_READS;
+
+	Serial.print("RTC time read: chip over I2C ");
+	Serial.print((uint32_t)chip_ns);
+	Serial.print(" ns, software clock ");
+	Serial.print((uint32_t)clock_ns);
+	Serial.println(" ns");
 }
@@ -0,0 +1,126 @@
+#include <Arduino.h>
+#include "scan_seq.h"
+#include "crc16.h"
+
+/*
+ * Per-device scan sequence numbers, increasing across reboots, so the
+ * backend can drop the duplicates that at-least-once delivery (QoS 1)
+ * and journal replays produce. The flash holds the first number not yet
+ * handed out (the limit), in two slots written in turn, so a write torn
+ * by a power cut leaves the other one; the valid slot with the higher
+ * limit wins.
+*/
+
+/**
+ * struct scan_seq_slot_s - on-flash layout of a slot
+ *
+ * @limit: first sequence number not reserved
+ * @crc: CRC16 over @limit
+*/
+typedef struct scan_seq_slot_s
+{
+	uint32_t limit;
+	uint16_t crc;
+} scan_seq_slot_t;
+
+#define SCAN_SEQ_SLOTS          2
+#define SCAN_SEQ_STORAGE_SIZE   (SCAN_SEQ_SLOTS * sizeof(scan_seq_slot_t))
+
+/* backing storage, NULL until scan_seq_begin succeeds */
+static storage_t *seq_storage = NULL;
+
+/* last sequence number handed out, the reserved limit and its slot */
+static uint32_t seq_last = 0;
+static uint32_t seq_limit = 1;
+static uint8_t seq_slot = 0;
+
+/**
+ * reserve - reserves the next SCAN_SEQ_RESERVE sequence numbers, only
+ *  once they are on flash, if any
+ *
+ * Return: true if reserved, false if the flash could not be written
+*/
+static bool reserve()
+{
+	scan_seq_slot_t slot;
+	uint8_t next_slot = (seq_slot + 1) % SCAN_SEQ_SLOTS;
+
+	slot.limit = seq_last + 1 + SCAN_SEQ_RESERVE;
+	slot.crc = crc16(&slot.limit, sizeof(slot.limit));
+
+	/* a failed write may have torn its slot, the retry writes it again */
+	if (seq_storage && !seq_storage->write(seq_storage->ctx,
+			next_slot * sizeof(slot), &slot, sizeof(slot)))
+		return false;
+
+	/* without flash the numbers still increase, until the next reboot */
+	seq_limit = slot.limit;
+	seq_slot = next_slot;
+	return true;
+}
+
+/**
+ * scan_seq_storage_size - retrieves the storage size the sequence
+ *  numbers need
+ *
+ * Return: size of the storage in bytes
+*/
+uint32_t scan_seq_storage_size()
+{
+	return (SCAN_SEQ_STORAGE_SIZE);
+}
+
+/**
+ * scan_seq_begin - attaches the sequence numbers to their storage and
+ *  carries on after the last reservation
+ *
+ * @storage: storage backend, at least SCAN_SEQ_STORAGE_SIZE bytes
+ *
+ * Return: true on success, false if the storage is too small or cannot
+ *  be written
+*/
+bool scan_seq_begin(storage_t *storage)
+{
+	scan_seq_slot_t slot;
+	uint32_t limit = 1;
+
+	if (storage->size < SCAN_SEQ_STORAGE_SIZE)
+		return false;
+
+	for (uint8_t i = 0; i < SCAN_SEQ_SLOTS; i++)
+	{
+		if (!storage->read(storage->ctx, i * sizeof(slot), &slot, sizeof(slot)) ||
+				slot.crc != crc16(&slot.limit, sizeof(slot.limit)) ||
+				slot.limit == 0xFFFFFFFF)
+			continue;
+
+		if (slot.limit > limit)
+		{
+			limit = slot.limit;
+			seq_slot = i;
+		}
+	}
+
+	seq_storage = storage;
+	seq_last = limit - 1;
+
+	return (reserve());
+}
+
+/**
+ * scan_seq_next - hands out the next sequence number, run by the RFID task
+ *
+ * Return: sequence number, 0 if the reservation is used up and the flash
+ *  could not be written, as the number would be handed out again after a
+ *  reboot
+ *
+ * Note: writes the flash once every SCAN_SEQ_RESERVE scans, and on every
+ *  scan while that fails
+*/
+uint32_t scan_seq_next()
+{
+	if (seq_last + 1 >= seq_limit && !reserve())
+		return (0);
+
+	return (++seq_last);
+}
@@ -0,0 +1,242 @@
+#include <Arduino.h>
+#include "main.h"
+#include "tasks.h"
+#include "hal.h"
+#include "my_wifi.h"
+#include "mqtt.h"
+#include "rfid.h"
+#include "lcd.h"
+#include "alarm.h"
+#include "verdict_cache.h"
+#include "trace.h"
+#include "power.h"
+#include "timesync.h"
+#include "rtc.h"
+#include "ui.h"
+
+
+/*
+ * event queues, each with exactly one producer and one consumer:
+ *   scan_queue: RFID task -> network task
+ *   rfid_ui_queue: RFID task -> UI task
+ *   mqtt_ui_queue: MQTT client callbacks -> UI task
+ *   wifi_ui_queue: WiFi event handler -> UI task
+*/
+static event_queue_t scan_queue;
+static event_queue_t rfid_ui_queue;
+event_queue_t mqtt_ui_queue;
+event_queue_t wifi_ui_queue;
+
+/**
+ * post_event - queues a scan-less event and wakes the consuming task
+ *
+ * @queue: queue to post to, the caller must be its only producer
+ * @task: task consuming the queue, one of enum task_id_e
+ * @type: one of enum event_type_e
+ * @code: event-specific value
+ *
+ * Return: Nothing
+*/
+void post_event(event_queue_t *queue, uint8_t task, uint8_t type, uint8_t code)
+{
+	event_t event;
+
+	memset(&event, 0, sizeof(event));
+	event.type = type;
+	event.code = code;
+
+	if (event_queue_push(queue, &event))
+		hal_task_notify(task);
+	else
+		Serial.println("Event queue full, event lost");
+}
+
+/**
+ * rfid_task - checks the reader for a card, timestamps every scan and
+ *  hands it to the network and UI tasks
+ *
+ * Return: Nothing
+*/
+static void rfid_task()
+{
+	event_t event;
+	uint32_t start;
+
+	rfid_log_stats();
+
+	/* Scanning any 'new' RFID card in the vicinity */
+	if (!rfid_read_new_card())
+		return;
+
+	memset(&event, 0, sizeof(event));
+	event.type = EVENT_SCAN;
+
+	/* stamping the scan with the synced time and its sequence number */
+	start = trace_cycles();
+	timesync_stamp(&event.scan);
+	trace_cycles_since(TRACE_TIMESTAMP, start);
+	event.detected_at = card_detected_at;
+	event.scan.uid_size = card_uid_size;
+	memcpy(event.scan.uid, card_uid, card_uid_size);
+	event.scan.outside_shift = !shift_status;
+
+	if (event_queue_push(&scan_queue, &event))
+		hal_task_notify(TASK_NET);
+	else
+		Serial.println("Scan queue full, scan lost");
+
+	/* cards the backend already rejected get their verdict at once */
+	event.type = EVENT_SCANNED;
+	event.code = verdict_cache_lookup(card_uid, card_uid_size);
+	if (event_queue_push(&rfid_ui_queue, &event))
+		hal_task_notify(TASK_UI);
+}
+
+/**
+ * net_task - publishes queued scans (journalling them while offline),
+ *  replays the offline journal, syncs the time and publishes the
+ *  diagnostics
+ *
+ * Return: Nothing
+*/
+static void net_task()
+{
+	event_t event;
+	uint16_t packet_id;
+
+	while (event_queue_pop(&scan_queue, &event))
+	{
+		packet_id = mqtt_send_scanned_card(&event.scan);
+		if (packet_id)
+			trace_published(event.detected_at, packet_id);
+	}
+
+	/* publish a batch of scans journalled while offline, if any */
+	mqtt_replay_journal();
+
+	/* save the card updates received since the last save, if due */
+	verdict_cache_persist(millis());
+
+	timesync_run();
+	rtc_check();
+
+	mqtt_publish_diagnostics();
+}
+
+/**
+ * ui_handle_event - applies an event from the other tasks to the UI state
+ *
+ * @event: event to apply
+ *
+ * Return: Nothing
+*/
+static void ui_handle_event(const event_t *event)
+{
+	switch (event->type)
+	{
+		case EVENT_SCANNED:
+			/*
+			 * cached verdict, only shown: the backend's response still
+			 * follows and decides the alarm
+			*/
+			if (event->code)
+			{
+				ui_show(UI_INVALID, event->code);
+				break;
+			}
+
+			if (!mqtt_isConnected())
+				break;
+
+			ui_show(UI_VERIFYING, 0);
+
+			/* scan not during shift - PROBLEM */
+			if (event->scan.outside_shift)
+				alarm_reason = NO_SHIFT_SCAN;
+			break;
+
+		case EVENT_VERDICT:
+			if (event->code == SUCCESS)
+				ui_show(UI_VALID, 0);
+			else
+			{
+				alarm_reason = event->code;
+				ui_show(UI_INVALID, event->code);
+			}
+			break;
+
+		case EVENT_ALARM:
+			if (event->code)
+				trigger_alarm();
+			else
+			{
+				alarm_reason = 0;
+				silence_alarm();
+			}
+			break;
+
+		case EVENT_SHIFT:
+			/* shift over, or the monitoring platform went down */
+			if (!event->code)
+				silence_alarm();
+			break;
+
+		case EVENT_OVERDUE:
+			alarm_reason = OVERDUE_SCAN;
+			break;
+
+		case EVENT_WIFI:
+			if (event->code)
+				silence_alarm();
+			else
+				ui_show(UI_CONNECTING, 0);
+			break;
+	}
+}
+
+/**
+ * ui_task - owns the LCD and the alarm: applies the other tasks' events
+ *  and runs the UI state machine
+ *
+ * Return: Nothing
+*/
+static void ui_task()
+{
+	event_t event;
+
+	/* if WiFi config mode button pressed */
+	check_wifi_config_requested();
+	/* if the cached access point did not answer in time */
+	check_wifi_fallback();
+
+	power_log_stats();
+
+	while (event_queue_pop(&rfid_ui_queue, &event))
+		ui_handle_event(&event);
+	while (event_queue_pop(&mqtt_ui_queue, &event))
+		ui_handle_event(&event);
+	while (event_queue_pop(&wifi_ui_queue, &event))
+		ui_handle_event(&event);
+
+	ui_run();
+	display_scroll_run();
+}
+
+/**
+ * initialize_tasks - starts the RFID, UI and network tasks on their cores
+ *
+ * Return: Nothing
+ *
+ * Note: every other module must be initialised prior to this
+*/
+void initialize_tasks()
+{
+	hal_task_start(TASK_NET, "net", net_task, NET_TASK_PERIOD,
+		NET_TASK_CORE, NET_TASK_PRIORITY, NET_TASK_STACK);
+	hal_task_start(TASK_UI, "ui", ui_task, UI_TASK_PERIOD,
+		UI_TASK_CORE, UI_TASK_PRIORITY, UI_TASK_STACK);
+	hal_task_start(TASK_RFID, "rfid", rfid_task,
+		rfid_detect_mode == RFID_DETECT_IRQ ?
+			RFID_TASK_IRQ_PERIOD : RFID_TASK_PERIOD,
+		RFID_TASK_CORE, RFID_TASK_PRIORITY, RFID_TASK_STACK);
+}
@@ -0,0 +1,506 @@
+#include <Arduino.h>
+#include <atomic>
+#include "timesync.h"
+#include "tasks.h"
+#include "my_wifi.h"
+#include "mqtt.h"
+#include "rtc.h"
+#include "scan_seq.h"
+#include "hal.h"
+
+/*
+ * The checkpoint's clock is the local microsecond timer, anchored to an
+ * epoch time and corrected for the timer's drift. The RTC gives the
+ * anchor at boot, then every SNTP sync measures the server's offset from
+ * the clock (NTP's on-wire calculation, which cancels a symmetric round
+ * trip), re-anchors the clock on the server and folds the offset that
+ * built up since the previous sync into the drift estimate, so the clock
+ * keeps time between syncs. Until the first sync, the clock follows the
+ * RTC's software clock (see rtc.cpp). The RTC carries the time over power
+ * cycles and is set whenever it strays from the synced clock.
+ *
+ * The network task syncs while the RFID task reads the clock, so the
+ * anchor is guarded by a sequence lock, as in verdict_cache.cpp. The
+ * server's address is looked up in the background and kept until a sync
+ * fails, so the network task never waits on DNS.
+*/
+
+/* SNTP packet, see RFC 4330 */
+#define NTP_PACKET_LEN          48
+#define NTP_CLIENT_REQUEST      0x23	/* leap 0, version 4, mode client */
+#define NTP_MODE_MASK           0x07
+#define NTP_MODE_SERVER         4
+#define NTP_LEAP_UNSYNCED       3
+#define NTP_ORIGINATE_OFFSET    24
+#define NTP_RECEIVE_OFFSET      32
+#define NTP_TRANSMIT_OFFSET     40
+/* seconds from the NTP epoch (1900) to the Unix epoch (1970) */
+#define NTP_UNIX_OFFSET         2208988800UL
+
+/**
+ * struct clock_anchor_s - ties the local timer to epoch time
+ *
+ * @local_us: local timer at the anchor, as hal_clock_us() [us]
+ * @epoch_us: epoch time at the anchor [us]
+ * @drift_ppb: correction to the local timer's rate [ppb]
+*/
+typedef struct clock_anchor_s
+{
+	uint64_t local_us;
+	uint64_t epoch_us;
+	int32_t drift_ppb;
+} clock_anchor_t;
+
+/* sequence lock guarding the anchor, odd while it is rewritten */
+static std::atomic<uint32_t> anchor_seq(0);
+static clock_anchor_t anchor;
+
+/* RFID task: last scan's time, scans never go back */
+static uint64_t last_stamp_us = 0;
+
+/* request in flight: its transmit timestamp, and when it was sent */
+static bool request_pending = false;
+static uint8_t request_stamp[8];
+static uint64_t request_epoch_us = 0;
+static uint32_t request_sent_at = 0;
+
+/* server's address, 0 until looked up or after a failed sync */
+static uint32_t server_ip = 0;
+
+/* millis() when the next sync is due */
+static uint32_t next_sync_at = 0;
+/* local timer at the last accepted sync, the drift is measured from it */
+static uint64_t last_sync_local_us = 0;
+
+static timesync_stats_t stats;
+
+/**
+ * read_anchor - takes a consistent copy of the clock's anchor
+ *
+ * @copy: where to store the copy
+ *
+ * Return: Nothing
+*/
+static void read_anchor(clock_anchor_t *copy)
+{
+	uint32_t seq;
+
+	do {
+		seq = anchor_seq.load(std::memory_order_acquire);
+		*copy = anchor;
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((seq & 1) || anchor_seq.load(std::memory_order_relaxed) != seq);
+}
+
+/**
+ * write_anchor - re-anchors the clock, only the network task does
+ *
+ * @update: new anchor
+ *
+ * Return: Nothing
+*/
+static void write_anchor(const clock_anchor_t *update)
+{
+	anchor_seq.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	anchor = *update;
+	anchor_seq.fetch_add(1, std::memory_order_release);
+}
+
+/**
+ * clock_at - converts a local timer reading to epoch time
+ *
+ * @from: anchor to convert with
+ * @local_us: local timer reading, as hal_clock_us() [us]
+ *
+ * Return: epoch time [us]
+*/
+static uint64_t clock_at(const clock_anchor_t *from, uint64_t local_us)
+{
+	int64_t elapsed = (int64_t)(local_us - from->local_us);
+
+	return (from->epoch_us + elapsed + elapsed * from->drift_ppb / 1000000000LL);
+}
+
+/**
+ * put_ntp_time - stores an epoch time as an NTP timestamp
+ *
+ * @p: destination, 8 bytes
+ * @epoch_us: epoch time [us]
+ *
+ * Return: Nothing
+*/
+static void put_ntp_time(uint8_t *p, uint64_t epoch_us)
+{
+	uint32_t seconds = (uint32_t)(epoch_us / 1000000) + NTP_UNIX_OFFSET;
+	uint32_t fraction = ((epoch_us % 1000000) << 32) / 1000000;
+
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		p[i] = seconds >> (24 - 8 * i);
+		p[4 + i] = fraction >> (24 - 8 * i);
+	}
+}
+
+/**
+ * get_ntp_time - loads an NTP timestamp as an epoch time
+ *
+ * @p: source, 8 bytes
+ *
+ * Return: epoch time [us], NTP eras wrap over so it holds until 2106
+*/
+static uint64_t get_ntp_time(const uint8_t *p)
+{
+	uint32_t seconds = 0, fraction = 0;
+
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		seconds = (seconds << 8) | p[i];
+		fraction = (fraction << 8) | p[4 + i];
+	}
+
+	return ((uint64_t)(uint32_t)(seconds - NTP_UNIX_OFFSET) * 1000000 +
+		(((uint64_t)fraction * 1000000) >> 32));
+}
+
+/**
+ * on_receive - hal_udp_begin handler: wakes the network task to take the
+ *  server's response
+ *
+ * Return: Nothing
+*/
+static void on_receive()
+{
+	hal_task_notify(TASK_NET);
+}
+
+/**
+ * discipline_rtc - sets the RTC if it strayed from the synced clock
+ *
+ * Return: Nothing
+*/
+static void discipline_rtc()
+{
+	uint64_t epoch_us = timesync_now_us();
+	int64_t error = (int64_t)(rtc_now_us() - epoch_us) / 1000;
+	rtc_stats_t rtc;
+
+	/* until the RTC's clock follows its square wave, its phase is unknown */
+	rtc_get_stats(&rtc);
+	if (!rtc.running && error < 1000 && error > -1000)
+		return;
+
+	if (error < TIMESYNC_RTC_TOLERANCE && error > -TIMESYNC_RTC_TOLERANCE)
+		return;
+
+	rtc_adjust(epoch_us);
+	stats.rtc_adjusts++;
+
+	Serial.print("RTC was off by ");
+	Serial.print((int32_t)error);
+	Serial.println(" ms, set");
+}
+
+/**
+ * apply_sync - re-anchors the clock on the server's time and updates the
+ *  drift estimate
+ *
+ * @offset_us: server time minus the clock's [us]
+ * @delay_us: round trip of the response [us]
+ * @local_us: local timer when the response arrived [us]
+ *
+ * Return: Nothing
+*/
+static void apply_sync(int64_t offset_us, int64_t delay_us, uint64_t local_us)
+{
+	clock_anchor_t update;
+	int64_t span = (int64_t)(local_us - last_sync_local_us);
+	bool step = offset_us >= TIMESYNC_STEP_THRESHOLD * 1000LL ||
+		offset_us <= -TIMESYNC_STEP_THRESHOLD * 1000LL;
+
+	read_anchor(&update);
+	update.epoch_us = clock_at(&update, local_us) + offset_us;
+	update.local_us = local_us;
+
+	/*
+	 * the offset built up since the last sync is what the drift
+	 * correction missed; half of it is taken to ride out delay jitter
+	*/
+	if (stats.synced && !step && span >= TIMESYNC_DRIFT_MIN_SPAN * 1000LL)
+	{
+		int64_t drift = update.drift_ppb +
+			offset_us * 1000000000LL / span / 2;
+
+		if (drift > TIMESYNC_MAX_DRIFT)
+			drift = TIMESYNC_MAX_DRIFT;
+		else if (drift < -TIMESYNC_MAX_DRIFT)
+			drift = -TIMESYNC_MAX_DRIFT;
+		update.drift_ppb = (int32_t)drift;
+	}
+
+	write_anchor(&update);
+
+	last_sync_local_us = local_us;
+
+	stats.synced = true;
+	stats.syncs++;
+	stats.offset_us = offset_us;
+	stats.delay_us = (uint32_t)delay_us;
+	stats.drift_ppb = update.drift_ppb;
+
+	Serial.print("Time sync: offset ");
+	Serial.print((int32_t)(offset_us / 1000));
+	Serial.print(" ms, delay ");
+	Serial.print((uint32_t)(delay_us / 1000));
+	Serial.print(" ms, drift ");
+	Serial.print(update.drift_ppb / 1000);
+	Serial.println(" ppm");
+
+	discipline_rtc();
+}
+
+/**
+ * handle_response - checks the server's response and syncs on it
+ *
+ * @packet: received datagram
+ * @len: length of the datagram
+ * @local_us: local timer when it arrived [us]
+ *
+ * Return: true if it answers the request in flight, accepted or not,
+ *  false otherwise
+*/
+static bool handle_response(const uint8_t *packet, size_t len,
+		uint64_t local_us)
+{
+	clock_anchor_t now;
+	int64_t t1, t2, t3, t4, offset, delay;
+
+	if (len < NTP_PACKET_LEN ||
+			(packet[0] & NTP_MODE_MASK) != NTP_MODE_SERVER ||
+			memcmp(&packet[NTP_ORIGINATE_OFFSET], request_stamp,
+				sizeof(request_stamp)))
+		return false;
+
+	/* answered, but by an unsynchronised server (or a kiss-o'-death) */
+	if ((packet[0] >> 6) == NTP_LEAP_UNSYNCED || !packet[1] || packet[1] > 15)
+	{
+		stats.failures++;
+		return true;
+	}
+
+	read_anchor(&now);
+	t1 = (int64_t)request_epoch_us;
+	t2 = (int64_t)get_ntp_time(&packet[NTP_RECEIVE_OFFSET]);
+	t3 = (int64_t)get_ntp_time(&packet[NTP_TRANSMIT_OFFSET]);
+	t4 = (int64_t)clock_at(&now, local_us);
+
+	offset = ((t2 - t1) + (t3 - t4)) / 2;
+	delay = (t4 - t1) - (t3 - t2);
+
+	if (delay < 0 || delay > TIMESYNC_MAX_DELAY * 1000LL)
+	{
+		stats.failures++;
+		return true;
+	}
+
+	apply_sync(offset, delay, local_us);
+	return true;
+}
+
+/**
+ * server_address - finds the SNTP server's address, looking it up in the
+ *  background the first time and after a failed sync
+ *
+ * Return: HAL_DNS_RESOLVED once server_ip is known, HAL_DNS_PENDING or
+ *  HAL_DNS_FAILED otherwise
+*/
+static uint8_t server_address()
+{
+	const char *host = TIMESYNC_SERVER;
+
+	if (server_ip)
+		return (HAL_DNS_RESOLVED);
+
+	if (!*host)
+	{
+		if (!domain)
+		{
+			server_ip = (uint32_t)broker_ip;
+			return (server_ip ? HAL_DNS_RESOLVED : HAL_DNS_FAILED);
+		}
+		host = broker_host;
+	}
+
+	return (hal_dns_lookup(host, &server_ip));
+}
+
+/**
+ * send_request - sends an SNTP request to the server at server_ip
+ *
+ * Return: true if sent, false otherwise
+*/
+static bool send_request()
+{
+	uint8_t packet[NTP_PACKET_LEN];
+
+	memset(packet, 0, sizeof(packet));
+	packet[0] = NTP_CLIENT_REQUEST;
+
+	/* the server echoes the transmit timestamp, which tells its response apart */
+	request_epoch_us = timesync_now_us();
+	put_ntp_time(&packet[NTP_TRANSMIT_OFFSET], request_epoch_us);
+	memcpy(request_stamp, &packet[NTP_TRANSMIT_OFFSET], sizeof(request_stamp));
+
+	return (hal_udp_send(server_ip, TIMESYNC_SERVER_PORT,
+		packet, sizeof(packet)));
+}
+
+/**
+ * anchor_on_rtc - anchors the clock on the RTC's, until synced
+ *
+ * Return: Nothing
+*/
+static void anchor_on_rtc()
+{
+	clock_anchor_t start;
+
+	start.local_us = hal_clock_us();
+	start.epoch_us = rtc_now_us();
+	start.drift_ppb = 0;
+	write_anchor(&start);
+}
+
+/**
+ * initialize_timesync - starts the clock off the RTC and opens the SNTP
+ *  socket
+ *
+ * Return: Nothing
+ *
+ * Note: initialize_RTC() should be called prior to this
+*/
+void initialize_timesync()
+{
+	anchor_on_rtc();
+
+	if (!hal_udp_begin(TIMESYNC_LOCAL_PORT, on_receive))
+		Serial.println("Time sync: no UDP socket, running off the RTC");
+
+	next_sync_at = millis();
+}
+
+/**
+ * timesync_run - syncs with the SNTP server when due and takes its
+ *  response, run by the network task
+ *
+ * Return: Nothing
+*/
+void timesync_run()
+{
+	uint8_t packet[NTP_PACKET_LEN];
+	uint64_t received_at;
+	size_t len;
+
+	if (request_pending)
+	{
+		uint32_t syncs = stats.syncs;
+
+		while ((len = hal_udp_receive(packet, sizeof(packet), &received_at)))
+		{
+			if (handle_response(packet, len, received_at))
+			{
+				request_pending = false;
+				next_sync_at = millis() + (stats.syncs != syncs ?
+					TIMESYNC_PERIOD : TIMESYNC_RETRY);
+				return;
+			}
+		}
+
+		if (millis() - request_sent_at < TIMESYNC_TIMEOUT)
+			return;
+
+		/* unanswered: the server may have moved, look it up again */
+		request_pending = false;
+		server_ip = 0;
+		stats.failures++;
+		next_sync_at = millis() + TIMESYNC_RETRY;
+		return;
+	}
+
+	/* the RTC's clock locks onto its square wave after boot */
+	if (!stats.synced)
+		anchor_on_rtc();
+
+	if ((int32_t)(millis() - next_sync_at) < 0 || !wifi_isConnected())
+		return;
+
+	/* polled again on the next run until the lookup completes */
+	switch (server_address())
+	{
+		case HAL_DNS_PENDING:
+			return;
+		case HAL_DNS_FAILED:
+			stats.failures++;
+			next_sync_at = millis() + TIMESYNC_RETRY;
+			return;
+	}
+
+	/* drop anything left over from an earlier request */
+	while (hal_udp_receive(packet, sizeof(packet), &received_at))
+		;
+
+	request_sent_at = millis();
+	if (send_request())
+		request_pending = true;
+	else
+	{
+		stats.failures++;
+		next_sync_at = millis() + TIMESYNC_RETRY;
+	}
+}
+
+/**
+ * timesync_now_us - reads the clock
+ *
+ * Return: epoch time [us]
+*/
+uint64_t timesync_now_us()
+{
+	clock_anchor_t now;
+
+	read_anchor(&now);
+	return (clock_at(&now, hal_clock_us()));
+}
+
+/**
+ * timesync_stamp - stamps a scan with the time and the next sequence
+ *  number, run by the RFID task
+ *
+ * @record: scan to stamp
+ *
+ * Return: Nothing
+*/
+void timesync_stamp(scan_record_t *record)
+{
+	uint64_t now = timesync_now_us();
+
+	/* a sync may step the clock back, the scans stay in order */
+	if (now < last_stamp_us)
+		now = last_stamp_us;
+	last_stamp_us = now;
+
+	record->scan_time = (uint32_t)(now / 1000000);
+	record->scan_ms = (uint16_t)(now / 1000 % 1000);
+	record->seq = scan_seq_next();
+}
+
+/**
+ * timesync_get_stats - gets the time sync state since startup
+ *
+ * @copy: where to store the state
+ *
+ * Return: Nothing
+*/
+void timesync_get_stats(timesync_stats_t *copy)
+{
+	*copy = stats;
+}
@@ -0,0 +1,168 @@
+#include <Arduino.h>
+#include "trace.h"
+#include "hal.h"
+
+/*
+ * Stages that run within one task are timed with the CPU's cycle
+ * counter (trace_cycles/trace_cycles_since): cheap and precise, but each
+ * core has its own. Stages that span tasks, and so maybe cores, are
+ * timed with micros(), which every core shares.
+ *
+ * Each histogram is only written by the task running its stage. The
+ * backend's response does not say which scan it answers, so the
+ * published-scan stages follow the last published live scan.
+*/
+
+static trace_histogram_t histograms[TRACE_STAGE_COUNT];
+
+static const char *const stage_names[TRACE_STAGE_COUNT] = {
+	"detect",
+	"read-uid",
+	"format-uid",
+	"timestamp",
+	"publish",
+	"ack",
+	"verdict",
+	"tap-to-verdict",
+	"mqtt-ready",
+	"boot-to-publish",
+	"wifi-connect"
+};
+
+/* last published live scan: when it was detected and published [us] */
+static volatile uint32_t traced_detected_at = 0;
+static volatile uint32_t traced_published_at = 0;
+/* its packet ID, 0 once its verdict arrived */
+static volatile uint16_t traced_packet_id = 0;
+/* whether its acknowledgement arrived */
+static volatile bool traced_acked = false;
+
+/**
+ * trace_cycles - reads the current core's cycle counter
+ *
+ * Return: cycle count, to pass to trace_cycles_since()
+*/
+uint32_t trace_cycles()
+{
+	return (hal_cycle_count());
+}
+
+/**
+ * trace_cycles_since - records a stage timed with the cycle counter
+ *
+ * @stage: one of enum trace_stage_e
+ * @start: trace_cycles() at the start of the stage, on the same core
+ *
+ * Return: Nothing
+*/
+void trace_cycles_since(uint8_t stage, uint32_t start)
+{
+	trace_record(stage, (hal_cycle_count() - start) / hal_cycles_per_us());
+}
+
+/**
+ * trace_record - adds a latency to a stage's histogram
+ *
+ * @stage: one of enum trace_stage_e
+ * @us: latency [us]
+ *
+ * Return: Nothing
+*/
+void trace_record(uint8_t stage, uint32_t us)
+{
+	trace_histogram_t *histogram;
+	uint8_t bucket = 0;
+
+	if (stage >= TRACE_STAGE_COUNT)
+		return;
+
+	histogram = &histograms[stage];
+
+	if (us >= 2)
+		bucket = 31 - __builtin_clz(us);
+	if (bucket >= TRACE_BUCKETS)
+		bucket = TRACE_BUCKETS - 1;
+
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	if (us > histogram->max)
+		histogram->max = us;
+}
+
+/**
+ * trace_published - starts following a live scan handed to the MQTT client
+ *
+ * @detected_at: micros() when the scan's card was detected
+ * @packet_id: packet ID of the scan's publish
+ *
+ * Return: Nothing
+*/
+void trace_published(uint32_t detected_at, uint16_t packet_id)
+{
+	uint32_t now = micros();
+
+	trace_record(TRACE_PUBLISH, now - detected_at);
+
+	traced_packet_id = 0;
+	traced_detected_at = detected_at;
+	traced_published_at = now;
+	traced_acked = false;
+	traced_packet_id = packet_id;
+}
+
+/**
+ * trace_acked - records the broker's acknowledgement of the followed scan
+ *
+ * @packet_id: packet ID of the acknowledged publish
+ *
+ * Return: Nothing
+*/
+void trace_acked(uint16_t packet_id)
+{
+	if (!packet_id || packet_id != traced_packet_id || traced_acked)
+		return;
+
+	traced_acked = true;
+	trace_record(TRACE_ACK, micros() - traced_published_at);
+}
+
+/**
+ * trace_verdict - records the backend's response to the followed scan
+ *
+ * Return: Nothing
+*/
+void trace_verdict()
+{
+	uint32_t now = micros();
+
+	if (!traced_packet_id)
+		return;
+
+	trace_record(TRACE_VERDICT, now - traced_published_at);
+	trace_record(TRACE_TAP_TO_VERDICT, now - traced_detected_at);
+	traced_packet_id = 0;
+}
+
+/**
+ * trace_histogram - retrieves a stage's latency histogram
+ *
+ * @stage: one of enum trace_stage_e
+ *
+ * Return: the stage's histogram, NULL for an unknown stage
+*/
+const trace_histogram_t *trace_histogram(uint8_t stage)
+{
+	return (stage < TRACE_STAGE_COUNT ? &histograms[stage] : NULL);
+}
+
+/**
+ * trace_stage_name - retrieves the name a stage is published under
+ *
+ * @stage: one of enum trace_stage_e
+ *
+ * Return: the stage's name, NULL for an unknown stage
+*/
+const char *trace_stage_name(uint8_t stage)
+{
+	return (stage < TRACE_STAGE_COUNT ? stage_names[stage] : NULL);
+}
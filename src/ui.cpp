@@ -0,0 +1,235 @@
+#include <Arduino.h>
+#include "main.h"
+#include "ui.h"
+#include "lcd.h"
+#include "alarm.h"
+#include "my_wifi.h"
+#include "mqtt.h"
+
+/*
+ * UI state machine: the screens are declared in ui_screens, each drawn
+ * once as it is entered, or as its code changes, and never in between
+ * (scrolling aside). Events request transient screens with ui_show();
+ * the base screen is the alarm while it is on, home otherwise.
+ *
+ * A requested screen replaces the current one if it ranks at least as
+ * high, or once the current one has been up for its dwell time; until
+ * then it waits, for up to its own timeout. A transient screen gives way
+ * to the base screen at its timeout, or as soon as the base outranks it.
+*/
+
+/* home screen codes: which connections are up */
+#define UI_HOME_WIFI            0x01
+#define UI_HOME_MQTT            0x02
+
+/**
+ * struct ui_screen_def_s - how a screen behaves
+ *
+ * @priority: rank against the other screens, higher wins
+ * @dwell: least time it stays up before a lower priority screen [ms]
+ * @timeout: time it stays up [ms], 0 for the base screens
+ * @render: draws it
+*/
+typedef struct ui_screen_def_s
+{
+	uint8_t priority;
+	uint16_t dwell;
+	uint16_t timeout;
+	void (*render)(uint8_t code);
+} ui_screen_def_t;
+
+static void render_home(uint8_t);
+static void render_connecting(uint8_t);
+static void render_verifying(uint8_t);
+static void render_valid(uint8_t);
+static void render_invalid(uint8_t);
+static void render_alarm(uint8_t);
+
+/* in enum ui_screen_e order */
+static const ui_screen_def_t ui_screens[UI_SCREEN_COUNT] = {
+	{0, 0, 0, render_home},
+	{1, 0, UI_CONNECTING_TIMEOUT, render_connecting},
+	{2, UI_VERIFYING_DWELL, UI_VERIFYING_TIMEOUT, render_verifying},
+	{3, UI_VERDICT_DWELL, UI_VERDICT_TIMEOUT, render_valid},
+	{3, UI_VERDICT_DWELL, UI_VERDICT_TIMEOUT, render_invalid},
+	{4, 0, 0, render_alarm},
+};
+
+/* screen shown, UI_SCREEN_COUNT before the first run, its code and since when */
+static uint8_t current = UI_SCREEN_COUNT;
+static uint8_t current_code = 0;
+static uint32_t entered_at = 0;
+
+/* screen requested by an event, waiting for the current one's dwell */
+static bool pending = false;
+static uint8_t pending_screen = 0;
+static uint8_t pending_code = 0;
+static uint32_t pending_at = 0;
+
+/**
+ * render_home - draws the connection status and "Scan Card"
+ *
+ * @code: UI_HOME_* flags
+ *
+ * Return: Nothing
+*/
+static void render_home(uint8_t code)
+{
+	display_default_text(
+		code & UI_HOME_WIFI ? DISPLAY_SUCCESS : DISPLAY_FAILURE,
+		code & UI_HOME_MQTT ? DISPLAY_SUCCESS : DISPLAY_FAILURE);
+}
+
+/**
+ * render_connecting - draws "Connecting to WiFi"
+ *
+ * @code: unused
+ *
+ * Return: Nothing
+*/
+static void render_connecting(uint8_t code)
+{
+	(void)code;
+	display_connecting_to_wifi();
+}
+
+/**
+ * render_verifying - draws "Scanning and verifying sentry ID"
+ *
+ * @code: unused
+ *
+ * Return: Nothing
+*/
+static void render_verifying(uint8_t code)
+{
+	(void)code;
+	display_scanning_verifying();
+}
+
+/**
+ * render_valid - draws the valid scan verdict
+ *
+ * @code: unused
+ *
+ * Return: Nothing
+*/
+static void render_valid(uint8_t code)
+{
+	(void)code;
+	display_valid_scan();
+}
+
+/**
+ * render_invalid - draws the invalid scan verdict
+ *
+ * @code: reason, one of enum alerts_e
+ *
+ * Return: Nothing
+*/
+static void render_invalid(uint8_t code)
+{
+	display_invalid_scan(code);
+}
+
+/**
+ * render_alarm - draws the alarm's reason
+ *
+ * @code: reason, one of enum alerts_e
+ *
+ * Return: Nothing
+*/
+static void render_alarm(uint8_t code)
+{
+	if (code == OVERDUE_SCAN)
+		display_scan_time_elapsed();
+	else
+		display_invalid_scan(code);
+}
+
+/**
+ * enter - shows a screen
+ *
+ * @screen: one of enum ui_screen_e
+ * @code: screen-specific value
+ *
+ * Return: Nothing
+*/
+static void enter(uint8_t screen, uint8_t code)
+{
+	current = screen;
+	current_code = code;
+	entered_at = millis();
+
+	display_scroll_stop();
+	ui_screens[screen].render(code);
+}
+
+/**
+ * ui_show - requests a transient screen
+ *
+ * @screen: UI_CONNECTING, UI_VERIFYING, UI_VALID or UI_INVALID
+ * @code: screen-specific value
+ *
+ * Return: Nothing
+ *
+ * Note: replaces an earlier request still waiting
+*/
+void ui_show(uint8_t screen, uint8_t code)
+{
+	pending = true;
+	pending_screen = screen;
+	pending_code = code;
+	pending_at = millis();
+}
+
+/**
+ * ui_run - moves to the screen due, drawing it if it changed
+ *
+ * Return: Nothing
+*/
+void ui_run()
+{
+	uint32_t now = millis();
+	uint8_t base, base_code;
+	const ui_screen_def_t *screen;
+	bool dwelt;
+
+	if (alarm_on_off)
+	{
+		base = UI_ALARM;
+		base_code = alarm_reason;
+	}
+	else
+	{
+		base = UI_HOME;
+		base_code = (wifi_isConnected() ? UI_HOME_WIFI : 0) |
+			(wifi_isConnected() && mqtt_isConnected() ? UI_HOME_MQTT : 0);
+	}
+
+	if (current == UI_SCREEN_COUNT)
+		enter(base, base_code);
+
+	/* outranked by the base screen, or waited too long */
+	if (pending && (ui_screens[pending_screen].priority < ui_screens[base].priority ||
+			now - pending_at >= ui_screens[pending_screen].timeout))
+		pending = false;
+
+	screen = &ui_screens[current];
+	dwelt = now - entered_at >= screen->dwell;
+
+	if (pending && (ui_screens[pending_screen].priority >= screen->priority || dwelt))
+	{
+		pending = false;
+		enter(pending_screen, pending_code);
+		return;
+	}
+
+	if (screen->timeout)
+	{
+		if (now - entered_at >= screen->timeout ||
+				ui_screens[base].priority > screen->priority)
+			enter(base, base_code);
+	}
+	else if (current != base || current_code != base_code)
+		enter(base, base_code);
+}
@@ -0,0 +1,640 @@
+#include <string.h>
+#include <atomic>
+#include "main.h"
+#include "verdict_cache.h"
+#include "crc16.h"
+
+/*
+ * The cache is a RAM copy of the backend's registered and stolen cards,
+ * kept sorted by UID for binary search and fronted by a Bloom filter so
+ * most unknown cards are rejected without a search. Updates are applied
+ * by the MQTT client's task while the RFID task looks cards up, so the
+ * table is guarded by a sequence lock: the writer makes the sequence odd
+ * while it edits, and a reader that saw it odd or changed retries.
+ *
+ * On flash the table is a header followed by the sorted entries, both
+ * checksummed; the header is written last so an interrupted write is
+ * caught on the next boot and the cache resyncs from empty. The network
+ * task saves the table, VERDICT_CACHE_PERSIST_DELAY after the first
+ * unsaved update and never mid-snapshot, under the same sequence lock as
+ * lookups: a save an update overlapped is done again.
+*/
+
+/* times a lookup retries while an update is being applied */
+#define VERDICT_CACHE_READ_RETRIES      4
+
+/* cache flags */
+#define CACHE_FLAG_PARTIAL              0x01	/* snapshot in progress */
+#define CACHE_FLAG_OVERFLOW             0x02	/* a card did not fit */
+
+/**
+ * struct card_entry_s - a cached card, @uid_size and @uid form the sort
+ *  key so the bytes past @uid_size are always zero
+ *
+ * @uid_size: length of the RFID UID in bytes
+ * @uid: RFID UID bytes
+ * @status: one of enum card_status_e
+*/
+typedef struct card_entry_s
+{
+	uint8_t uid_size;
+	uint8_t uid[RFID_UID_MAX_LEN];
+	uint8_t status;
+} card_entry_t;
+
+#define CARD_KEY_LEN            (offsetof(card_entry_t, status))
+
+/**
+ * struct cache_header_s - on-flash layout of the cache's header
+ *
+ * @version: version of the backend's card table the cache holds, 0 if none
+ * @count: number of entries following the header
+ * @flags: CACHE_FLAG_* bits
+ * @entries_crc: CRC16 over the @count entries
+ * @crc: CRC16 over the header fields before it
+*/
+typedef struct cache_header_s
+{
+	uint32_t version;
+	uint16_t count;
+	uint8_t flags;
+	uint8_t reserved;
+	uint16_t entries_crc;
+	uint16_t crc;
+} cache_header_t;
+
+#define CACHE_ENTRIES_OFFSET    (sizeof(cache_header_t))
+#define CACHE_STORAGE_SIZE      (CACHE_ENTRIES_OFFSET + \
+	VERDICT_CACHE_CAPACITY * sizeof(card_entry_t))
+
+static_assert((VERDICT_CACHE_BLOOM_BITS & (VERDICT_CACHE_BLOOM_BITS - 1)) == 0,
+	"VERDICT_CACHE_BLOOM_BITS must be a power of two");
+static_assert(VERDICT_CACHE_CAPACITY <= 0xFFFF,
+	"VERDICT_CACHE_CAPACITY must fit the header's count");
+
+/* backing storage, NULL until verdict_cache_begin succeeds */
+static storage_t *cache_storage = NULL;
+
+/* sequence lock guarding everything below, odd while an update is applied */
+static std::atomic<uint32_t> cache_seq(0);
+
+static card_entry_t cache_entries[VERDICT_CACHE_CAPACITY];
+static uint32_t cache_count = 0;
+static uint32_t cache_version = 0;
+static uint8_t cache_flags = 0;
+static uint32_t cache_bloom[VERDICT_CACHE_BLOOM_BITS / 32];
+
+/* set by updates, cleared by the save covering them */
+static std::atomic<bool> cache_dirty(false);
+/* when the saver first saw the unsaved updates, now_ms */
+static bool cache_dirty_seen = false;
+static uint32_t cache_dirty_since = 0;
+
+/**
+ * make_key - builds a card entry's sort key from a UID
+ *
+ * @entry: entry to fill, its status is cleared
+ * @uid: RFID UID bytes
+ * @uid_size: length of the RFID UID in bytes
+ *
+ * Return: Nothing
+*/
+static void make_key(card_entry_t *entry, const uint8_t *uid, uint8_t uid_size)
+{
+	memset(entry, 0, sizeof(*entry));
+	entry->uid_size = uid_size;
+	memcpy(entry->uid, uid, uid_size);
+}
+
+/**
+ * find_entry - binary searches the cache for a card
+ *
+ * @key: entry holding the card's key
+ * @pos: where to store the card's index, or where it would be inserted
+ *
+ * Return: true if the card is cached, false otherwise
+*/
+static bool find_entry(const card_entry_t *key, uint32_t *pos)
+{
+	uint32_t low = 0, high = cache_count;
+
+	/* bounded even if an update shrinks the table mid-search */
+	if (high > VERDICT_CACHE_CAPACITY)
+		high = VERDICT_CACHE_CAPACITY;
+
+	while (low < high)
+	{
+		uint32_t mid = low + (high - low) / 2;
+		int cmp = memcmp(&cache_entries[mid], key, CARD_KEY_LEN);
+
+		if (cmp == 0)
+		{
+			*pos = mid;
+			return true;
+		}
+		if (cmp < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	*pos = low;
+	return false;
+}
+
+/**
+ * bloom_hash - FNV-1a hash of a card's key, split into the two halves
+ *  of the Bloom filter's double hashing
+ *
+ * @key: entry holding the card's key
+ * @step: where to store the odd stride between the card's bits
+ *
+ * Return: index of the card's first bit
+*/
+static uint32_t bloom_hash(const card_entry_t *key, uint32_t *step)
+{
+	const uint8_t *bytes = (const uint8_t *)key;
+	uint32_t hash = 2166136261u;
+
+	for (size_t i = 0; i < CARD_KEY_LEN; i++)
+		hash = (hash ^ bytes[i]) * 16777619u;
+
+	*step = (hash >> 16) | 1;
+	return (hash);
+}
+
+/**
+ * bloom_add - sets a card's bits in the Bloom filter
+ *
+ * @key: entry holding the card's key
+ *
+ * Return: Nothing
+*/
+static void bloom_add(const card_entry_t *key)
+{
+	uint32_t step, bit = bloom_hash(key, &step);
+
+	for (uint8_t i = 0; i < VERDICT_CACHE_BLOOM_HASHES; i++, bit += step)
+	{
+		uint32_t b = bit & (VERDICT_CACHE_BLOOM_BITS - 1);
+
+		cache_bloom[b / 32] |= 1UL << (b % 32);
+	}
+}
+
+/**
+ * bloom_maybe - checks a card's bits in the Bloom filter
+ *
+ * @key: entry holding the card's key
+ *
+ * Return: false if the card is certainly not cached, true if it may be
+*/
+static bool bloom_maybe(const card_entry_t *key)
+{
+	uint32_t step, bit = bloom_hash(key, &step);
+
+	for (uint8_t i = 0; i < VERDICT_CACHE_BLOOM_HASHES; i++, bit += step)
+	{
+		uint32_t b = bit & (VERDICT_CACHE_BLOOM_BITS - 1);
+
+		if (!(cache_bloom[b / 32] & (1UL << (b % 32))))
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * bloom_rebuild - rebuilds the Bloom filter from the table, Bloom filters
+ *  cannot forget a card so this follows every removal
+ *
+ * Return: Nothing
+*/
+static void bloom_rebuild()
+{
+	memset(cache_bloom, 0, sizeof(cache_bloom));
+
+	for (uint32_t i = 0; i < cache_count; i++)
+		bloom_add(&cache_entries[i]);
+}
+
+/**
+ * persist - saves the table and then its header
+ *
+ * Return: true on success, false otherwise
+*/
+static bool persist()
+{
+	cache_header_t header;
+	size_t entries_len = cache_count * sizeof(card_entry_t);
+
+	memset(&header, 0, sizeof(header));
+	header.version = cache_version;
+	header.count = cache_count;
+	header.flags = cache_flags;
+	header.entries_crc = crc16(cache_entries, entries_len);
+	header.crc = crc16(&header, offsetof(cache_header_t, crc));
+
+	if (entries_len && !cache_storage->write(cache_storage->ctx,
+			CACHE_ENTRIES_OFFSET, cache_entries, entries_len))
+		return false;
+
+	return (cache_storage->write(cache_storage->ctx, 0,
+		&header, sizeof(header)));
+}
+
+/**
+ * verdict_cache_storage_size - retrieves the storage size the cache needs
+ *
+ * Return: size of the cache's storage in bytes
+*/
+uint32_t verdict_cache_storage_size()
+{
+	return (CACHE_STORAGE_SIZE);
+}
+
+/**
+ * verdict_cache_begin - attaches the cache to its storage and loads the
+ *  cards saved before the last reboot
+ *
+ * @storage: storage backend, at least CACHE_STORAGE_SIZE bytes
+ *
+ * Return: true on success, false if the storage is too small
+*/
+bool verdict_cache_begin(storage_t *storage)
+{
+	cache_header_t header;
+
+	if (storage->size < CACHE_STORAGE_SIZE)
+		return false;
+
+	cache_storage = storage;
+	cache_count = 0;
+	cache_version = 0;
+	cache_flags = 0;
+
+	/* blank or damaged cache: start empty, the backend resyncs it */
+	if (storage->read(storage->ctx, 0, &header, sizeof(header)) &&
+			header.crc == crc16(&header, offsetof(cache_header_t, crc)) &&
+			header.count <= VERDICT_CACHE_CAPACITY &&
+			storage->read(storage->ctx, CACHE_ENTRIES_OFFSET, cache_entries,
+				header.count * sizeof(card_entry_t)) &&
+			header.entries_crc == crc16(cache_entries,
+				header.count * sizeof(card_entry_t)))
+	{
+		cache_count = header.count;
+		cache_version = header.version;
+		cache_flags = header.flags;
+	}
+
+	bloom_rebuild();
+
+	return true;
+}
+
+/**
+ * verdict_cache_lookup - gives the immediate verdict on a scanned card
+ *
+ * @uid: RFID UID bytes
+ * @uid_size: length of the RFID UID in bytes
+ *
+ * Return: UNKNOWN_CARD or STOLEN_CARD if the cache knows the scan is
+ *  invalid, 0 if the backend has to decide (registered card, or no
+ *  complete cache)
+*/
+uint8_t verdict_cache_lookup(const uint8_t *uid, uint8_t uid_size)
+{
+	card_entry_t key;
+	uint32_t pos;
+
+	if (uid_size > RFID_UID_MAX_LEN)
+		return (0);
+
+	make_key(&key, uid, uid_size);
+
+	for (uint8_t attempt = 0; attempt < VERDICT_CACHE_READ_RETRIES; attempt++)
+	{
+		uint32_t seq = cache_seq.load(std::memory_order_acquire);
+		uint8_t verdict = 0;
+
+		/* update in progress */
+		if (seq & 1)
+			continue;
+
+		if (cache_version && !cache_flags)
+		{
+			if (!bloom_maybe(&key) || !find_entry(&key, &pos))
+				verdict = UNKNOWN_CARD;
+			else if (cache_entries[pos].status == CARD_STOLEN)
+				verdict = STOLEN_CARD;
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (cache_seq.load(std::memory_order_relaxed) == seq)
+			return (verdict);
+	}
+
+	/* never stalls a scan on a long update, the backend decides */
+	return (0);
+}
+
+/**
+ * next_token - extracts the next whitespace-separated token
+ *
+ * @p: parse position, advanced past the token
+ * @end: end of the message
+ * @len: where to store the token's length
+ *
+ * Return: start of the token, NULL at the end of the message
+*/
+static const char *next_token(const char **p, const char *end, size_t *len)
+{
+	const char *token;
+
+	while (*p < end && (**p == ' ' || **p == '\t' || **p == '\r' || **p == '\n'))
+		(*p)++;
+
+	if (*p == end)
+		return (NULL);
+
+	token = *p;
+	while (*p < end && **p != ' ' && **p != '\t' && **p != '\r' && **p != '\n')
+		(*p)++;
+
+	*len = *p - token;
+	return (token);
+}
+
+/**
+ * parse_version - parses a decimal version token
+ *
+ * @token: token to parse
+ * @len: length of the token
+ * @version: where to store the version
+ *
+ * Return: true if the token is a number, false otherwise
+*/
+static bool parse_version(const char *token, size_t len, uint32_t *version)
+{
+	*version = 0;
+
+	if (len == 0 || len > 10)
+		return false;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		if (token[i] < '0' || token[i] > '9')
+			return false;
+		*version = *version * 10 + (token[i] - '0');
+	}
+
+	return true;
+}
+
+/**
+ * hex_value - decodes a hex digit
+ *
+ * @c: character to decode
+ *
+ * Return: value of the digit, -1 if @c is not a hex digit
+*/
+static int hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return (c - '0');
+	if (c >= 'a' && c <= 'f')
+		return (c - 'a' + 10);
+	if (c >= 'A' && c <= 'F')
+		return (c - 'A' + 10);
+	return (-1);
+}
+
+/**
+ * parse_op - parses an update operation token: +, ! or - and a hex UID
+ *
+ * @token: token to parse
+ * @len: length of the token
+ * @entry: where to store the card, its status is 0 for a removal
+ *
+ * Return: true if the token is a valid operation, false otherwise
+*/
+static bool parse_op(const char *token, size_t len, card_entry_t *entry)
+{
+	uint8_t uid[RFID_UID_MAX_LEN];
+	size_t uid_size = (len - 1) / 2;
+
+	if (len < 3 || (len - 1) % 2 || uid_size > RFID_UID_MAX_LEN)
+		return false;
+
+	for (size_t i = 0; i < uid_size; i++)
+	{
+		int high = hex_value(token[1 + 2 * i]);
+		int low = hex_value(token[2 + 2 * i]);
+
+		if (high < 0 || low < 0)
+			return false;
+		uid[i] = (high << 4) | low;
+	}
+
+	make_key(entry, uid, uid_size);
+
+	switch (token[0])
+	{
+		case '+':
+			entry->status = CARD_REGISTERED;
+			return true;
+		case '!':
+			entry->status = CARD_STOLEN;
+			return true;
+		case '-':
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * apply_op - adds, updates or removes a card, keeping the table sorted
+ *
+ * @op: card and its new status, 0 to remove it
+ *
+ * Return: true if a card was removed, false otherwise
+*/
+static bool apply_op(const card_entry_t *op)
+{
+	uint32_t pos;
+	bool found = find_entry(op, &pos);
+
+	if (!op->status)
+	{
+		if (!found)
+			return false;
+
+		memmove(&cache_entries[pos], &cache_entries[pos + 1],
+			(cache_count - pos - 1) * sizeof(card_entry_t));
+		cache_count--;
+		return true;
+	}
+
+	if (found)
+	{
+		cache_entries[pos].status = op->status;
+		return false;
+	}
+
+	/* a missing card would read as unknown, stop giving verdicts */
+	if (cache_count == VERDICT_CACHE_CAPACITY)
+	{
+		cache_flags |= CACHE_FLAG_OVERFLOW;
+		return false;
+	}
+
+	memmove(&cache_entries[pos + 1], &cache_entries[pos],
+		(cache_count - pos) * sizeof(card_entry_t));
+	cache_entries[pos] = *op;
+	cache_count++;
+	bloom_add(op);
+
+	return false;
+}
+
+/**
+ * verdict_cache_update - applies a card update message from the backend,
+ *  see verdict_cache.h for its format
+ *
+ * @message: message payload, not null-terminated
+ * @len: length of the message
+ *
+ * Return: one of enum verdict_update_e
+ *
+ * Note: must only be called from one task, the cache's only writer
+*/
+verdict_update_t verdict_cache_update(const char *message, size_t len)
+{
+	const char *end = message + len, *p = message, *token;
+	uint32_t base_version, new_version;
+	bool reset = false, more = false, removed = false;
+	card_entry_t op;
+	size_t token_len;
+
+	if (!cache_storage)
+		return (VERDICT_UPDATE_INVALID);
+
+	/* first pass: validate the whole message before touching the table */
+	token = next_token(&p, end, &token_len);
+	if (!token || !parse_version(token, token_len, &base_version))
+		return (VERDICT_UPDATE_INVALID);
+	token = next_token(&p, end, &token_len);
+	if (!token || !parse_version(token, token_len, &new_version) ||
+			!new_version)
+		return (VERDICT_UPDATE_INVALID);
+
+	const char *ops = p;
+
+	while ((token = next_token(&p, end, &token_len)))
+	{
+		if (token_len == 5 && !memcmp(token, "reset", 5))
+			reset = true;
+		else if (token_len == 4 && !memcmp(token, "more", 4))
+			more = true;
+		else if (!parse_op(token, token_len, &op))
+			return (VERDICT_UPDATE_INVALID);
+	}
+
+	if (!reset && base_version != cache_version)
+		return (new_version <= cache_version ?
+			VERDICT_UPDATE_STALE : VERDICT_UPDATE_GAP);
+
+	/* second pass: apply it under the sequence lock */
+	cache_seq.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	if (reset)
+	{
+		cache_count = 0;
+		cache_flags = 0;
+		memset(cache_bloom, 0, sizeof(cache_bloom));
+	}
+
+	for (p = ops; (token = next_token(&p, end, &token_len)); )
+	{
+		/* "reset" and "more" do not parse as operations */
+		if (parse_op(token, token_len, &op))
+			removed |= apply_op(&op);
+	}
+
+	if (removed)
+		bloom_rebuild();
+
+	cache_version = new_version;
+	if (more)
+		cache_flags |= CACHE_FLAG_PARTIAL;
+	else
+		cache_flags &= ~CACHE_FLAG_PARTIAL;
+
+	cache_seq.fetch_add(1, std::memory_order_release);
+	cache_dirty.store(true, std::memory_order_release);
+
+	return (VERDICT_UPDATE_APPLIED);
+}
+
+/**
+ * verdict_cache_persist - saves the updates applied since the last save,
+ *  once they have gathered for VERDICT_CACHE_PERSIST_DELAY and unless a
+ *  snapshot is in progress
+ *
+ * @now_ms: current time [ms]
+ *
+ * Return: Nothing
+ *
+ * Note: must only be called from one task, run by the network task
+*/
+void verdict_cache_persist(uint32_t now_ms)
+{
+	uint32_t seq;
+
+	if (!cache_storage || !cache_dirty.load(std::memory_order_acquire))
+		return;
+
+	if (!cache_dirty_seen)
+	{
+		cache_dirty_seen = true;
+		cache_dirty_since = now_ms;
+	}
+
+	if (now_ms - cache_dirty_since < VERDICT_CACHE_PERSIST_DELAY)
+		return;
+
+	/* mid-update or mid-snapshot: the flash keeps the last complete table */
+	seq = cache_seq.load(std::memory_order_acquire);
+	if ((seq & 1) || (cache_flags & CACHE_FLAG_PARTIAL))
+		return;
+
+	cache_dirty.store(false, std::memory_order_relaxed);
+	cache_dirty_seen = false;
+
+	/* failed, or overlapped by an update: saved again after the delay */
+	if (!persist() || cache_seq.load(std::memory_order_acquire) != seq)
+		cache_dirty.store(true, std::memory_order_relaxed);
+}
+
+/**
+ * verdict_cache_version - retrieves the version of the backend's card
+ *  table the cache holds
+ *
+ * Return: cache version, 0 if the cache is empty
+*/
+uint32_t verdict_cache_version()
+{
+	return (cache_version);
+}
+
+/**
+ * verdict_cache_count - retrieves the number of cached cards
+ *
+ * Return: number of cached cards
+*/
+uint32_t verdict_cache_count()
+{
+	return (cache_count);
+}
@@ -0,0 +1,1095 @@
+/*
+ * Fleet load simulation: a fleet of virtual checkpoints connects to a
+ * broker, one real MQTT 3.1.1 connection each, all served by one epoll
+ * event loop. They speak the firmware's protocol (mqtt_topics.h): the
+ * will and retained status on CONNECTED, the kept session, the
+ * subscriptions and QoS of the policy table, the card sync request,
+ * scans on SENTRY_SCAN_INFO once SHIFT_ON_OFF turns the shift on, and
+ * the verdicts on RESPONSE.
+ * Halfway through, every checkpoint loses its connection at the same
+ * instant and reconnects with the firmware's backoff.
+ *
+ * Unless told there is a real one, a stand-in backend answers every scan
+ * with a valid verdict and turns the shift on once the fleet is up. It
+ * follows the code with the checkpoint ID and sequence number of the scan
+ * it answers ("1 17 42"), which the firmware's parser ignores, so each
+ * checkpoint can time the verdict meant for it.
+ *
+ * Build and run on Linux, against a local broker accepting anonymous
+ * clients (e.g. mosquitto, with max_connections and its open file limit
+ * raised to the fleet's size):
+ *   g++ -std=gnu++11 -O2 -Wall -Iinclude -Isrc/hal/native/arduino \
+ *     tools/fleet_sim.cpp -o fleet_sim
+ *   ulimit -n 8192
+ *   ./fleet_sim [host] [port] [checkpoints] [scan period s] [length s] [backend]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "main.h"
+#include "backoff.h"
+#include "mqtt.h"
+#include "mqtt_topics.h"
+
+/* longest wait for events, and so the timers' resolution [ms] */
+#define SIM_TICK                10
+/* the checkpoints power up spread over this long [ms] */
+#define SIM_RAMP                5000
+/* keep-alive, as set by the firmware [s] */
+#define SIM_KEEP_ALIVE          60
+/* connection attempt given up without a CONNACK [ms] */
+#define SIM_CONNECT_TIMEOUT     10000
+/* seconds of the reconnect storm shown in the timeline */
+#define SIM_TIMELINE            30
+/* client ID of the stand-in backend */
+#define SIM_BACKEND_ID          "fleet-sim-backend"
+
+/* MQTT control packet types, high nibble of the fixed header */
+#define MQTT_CONNECT            0x10
+#define MQTT_CONNACK            0x20
+#define MQTT_PUBLISH            0x30
+#define MQTT_PUBACK             0x40
+#define MQTT_PUBREC             0x50
+#define MQTT_PUBREL             0x60
+#define MQTT_PUBCOMP            0x70
+#define MQTT_SUBSCRIBE          0x80
+#define MQTT_SUBACK             0x90
+#define MQTT_PINGREQ            0xC0
+#define MQTT_PINGRESP           0xD0
+#define MQTT_DISCONNECT         0xE0
+
+/**
+ * enum sim_state_e - connection states of a virtual checkpoint
+ *
+ * @SIM_IDLE: waiting for its next connection attempt
+ * @SIM_CONNECTING: TCP connection or CONNACK pending
+ * @SIM_CONNECTED: connected to the broker
+*/
+typedef enum sim_state_e
+{
+	SIM_IDLE = 0,
+	SIM_CONNECTING = 1,
+	SIM_CONNECTED = 2
+} sim_state_t;
+
+/**
+ * struct client_s - a virtual checkpoint, or the stand-in backend
+ *
+ * @fd: socket, -1 when not connected
+ * @state: one of enum sim_state_e
+ * @backend: true for the stand-in backend
+ * @shift: whether the shift is on, kept across reconnections
+ * @subscribed: whether it has subscribed since it started
+ * @writable: whether the socket is polled for writing
+ * @failures: consecutive failed connection attempts
+ * @id: checkpoint ID
+ * @packet_id: last packet ID used
+ * @seq: last scan sequence number used
+ * @awaiting: sequence number of the scan awaiting its verdict, 0 if none
+ * @next_at: next connection attempt, or next scan once connected [us]
+ * @attempt_at: start of the connection attempt [us]
+ * @sent_at: last packet sent, for the keep-alive [us]
+ * @scanned_at: publish time of the scan awaiting its verdict [us]
+ * @rx: bytes received and not yet parsed
+ * @tx: bytes waiting for the socket
+ * @scans: publish time of the scans awaiting acknowledgement, by packet ID [us]
+*/
+typedef struct client_s
+{
+	int fd;
+	uint8_t state;
+	bool backend;
+	bool shift;
+	bool subscribed;
+	bool writable;
+	uint8_t failures;
+	uint32_t id;
+	uint16_t packet_id;
+	uint32_t seq;
+	uint32_t awaiting;
+	uint64_t next_at;
+	uint64_t attempt_at;
+	uint64_t sent_at;
+	uint64_t scanned_at;
+	std::vector<uint8_t> rx;
+	std::vector<uint8_t> tx;
+	std::map<uint16_t, uint64_t> scans;
+} client_t;
+
+/**
+ * struct sim_stats_s - what the run measured
+ *
+ * @connect_us: connection attempt to CONNACK of every connection [us]
+ * @ack_us: publish to acknowledgement of every scan [us]
+ * @verdict_us: publish to verdict of every answered scan [us]
+ * @attempts: connection attempts
+ * @failures: failed connection attempts
+ * @resumed: connections that found their session kept by the broker
+ * @scans: scans published
+ * @acked: scans acknowledged
+ * @deliveries: messages received on RESPONSE, by every checkpoint
+ * @storm_attempts: connection attempts per second of the storm
+ * @storm_connected: checkpoints connected at the end of each second of the storm
+*/
+typedef struct sim_stats_s
+{
+	std::vector<uint32_t> connect_us;
+	std::vector<uint32_t> ack_us;
+	std::vector<uint32_t> verdict_us;
+	uint32_t attempts;
+	uint32_t failures;
+	uint32_t resumed;
+	uint32_t scans;
+	uint32_t acked;
+	uint32_t deliveries;
+	uint32_t storm_attempts[SIM_TIMELINE];
+	uint32_t storm_connected[SIM_TIMELINE];
+} sim_stats_t;
+
+/* broker address, resolved once */
+static struct sockaddr_storage broker_addr;
+static socklen_t broker_addr_len;
+
+static int epoll_fd;
+static sim_stats_t stats;
+
+/* scan period [us], start of the run and of the storm, 0 before it [us] */
+static uint64_t scan_period;
+static uint64_t started_at;
+static uint64_t storm_at = 0;
+
+/* xorshift32 state, every checkpoint draws from the same stream */
+static uint32_t rng_state = 2463534242u;
+
+static void drop(client_t *, bool);
+
+/**
+ * now_us - reads the monotonic clock
+ *
+ * Return: time [us]
+*/
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+/**
+ * rng - draws a pseudo-random number
+ *
+ * @bound: exclusive upper bound
+ *
+ * Return: number in [0, bound)
+*/
+static uint32_t rng(uint32_t bound)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return (bound ? rng_state % bound : 0);
+}
+
+/**
+ * watch - polls a client's socket for reading, and for writing while it
+ *  has bytes waiting
+ *
+ * @client: client
+ * @writable: whether to poll for writing
+ *
+ * Return: Nothing
+*/
+static void watch(client_t *client, bool writable)
+{
+	struct epoll_event event;
+
+	if (client->writable == writable)
+		return;
+
+	event.events = EPOLLIN | (writable ? (uint32_t)EPOLLOUT : 0);
+	event.data.ptr = client;
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+	client->writable = writable;
+}
+
+/**
+ * flush - sends the bytes waiting for a client's socket
+ *
+ * @client: client
+ *
+ * Return: Nothing
+*/
+static void flush(client_t *client)
+{
+	size_t sent = 0;
+
+	while (sent < client->tx.size())
+	{
+		ssize_t n = send(client->fd, &client->tx[sent],
+			client->tx.size() - sent, MSG_NOSIGNAL);
+
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (n <= 0)
+		{
+			drop(client, client->state != SIM_CONNECTED);
+			return;
+		}
+		sent += n;
+	}
+
+	client->tx.erase(client->tx.begin(), client->tx.begin() + sent);
+	watch(client, !client->tx.empty());
+}
+
+/**
+ * send_packet - queues a control packet on a client's socket
+ *
+ * @client: client
+ * @type: packet type and flags
+ * @body: variable header and payload
+ * @len: length of @body
+ *
+ * Return: Nothing
+*/
+static void send_packet(client_t *client, uint8_t type, const uint8_t *body,
+		size_t len)
+{
+	uint32_t remaining = len;
+
+	if (client->fd < 0)
+		return;
+
+	client->tx.push_back(type);
+	do {
+		uint8_t digit = remaining % 128;
+
+		remaining /= 128;
+		client->tx.push_back(digit | (remaining ? 0x80 : 0));
+	} while (remaining);
+	client->tx.insert(client->tx.end(), body, body + len);
+
+	client->sent_at = now_us();
+	if (client->state == SIM_CONNECTED)
+		flush(client);
+}
+
+/**
+ * put_u16 - appends a big-endian 16-bit number
+ *
+ * @p: destination
+ * @value: number
+ *
+ * Return: Nothing
+*/
+static void put_u16(std::vector<uint8_t> *p, uint16_t value)
+{
+	p->push_back(value >> 8);
+	p->push_back(value & 0xFF);
+}
+
+/**
+ * put_str - appends a length-prefixed string
+ *
+ * @p: destination
+ * @s: string
+ * @len: length of @s
+ *
+ * Return: Nothing
+*/
+static void put_str(std::vector<uint8_t> *p, const char *s, size_t len)
+{
+	put_u16(p, len);
+	p->insert(p->end(), s, s + len);
+}
+
+/**
+ * next_packet_id - allocates a client's next packet ID
+ *
+ * @client: client
+ *
+ * Return: packet ID, never 0
+*/
+static uint16_t next_packet_id(client_t *client)
+{
+	if (++client->packet_id == 0)
+		client->packet_id = 1;
+
+	return (client->packet_id);
+}
+
+/**
+ * send_ack - sends a two-byte acknowledgement packet
+ *
+ * @client: client
+ * @type: packet type and flags
+ * @id: packet ID
+ *
+ * Return: Nothing
+*/
+static void send_ack(client_t *client, uint8_t type, uint16_t id)
+{
+	uint8_t body[2] = {(uint8_t)(id >> 8), (uint8_t)(id & 0xFF)};
+
+	send_packet(client, type, body, sizeof(body));
+}
+
+/**
+ * publish - publishes a message at its topic's QoS
+ *
+ * @client: client
+ * @topic: topic
+ * @retain: whether the broker keeps it for later subscribers
+ * @payload: message
+ *
+ * Return: packet ID, 0 at QoS 0
+*/
+static uint16_t publish(client_t *client, const char *topic, bool retain,
+		const char *payload)
+{
+	std::vector<uint8_t> body;
+	uint8_t qos = mqtt_qos_of(topic);
+	uint16_t id = 0;
+
+	put_str(&body, topic, strlen(topic));
+	if (qos)
+	{
+		id = next_packet_id(client);
+		put_u16(&body, id);
+	}
+	body.insert(body.end(), payload, payload + strlen(payload));
+
+	send_packet(client, MQTT_PUBLISH | (qos << 1) | (retain ? 1 : 0),
+		body.data(), body.size());
+
+	return (id);
+}
+
+/**
+ * subscribe - subscribes to a topic
+ *
+ * @client: client
+ * @topic: topic
+ * @qos: highest QoS to receive it at
+ *
+ * Return: Nothing
+*/
+static void subscribe(client_t *client, const char *topic, uint8_t qos)
+{
+	std::vector<uint8_t> body;
+
+	put_u16(&body, next_packet_id(client));
+	put_str(&body, topic, strlen(topic));
+	body.push_back(qos);
+
+	send_packet(client, MQTT_SUBSCRIBE | 0x02, body.data(), body.size());
+}
+
+/**
+ * schedule_reconnect - picks a checkpoint's next connection attempt the
+ *  way the firmware does, exponential backoff with full jitter
+ *
+ * @client: checkpoint
+ * @now: current time [us]
+ *
+ * Return: Nothing
+*/
+static void schedule_reconnect(client_t *client, uint64_t now)
+{
+	uint32_t window = backoff_window(client->failures, MQTT_BACKOFF_BASE,
+		MQTT_BACKOFF_CAP);
+
+	if (client->failures < 0xFF)
+		client->failures++;
+
+	client->next_at = now + (uint64_t)rng(window + 1) * 1000;
+}
+
+/**
+ * drop - closes a client's connection
+ *
+ * @client: client
+ * @failed: whether a connection attempt failed
+ *
+ * Return: Nothing
+*/
+static void drop(client_t *client, bool failed)
+{
+	if (client->fd < 0)
+		return;
+
+	close(client->fd);
+	client->fd = -1;
+	client->state = SIM_IDLE;
+	client->writable = false;
+	client->rx.clear();
+	client->tx.clear();
+	client->scans.clear();
+	client->awaiting = 0;
+
+	if (failed)
+		stats.failures++;
+
+	/* the backend only reconnects after a failed attempt */
+	if (client->backend && !failed)
+		client->next_at = now_us();
+	else
+		schedule_reconnect(client, now_us());
+}
+
+/**
+ * start_connect - opens a client's connection and queues its CONNECT,
+ *  with the firmware's will for a checkpoint
+ *
+ * @client: client
+ * @now: current time [us]
+ *
+ * Return: Nothing
+*/
+static void start_connect(client_t *client, uint64_t now)
+{
+	struct epoll_event event;
+	std::vector<uint8_t> body;
+	char client_id[MQTT_CLIENT_ID_MAX_LEN], will[64];
+	int one = 1;
+
+	client->fd = socket(broker_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (client->fd < 0)
+	{
+		perror("socket (raise the open file limit with ulimit -n)");
+		exit(1);
+	}
+	setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if (connect(client->fd, (struct sockaddr *)&broker_addr, broker_addr_len) &&
+			errno != EINPROGRESS)
+	{
+		close(client->fd);
+		client->fd = -1;
+		stats.attempts++;
+		stats.failures++;
+		schedule_reconnect(client, now);
+		return;
+	}
+
+	/* writable once connected */
+	event.events = EPOLLIN | EPOLLOUT;
+	event.data.ptr = client;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &event);
+	client->writable = true;
+
+	client->state = SIM_CONNECTING;
+	client->attempt_at = now;
+	stats.attempts++;
+	if (storm_at && now >= storm_at && (now - storm_at) / 1000000 < SIM_TIMELINE)
+		stats.storm_attempts[(now - storm_at) / 1000000]++;
+
+	/* variable header: "MQTT", level 4, flags, keep-alive */
+	put_str(&body, "MQTT", 4);
+	body.push_back(4);
+
+	if (client->backend)
+	{
+		/* clean session */
+		body.push_back(0x02);
+		put_u16(&body, SIM_KEEP_ALIVE);
+		put_str(&body, SIM_BACKEND_ID, strlen(SIM_BACKEND_ID));
+	}
+	else
+	{
+		snprintf(client_id, sizeof(client_id), MQTT_CLIENT_ID_PREFIX "%u",
+			(unsigned int)client->id);
+		snprintf(will, sizeof(will), "{\"id\":\"%s\",\"connected\":false}",
+			client_id);
+
+		/* kept session, will retained at the CONNECTED topic's QoS */
+		body.push_back(0x04 | (mqtt_qos_of(CONNECTED) << 3) | 0x20);
+		put_u16(&body, SIM_KEEP_ALIVE);
+		put_str(&body, client_id, strlen(client_id));
+		put_str(&body, CONNECTED, strlen(CONNECTED));
+		put_str(&body, will, strlen(will));
+	}
+
+	send_packet(client, MQTT_CONNECT, body.data(), body.size());
+}
+
+/**
+ * on_connack - runs what the firmware runs once connected
+ *
+ * @client: client
+ * @session_present: whether the broker kept the client's session
+ * @now: current time [us]
+ *
+ * Return: Nothing
+*/
+static void on_connack(client_t *client, bool session_present, uint64_t now)
+{
+	char payload[96];
+
+	client->state = SIM_CONNECTED;
+	client->failures = 0;
+	stats.connect_us.push_back(now - client->attempt_at);
+
+	if (client->backend)
+	{
+		subscribe(client, SENTRY_SCAN_INFO, mqtt_qos_of(SENTRY_SCAN_INFO));
+		subscribe(client, OUTSIDE_SHIFT_SCAN, mqtt_qos_of(OUTSIDE_SHIFT_SCAN));
+		return;
+	}
+
+	snprintf(payload, sizeof(payload),
+		"{\"id\":\"" MQTT_CLIENT_ID_PREFIX "%u\",\"connected\":true}",
+		(unsigned int)client->id);
+	publish(client, CONNECTED, true, payload);
+
+	/* the broker kept the subscriptions */
+	if (session_present && client->subscribed)
+		stats.resumed++;
+	else
+	{
+		for (size_t i = 0; i < TOPIC_QOS_COUNT; i++)
+			if (topic_qos[i].subscribe)
+				subscribe(client, topic_qos[i].topic, topic_qos[i].qos);
+		client->subscribed = true;
+	}
+
+	snprintf(payload, sizeof(payload),
+		"{\"checkpoint-id\":%u,\"cards-version\":0}",
+		(unsigned int)client->id);
+	publish(client, CARD_SYNC, false, payload);
+
+	/* a scan due while offline went to the journal, it goes out now */
+	if (client->shift && client->next_at < now)
+		client->next_at = now;
+}
+
+/**
+ * publish_scan - publishes a scan the way the firmware encodes it
+ *
+ * @client: checkpoint
+ * @now: current time [us]
+ *
+ * Return: Nothing
+*/
+static void publish_scan(client_t *client, uint64_t now)
+{
+	char payload[128];
+	uint32_t uid = rng(0xFFFFFFFF);
+	uint16_t id;
+
+	client->seq++;
+	snprintf(payload, sizeof(payload),
+		"{\"checkpoint-id\":%u,\"sentry-id\":\"%02x %02x %02x %02x\","
+		"\"scan-time\":%u,\"scan-ms\":%u,\"seq\":%u}",
+		(unsigned int)client->id, uid >> 24, (uid >> 16) & 0xFF,
+		(uid >> 8) & 0xFF, uid & 0xFF, (unsigned int)time(NULL),
+		(unsigned int)((now / 1000) % 1000), (unsigned int)client->seq);
+
+	id = publish(client, SENTRY_SCAN_INFO, false, payload);
+	if (id)
+		client->scans[id] = now;
+
+	client->awaiting = client->seq;
+	client->scanned_at = now;
+	stats.scans++;
+}
+
+/**
+ * on_message - reacts to a message the way the firmware does, or answers
+ *  a scan for the backend
+ *
+ * @client: client
+ * @topic: topic
+ * @payload: message, not null-terminated
+ * @len: length of @payload
+ * @now: current time [us]
+ *
+ * Return: Nothing
+*/
+static void on_message(client_t *client, const char *topic,
+		const char *payload, size_t len, uint64_t now)
+{
+	std::string message(payload, len);
+
+	if (client->backend)
+	{
+		unsigned int id, seq;
+		const char *p = strstr(message.c_str(), "\"checkpoint-id\":");
+		const char *q = strstr(message.c_str(), "\"seq\":");
+		char verdict[32];
+
+		if (!p || !q || sscanf(p, "\"checkpoint-id\":%u", &id) != 1 ||
+				sscanf(q, "\"seq\":%u", &seq) != 1)
+			return;
+
+		snprintf(verdict, sizeof(verdict), "%u %u %u", (unsigned int)SUCCESS, id, seq);
+		publish(client, RESPONSE, false, verdict);
+		return;
+	}
+
+	if (!strcmp(topic, SHIFT_ON_OFF))
+	{
+		bool on = mqtt_parse_on_off(payload, len);
+
+		/* sentries reach their checkpoints at random within a period */
+		if (on && !client->shift)
+			client->next_at = now + rng(scan_period);
+		client->shift = on;
+	}
+	else if (!strcmp(topic, RESPONSE))
+	{
+		unsigned int code, id, seq;
+
+		stats.deliveries++;
+
+		/* the firmware's verdict, then the tag it ignores */
+		code = mqtt_parse_code(payload, len);
+		if (sscanf(message.c_str(), "%*u %u %u", &id, &seq) == 2 &&
+				code && id == client->id && seq == client->awaiting)
+		{
+			stats.verdict_us.push_back(now - client->scanned_at);
+			client->awaiting = 0;
+		}
+	}
+}
+
+/**
+ * on_packet - handles a control packet received by a client
+ *
+ * @client: client
+ * @type: first byte of the fixed header
+ * @body: variable header and payload
+ * @len: length of @body
+ * @now: current time [us]
+ *
+ * Return: Nothing
+*/
+static void on_packet(client_t *client, uint8_t type, const uint8_t *body,
+		size_t len, uint64_t now)
+{
+	uint16_t id = len >= 2 ? (body[0] << 8) | body[1] : 0;
+
+	switch (type & 0xF0)
+	{
+		case MQTT_CONNACK:
+			if (len < 2 || body[1])
+				drop(client, true);
+			else
+				on_connack(client, body[0] & 0x01, now);
+			break;
+		case MQTT_PUBLISH:
+		{
+			uint8_t qos = (type >> 1) & 0x03;
+			size_t offset = 2 + id + (qos ? 2 : 0);
+
+			if (offset > len)
+				break;
+			if (qos)
+				send_ack(client, qos == 1 ? MQTT_PUBACK : MQTT_PUBREC,
+					(body[offset - 2] << 8) | body[offset - 1]);
+
+			/* the topic length is where the packet ID of the others is */
+			on_message(client, std::string((const char *)body + 2, id).c_str(),
+				(const char *)body + offset, len - offset, now);
+			break;
+		}
+		case MQTT_PUBREC:
+			send_ack(client, MQTT_PUBREL | 0x02, id);
+			break;
+		case MQTT_PUBREL:
+			send_ack(client, MQTT_PUBCOMP, id);
+			break;
+		case MQTT_PUBACK:
+		case MQTT_PUBCOMP:
+		{
+			std::map<uint16_t, uint64_t>::iterator scan = client->scans.find(id);
+
+			if (scan != client->scans.end())
+			{
+				stats.ack_us.push_back(now - scan->second);
+				stats.acked++;
+				client->scans.erase(scan);
+			}
+			break;
+		}
+	}
+}
+
+/**
+ * packet_size - decodes the fixed header of the next packet received
+ *
+ * @rx: bytes received
+ * @start: offset of the packet
+ * @header: where to store the fixed header's length
+ * @remaining: where to store the remaining length
+ *
+ * Return: true if the packet is complete, false otherwise
+*/
+static bool packet_size(const std::vector<uint8_t> &rx, size_t start,
+		size_t *header, uint32_t *remaining)
+{
+	uint32_t shift = 0;
+	uint8_t digit;
+
+	*header = 1;
+	*remaining = 0;
+	do {
+		if (start + *header >= rx.size())
+			return (false);
+		digit = rx[start + (*header)++];
+		*remaining |= (uint32_t)(digit & 0x7F) << shift;
+		shift += 7;
+	} while (digit & 0x80);
+
+	return (rx.size() - start >= *header + *remaining);
+}
+
+/**
+ * on_readable - reads what a client's socket holds and handles every
+ *  complete packet
+ *
+ * @client: client
+ * @now: current time [us]
+ *
+ * Return: Nothing
+*/
+static void on_readable(client_t *client, uint64_t now)
+{
+	uint8_t buf[4096];
+	size_t used = 0, header;
+	uint32_t remaining;
+	ssize_t n;
+
+	while ((n = recv(client->fd, buf, sizeof(buf), 0)) > 0)
+		client->rx.insert(client->rx.end(), buf, buf + n);
+
+	if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+	{
+		drop(client, client->state != SIM_CONNECTED);
+		return;
+	}
+
+	while (client->fd >= 0 &&
+			packet_size(client->rx, used, &header, &remaining))
+	{
+		on_packet(client, client->rx[used], &client->rx[used + header],
+			remaining, now);
+		used += header + remaining;
+	}
+
+	if (client->fd >= 0)
+		client->rx.erase(client->rx.begin(), client->rx.begin() + used);
+}
+
+/**
+ * on_writable - completes a client's TCP connection, or sends what is
+ *  waiting once the socket has room
+ *
+ * @client: client
+ *
+ * Return: Nothing
+*/
+static void on_writable(client_t *client)
+{
+	int error = 0;
+	socklen_t error_len = sizeof(error);
+
+	if (client->state == SIM_CONNECTING)
+	{
+		getsockopt(client->fd, SOL_SOCKET, SO_ERROR, &error, &error_len);
+		if (error)
+		{
+			drop(client, true);
+			return;
+		}
+	}
+
+	flush(client);
+}
+
+/**
+ * run_timers - starts the connection attempts and scans due, keeps the
+ *  connections alive
+ *
+ * @clients: the fleet, then the backend
+ * @now: current time [us]
+ *
+ * Return: Nothing
+*/
+static void run_timers(std::vector<client_t> &clients, uint64_t now)
+{
+	for (size_t i = 0; i < clients.size(); i++)
+	{
+		client_t *client = &clients[i];
+
+		if (client->state == SIM_IDLE && now >= client->next_at)
+			start_connect(client, now);
+		else if (client->state == SIM_CONNECTING &&
+				now - client->attempt_at >= SIM_CONNECT_TIMEOUT * 1000ULL)
+			drop(client, true);
+		else if (client->state == SIM_CONNECTED)
+		{
+			if (client->shift && now >= client->next_at)
+			{
+				publish_scan(client, now);
+				/* the next sentry arrives within a quarter period of due */
+				client->next_at += scan_period * 3 / 4 + rng(scan_period / 2);
+			}
+			if (now - client->sent_at >= SIM_KEEP_ALIVE * 1000000ULL / 2)
+				send_packet(client, MQTT_PINGREQ, NULL, 0);
+		}
+	}
+}
+
+/**
+ * connected_count - counts the checkpoints connected
+ *
+ * @clients: the fleet, then the backend
+ * @count: number of checkpoints
+ *
+ * Return: number connected
+*/
+static uint32_t connected_count(const std::vector<client_t> &clients,
+		uint32_t count)
+{
+	uint32_t connected = 0;
+
+	for (uint32_t i = 0; i < count; i++)
+		connected += clients[i].state == SIM_CONNECTED;
+
+	return (connected);
+}
+
+/**
+ * print_latency - prints the median, 99th percentile and largest latency
+ *
+ * @name: what was timed
+ * @latencies: latencies [us], sorted in place
+ *
+ * Return: Nothing
+*/
+static void print_latency(const char *name, std::vector<uint32_t> &latencies)
+{
+	size_t n = latencies.size();
+
+	if (!n)
+	{
+		printf("  %-9s none\n", name);
+		return;
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	printf("  %-9s p50 %8.1f ms  p99 %8.1f ms  max %8.1f ms\n", name,
+		latencies[n / 2] / 1000.0, latencies[n * 99 / 100] / 1000.0,
+		latencies[n - 1] / 1000.0);
+}
+
+/**
+ * resolve - resolves the broker's address
+ *
+ * @host: broker host
+ * @port: broker port
+ *
+ * Return: Nothing
+*/
+static void resolve(const char *host, const char *port)
+{
+	struct addrinfo hints, *addr;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &addr))
+	{
+		fprintf(stderr, "cannot resolve %s\n", host);
+		exit(1);
+	}
+
+	memcpy(&broker_addr, addr->ai_addr, addr->ai_addrlen);
+	broker_addr_len = addr->ai_addrlen;
+	freeaddrinfo(addr);
+}
+
+/**
+ * main - runs the fleet against the broker and prints what it measured
+ *
+ * @argc: number of arguments
+ * @argv: broker host and port, checkpoints, scan period [s], length [s],
+ *  1 to run the stand-in backend or 0 for a real one
+ *
+ * Return: 0
+*/
+int main(int argc, char **argv)
+{
+	const char *host = argc > 1 ? argv[1] : "localhost";
+	const char *port = argc > 2 ? argv[2] : "1883";
+	uint32_t count = argc > 3 ? strtoul(argv[3], NULL, 10) : 1000;
+	uint32_t period = argc > 4 ? strtoul(argv[4], NULL, 10) : 60;
+	uint32_t length = argc > 5 ? strtoul(argv[5], NULL, 10) : 120;
+	bool with_backend = argc > 6 ? atoi(argv[6]) != 0 : true;
+	std::vector<client_t> clients(count + (with_backend ? 1 : 0));
+	struct epoll_event events[256];
+	uint64_t now, shift_at = 0, storm_end = 0, ended_at;
+	uint32_t storm_second = 0;
+
+	if (!count || !period || length < 4)
+	{
+		fprintf(stderr, "usage: %s [host] [port] [checkpoints] [scan period s] "
+			"[length s] [backend]\n", argv[0]);
+		return (1);
+	}
+
+	resolve(host, port);
+	epoll_fd = epoll_create1(0);
+	memset(stats.storm_attempts, 0, sizeof(stats.storm_attempts));
+	memset(stats.storm_connected, 0, sizeof(stats.storm_connected));
+	stats.attempts = stats.failures = stats.scans = stats.acked = 0;
+	stats.deliveries = stats.resumed = 0;
+
+	printf("%u checkpoints to %s:%s, a scan every %u s each, %u s, "
+		"all disconnected at %u s\n", (unsigned int)count, host, port,
+		(unsigned int)period, (unsigned int)length,
+		(unsigned int)(length / 2));
+
+	scan_period = period * 1000000ULL;
+	started_at = now_us();
+
+	for (size_t i = 0; i < clients.size(); i++)
+	{
+		client_t *client = &clients[i];
+
+		client->fd = -1;
+		client->state = SIM_IDLE;
+		client->backend = i == count;
+		client->shift = false;
+		client->subscribed = false;
+		client->writable = false;
+		client->failures = 0;
+		client->id = i + 1;
+		client->packet_id = 0;
+		client->seq = 0;
+		client->awaiting = 0;
+		client->sent_at = 0;
+		/* the backend is up first, the checkpoints power up over the ramp */
+		client->next_at = started_at +
+			(client->backend ? 0 : (uint64_t)rng(SIM_RAMP) * 1000);
+	}
+
+	for (now = started_at; now - started_at < length * 1000000ULL; now = now_us())
+	{
+		int n = epoll_wait(epoll_fd, events, 256, SIM_TICK);
+
+		now = now_us();
+		for (int i = 0; i < n; i++)
+		{
+			client_t *client = (client_t *)events[i].data.ptr;
+
+			if (client->fd < 0)
+				continue;
+			if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+				on_writable(client);
+			if (client->fd >= 0 && events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+				on_readable(client, now);
+		}
+
+		run_timers(clients, now);
+
+		/* shift change: the whole fleet starts scanning at once */
+		if (with_backend && !shift_at && clients[count].state == SIM_CONNECTED &&
+				(connected_count(clients, count) == count ||
+				now - started_at >= 2 * SIM_RAMP * 1000ULL))
+		{
+			shift_at = now;
+			publish(&clients[count], SHIFT_ON_OFF, false, "ON");
+			printf("shift on at %.1f s, %u connected\n",
+				(now - started_at) / 1e6,
+				(unsigned int)connected_count(clients, count));
+		}
+
+		/* every checkpoint loses its connection at once */
+		if (!storm_at && now - started_at >= length * 500000ULL)
+		{
+			storm_at = now;
+			for (uint32_t i = 0; i < count; i++)
+			{
+				if (clients[i].fd < 0)
+					continue;
+				clients[i].failures = 0;
+				drop(&clients[i], false);
+			}
+		}
+
+		/* storm timeline, until everyone is back */
+		if (storm_at && !storm_end)
+		{
+			uint32_t connected = connected_count(clients, count);
+
+			for (; storm_second < SIM_TIMELINE &&
+					now - storm_at >= (storm_second + 1) * 1000000ULL; storm_second++)
+				stats.storm_connected[storm_second] = connected;
+			if (connected == count)
+				storm_end = now;
+		}
+	}
+
+	ended_at = now;
+
+	for (size_t i = 0; i < clients.size(); i++)
+	{
+		if (clients[i].state == SIM_CONNECTED)
+		{
+			send_packet(&clients[i], MQTT_DISCONNECT, NULL, 0);
+			close(clients[i].fd);
+		}
+		else if (clients[i].fd >= 0)
+			close(clients[i].fd);
+	}
+
+	printf("connections: %u attempts, %u failed, %u sessions resumed\n",
+		(unsigned int)stats.attempts, (unsigned int)stats.failures,
+		(unsigned int)stats.resumed);
+	print_latency("connect", stats.connect_us);
+
+	printf("scans: %u published (%.1f/s since the shift started), %u acknowledged\n",
+		(unsigned int)stats.scans,
+		shift_at ? stats.scans / ((ended_at - shift_at) / 1e6) : 0.0,
+		(unsigned int)stats.acked);
+	print_latency("ack", stats.ack_us);
+
+	printf("verdicts: %u scans answered, %u messages delivered on the shared response topic (%.0f per verdict)\n",
+		(unsigned int)stats.verdict_us.size(), (unsigned int)stats.deliveries,
+		stats.verdict_us.size() ?
+			(double)stats.deliveries / stats.verdict_us.size() : 0.0);
+	print_latency("verdict", stats.verdict_us);
+
+	if (storm_end)
+		printf("storm: all %u reconnected after %.1f s\n", (unsigned int)count,
+			(storm_end - storm_at) / 1e6);
+	else
+		printf("storm: %u/%u reconnected by the end\n",
+			(unsigned int)connected_count(clients, count), (unsigned int)count);
+
+	printf("  attempts/s:");
+	for (uint32_t s = 0; s < SIM_TIMELINE; s++)
+		printf(" %u", (unsigned int)stats.storm_attempts[s]);
+	printf("\n  connected:");
+	for (uint32_t s = 0; s < storm_second; s++)
+		printf(" %u", (unsigned int)stats.storm_connected[s]);
+	printf("\n");
+
+	return (0);
+}
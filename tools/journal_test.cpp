@@ -0,0 +1,353 @@
+/*
+ * Offline scan journal test: runs the journal (journal.cpp) on a
+ * file-backed stand-in for its LittleFS file and checks appends, the
+ * ring wrapping around, entries torn by a power cut being rejected by
+ * their CRC, and the undelivered records and acknowledgements surviving
+ * a reboot, simulated by attaching the journal to the same file again.
+ * Exits non-zero on failure.
+ *
+ * Build and run on Linux:
+ *   g++ -std=gnu++11 -O2 -Wall -Iinclude tools/journal_test.cpp \
+ *     src/journal.cpp src/crc16.cpp -o journal_test
+ *   ./journal_test
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "journal.h"
+
+/*
+ * the ring's slots are followed by the meta block, which is smaller than
+ * JOURNAL_CAPACITY bytes: the layout is private to journal.cpp
+*/
+#define META_SIZE               (journal_storage_size() % JOURNAL_CAPACITY)
+#define SLOT_SIZE               (journal_storage_size() / JOURNAL_CAPACITY)
+
+/* checks failed so far */
+static unsigned int failures = 0;
+
+/* the journal's backing file, erased (0xFF) when the test starts */
+static FILE *flash = NULL;
+static storage_t storage;
+
+/**
+ * check - counts and reports a failed check
+ *
+ * @ok: outcome of the check
+ * @what: what was checked
+ *
+ * Return: Nothing
+*/
+static void check(bool ok, const char *what)
+{
+	if (ok)
+		return;
+
+	failures++;
+	printf("FAIL: %s\n", what);
+}
+
+/**
+ * file_read - storage_t read callback on the backing file
+ *
+ * @ctx: backing FILE
+ * @offset: where to read
+ * @data: where to store the bytes
+ * @len: number of bytes to read
+ *
+ * Return: true on success, false otherwise
+*/
+static bool file_read(void *ctx, uint32_t offset, void *data, size_t len)
+{
+	FILE *file = (FILE *)ctx;
+
+	return (!fseek(file, offset, SEEK_SET) && fread(data, 1, len, file) == len);
+}
+
+/**
+ * file_write - storage_t write callback on the backing file
+ *
+ * @ctx: backing FILE
+ * @offset: where to write
+ * @data: bytes to write
+ * @len: number of bytes to write
+ *
+ * Return: true on success, false otherwise
+*/
+static bool file_write(void *ctx, uint32_t offset, const void *data, size_t len)
+{
+	FILE *file = (FILE *)ctx;
+
+	return (!fseek(file, offset, SEEK_SET) &&
+		fwrite(data, 1, len, file) == len && !fflush(file));
+}
+
+/**
+ * erase_flash - erases the backing file and attaches the journal to it
+ *
+ * Return: Nothing
+*/
+static void erase_flash()
+{
+	uint8_t erased[256];
+	uint32_t size = journal_storage_size();
+
+	memset(erased, 0xFF, sizeof(erased));
+	for (uint32_t offset = 0; offset < size; offset += sizeof(erased))
+		file_write(flash, offset, erased,
+			size - offset < sizeof(erased) ? size - offset : sizeof(erased));
+
+	storage.read = file_read;
+	storage.write = file_write;
+	storage.size = size;
+	storage.ctx = flash;
+	check(journal_begin(&storage), "journal attaches to erased storage");
+}
+
+/**
+ * reboot - attaches the journal to the backing file again, as on boot
+ *
+ * Return: Nothing
+*/
+static void reboot()
+{
+	check(journal_begin(&storage), "journal attaches after a reboot");
+}
+
+/**
+ * make_scan - builds the n-th scan of a test
+ *
+ * @n: scan number
+ * @record: where to store the scan
+ *
+ * Return: Nothing
+*/
+static void make_scan(uint32_t n, scan_record_t *record)
+{
+	memset(record, 0, sizeof(*record));
+	record->scan_time = 1792120090 + n;
+	record->seq = n;
+	record->scan_ms = n % 1000;
+	record->uid_size = 4;
+	memcpy(record->uid, &n, sizeof(n));
+	record->outside_shift = n & 1;
+}
+
+/**
+ * append_scans - journals scans first to first + count - 1
+ *
+ * @first: number of the first scan
+ * @count: number of scans
+ *
+ * Return: Nothing
+*/
+static void append_scans(uint32_t first, uint32_t count)
+{
+	scan_record_t record;
+
+	for (uint32_t n = first; n < first + count; n++)
+	{
+		make_scan(n, &record);
+		check(journal_append(&record), "append succeeds");
+	}
+}
+
+/**
+ * peek_is - checks that an undelivered record is the n-th scan
+ *
+ * @pos: position of the record, 0 being the oldest undelivered
+ * @n: scan number expected there
+ *
+ * Return: true if it is, false otherwise
+*/
+static bool peek_is(uint32_t pos, uint32_t n)
+{
+	scan_record_t record, expected;
+
+	make_scan(n, &expected);
+	return (journal_peek(pos, &record) &&
+		!memcmp(&record, &expected, sizeof(record)));
+}
+
+/**
+ * test_append - appends a few scans and reads them back in order
+ *
+ * Return: Nothing
+*/
+static void test_append()
+{
+	bool in_order = true;
+
+	erase_flash();
+	check(journal_pending() == 0, "erased journal is empty");
+
+	append_scans(0, 20);
+	check(journal_pending() == 20, "appended scans are pending");
+	for (uint32_t i = 0; i < 20; i++)
+		in_order &= peek_is(i, i);
+	check(in_order, "appended scans read back in order");
+	check(!journal_peek(20, NULL), "nothing past the newest scan");
+}
+
+/**
+ * test_reboot - checks that undelivered scans and acknowledgements are
+ *  kept across reboots
+ *
+ * Return: Nothing
+*/
+static void test_reboot()
+{
+	erase_flash();
+	append_scans(0, 20);
+
+	reboot();
+	check(journal_pending() == 20, "pending scans survive a reboot");
+	check(peek_is(0, 0) && peek_is(19, 19), "they replay from the oldest");
+
+	/* a batch delivered, then the power goes */
+	journal_consume(8);
+	reboot();
+	check(journal_pending() == 12, "acknowledged scans stay delivered");
+	check(peek_is(0, 8), "replay resumes after the acknowledged scans");
+
+	/* appends continue from the recovered head */
+	append_scans(20, 5);
+	reboot();
+	check(journal_pending() == 17 && peek_is(16, 24),
+		"appends after a reboot continue the ring");
+
+	journal_consume(17);
+	reboot();
+	check(journal_pending() == 0, "fully delivered journal stays empty");
+}
+
+/**
+ * test_wrap - fills the ring past its capacity
+ *
+ * Return: Nothing
+*/
+static void test_wrap()
+{
+	uint32_t dropped = journal_dropped();
+	bool in_order = true;
+
+	erase_flash();
+	append_scans(0, JOURNAL_CAPACITY + 10);
+
+	check(journal_pending() == JOURNAL_CAPACITY, "a full ring holds its capacity");
+	check(journal_dropped() - dropped == 10, "overwritten scans are counted");
+	check(peek_is(0, 10), "the oldest scans are overwritten first");
+	for (uint32_t i = 0; i < JOURNAL_CAPACITY; i++)
+		in_order &= peek_is(i, 10 + i);
+	check(in_order, "a wrapped ring reads back in order");
+
+	reboot();
+	check(journal_pending() == JOURNAL_CAPACITY && peek_is(0, 10) &&
+		peek_is(JOURNAL_CAPACITY - 1, JOURNAL_CAPACITY + 9),
+		"a wrapped ring is recovered after a reboot");
+
+	/* delivered past the wrap point, then more scans */
+	journal_consume(JOURNAL_CAPACITY - 3);
+	append_scans(JOURNAL_CAPACITY + 10, 4);
+	reboot();
+	check(journal_pending() == 7 && peek_is(0, JOURNAL_CAPACITY + 7) &&
+		peek_is(6, JOURNAL_CAPACITY + 13),
+		"acknowledgements past the wrap point survive a reboot");
+}
+
+/**
+ * tear - overwrites the second half of a scan's slot as erased flash, as
+ *  a power cut in the middle of writing it would leave it
+ *
+ * @seq: journal sequence number of the scan, scan n has n + 1 on a
+ *  journal started erased
+ *
+ * Return: Nothing
+*/
+static void tear(uint32_t seq)
+{
+	uint8_t erased[64];
+
+	memset(erased, 0xFF, sizeof(erased));
+	file_write(flash, (seq % JOURNAL_CAPACITY) * SLOT_SIZE + SLOT_SIZE / 2,
+		erased, SLOT_SIZE - SLOT_SIZE / 2);
+}
+
+/**
+ * test_torn - checks that torn entries fail their CRC: a torn newest
+ *  entry is not recovered, a torn older one is skipped over
+ *
+ * Return: Nothing
+*/
+static void test_torn()
+{
+	scan_record_t record;
+
+	erase_flash();
+	append_scans(0, 10);
+
+	/* power cut while writing scan 9 */
+	tear(10);
+	reboot();
+	check(journal_pending() == 9, "a torn newest scan is not recovered");
+	check(peek_is(8, 8), "the scans before it are");
+
+	/* its slot is written again by the next append */
+	append_scans(100, 1);
+	check(journal_pending() == 10 && peek_is(9, 100),
+		"the torn slot is reused");
+
+	/* scan 4 damaged on flash after it was written */
+	tear(5);
+	check(!journal_peek(4, &record), "a torn older scan fails its CRC");
+	check(peek_is(3, 3) && peek_is(5, 5), "its neighbours still read");
+
+	/* delivering the batch skips over it */
+	journal_consume(10);
+	reboot();
+	check(journal_pending() == 0, "a torn scan is consumed with its batch");
+}
+
+/**
+ * test_torn_meta - checks that a torn acknowledgement replays the scans
+ *  again rather than losing any
+ *
+ * Return: Nothing
+*/
+static void test_torn_meta()
+{
+	uint8_t erased[4];
+
+	erase_flash();
+	append_scans(0, 10);
+	journal_consume(6);
+
+	/* the end of the acknowledged sequence number and the start of its CRC */
+	memset(erased, 0xFF, sizeof(erased));
+	file_write(flash, journal_storage_size() - META_SIZE + 2, erased,
+		sizeof(erased));
+	reboot();
+	check(journal_pending() == 10 && peek_is(0, 0),
+		"a torn acknowledgement replays everything still journalled");
+}
+
+int main()
+{
+	flash = tmpfile();
+	if (!flash)
+	{
+		perror("tmpfile");
+		return (1);
+	}
+
+	test_append();
+	test_reboot();
+	test_wrap();
+	test_torn();
+	test_torn_meta();
+
+	fclose(flash);
+	printf("%s\n", failures ? "journal test failed" : "journal test passed");
+	return (failures ? 1 : 0);
+}
@@ -0,0 +1,417 @@
+/*
+ * QoS benchmark: publishes scan messages to a broker at QoS 1 and at
+ * QoS 2 over one MQTT 3.1.1 connection, with a bounded number of them
+ * in flight, and prints the throughput and the publish-to-completion
+ * latency (PUBACK for QoS 1, PUBCOMP for QoS 2) of each.
+ *
+ * Build and run on the host, against a local broker (e.g. mosquitto);
+ * the gap grows with the round trip, e.g. under tc netem:
+ *   g++ -std=gnu++11 -O2 -Wall tools/mqtt_qos_bench.cpp -o mqtt_qos_bench
+ *   ./mqtt_qos_bench [host] [port] [messages] [in flight]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include <vector>
+
+/* topic the firmware publishes scans on */
+#define BENCH_TOPIC             "sentry-platform/checkpoints/sentry-scan-info"
+/* longest wait for the broker [ms] */
+#define BENCH_TIMEOUT           5000
+
+/* MQTT control packet types, high nibble of the fixed header */
+#define MQTT_CONNECT            0x10
+#define MQTT_CONNACK            0x20
+#define MQTT_PUBLISH            0x30
+#define MQTT_PUBACK             0x40
+#define MQTT_PUBREC             0x50
+#define MQTT_PUBREL             0x62	/* with its mandatory flags */
+#define MQTT_PUBCOMP            0x70
+#define MQTT_DISCONNECT         0xE0
+
+/**
+ * struct bench_s - one run's state
+ *
+ * @fd: socket connected to the broker
+ * @sent_at: publish time of every message, by packet ID [us]
+ * @latencies: publish-to-completion latency of every completed message [us]
+ * @in_flight: messages published and not yet completed
+ * @packets: control packets sent and received
+*/
+typedef struct bench_s
+{
+	int fd;
+	std::vector<uint64_t> sent_at;
+	std::vector<uint32_t> latencies;
+	uint32_t in_flight;
+	uint32_t packets;
+} bench_t;
+
+/**
+ * now_us - reads the monotonic clock
+ *
+ * Return: time [us]
+*/
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+/**
+ * send_all - sends a buffer, exits on failure
+ *
+ * @fd: socket
+ * @data: bytes to send
+ * @len: number of bytes
+ *
+ * Return: Nothing
+*/
+static void send_all(int fd, const uint8_t *data, size_t len)
+{
+	while (len)
+	{
+		ssize_t n = send(fd, data, len, 0);
+
+		if (n <= 0)
+		{
+			perror("send");
+			exit(1);
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+/**
+ * recv_all - receives exactly a number of bytes, exits on failure or
+ *  after BENCH_TIMEOUT of silence
+ *
+ * @fd: socket
+ * @data: destination
+ * @len: number of bytes
+ *
+ * Return: Nothing
+*/
+static void recv_all(int fd, uint8_t *data, size_t len)
+{
+	struct pollfd pfd = {fd, POLLIN, 0};
+
+	while (len)
+	{
+		ssize_t n;
+
+		if (poll(&pfd, 1, BENCH_TIMEOUT) <= 0)
+		{
+			fprintf(stderr, "broker timed out\n");
+			exit(1);
+		}
+
+		n = recv(fd, data, len, 0);
+		if (n <= 0)
+		{
+			fprintf(stderr, "broker closed the connection\n");
+			exit(1);
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+/**
+ * put_header - writes a fixed header
+ *
+ * @p: destination, at least 5 bytes
+ * @type: packet type and flags
+ * @remaining: remaining length
+ *
+ * Return: header length
+*/
+static size_t put_header(uint8_t *p, uint8_t type, uint32_t remaining)
+{
+	size_t len = 0;
+
+	p[len++] = type;
+	do {
+		uint8_t digit = remaining % 128;
+
+		remaining /= 128;
+		p[len++] = digit | (remaining ? 0x80 : 0);
+	} while (remaining);
+
+	return (len);
+}
+
+/**
+ * put_str - writes a length-prefixed string
+ *
+ * @p: destination
+ * @s: string
+ *
+ * Return: bytes written
+*/
+static size_t put_str(uint8_t *p, const char *s)
+{
+	size_t len = strlen(s);
+
+	p[0] = len >> 8;
+	p[1] = len & 0xFF;
+	memcpy(p + 2, s, len);
+
+	return (len + 2);
+}
+
+/**
+ * recv_packet - receives a control packet
+ *
+ * @fd: socket
+ * @body: destination of the variable header and payload
+ * @size: size of @body
+ * @len: where to store the body's length
+ *
+ * Return: first byte of the fixed header
+*/
+static uint8_t recv_packet(int fd, uint8_t *body, size_t size, size_t *len)
+{
+	uint8_t type, digit;
+	uint32_t remaining = 0, shift = 0;
+
+	recv_all(fd, &type, 1);
+	do {
+		recv_all(fd, &digit, 1);
+		remaining |= (uint32_t)(digit & 0x7F) << shift;
+		shift += 7;
+	} while (digit & 0x80);
+
+	if (remaining > size)
+	{
+		fprintf(stderr, "packet too large\n");
+		exit(1);
+	}
+	recv_all(fd, body, remaining);
+	*len = remaining;
+
+	return (type);
+}
+
+/**
+ * send_ack - sends a two-byte acknowledgement packet
+ *
+ * @fd: socket
+ * @type: packet type and flags
+ * @id: packet ID
+ *
+ * Return: Nothing
+*/
+static void send_ack(int fd, uint8_t type, uint16_t id)
+{
+	uint8_t packet[4] = {type, 2, (uint8_t)(id >> 8), (uint8_t)(id & 0xFF)};
+
+	send_all(fd, packet, sizeof(packet));
+}
+
+/**
+ * handle_packet - receives one packet from the broker and completes the
+ *  message it acknowledges, if any
+ *
+ * @bench: run's state
+ *
+ * Return: Nothing
+*/
+static void handle_packet(bench_t *bench)
+{
+	uint8_t body[256];
+	size_t len;
+	uint8_t type = recv_packet(bench->fd, body, sizeof(body), &len);
+	uint16_t id = len >= 2 ? (body[0] << 8) | body[1] : 0;
+
+	bench->packets++;
+
+	switch (type & 0xF0)
+	{
+		case MQTT_PUBREC:
+			send_ack(bench->fd, MQTT_PUBREL, id);
+			bench->packets++;
+			break;
+		case MQTT_PUBACK:
+		case MQTT_PUBCOMP:
+			bench->latencies.push_back(now_us() - bench->sent_at[id]);
+			bench->in_flight--;
+			break;
+	}
+}
+
+/**
+ * connect_broker - opens a clean MQTT session
+ *
+ * @host: broker host
+ * @port: broker port
+ *
+ * Return: connected socket
+*/
+static int connect_broker(const char *host, const char *port)
+{
+	struct addrinfo hints, *addr;
+	uint8_t packet[128], payload[96], body[16];
+	char client_id[32];
+	size_t len = 0, var = 0;
+	int fd, one = 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &addr))
+	{
+		fprintf(stderr, "cannot resolve %s\n", host);
+		exit(1);
+	}
+
+	fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+	if (fd < 0 || connect(fd, addr->ai_addr, addr->ai_addrlen))
+	{
+		perror("connect");
+		exit(1);
+	}
+	freeaddrinfo(addr);
+
+	/* every acknowledgement goes out at once, as on the device */
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	snprintf(client_id, sizeof(client_id), "qos-bench-%d", (int)getpid());
+
+	/* variable header: "MQTT", level 4, clean session, keep-alive 60 s */
+	var = put_str(payload, "MQTT");
+	payload[var++] = 4;
+	payload[var++] = 0x02;
+	payload[var++] = 0;
+	payload[var++] = 60;
+	var += put_str(payload + var, client_id);
+
+	len = put_header(packet, MQTT_CONNECT, var);
+	memcpy(packet + len, payload, var);
+	send_all(fd, packet, len + var);
+
+	if ((recv_packet(fd, body, sizeof(body), &len) & 0xF0) != MQTT_CONNACK ||
+			len < 2 || body[1])
+	{
+		fprintf(stderr, "connection refused\n");
+		exit(1);
+	}
+
+	return (fd);
+}
+
+/**
+ * run - publishes the messages at a QoS level and prints the results
+ *
+ * @host: broker host
+ * @port: broker port
+ * @qos: 1 or 2
+ * @count: number of messages
+ * @window: most messages in flight at once
+ *
+ * Return: Nothing
+*/
+static void run(const char *host, const char *port, uint8_t qos,
+		uint32_t count, uint32_t window)
+{
+	bench_t bench;
+	uint8_t packet[256];
+	char payload[160];
+	uint64_t started;
+	double seconds;
+
+	bench.fd = connect_broker(host, port);
+	bench.sent_at.assign(65536, 0);
+	bench.in_flight = 0;
+	bench.packets = 0;
+
+	started = now_us();
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint16_t id = i % 65535 + 1;
+		size_t len, var;
+
+		while (bench.in_flight >= window)
+			handle_packet(&bench);
+
+		/* the firmware's JSON scan message */
+		snprintf(payload, sizeof(payload),
+			"{\"checkpoint-id\":1,\"sentry-id\":\"04 a1 2b ff\","
+			"\"scan-time\":%u,\"scan-ms\":%u,\"seq\":%u}",
+			(unsigned int)time(NULL), (unsigned int)(i % 1000),
+			(unsigned int)(i + 1));
+
+		var = 2 + strlen(BENCH_TOPIC) + 2 + strlen(payload);
+		len = put_header(packet, MQTT_PUBLISH | (qos << 1), var);
+		len += put_str(packet + len, BENCH_TOPIC);
+		packet[len++] = id >> 8;
+		packet[len++] = id & 0xFF;
+		memcpy(packet + len, payload, strlen(payload));
+		len += strlen(payload);
+
+		bench.sent_at[id] = now_us();
+		send_all(bench.fd, packet, len);
+		bench.in_flight++;
+		bench.packets++;
+	}
+
+	while (bench.in_flight)
+		handle_packet(&bench);
+
+	seconds = (now_us() - started) / 1e6;
+
+	packet[0] = MQTT_DISCONNECT;
+	packet[1] = 0;
+	send_all(bench.fd, packet, 2);
+	close(bench.fd);
+
+	std::sort(bench.latencies.begin(), bench.latencies.end());
+
+	printf("QoS %u: %8.0f msgs/s  %4.1f packets/msg  latency p50 %6u us  p99 %6u us  max %6u us\n",
+		qos, count / seconds, (double)bench.packets / count,
+		bench.latencies[count / 2], bench.latencies[count * 99 / 100],
+		bench.latencies[count - 1]);
+}
+
+/**
+ * main - benchmarks QoS 1 against QoS 2
+ *
+ * @argc: number of arguments
+ * @argv: broker host and port, messages per run, messages in flight
+ *
+ * Return: 0
+*/
+int main(int argc, char **argv)
+{
+	const char *host = argc > 1 ? argv[1] : "localhost";
+	const char *port = argc > 2 ? argv[2] : "1883";
+	uint32_t count = argc > 3 ? strtoul(argv[3], NULL, 10) : 10000;
+	uint32_t window = argc > 4 ? strtoul(argv[4], NULL, 10) : 1;
+
+	if (!count || !window || window > 65535)
+	{
+		fprintf(stderr, "usage: %s [host] [port] [messages] [in flight]\n",
+			argv[0]);
+		return (1);
+	}
+
+	printf("%u messages to %s:%s, %u in flight\n", (unsigned int)count,
+		host, port, (unsigned int)window);
+
+	run(host, port, 1, count, window);
+	run(host, port, 2, count, window);
+
+	return (0);
+}
@@ -0,0 +1,238 @@
+/*
+ * Payload encoding benchmark: encodes the scan and connection status
+ * messages with the firmware's fixed-buffer encoders (payload.cpp) and
+ * with ArduinoJson, as mqtt.cpp did before them, and prints the bytes and
+ * the time per encode of each. The host's times only compare the paths,
+ * the ESP32 is about an order of magnitude slower on both.
+ *
+ * Build and run on the host; the ArduinoJson rows need ArduinoJson 6 on
+ * the include path (e.g. the library's src/ directory) and are skipped
+ * without it:
+ *   g++ -std=gnu++11 -O2 -Wall -Iinclude -Isrc/hal/native/arduino \
+ *     -I<ArduinoJson>/src tools/payload_bench.cpp src/payload.cpp \
+ *     -o payload_bench
+ *   ./payload_bench [encodes]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "payload.h"
+#include "trace.h"
+#include "boot.h"
+
+#if defined(__has_include)
+#if __has_include(<ArduinoJson.h>)
+#include <ArduinoJson.h>
+#define BENCH_ARDUINOJSON       1
+#endif
+#endif
+
+/* client ID and checkpoint ID of the benchmarked messages */
+#define BENCH_CLIENT_ID         "Checkpoint-1042"
+#define BENCH_CHECKPOINT_ID     1042
+
+/* sink for the encoded lengths, so the encodes are not optimized out */
+static volatile size_t bench_sink;
+
+/*
+ * the diagnostics and boot report encoders are not benchmarked: stand-ins
+ * for the trace and boot accessors payload.cpp links against
+*/
+const trace_histogram_t *trace_histogram(uint8_t stage)
+{
+	return (NULL);
+}
+
+const char *trace_stage_name(uint8_t stage)
+{
+	return (NULL);
+}
+
+const boot_record_t *boot_record(uint8_t age)
+{
+	return (NULL);
+}
+
+const char *boot_phase_name(uint8_t phase)
+{
+	return (NULL);
+}
+
+const char *boot_reset_name(uint8_t reset)
+{
+	return (NULL);
+}
+
+/**
+ * now_ns - reads the monotonic clock
+ *
+ * Return: time [ns]
+*/
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/**
+ * encode_scan_json - encodes the scan message with payload.cpp
+ *
+ * @buf: destination buffer
+ * @size: size of the destination buffer
+ * @record: scan to encode
+ *
+ * Return: payload length
+*/
+static size_t encode_scan_json(char *buf, size_t size, const scan_record_t *record)
+{
+	return (payload_encode_scan_json(buf, size, BENCH_CHECKPOINT_ID, record));
+}
+
+/**
+ * encode_scan_binary - encodes the binary scan message with payload.cpp
+ *
+ * @buf: destination buffer
+ * @size: size of the destination buffer
+ * @record: scan to encode
+ *
+ * Return: payload length
+*/
+static size_t encode_scan_binary(char *buf, size_t size, const scan_record_t *record)
+{
+	return (payload_encode_scan_binary((uint8_t *)buf, size,
+		BENCH_CHECKPOINT_ID, record));
+}
+
+/**
+ * encode_connected_json - encodes the connection status with payload.cpp
+ *
+ * @buf: destination buffer
+ * @size: size of the destination buffer
+ * @record: unused
+ *
+ * Return: payload length
+*/
+static size_t encode_connected_json(char *buf, size_t size, const scan_record_t *record)
+{
+	return (payload_encode_connected_json(buf, size, BENCH_CLIENT_ID, true));
+}
+
+#ifdef BENCH_ARDUINOJSON
+/**
+ * encode_scan_arduinojson - encodes the same scan message with ArduinoJson
+ *
+ * @buf: destination buffer
+ * @size: size of the destination buffer
+ * @record: scan to encode
+ *
+ * Return: payload length
+*/
+static size_t encode_scan_arduinojson(char *buf, size_t size, const scan_record_t *record)
+{
+	StaticJsonDocument<128> doc;
+	char uid[3 * RFID_UID_MAX_LEN];
+
+	payload_format_uid(uid, sizeof(uid), record->uid, record->uid_size);
+
+	doc["checkpoint-id"] = BENCH_CHECKPOINT_ID;
+	doc["sentry-id"] = (const char *)uid;
+	doc["scan-time"] = record->scan_time;
+	doc["scan-ms"] = record->scan_ms;
+	doc["seq"] = record->seq;
+
+	return (serializeJson(doc, buf, size));
+}
+
+/**
+ * encode_connected_arduinojson - encodes the connection status with
+ *  ArduinoJson
+ *
+ * @buf: destination buffer
+ * @size: size of the destination buffer
+ * @record: unused
+ *
+ * Return: payload length
+*/
+static size_t encode_connected_arduinojson(char *buf, size_t size, const scan_record_t *record)
+{
+	StaticJsonDocument<128> doc;
+
+	doc["id"] = BENCH_CLIENT_ID;
+	doc["connected"] = true;
+
+	return (serializeJson(doc, buf, size));
+}
+#endif
+
+/**
+ * struct bench_s - an encoding path to benchmark
+ *
+ * @name: name printed
+ * @encode: encodes the message into a buffer, returns its length
+*/
+typedef struct bench_s
+{
+	const char *name;
+	size_t (*encode)(char *, size_t, const scan_record_t *);
+} bench_t;
+
+/**
+ * run - times an encoding path and prints its results
+ *
+ * @bench: encoding path
+ * @record: scan to encode
+ * @count: number of encodes
+ *
+ * Return: Nothing
+*/
+static void run(const bench_t *bench, scan_record_t *record, uint32_t count)
+{
+	char buf[PAYLOAD_CONNECTED_MAX_LEN];
+	size_t len = bench->encode(buf, sizeof(buf), record);
+	uint64_t start = now_ns();
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		/* a new scan every time, as the firmware encodes them */
+		record->seq++;
+		bench_sink = bench->encode(buf, sizeof(buf), record);
+	}
+
+	printf("%-24s %5u bytes %8.1f ns/encode\n", bench->name,
+		(unsigned int)len, (double)(now_ns() - start) / count);
+}
+
+int main(int argc, char **argv)
+{
+	static const bench_t benches[] = {
+		{"scan, payload.cpp", encode_scan_json},
+		{"scan, binary", encode_scan_binary},
+#ifdef BENCH_ARDUINOJSON
+		{"scan, ArduinoJson", encode_scan_arduinojson},
+#endif
+		{"connected, payload.cpp", encode_connected_json},
+#ifdef BENCH_ARDUINOJSON
+		{"connected, ArduinoJson", encode_connected_arduinojson},
+#endif
+	};
+	uint32_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	scan_record_t record = {1792120090, 1, 200,
+		{0x04, 0xa1, 0x2b, 0xff, 0x51, 0x3c, 0x80}, 7, 0};
+
+	if (!count)
+		count = 1;
+
+	printf("%u encodes per path\n", (unsigned int)count);
+#ifndef BENCH_ARDUINOJSON
+	printf("ArduinoJson not found, its paths are skipped\n");
+#endif
+
+	for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+		run(&benches[i], &record, count);
+
+	return (0);
+}
@@ -0,0 +1,221 @@
+/*
+ * Binary scan message test: round-trips scans through the firmware's
+ * encoder and the reference decoder (payload.cpp), decodes hand-built
+ * version 1 messages, and checks that truncated, overlong, bad-version
+ * and oversized-UID messages are rejected. Exits non-zero on failure.
+ *
+ * Build and run on the host:
+ *   g++ -std=gnu++11 -O2 -Wall -Iinclude -Isrc/hal/native/arduino \
+ *     tools/payload_test.cpp src/payload.cpp -o payload_test
+ *   ./payload_test
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "payload.h"
+#include "trace.h"
+#include "boot.h"
+
+/* checks failed so far */
+static unsigned int failures = 0;
+
+/*
+ * only the binary scan codec is tested: stand-ins for the trace and boot
+ * accessors payload.cpp links against
+*/
+const trace_histogram_t *trace_histogram(uint8_t stage)
+{
+	return (NULL);
+}
+
+const char *trace_stage_name(uint8_t stage)
+{
+	return (NULL);
+}
+
+const boot_record_t *boot_record(uint8_t age)
+{
+	return (NULL);
+}
+
+const char *boot_phase_name(uint8_t phase)
+{
+	return (NULL);
+}
+
+const char *boot_reset_name(uint8_t reset)
+{
+	return (NULL);
+}
+
+/**
+ * check - counts and reports a failed check
+ *
+ * @ok: outcome of the check
+ * @what: what was checked
+ *
+ * Return: Nothing
+*/
+static void check(bool ok, const char *what)
+{
+	if (ok)
+		return;
+
+	failures++;
+	printf("FAIL: %s\n", what);
+}
+
+/**
+ * same_scan - compares two scans field by field
+ *
+ * @a: first scan
+ * @b: second scan
+ *
+ * Return: true if they are the same scan
+*/
+static bool same_scan(const scan_record_t *a, const scan_record_t *b)
+{
+	return (a->scan_time == b->scan_time && a->seq == b->seq &&
+		a->scan_ms == b->scan_ms && a->uid_size == b->uid_size &&
+		!memcmp(a->uid, b->uid, a->uid_size) &&
+		!a->outside_shift == !b->outside_shift);
+}
+
+/**
+ * test_round_trip - encodes scans as version 2 messages and decodes them
+ *
+ * Return: Nothing
+*/
+static void test_round_trip()
+{
+	static const uint8_t uid_sizes[] = {4, 7, 10};
+	/* room for a trailing byte past the longest message */
+	uint8_t buf[PAYLOAD_SCAN_BINARY_MAX_LEN + 1];
+	scan_record_t scan, decoded;
+	uint32_t checkpoint_id;
+	size_t len;
+
+	for (size_t i = 0; i < sizeof(uid_sizes); i++)
+	{
+		for (uint8_t outside_shift = 0; outside_shift < 2; outside_shift++)
+		{
+			memset(&scan, 0, sizeof(scan));
+			scan.scan_time = 1792120090 + i;
+			scan.seq = 0xFFFFFFF0 + i;
+			scan.scan_ms = 999;
+			scan.uid_size = uid_sizes[i];
+			for (uint8_t j = 0; j < scan.uid_size; j++)
+				scan.uid[j] = 0xA0 + j;
+			scan.outside_shift = outside_shift;
+
+			len = payload_encode_scan_binary(buf, sizeof(buf), 0xDEADBEEF, &scan);
+			check(len == (size_t)PAYLOAD_BINARY_HEADER_LEN + scan.uid_size,
+				"v2 length is the header plus the UID");
+			check(buf[0] == PAYLOAD_BINARY_VERSION && buf[0] != '{',
+				"v2 starts with its version, never '{'");
+			check(payload_decode_scan_binary(buf, len, &checkpoint_id, &decoded),
+				"v2 decodes");
+			check(checkpoint_id == 0xDEADBEEF, "v2 checkpoint ID round-trips");
+			check(same_scan(&scan, &decoded), "v2 scan round-trips");
+
+			/* every shorter prefix is a truncated message */
+			for (size_t cut = 0; cut < len; cut++)
+				check(!payload_decode_scan_binary(buf, cut, &checkpoint_id, &decoded),
+					"truncated v2 is rejected");
+
+			/* trailing bytes are not ignored */
+			buf[len] = 0;
+			check(!payload_decode_scan_binary(buf, len + 1, &checkpoint_id, &decoded),
+				"overlong v2 is rejected");
+		}
+	}
+
+	/* the encoder never writes past the buffer */
+	scan.uid_size = 7;
+	check(!payload_encode_scan_binary(buf, PAYLOAD_BINARY_HEADER_LEN + 6, 1, &scan),
+		"encoding into a short buffer fails");
+	scan.uid_size = RFID_UID_MAX_LEN + 1;
+	check(!payload_encode_scan_binary(buf, sizeof(buf), 1, &scan),
+		"encoding an oversized UID fails");
+}
+
+/**
+ * test_version_1 - decodes hand-built version 1 messages, which lack the
+ *  milliseconds and sequence number
+ *
+ * Return: Nothing
+*/
+static void test_version_1()
+{
+	/* version, flags, checkpoint 42, scan time 1792120090, 4-byte UID */
+	static const uint8_t v1[] = {1, PAYLOAD_FLAG_OUTSIDE_SHIFT,
+		42, 0, 0, 0, 0x1A, 0x95, 0xD1, 0x6A, 4, 0x04, 0xA1, 0x2B, 0xFF};
+	scan_record_t decoded;
+	uint32_t checkpoint_id;
+
+	check(sizeof(v1) == PAYLOAD_BINARY_V1_HEADER_LEN + 4, "v1 fixture layout");
+	check(payload_decode_scan_binary(v1, sizeof(v1), &checkpoint_id, &decoded),
+		"v1 decodes");
+	check(checkpoint_id == 42, "v1 checkpoint ID");
+	check(decoded.scan_time == 1792120090, "v1 scan time");
+	check(decoded.scan_ms == 0 && decoded.seq == 0,
+		"v1 has no milliseconds or sequence number");
+	check(decoded.uid_size == 4 && decoded.uid[0] == 0x04 && decoded.uid[3] == 0xFF,
+		"v1 UID");
+	check(decoded.outside_shift, "v1 outside-shift flag");
+
+	for (size_t cut = 0; cut < sizeof(v1); cut++)
+		check(!payload_decode_scan_binary(v1, cut, &checkpoint_id, &decoded),
+			"truncated v1 is rejected");
+}
+
+/**
+ * test_invalid - checks that messages of unknown versions, and ones
+ *  claiming a UID longer than any card's, are rejected
+ *
+ * Return: Nothing
+*/
+static void test_invalid()
+{
+	static const uint8_t versions[] = {0, 3, '{', 0xFF};
+	uint8_t buf[PAYLOAD_SCAN_BINARY_MAX_LEN + 1];
+	scan_record_t scan, decoded;
+	uint32_t checkpoint_id;
+	size_t len;
+
+	memset(&scan, 0, sizeof(scan));
+	scan.uid_size = 4;
+	len = payload_encode_scan_binary(buf, sizeof(buf), 7, &scan);
+
+	for (size_t i = 0; i < sizeof(versions); i++)
+	{
+		buf[0] = versions[i];
+		check(!payload_decode_scan_binary(buf, len, &checkpoint_id, &decoded),
+			"unknown version is rejected");
+	}
+
+	/* a UID length past RFID_UID_MAX_LEN, with the bytes to match */
+	memset(buf, 0, sizeof(buf));
+	buf[0] = PAYLOAD_BINARY_VERSION;
+	buf[PAYLOAD_BINARY_HEADER_LEN - 1] = RFID_UID_MAX_LEN + 1;
+	check(!payload_decode_scan_binary(buf, PAYLOAD_BINARY_HEADER_LEN +
+		RFID_UID_MAX_LEN + 1, &checkpoint_id, &decoded),
+		"oversized v2 UID is rejected");
+
+	buf[0] = 1;
+	buf[PAYLOAD_BINARY_V1_HEADER_LEN - 1] = RFID_UID_MAX_LEN + 1;
+	check(!payload_decode_scan_binary(buf, PAYLOAD_BINARY_V1_HEADER_LEN +
+		RFID_UID_MAX_LEN + 1, &checkpoint_id, &decoded),
+		"oversized v1 UID is rejected");
+}
+
+int main()
+{
+	test_round_trip();
+	test_version_1();
+	test_invalid();
+
+	printf("%s\n", failures ? "binary payload test failed" : "binary payload test passed");
+	return (failures ? 1 : 0);
+}
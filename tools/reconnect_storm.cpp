@@ -0,0 +1,217 @@
+/*
+ * Reconnect storm simulation: a fleet of checkpoints loses the broker at
+ * the same instant (broker restart) and reconnects under each retry
+ * policy; prints the connection attempts the broker sees per second.
+ *
+ * Build and run on the host:
+ *   g++ -std=gnu++11 -O2 -Wall -Iinclude -Isrc/hal/native/arduino \
+ *     tools/reconnect_storm.cpp -o reconnect_storm
+ *   ./reconnect_storm [devices] [broker downtime s] [broker accepts/s]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include "backoff.h"
+#include "mqtt.h"
+
+/* simulation resolution and length [ms] */
+#define SIM_STEP                10
+#define SIM_LENGTH              300000
+/* time a connection attempt takes to succeed or fail [ms] */
+#define SIM_CONNECT_TIME        50
+/* period of the previous fixed-period retry policy [ms] */
+#define SIM_FIXED_PERIOD        2000
+/* seconds of attempts-per-second shown in the timeline */
+#define SIM_TIMELINE            40
+
+/**
+ * struct device_s - a simulated checkpoint
+ *
+ * @next_attempt: when its next connection attempt starts [ms]
+ * @failures: consecutive failed attempts
+ * @connected: whether it is connected
+*/
+typedef struct device_s
+{
+	uint32_t next_attempt;
+	uint8_t failures;
+	bool connected;
+} device_t;
+
+/**
+ * struct policy_s - a retry policy
+ *
+ * @name: name shown in the report
+ * @retry_delay: delay before the next attempt of a device that failed
+*/
+typedef struct policy_s
+{
+	const char *name;
+	uint32_t (*retry_delay)(device_t *);
+} policy_t;
+
+/* xorshift32 state, every device draws from the same stream */
+static uint32_t rng_state = 2463534242u;
+
+/**
+ * rng - draws a pseudo-random number
+ *
+ * @bound: exclusive upper bound
+ *
+ * Return: number in [0, bound)
+*/
+static uint32_t rng(uint32_t bound)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return (bound ? rng_state % bound : 0);
+}
+
+/**
+ * fixed_delay - previous policy: a Ticker retrying every 2 s
+ *
+ * @device: device that failed
+ *
+ * Return: delay before its next attempt [ms]
+*/
+static uint32_t fixed_delay(device_t *device)
+{
+	(void)device;
+	return (SIM_FIXED_PERIOD);
+}
+
+/**
+ * exponential_delay - exponential backoff without jitter
+ *
+ * @device: device that failed
+ *
+ * Return: delay before its next attempt [ms]
+*/
+static uint32_t exponential_delay(device_t *device)
+{
+	return (backoff_window(device->failures++, MQTT_BACKOFF_BASE,
+		MQTT_BACKOFF_CAP));
+}
+
+/**
+ * full_jitter_delay - the firmware's policy, exponential backoff with
+ *  full jitter
+ *
+ * @device: device that failed
+ *
+ * Return: delay before its next attempt [ms]
+*/
+static uint32_t full_jitter_delay(device_t *device)
+{
+	return (rng(backoff_window(device->failures++, MQTT_BACKOFF_BASE,
+		MQTT_BACKOFF_CAP) + 1));
+}
+
+/**
+ * simulate - runs a broker restart against a fleet under a retry policy
+ *
+ * @policy: retry policy of every device
+ * @count: number of devices
+ * @downtime: time the broker stays down [ms]
+ * @accept_rate: connections the broker accepts per second once up
+ *
+ * Return: Nothing
+*/
+static void simulate(const policy_t *policy, uint32_t count,
+		uint32_t downtime, uint32_t accept_rate)
+{
+	std::vector<device_t> devices(count);
+	std::vector<uint32_t> per_second(SIM_LENGTH / 1000, 0);
+	std::vector<uint32_t> accepted(SIM_LENGTH / 1000, 0);
+	uint32_t connected = 0, attempts = 0, all_connected = 0;
+	uint32_t peak = 0, peak_up = 0;
+
+	/* the broker goes down at t=0: every device fails at once */
+	for (uint32_t i = 0; i < count; i++)
+	{
+		memset(&devices[i], 0, sizeof(device_t));
+		devices[i].next_attempt = policy->retry_delay(&devices[i]);
+	}
+
+	for (uint32_t now = 0; now < SIM_LENGTH && connected < count; now += SIM_STEP)
+	{
+		uint32_t second = now / 1000;
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			device_t *device = &devices[i];
+
+			if (device->connected || device->next_attempt > now)
+				continue;
+
+			attempts++;
+			per_second[second]++;
+
+			if (now >= downtime && accepted[second] < accept_rate)
+			{
+				device->connected = true;
+				accepted[second]++;
+				connected++;
+				all_connected = now + SIM_CONNECT_TIME;
+			}
+			else
+				device->next_attempt = now + SIM_CONNECT_TIME +
+					policy->retry_delay(device);
+		}
+	}
+
+	/* peak overall, and once the broker is back and has to serve them */
+	for (uint32_t s = 0; s < per_second.size(); s++)
+	{
+		if (per_second[s] > peak)
+			peak = per_second[s];
+		if (s >= downtime / 1000 && per_second[s] > peak_up)
+			peak_up = per_second[s];
+	}
+
+	printf("%-22s attempts %6u  peak %5u/s  peak once up %5u/s  ",
+		policy->name, (unsigned int)attempts, (unsigned int)peak,
+		(unsigned int)peak_up);
+	if (connected < count)
+		printf("%u/%u connected after %u s\n", (unsigned int)connected,
+			(unsigned int)count, SIM_LENGTH / 1000);
+	else
+		printf("all connected after %.1f s\n", all_connected / 1000.0);
+
+	printf("  attempts/s:");
+	for (uint32_t s = 0; s < SIM_TIMELINE; s++)
+		printf(" %u", (unsigned int)per_second[s]);
+	printf("\n");
+}
+
+/**
+ * main - simulates a broker restart under each retry policy
+ *
+ * @argc: number of arguments
+ * @argv: devices, broker downtime [s] and broker accept rate [1/s]
+ *
+ * Return: 0
+*/
+int main(int argc, char **argv)
+{
+	static const policy_t policies[] = {
+		{"fixed 2 s period", fixed_delay},
+		{"exponential", exponential_delay},
+		{"exponential + jitter", full_jitter_delay},
+	};
+	uint32_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 500;
+	uint32_t downtime = (argc > 2 ? strtoul(argv[2], NULL, 10) : 10) * 1000;
+	uint32_t accept_rate = argc > 3 ? strtoul(argv[3], NULL, 10) : 100;
+
+	printf("%u devices, broker down for %u s, accepts %u connections/s\n",
+		(unsigned int)count, (unsigned int)(downtime / 1000),
+		(unsigned int)accept_rate);
+
+	for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++)
+		simulate(&policies[i], count, downtime, accept_rate);
+
+	return (0);
+}